@@ -182,11 +182,14 @@ HEADERS += src/qt/bitcoingui.h \
     src/hash.h \
     src/uint256.h \
     src/kernel.h \
+    src/kernelsearch.h \
     src/scrypt.h \
     src/pbkdf2.h \
     src/serialize.h \
     src/core.h \
     src/main.h \
+    src/merkle.h \
+    src/checkqueue.h \
     src/miner.h \
     src/irc.h \
     src/net.h \
@@ -194,11 +197,17 @@ HEADERS += src/qt/bitcoingui.h \
     src/eckey.h \
     src/db.h \
     src/txdb.h \
+    src/txcache.h \
+    src/sigcache.h \
+    src/sigverify.h \
+    src/pubkeycache.h \
+    src/leveldbbatch.h \
     src/txmempool.h \
     src/walletdb.h \
     src/script.h \
     src/init.h \
     src/mruset.h \
+    src/prevector.h \
     src/json/json_spirit_writer_template.h \
     src/json/json_spirit_writer.h \
     src/json/json_spirit_value.h \
@@ -303,6 +312,10 @@ SOURCES += src/qt/bitcoin.cpp src/qt/bitcoingui.cpp \
     src/chainparams.cpp \
     src/version.cpp \
     src/sync.cpp \
+    src/txcache.cpp \
+    src/sigcache.cpp \
+    src/sigverify.cpp \
+    src/pubkeycache.cpp \
     src/txmempool.cpp \
     src/util.cpp \
     src/hash.cpp \
@@ -312,6 +325,7 @@ SOURCES += src/qt/bitcoin.cpp src/qt/bitcoingui.cpp \
     src/script.cpp \
     src/core.cpp \
     src/main.cpp \
+    src/merkle.cpp \
     src/miner.cpp \
     src/init.cpp \
     src/irc.cpp \
@@ -360,6 +374,7 @@ SOURCES += src/qt/bitcoin.cpp src/qt/bitcoingui.cpp \
     src/qt/rpcconsole.cpp \
     src/noui.cpp \
     src/kernel.cpp \
+    src/kernelsearch.cpp \
     src/scrypt-arm.S \
     src/scrypt-x86.S \
     src/scrypt-x86_64.S \
@@ -382,6 +397,9 @@ SOURCES += src/qt/bitcoin.cpp src/qt/bitcoingui.cpp \
     src/crypto/ripemd160.cpp \
     src/crypto/sha1.cpp \
     src/crypto/sha256.cpp \
+    src/crypto/sha256_sse41.cpp \
+    src/crypto/sha256_avx2.cpp \
+    src/crypto/sha256_shani.cpp \
     src/crypto/sha512.cpp \
     src/eccryptoverify.cpp \
     src/qt/masternodemanager.cpp \
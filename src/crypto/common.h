@@ -11,6 +11,13 @@
 #include <endian.h>
 #endif
 
+// The x86 SHA-256 implementations select their instruction sets with
+// per-function target attributes, so they build without special flags
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__amd64__) || defined(__i386__)) && \
+    (defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define ENABLE_SHA256_X86 1
+#endif
+
 uint32_t static inline ReadLE32(const unsigned char* ptr)
 {
 #if HAVE_DECL_LE32TOH == 1
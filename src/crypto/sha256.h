@@ -7,6 +7,7 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <string>
 
 /** A hasher class for SHA-256. */
 class CSHA256
@@ -25,4 +26,20 @@ public:
     CSHA256& Reset();
 };
 
+/** Select the fastest SHA-256 implementations this CPU supports, and return
+ *  a description of them. Call once at startup, before any other thread
+ *  hashes; until then the portable code is used. */
+std::string SHA256AutoDetect();
+
+/** Compute the double SHA-256 of each of blocks 64-byte messages at in, and
+ *  write the 32-byte results to out. Several messages are hashed at once
+ *  where the CPU allows, which makes this the fastest way to hash the
+ *  levels of a merkle tree. */
+void SHA256D64(unsigned char* out, const unsigned char* in, size_t blocks);
+
+/** Compute the double SHA-256 of each of blocks 56-byte messages at in, and
+ *  write the 32-byte results to out. A 56-byte message is one block and a
+ *  second of nothing but its length, as is a proof-of-stake kernel. */
+void SHA256D56(unsigned char* out, const unsigned char* in, size_t blocks);
+
 #endif // BITCOIN_CRYPTO_SHA256_H
@@ -0,0 +1,227 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+//
+// SHA-256 with the Intel SHA extensions, after Intel's reference code.
+
+#include "crypto/common.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(ENABLE_SHA256_X86)
+#include <immintrin.h>
+
+#define SHANI_TARGET __attribute__((target("sse4.1,sha")))
+#define SHANI_INLINE static inline __attribute__((always_inline, target("sse4.1,sha")))
+
+namespace sha256_shani
+{
+namespace
+{
+
+__attribute__((aligned(16))) const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+SHANI_INLINE __m128i Mask()
+{
+    return _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+}
+
+/** Four rounds, with the message words in m. */
+SHANI_INLINE void QuadRound(__m128i& state0, __m128i& state1, __m128i m, int i)
+{
+    __m128i msg = _mm_add_epi32(m, _mm_load_si128((const __m128i*)&K[i]));
+    state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+    state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0e));
+}
+
+/** First half of the message schedule for the words in m0. */
+SHANI_INLINE void ShiftMessageA(__m128i& m0, __m128i m1)
+{
+    m0 = _mm_sha256msg1_epu32(m0, m1);
+}
+
+/** Finish the schedule of m2 from m0 and m1. */
+SHANI_INLINE void ShiftMessageC(__m128i m0, __m128i m1, __m128i& m2)
+{
+    m2 = _mm_sha256msg2_epu32(_mm_add_epi32(m2, _mm_alignr_epi8(m1, m0, 4)), m1);
+}
+
+SHANI_INLINE void ShiftMessageB(__m128i& m0, __m128i m1, __m128i& m2)
+{
+    ShiftMessageC(m0, m1, m2);
+    ShiftMessageA(m0, m1);
+}
+
+SHANI_INLINE __m128i Load(const unsigned char* in)
+{
+    return _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)in), Mask());
+}
+
+/** Switch between s[0..7] and the ABEF/CDGH register layout. */
+SHANI_INLINE void Unpack(const uint32_t* s, __m128i& state0, __m128i& state1)
+{
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)s), 0xb1);  // CDAB
+    state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)(s + 4)), 0x1b); // EFGH
+    state0 = _mm_alignr_epi8(tmp, state1, 8);                                   // ABEF
+    state1 = _mm_blend_epi16(state1, tmp, 0xf0);                                // CDGH
+}
+
+SHANI_INLINE void Pack(__m128i state0, __m128i state1, uint32_t* s)
+{
+    __m128i tmp = _mm_shuffle_epi32(state0, 0x1b); // FEBA
+    state1 = _mm_shuffle_epi32(state1, 0xb1);      // DCHG
+    _mm_storeu_si128((__m128i*)s, _mm_blend_epi16(tmp, state1, 0xf0));     // DCBA
+    _mm_storeu_si128((__m128i*)(s + 4), _mm_alignr_epi8(state1, tmp, 8));  // HGFE
+}
+
+/** One block for each of L messages, interleaved so that the rounds of one
+ *  fill the latency of the other's. */
+template<int L>
+SHANI_INLINE void TransformLanes(__m128i* state0, __m128i* state1, const unsigned char* const* chunk)
+{
+    __m128i save0[L], save1[L], m0[L], m1[L], m2[L], m3[L];
+    int l;
+    for (l = 0; l < L; l++) {
+        save0[l] = state0[l];
+        save1[l] = state1[l];
+    }
+
+    for (l = 0; l < L; l++) QuadRound(state0[l], state1[l], m0[l] = Load(chunk[l]), 0);
+    for (l = 0; l < L; l++) QuadRound(state0[l], state1[l], m1[l] = Load(chunk[l] + 16), 4);
+    for (l = 0; l < L; l++) ShiftMessageA(m0[l], m1[l]);
+    for (l = 0; l < L; l++) QuadRound(state0[l], state1[l], m2[l] = Load(chunk[l] + 32), 8);
+    for (l = 0; l < L; l++) ShiftMessageA(m1[l], m2[l]);
+    for (l = 0; l < L; l++) QuadRound(state0[l], state1[l], m3[l] = Load(chunk[l] + 48), 12);
+    for (l = 0; l < L; l++) ShiftMessageB(m2[l], m3[l], m0[l]);
+    for (int i = 16; i < 48; i += 16) {
+        for (l = 0; l < L; l++) QuadRound(state0[l], state1[l], m0[l], i);
+        for (l = 0; l < L; l++) ShiftMessageB(m3[l], m0[l], m1[l]);
+        for (l = 0; l < L; l++) QuadRound(state0[l], state1[l], m1[l], i + 4);
+        for (l = 0; l < L; l++) ShiftMessageB(m0[l], m1[l], m2[l]);
+        for (l = 0; l < L; l++) QuadRound(state0[l], state1[l], m2[l], i + 8);
+        for (l = 0; l < L; l++) ShiftMessageB(m1[l], m2[l], m3[l]);
+        for (l = 0; l < L; l++) QuadRound(state0[l], state1[l], m3[l], i + 12);
+        for (l = 0; l < L; l++) ShiftMessageB(m2[l], m3[l], m0[l]);
+    }
+    for (l = 0; l < L; l++) QuadRound(state0[l], state1[l], m0[l], 48);
+    for (l = 0; l < L; l++) ShiftMessageB(m3[l], m0[l], m1[l]);
+    for (l = 0; l < L; l++) QuadRound(state0[l], state1[l], m1[l], 52);
+    for (l = 0; l < L; l++) ShiftMessageC(m0[l], m1[l], m2[l]);
+    for (l = 0; l < L; l++) QuadRound(state0[l], state1[l], m2[l], 56);
+    for (l = 0; l < L; l++) ShiftMessageC(m1[l], m2[l], m3[l]);
+    for (l = 0; l < L; l++) QuadRound(state0[l], state1[l], m3[l], 60);
+
+    for (l = 0; l < L; l++) {
+        state0[l] = _mm_add_epi32(state0[l], save0[l]);
+        state1[l] = _mm_add_epi32(state1[l], save1[l]);
+    }
+}
+
+const uint32_t INIT[8] = {0x6a09e667ul, 0xbb67ae85ul, 0x3c6ef372ul, 0xa54ff53aul, 0x510e527ful, 0x9b05688cul, 0x1f83d9abul, 0x5be0cd19ul};
+
+// Padding and length of a 64-byte message, and of a 32-byte one after the
+// 32 bytes of the first hash
+const unsigned char PAD64[64] = {0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x02, 0x00};
+
+// The block after a 56-byte message and its first padding byte: the length
+const unsigned char PAD56[64] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x01, 0xc0};
+
+} // namespace
+
+SHANI_TARGET void Transform(uint32_t* s, const unsigned char* chunk, size_t blocks)
+{
+    __m128i state0, state1;
+    Unpack(s, state0, state1);
+    while (blocks--) {
+        TransformLanes<1>(&state0, &state1, &chunk);
+        chunk += 64;
+    }
+    Pack(state0, state1, s);
+}
+
+// Double SHA-256 of two messages of one block each after padding, plus a
+// block of padding alone
+SHANI_INLINE void TransformD_2way(unsigned char* out, const unsigned char* in, size_t nStride, const unsigned char* pad)
+{
+    __m128i state0[2], state1[2];
+    const unsigned char* chunk[2];
+
+    // First hash: the message, then the padding block
+    for (int l = 0; l < 2; l++) {
+        Unpack(INIT, state0[l], state1[l]);
+        chunk[l] = in + nStride * l;
+    }
+    TransformLanes<2>(state0, state1, chunk);
+    chunk[0] = chunk[1] = pad;
+    TransformLanes<2>(state0, state1, chunk);
+
+    // Second hash, of the 32-byte result and its padding
+    unsigned char buf[2][64];
+    for (int l = 0; l < 2; l++) {
+        uint32_t s[8];
+        Pack(state0[l], state1[l], s);
+        for (int i = 0; i < 8; i++)
+            WriteBE32(buf[l] + 4 * i, s[i]);
+        for (int i = 32; i < 64; i++)
+            buf[l][i] = 0;
+        buf[l][32] = 0x80;
+        buf[l][62] = 0x01;
+        Unpack(INIT, state0[l], state1[l]);
+        chunk[l] = buf[l];
+    }
+    TransformLanes<2>(state0, state1, chunk);
+
+    for (int l = 0; l < 2; l++) {
+        uint32_t s[8];
+        Pack(state0[l], state1[l], s);
+        for (int i = 0; i < 8; i++)
+            WriteBE32(out + 32 * l + 4 * i, s[i]);
+    }
+}
+
+SHANI_TARGET void TransformD64_2way(unsigned char* out, const unsigned char* in)
+{
+    TransformD_2way(out, in, 64, PAD64);
+}
+
+SHANI_TARGET void TransformD56_2way(unsigned char* out, const unsigned char* in)
+{
+    // A 56-byte message leaves no room for the length in its block
+    unsigned char buf[2][64];
+    for (int l = 0; l < 2; l++) {
+        for (int i = 0; i < 56; i++)
+            buf[l][i] = in[56 * l + i];
+        buf[l][56] = 0x80;
+        for (int i = 57; i < 64; i++)
+            buf[l][i] = 0;
+    }
+    TransformD_2way(out, buf[0], 64, PAD56);
+}
+
+} // namespace sha256_shani
+
+#endif // ENABLE_SHA256_X86
@@ -0,0 +1,198 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+//
+// Double SHA-256 of 4 64-byte messages at once, one in each 32-bit lane of
+// the SSE registers.
+
+#include "crypto/common.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(ENABLE_SHA256_X86)
+#include <immintrin.h>
+
+#define SHA_TARGET __attribute__((target("sse4.1")))
+#define SHA_INLINE static inline __attribute__((always_inline, target("sse4.1")))
+
+namespace sha256_sse41
+{
+namespace
+{
+
+SHA_INLINE __m128i K32(uint32_t x) { return _mm_set1_epi32(x); }
+SHA_INLINE __m128i Add(__m128i x, __m128i y) { return _mm_add_epi32(x, y); }
+SHA_INLINE __m128i Add(__m128i x, __m128i y, __m128i z) { return Add(Add(x, y), z); }
+SHA_INLINE __m128i Add(__m128i x, __m128i y, __m128i z, __m128i w) { return Add(Add(x, y), Add(z, w)); }
+SHA_INLINE __m128i Xor(__m128i x, __m128i y) { return _mm_xor_si128(x, y); }
+SHA_INLINE __m128i Xor(__m128i x, __m128i y, __m128i z) { return Xor(Xor(x, y), z); }
+SHA_INLINE __m128i Or(__m128i x, __m128i y) { return _mm_or_si128(x, y); }
+SHA_INLINE __m128i And(__m128i x, __m128i y) { return _mm_and_si128(x, y); }
+SHA_INLINE __m128i ShR(__m128i x, int n) { return _mm_srli_epi32(x, n); }
+SHA_INLINE __m128i ShL(__m128i x, int n) { return _mm_slli_epi32(x, n); }
+SHA_INLINE __m128i RotR(__m128i x, int n) { return Or(ShR(x, n), ShL(x, 32 - n)); }
+
+SHA_INLINE __m128i Ch(__m128i x, __m128i y, __m128i z) { return Xor(z, And(x, Xor(y, z))); }
+SHA_INLINE __m128i Maj(__m128i x, __m128i y, __m128i z) { return Or(And(x, y), And(z, Or(x, y))); }
+SHA_INLINE __m128i Sigma0(__m128i x) { return Xor(RotR(x, 2), RotR(x, 13), RotR(x, 22)); }
+SHA_INLINE __m128i Sigma1(__m128i x) { return Xor(RotR(x, 6), RotR(x, 11), RotR(x, 25)); }
+SHA_INLINE __m128i sigma0(__m128i x) { return Xor(RotR(x, 7), RotR(x, 18), ShR(x, 3)); }
+SHA_INLINE __m128i sigma1(__m128i x) { return Xor(RotR(x, 17), RotR(x, 19), ShR(x, 10)); }
+
+/** One round of SHA-256 in each lane. */
+SHA_INLINE void Round(__m128i a, __m128i b, __m128i c, __m128i& d, __m128i e, __m128i f, __m128i g, __m128i& h, __m128i k, __m128i w)
+{
+    __m128i t1 = Add(h, Sigma1(e), Ch(e, f, g), Add(k, w));
+    __m128i t2 = Add(Sigma0(a), Maj(a, b, c));
+    d = Add(d, t1);
+    h = Add(t1, t2);
+}
+
+/** Add one 64-byte block, the words in w, to the state of each lane. */
+SHA_INLINE void Transform(__m128i* s, const __m128i* w)
+{
+    __m128i a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+    __m128i w0 = w[0], w1 = w[1], w2 = w[2], w3 = w[3], w4 = w[4], w5 = w[5], w6 = w[6], w7 = w[7];
+    __m128i w8 = w[8], w9 = w[9], w10 = w[10], w11 = w[11], w12 = w[12], w13 = w[13], w14 = w[14], w15 = w[15];
+
+    Round(a, b, c, d, e, f, g, h, K32(0x428a2f98ul), w0);
+    Round(h, a, b, c, d, e, f, g, K32(0x71374491ul), w1);
+    Round(g, h, a, b, c, d, e, f, K32(0xb5c0fbcful), w2);
+    Round(f, g, h, a, b, c, d, e, K32(0xe9b5dba5ul), w3);
+    Round(e, f, g, h, a, b, c, d, K32(0x3956c25bul), w4);
+    Round(d, e, f, g, h, a, b, c, K32(0x59f111f1ul), w5);
+    Round(c, d, e, f, g, h, a, b, K32(0x923f82a4ul), w6);
+    Round(b, c, d, e, f, g, h, a, K32(0xab1c5ed5ul), w7);
+    Round(a, b, c, d, e, f, g, h, K32(0xd807aa98ul), w8);
+    Round(h, a, b, c, d, e, f, g, K32(0x12835b01ul), w9);
+    Round(g, h, a, b, c, d, e, f, K32(0x243185beul), w10);
+    Round(f, g, h, a, b, c, d, e, K32(0x550c7dc3ul), w11);
+    Round(e, f, g, h, a, b, c, d, K32(0x72be5d74ul), w12);
+    Round(d, e, f, g, h, a, b, c, K32(0x80deb1feul), w13);
+    Round(c, d, e, f, g, h, a, b, K32(0x9bdc06a7ul), w14);
+    Round(b, c, d, e, f, g, h, a, K32(0xc19bf174ul), w15);
+
+    Round(a, b, c, d, e, f, g, h, K32(0xe49b69c1ul), w0 = Add(w0, sigma1(w14), w9, sigma0(w1)));
+    Round(h, a, b, c, d, e, f, g, K32(0xefbe4786ul), w1 = Add(w1, sigma1(w15), w10, sigma0(w2)));
+    Round(g, h, a, b, c, d, e, f, K32(0x0fc19dc6ul), w2 = Add(w2, sigma1(w0), w11, sigma0(w3)));
+    Round(f, g, h, a, b, c, d, e, K32(0x240ca1ccul), w3 = Add(w3, sigma1(w1), w12, sigma0(w4)));
+    Round(e, f, g, h, a, b, c, d, K32(0x2de92c6ful), w4 = Add(w4, sigma1(w2), w13, sigma0(w5)));
+    Round(d, e, f, g, h, a, b, c, K32(0x4a7484aaul), w5 = Add(w5, sigma1(w3), w14, sigma0(w6)));
+    Round(c, d, e, f, g, h, a, b, K32(0x5cb0a9dcul), w6 = Add(w6, sigma1(w4), w15, sigma0(w7)));
+    Round(b, c, d, e, f, g, h, a, K32(0x76f988daul), w7 = Add(w7, sigma1(w5), w0, sigma0(w8)));
+    Round(a, b, c, d, e, f, g, h, K32(0x983e5152ul), w8 = Add(w8, sigma1(w6), w1, sigma0(w9)));
+    Round(h, a, b, c, d, e, f, g, K32(0xa831c66dul), w9 = Add(w9, sigma1(w7), w2, sigma0(w10)));
+    Round(g, h, a, b, c, d, e, f, K32(0xb00327c8ul), w10 = Add(w10, sigma1(w8), w3, sigma0(w11)));
+    Round(f, g, h, a, b, c, d, e, K32(0xbf597fc7ul), w11 = Add(w11, sigma1(w9), w4, sigma0(w12)));
+    Round(e, f, g, h, a, b, c, d, K32(0xc6e00bf3ul), w12 = Add(w12, sigma1(w10), w5, sigma0(w13)));
+    Round(d, e, f, g, h, a, b, c, K32(0xd5a79147ul), w13 = Add(w13, sigma1(w11), w6, sigma0(w14)));
+    Round(c, d, e, f, g, h, a, b, K32(0x06ca6351ul), w14 = Add(w14, sigma1(w12), w7, sigma0(w15)));
+    Round(b, c, d, e, f, g, h, a, K32(0x14292967ul), w15 = Add(w15, sigma1(w13), w8, sigma0(w0)));
+
+    Round(a, b, c, d, e, f, g, h, K32(0x27b70a85ul), w0 = Add(w0, sigma1(w14), w9, sigma0(w1)));
+    Round(h, a, b, c, d, e, f, g, K32(0x2e1b2138ul), w1 = Add(w1, sigma1(w15), w10, sigma0(w2)));
+    Round(g, h, a, b, c, d, e, f, K32(0x4d2c6dfcul), w2 = Add(w2, sigma1(w0), w11, sigma0(w3)));
+    Round(f, g, h, a, b, c, d, e, K32(0x53380d13ul), w3 = Add(w3, sigma1(w1), w12, sigma0(w4)));
+    Round(e, f, g, h, a, b, c, d, K32(0x650a7354ul), w4 = Add(w4, sigma1(w2), w13, sigma0(w5)));
+    Round(d, e, f, g, h, a, b, c, K32(0x766a0abbul), w5 = Add(w5, sigma1(w3), w14, sigma0(w6)));
+    Round(c, d, e, f, g, h, a, b, K32(0x81c2c92eul), w6 = Add(w6, sigma1(w4), w15, sigma0(w7)));
+    Round(b, c, d, e, f, g, h, a, K32(0x92722c85ul), w7 = Add(w7, sigma1(w5), w0, sigma0(w8)));
+    Round(a, b, c, d, e, f, g, h, K32(0xa2bfe8a1ul), w8 = Add(w8, sigma1(w6), w1, sigma0(w9)));
+    Round(h, a, b, c, d, e, f, g, K32(0xa81a664bul), w9 = Add(w9, sigma1(w7), w2, sigma0(w10)));
+    Round(g, h, a, b, c, d, e, f, K32(0xc24b8b70ul), w10 = Add(w10, sigma1(w8), w3, sigma0(w11)));
+    Round(f, g, h, a, b, c, d, e, K32(0xc76c51a3ul), w11 = Add(w11, sigma1(w9), w4, sigma0(w12)));
+    Round(e, f, g, h, a, b, c, d, K32(0xd192e819ul), w12 = Add(w12, sigma1(w10), w5, sigma0(w13)));
+    Round(d, e, f, g, h, a, b, c, K32(0xd6990624ul), w13 = Add(w13, sigma1(w11), w6, sigma0(w14)));
+    Round(c, d, e, f, g, h, a, b, K32(0xf40e3585ul), w14 = Add(w14, sigma1(w12), w7, sigma0(w15)));
+    Round(b, c, d, e, f, g, h, a, K32(0x106aa070ul), w15 = Add(w15, sigma1(w13), w8, sigma0(w0)));
+
+    Round(a, b, c, d, e, f, g, h, K32(0x19a4c116ul), w0 = Add(w0, sigma1(w14), w9, sigma0(w1)));
+    Round(h, a, b, c, d, e, f, g, K32(0x1e376c08ul), w1 = Add(w1, sigma1(w15), w10, sigma0(w2)));
+    Round(g, h, a, b, c, d, e, f, K32(0x2748774cul), w2 = Add(w2, sigma1(w0), w11, sigma0(w3)));
+    Round(f, g, h, a, b, c, d, e, K32(0x34b0bcb5ul), w3 = Add(w3, sigma1(w1), w12, sigma0(w4)));
+    Round(e, f, g, h, a, b, c, d, K32(0x391c0cb3ul), w4 = Add(w4, sigma1(w2), w13, sigma0(w5)));
+    Round(d, e, f, g, h, a, b, c, K32(0x4ed8aa4aul), w5 = Add(w5, sigma1(w3), w14, sigma0(w6)));
+    Round(c, d, e, f, g, h, a, b, K32(0x5b9cca4ful), w6 = Add(w6, sigma1(w4), w15, sigma0(w7)));
+    Round(b, c, d, e, f, g, h, a, K32(0x682e6ff3ul), w7 = Add(w7, sigma1(w5), w0, sigma0(w8)));
+    Round(a, b, c, d, e, f, g, h, K32(0x748f82eeul), w8 = Add(w8, sigma1(w6), w1, sigma0(w9)));
+    Round(h, a, b, c, d, e, f, g, K32(0x78a5636ful), w9 = Add(w9, sigma1(w7), w2, sigma0(w10)));
+    Round(g, h, a, b, c, d, e, f, K32(0x84c87814ul), w10 = Add(w10, sigma1(w8), w3, sigma0(w11)));
+    Round(f, g, h, a, b, c, d, e, K32(0x8cc70208ul), w11 = Add(w11, sigma1(w9), w4, sigma0(w12)));
+    Round(e, f, g, h, a, b, c, d, K32(0x90befffaul), w12 = Add(w12, sigma1(w10), w5, sigma0(w13)));
+    Round(d, e, f, g, h, a, b, c, K32(0xa4506cebul), w13 = Add(w13, sigma1(w11), w6, sigma0(w14)));
+    Round(c, d, e, f, g, h, a, b, K32(0xbef9a3f7ul), Add(w14, sigma1(w12), w7, sigma0(w15)));
+    Round(b, c, d, e, f, g, h, a, K32(0xc67178f2ul), Add(w15, sigma1(w13), w8, sigma0(w0)));
+
+    s[0] = Add(s[0], a);
+    s[1] = Add(s[1], b);
+    s[2] = Add(s[2], c);
+    s[3] = Add(s[3], d);
+    s[4] = Add(s[4], e);
+    s[5] = Add(s[5], f);
+    s[6] = Add(s[6], g);
+    s[7] = Add(s[7], h);
+}
+
+SHA_INLINE void Initialize(__m128i* s)
+{
+    s[0] = K32(0x6a09e667ul);
+    s[1] = K32(0xbb67ae85ul);
+    s[2] = K32(0x3c6ef372ul);
+    s[3] = K32(0xa54ff53aul);
+    s[4] = K32(0x510e527ful);
+    s[5] = K32(0x9b05688cul);
+    s[6] = K32(0x1f83d9abul);
+    s[7] = K32(0x5be0cd19ul);
+}
+
+/** Word i of each lane's message. */
+SHA_INLINE __m128i Read(const unsigned char* in, int i)
+{
+    return _mm_set_epi32(ReadBE32(in + 192 + 4 * i), ReadBE32(in + 128 + 4 * i), ReadBE32(in + 64 + 4 * i), ReadBE32(in + 4 * i));
+}
+
+/** Write word i of each lane's hash. */
+SHA_INLINE void Write(unsigned char* out, int i, __m128i v)
+{
+    uint32_t lanes[4];
+    _mm_storeu_si128((__m128i*)lanes, v);
+    for (int l = 0; l < 4; l++)
+        WriteBE32(out + 32 * l + 4 * i, lanes[l]);
+}
+
+} // namespace
+
+SHA_TARGET void TransformD64_4way(unsigned char* out, const unsigned char* in)
+{
+    __m128i s[8], t[8], w[16];
+    int i;
+
+    // First hash: the message, then a block of padding and length (512 bits)
+    Initialize(s);
+    for (i = 0; i < 16; i++)
+        w[i] = Read(in, i);
+    Transform(s, w);
+    for (i = 0; i < 16; i++)
+        w[i] = K32(0);
+    w[0] = K32(0x80000000ul);
+    w[15] = K32(0x200);
+    Transform(s, w);
+
+    // Second hash: the first one, padded, with length 256 bits
+    for (i = 0; i < 8; i++)
+        w[i] = s[i];
+    w[8] = K32(0x80000000ul);
+    for (i = 9; i < 15; i++)
+        w[i] = K32(0);
+    w[15] = K32(0x100);
+    Initialize(t);
+    Transform(t, w);
+
+    for (i = 0; i < 8; i++)
+        Write(out, i, t[i]);
+}
+
+} // namespace sha256_sse41
+
+#endif // ENABLE_SHA256_X86
@@ -10,6 +10,7 @@
 #include "util.h"
 #include "masternode.h"
 #include "instantx.h"
+#include "sigverify.h"
 #include "ui_interface.h"
 //#include "random.h"
 
@@ -448,6 +449,7 @@ void CDarkSendPool::Reset(){
 void CDarkSendPool::SetNull(bool clearEverything){
     finalTransaction.vin.clear();
     finalTransaction.vout.clear();
+    finalTransaction.InvalidateHash();
 
     entries.clear();
 
@@ -1069,6 +1071,7 @@ bool CDarkSendPool::AddScriptSig(const CTxIn newVin){
             if(newVin.prevout == vin.prevout && vin.nSequence == newVin.nSequence){
                 vin.scriptSig = newVin.scriptSig;
                 vin.prevPubKey = newVin.prevPubKey;
+                finalTransaction.InvalidateHash();
                 if(fDebug) LogPrintf("CDarkSendPool::AddScriptSig -- adding to finalTransaction  %s\n", newVin.scriptSig.ToString().substr(0,24).c_str());
             }
         }
@@ -2029,16 +2032,14 @@ bool CDarkSendSigner::VerifyMessage(CPubKey pubkey, vector<unsigned char>& vchSi
     ss << strMessageMagic;
     ss << strMessage;
 
-    CPubKey pubkey2;
-    if (!pubkey2.RecoverCompact(ss.GetHash(), vchSig)) {
+    if (!sigverifier.Verify(CSigVerifyItem(ss.GetHash(), vchSig, pubkey, true))) {
         errorMessage = _("Error recovering public key.");
+        if (fDebug)
+            LogPrintf("CDarkSendSigner::VerifyMessage -- signature does not match key %s\n", pubkey.GetID().ToString());
         return false;
     }
 
-    if (fDebug && pubkey2.GetID() != pubkey.GetID())
-        LogPrintf("CDarkSendSigner::VerifyMessage -- keys don't match: %s %s", pubkey2.GetID().ToString(), pubkey.GetID().ToString());
-
-    return (pubkey2.GetID() == pubkey.GetID());
+    return true;
 }
 
 bool CDarksendQueue::Sign()
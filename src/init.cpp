@@ -6,6 +6,11 @@
 #include "init.h"
 #include "main.h"
 #include "chainparams.h"
+#include "crypto/sha256.h"
+#include "txcache.h"
+#include "pubkeycache.h"
+#include "sigcache.h"
+#include "sigverify.h"
 #include "txdb.h"
 #include "rpcserver.h"
 #include "net.h"
@@ -19,6 +24,7 @@
 #include "market.h"
 
 #ifdef ENABLE_WALLET
+#include "kernelsearch.h"
 #include "wallet.h"
 #include "walletdb.h"
 #endif
@@ -117,6 +123,10 @@ void Shutdown()
     StopNode();
     {
         LOCK(cs_main);
+        if (pindexBest)
+            CTxDB().Flush();
+        if (GetBoolArg("-indexsnapshot", true))
+            WriteBlockIndexSnapshot();
 #ifdef ENABLE_WALLET
         if (pwalletMain)
             pwalletMain->SetBestChain(CBlockLocator(pindexBest));
@@ -190,8 +200,18 @@ std::string HelpMessage()
     strUsage += "  -pid=<file>            " + _("Specify pid file (default: slingd.pid)") + "\n";
     strUsage += "  -datadir=<dir>         " + _("Specify data directory") + "\n";
     strUsage += "  -wallet=<dir>          " + _("Specify wallet file (within data directory)") + "\n";
-    strUsage += "  -dbcache=<n>           " + _("Set database cache size in megabytes (default: 25)") + "\n";
+    strUsage += "  -dbcache=<n>           " + _("Set database cache size in megabytes, split evenly between LevelDB and -txcache when that is on (default: 25)") + "\n";
     strUsage += "  -dblogsize=<n>         " + _("Set database disk log size in megabytes (default: 100)") + "\n";
+    strUsage += "  -dbwritebuffer=<n>     " + _("Set the LevelDB write buffer size in megabytes (default: 4)") + "\n";
+    strUsage += "  -dbmaxopenfiles=<n>    " + _("Set the number of files LevelDB may keep open (default: 1000)") + "\n";
+    strUsage += "  -dbblocksize=<n>       " + _("Set the LevelDB block size in kilobytes (default: 4)") + "\n";
+    strUsage += "  -dbcompression         " + _("Compress LevelDB blocks if snappy is available (default: 1)") + "\n";
+    strUsage += "  -dbcoalesce=<n>        " + _("Write up to <n> block commits to LevelDB at once during initial block download, 0 to disable (default: 100)") + "\n";
+    strUsage += "  -indexsnapshot         " + _("Save the block index to a snapshot file at shutdown for faster startup (default: 1)") + "\n";
+    strUsage += "  -txcache               " + _("Keep recently connected transactions in memory, using half of -dbcache (default: 1)") + "\n";
+    strUsage += "  -sigcachesize=<n>      " + strprintf(_("Keep up to <n> megabytes of verified signatures in memory (default: %u)"), DEFAULT_MAX_SIG_CACHE_SIZE) + "\n";
+    strUsage += "  -pubkeycachesize=<n>   " + strprintf(_("Keep up to <n> parsed public keys in memory (default: %u)"), DEFAULT_PUBKEY_CACHE_SIZE) + "\n";
+    strUsage += "  -par=<n>               " + strprintf(_("Set the number of script verification threads (up to %d, 0 = auto, <0 = leave that many cores free, default: %d)"), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS) + "\n";
     strUsage += "  -timeout=<n>           " + _("Specify connection timeout in milliseconds (default: 5000)") + "\n";
     strUsage += "  -proxy=<ip:port>       " + _("Connect through SOCKS5 proxy") + "\n";
     strUsage += "  -tor=<ip:port>         " + _("Use proxy to reach tor hidden services (default: same as -proxy)") + "\n";
@@ -224,6 +244,7 @@ std::string HelpMessage()
 #endif
     strUsage += "  -paytxfee=<amt>        " + _("Fee per KB to add to transactions you send") + "\n";
     strUsage += "  -mininput=<amt>        " + _("When creating transactions, ignore inputs with value less than this (default: 0.01)") + "\n";
+    strUsage += "  -stakethreads=<n>      " + strprintf(_("Set the number of threads searching for stake kernels (up to %d, 0 = auto, <0 = leave that many cores free, default: 0)"), MAX_STAKE_SEARCH_THREADS) + "\n";
     if (fHaveGUI)
         strUsage += "  -server                " + _("Accept command line and JSON-RPC commands") + "\n";
 #if !defined(WIN32)
@@ -235,7 +256,7 @@ std::string HelpMessage()
     strUsage +=                               _("If <category> is not supplied, output all debugging information.") + "\n";
     strUsage +=                               _("<category> can be:");
     strUsage +=                                 " addrman, alert, db, lock, rand, rpc, selectcoins, mempool, net,"; // Don't translate these and qt below
-    strUsage +=                                 " coinage, coinstake, creation, stakemodifier";
+    strUsage +=                                 " coinage, coinstake, creation, stakemodifier, bench";
     if (fHaveGUI)
     {
         strUsage += ", qt.\n";
@@ -270,7 +291,9 @@ std::string HelpMessage()
     strUsage += "  -salvagewallet         " + _("Attempt to recover private keys from a corrupt wallet.dat") + "\n";
     strUsage += "  -checkblocks=<n>       " + _("How many blocks to check at startup (default: 500, 0 = all)") + "\n";
     strUsage += "  -checklevel=<n>        " + _("How thorough the block verification is (0-6, default: 1)") + "\n";
+    strUsage += "  -checkbackground       " + _("Verify the -checkblocks blocks in the background after startup (default: 0)") + "\n";
     strUsage += "  -loadblock=<file>      " + _("Imports blocks from external blk000?.dat file") + "\n";
+    strUsage += "  -checksigbackends      " + _("Verify every signature with both libsecp256k1 and OpenSSL and log differences and speed (default: 0)") + "\n";
     strUsage += "  -maxorphanblocks=<n>   " + strprintf(_("Keep at most <n> unconnectable blocks in memory (default: %u)"), DEFAULT_MAX_ORPHAN_BLOCKS) + "\n";
 
     strUsage += "\n" + _("Block creation options:") + "\n";
@@ -516,6 +539,31 @@ bool AppInit2(boost::thread_group& threadGroup)
     }
 #endif
 
+    // -par=0 means autodetect, but nScriptCheckThreads==0 means no concurrency
+    nScriptCheckThreads = GetArg("-par", DEFAULT_SCRIPTCHECK_THREADS);
+    if (nScriptCheckThreads <= 0)
+        nScriptCheckThreads += boost::thread::hardware_concurrency();
+    if (nScriptCheckThreads <= 1)
+        nScriptCheckThreads = 0;
+    else if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
+        nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
+
+    fCheckSigBackends = GetBoolArg("-checksigbackends", false);
+
+    int64_t nSigCacheBytes = min(max((int64_t)0, GetArg("-sigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE)), (int64_t)MAX_MAX_SIG_CACHE_SIZE) * 1048576;
+    if (mapArgs.count("-maxsigcachesize"))
+    {
+        // Still a number of signatures, as it always was
+        int64_t nSigCacheEntries = max((int64_t)0, GetArg("-maxsigcachesize", 0));
+        nSigCacheBytes = min(nSigCacheEntries, (int64_t)MAX_MAX_SIG_CACHE_SIZE * 1048576 / (int64_t)sizeof(uint256)) * sizeof(uint256);
+        InitWarning(_("Warning: Deprecated argument -maxsigcachesize, use -sigcachesize to give the size in megabytes"));
+    }
+    signatureCache.SetMaxSize((size_t)nSigCacheBytes);
+    LogPrintf("Using %u KiB of memory for up to %u verified signatures\n", nSigCacheBytes / 1024, signatureCache.GetMaxEntries());
+
+    int64_t nPubKeyCacheSize = min(max((int64_t)0, GetArg("-pubkeycachesize", DEFAULT_PUBKEY_CACHE_SIZE)), (int64_t)MAX_PUBKEY_CACHE_SIZE);
+    pubkeyCache.SetMaxEntries((size_t)nPubKeyCacheSize);
+
     fConfChange = GetBoolArg("-confchange", false);
     fMinimizeCoinAge = GetBoolArg("-minimizecoinage", false);
 
@@ -525,10 +573,18 @@ bool AppInit2(boost::thread_group& threadGroup)
         if (!ParseMoney(mapArgs["-mininput"], nMinimumInputValue))
             return InitError(strprintf(_("Invalid amount for -mininput=<amount>: '%s'"), mapArgs["-mininput"]));
     }
+
+    nStakeSearchThreads = GetArg("-stakethreads", 0);
+    if (nStakeSearchThreads <= 0)
+        nStakeSearchThreads += boost::thread::hardware_concurrency();
+    nStakeSearchThreads = max(1, min(nStakeSearchThreads, MAX_STAKE_SEARCH_THREADS));
 #endif
 
     // ********************************************************* Step 4: application initialization: dir lock, daemonize, pidfile, debug log
 
+    // Before any thread hashes
+    std::string strSHA256Impl = SHA256AutoDetect();
+
     // Sanity check
     if (!InitSanityCheck())
         return InitError(_("Initialization sanity check failed. Sling is shutting down."));
@@ -554,12 +610,21 @@ bool AppInit2(boost::thread_group& threadGroup)
     LogPrintf("\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n");
     LogPrintf("Sling version %s (%s)\n", FormatFullVersion(), CLIENT_DATE);
     LogPrintf("Using OpenSSL version %s\n", SSLeay_version(SSLEAY_VERSION));
+    LogPrintf("Using SHA256 implementation: %s\n", strSHA256Impl);
     if (!fLogTimestamps)
         LogPrintf("Startup time: %s\n", DateTimeStrFormat("%x %H:%M:%S", GetTime()));
     LogPrintf("Default data directory %s\n", GetDefaultDataDir().string());
     LogPrintf("Used data directory %s\n", strDataDir);
     std::ostringstream strErrors;
 
+    if (nScriptCheckThreads) {
+        LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
+        for (int i=0; i<nScriptCheckThreads-1; i++)
+            threadGroup.create_thread(&ThreadScriptCheck);
+        for (int i=0; i<nScriptCheckThreads-1; i++)
+            threadGroup.create_thread(&ThreadSigVerify);
+    }
+
     if (mapArgs.count("-masternodepaymentskey")) // masternode payments priv key
     {
         if (!masternodePayments.SetPrivKey(GetArg("-masternodepaymentskey", "")))
@@ -749,6 +814,10 @@ bool AppInit2(boost::thread_group& threadGroup)
         return false;
     }
 
+    // the other half of -dbcache is used by LevelDB, see GetOptions() in txdb-leveldb.cpp
+    if (GetBoolArg("-txcache", true))
+        txcache.SetMaxSize((size_t)GetArg("-dbcache", 25) * 1048576 / 2);
+
     uiInterface.InitMessage(_("Loading block index..."));
 
     nStart = GetTimeMillis();
@@ -766,6 +835,18 @@ bool AppInit2(boost::thread_group& threadGroup)
     }
     LogPrintf(" block index %15dms\n", GetTimeMillis() - nStart);
 
+    int nCheckLevel = GetArg("-checklevel", 1);
+    int nCheckDepth = GetArg("-checkblocks", 500);
+    bool fCheckBackground = GetBoolArg("-checkbackground", false);
+    if (!fCheckBackground)
+    {
+        uiInterface.InitMessage(_("Verifying blocks..."));
+        nStart = GetTimeMillis();
+        if (!VerifyBlocks(nCheckLevel, nCheckDepth))
+            return InitError(_("Error loading block database"));
+        LogPrintf(" verify blocks %13dms\n", GetTimeMillis() - nStart);
+    }
+
     if (GetBoolArg("-printblockindex", false) || GetBoolArg("-printblocktree", false))
     {
         PrintBlockTree();
@@ -886,6 +967,11 @@ bool AppInit2(boost::thread_group& threadGroup)
             pwalletMain->SetBestChain(CBlockLocator(pindexBest));
             nWalletDBUpdated++;
         }
+
+        // From here on the coins that may stake follow the wallet
+        nStart = GetTimeMillis();
+        pwalletMain->RebuildStakeCoins();
+        LogPrintf(" stake coins %15dms\n", GetTimeMillis() - nStart);
     } // (!fDisableWallet)
 #else // ENABLE_WALLET
     LogPrintf("No wallet compiled in!\n");
@@ -1028,8 +1114,15 @@ bool AppInit2(boost::thread_group& threadGroup)
 
     RandAddSeedPerfmon();
 
-    // reindex addresses found in blockchain
-    if(GetBoolArg("-reindexaddr", false))
+    // reindex addresses found in blockchain, also when an upgrade of the
+    // address index could not place every entry
+    bool fReindexAddr = GetBoolArg("-reindexaddr", false);
+    if (!fReindexAddr)
+    {
+        CTxDB txdbAddr("r");
+        fReindexAddr = txdbAddr.ReadAddrIndexRebuild();
+    }
+    if(fReindexAddr)
     {
         uiInterface.InitMessage(_("Rebuilding address index..."));
         CBlockIndex *pblockAddrIndex = pindexBest;
@@ -1040,9 +1133,10 @@ bool AppInit2(boost::thread_group& threadGroup)
 	    bool ReadFromDisk(const CBlockIndex* pindex, bool fReadTransactions=true);
 	    CBlock pblockAddr;
 	    if(pblockAddr.ReadFromDisk(pblockAddrIndex, true))
-	        pblockAddr.RebuildAddressIndex(txdbAddr);
+	        pblockAddr.RebuildAddressIndex(txdbAddr, pblockAddrIndex->nHeight);
 	    pblockAddrIndex = pblockAddrIndex->pprev;
 	}
+	txdbAddr.EraseAddrIndexRebuild();
     }
 
     //// debug print
@@ -1055,6 +1149,9 @@ bool AppInit2(boost::thread_group& threadGroup)
 #endif
 
     StartNode(threadGroup);
+
+    if (fCheckBackground)
+        threadGroup.create_thread(boost::bind(&ThreadVerifyBlocks, nCheckLevel, nCheckDepth));
 #ifdef ENABLE_WALLET
     // InitRPCMining is needed here so getwork/getblocktemplate in the GUI debug console works properly.
     InitRPCMining();
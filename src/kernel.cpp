@@ -324,9 +324,9 @@ static bool CheckStakeKernelHashV1(unsigned int nBits, const CBlock& blockFrom,
 //   quantities so as to generate blocks faster, degrading the system back into
 //   a proof-of-work situation.
 //
-static bool CheckStakeKernelHashV2(CBlockIndex* pindexPrev, unsigned int nBits, unsigned int nTimeBlockFrom, const CTransaction& txPrev, const COutPoint& prevout, unsigned int nTimeTx, uint256& hashProofOfStake, uint256& targetProofOfStake, bool fPrintProofOfStake)
+static bool CheckStakeKernelHashV2(CBlockIndex* pindexPrev, unsigned int nBits, unsigned int nTimeBlockFrom, unsigned int nTimeTxPrev, int64_t nValueIn, const COutPoint& prevout, unsigned int nTimeTx, uint256& hashProofOfStake, uint256& targetProofOfStake, bool fPrintProofOfStake)
 {
-    if (nTimeTx < txPrev.nTime)  // Transaction timestamp violation
+    if (nTimeTx < nTimeTxPrev)  // Transaction timestamp violation
         return error("CheckStakeKernelHash() : nTime violation");
 
     if (nTimeBlockFrom + nStakeMinAge > nTimeTx) // Min age requirement
@@ -337,7 +337,6 @@ static bool CheckStakeKernelHashV2(CBlockIndex* pindexPrev, unsigned int nBits,
     bnTarget.SetCompact(nBits);
 
     // Weighted target
-    int64_t nValueIn = txPrev.vout[prevout.n].nValue;
     CBigNum bnWeight = CBigNum(nValueIn);
     bnTarget *= bnWeight;
 
@@ -349,7 +348,7 @@ static bool CheckStakeKernelHashV2(CBlockIndex* pindexPrev, unsigned int nBits,
 
     // Calculate hash
     CDataStream ss(SER_GETHASH, 0);
-    ss << nStakeModifier << nTimeBlockFrom << txPrev.nTime << prevout.hash << prevout.n << nTimeTx;
+    ss << nStakeModifier << nTimeBlockFrom << nTimeTxPrev << prevout.hash << prevout.n << nTimeTx;
     hashProofOfStake = Hash(ss.begin(), ss.end());
 
     if (fPrintProofOfStake)
@@ -360,7 +359,7 @@ static bool CheckStakeKernelHashV2(CBlockIndex* pindexPrev, unsigned int nBits,
             DateTimeStrFormat(nTimeBlockFrom));
         LogPrintf("CheckStakeKernelHash() : check modifier=0x%016x nTimeBlockFrom=%u nTimeTxPrev=%u nPrevout=%u nTimeTx=%u hashProof=%s\n",
             nStakeModifier,
-            nTimeBlockFrom, txPrev.nTime, prevout.n, nTimeTx,
+            nTimeBlockFrom, nTimeTxPrev, prevout.n, nTimeTx,
             hashProofOfStake.ToString());
     }
 
@@ -376,7 +375,7 @@ static bool CheckStakeKernelHashV2(CBlockIndex* pindexPrev, unsigned int nBits,
             DateTimeStrFormat(nTimeBlockFrom));
         LogPrintf("CheckStakeKernelHash() : pass modifier=0x%016x nTimeBlockFrom=%u nTimeTxPrev=%u nPrevout=%u nTimeTx=%u hashProof=%s\n",
             nStakeModifier,
-            nTimeBlockFrom, txPrev.nTime, prevout.n, nTimeTx,
+            nTimeBlockFrom, nTimeTxPrev, prevout.n, nTimeTx,
             hashProofOfStake.ToString());
     }
 
@@ -386,7 +385,7 @@ static bool CheckStakeKernelHashV2(CBlockIndex* pindexPrev, unsigned int nBits,
 bool CheckStakeKernelHash(CBlockIndex* pindexPrev, unsigned int nBits, const CBlock& blockFrom, unsigned int nTxPrevOffset, const CTransaction& txPrev, const COutPoint& prevout, unsigned int nTimeTx, uint256& hashProofOfStake, uint256& targetProofOfStake, bool fPrintProofOfStake)
 {
     if (IsProtocolV2(pindexPrev->nHeight+1))
-        return CheckStakeKernelHashV2(pindexPrev, nBits, blockFrom.GetBlockTime(), txPrev, prevout, nTimeTx, hashProofOfStake, targetProofOfStake, fPrintProofOfStake);
+        return CheckStakeKernelHashV2(pindexPrev, nBits, blockFrom.GetBlockTime(), txPrev.nTime, txPrev.vout[prevout.n].nValue, prevout, nTimeTx, hashProofOfStake, targetProofOfStake, fPrintProofOfStake);
     else
         return CheckStakeKernelHashV1(nBits, blockFrom, nTxPrevOffset, txPrev, prevout, nTimeTx, hashProofOfStake, targetProofOfStake, fPrintProofOfStake);
 }
@@ -408,7 +407,7 @@ bool CheckProofOfStake(CBlockIndex* pindexPrev, const CTransaction& tx, unsigned
         return tx.DoS(1, error("CheckProofOfStake() : INFO: read txPrev failed"));  // previous transaction not in main chain, may occur during initial download
 
     // Verify signature
-    if (!VerifySignature(txPrev, tx, 0, SCRIPT_VERIFY_NONE, 0))
+    if (!VerifySignature(txPrev, tx, 0, MANDATORY_SCRIPT_VERIFY_FLAGS))
         return tx.DoS(100, error("CheckProofOfStake() : VerifySignature failed on coinstake %s", tx.GetHash().ToString()));
 
     // Read block header
@@ -454,3 +453,86 @@ bool CheckKernel(CBlockIndex* pindexPrev, unsigned int nBits, int64_t nTime, con
 
     return CheckStakeKernelHash(pindexPrev, nBits, block, txindex.pos.nTxPos - txindex.pos.nBlockPos, txPrev, prevout, nTime, hashProofOfStake, targetProofOfStake);
 }
+
+bool ReadKernelInput(const COutPoint& prevout, CStakeKernelInput& inputRet)
+{
+    CTxDB txdb("r");
+    CTransaction txPrev;
+    CTxIndex txindex;
+    if (!txPrev.ReadFromDisk(txdb, prevout, txindex))
+        return false;
+
+    // Read block header
+    CBlock block;
+    if (!block.ReadFromDisk(txindex.pos.nFile, txindex.pos.nBlockPos, false))
+        return false;
+
+    inputRet = CStakeKernelInput(prevout, txPrev.vout[prevout.n].nValue, txPrev.nTime, block.GetBlockTime(), block.GetHash());
+    return true;
+}
+
+bool CheckKernel(CBlockIndex* pindexPrev, unsigned int nBits, int64_t nTime, const CStakeKernelInput& input)
+{
+    if (input.nTimeBlockFrom + nStakeMinAge > nTime)
+        return false; // only count coins meeting min age requirement
+
+    // The old protocol hashes the offset of the transaction in its block
+    if (!IsProtocolV2(pindexPrev->nHeight+1))
+        return CheckKernel(pindexPrev, nBits, nTime, input.prevout);
+
+    uint256 hashProofOfStake, targetProofOfStake;
+    return CheckStakeKernelHashV2(pindexPrev, nBits, input.nTimeBlockFrom, input.nTime, input.nValue, input.prevout, nTime, hashProofOfStake, targetProofOfStake, false);
+}
+
+void CStakeKernelCache::Add(const CStakeKernelInput& input)
+{
+    LOCK(cs);
+    mapInputs[input.prevout] = input;
+}
+
+void CStakeKernelCache::Remove(const COutPoint& prevout)
+{
+    LOCK(cs);
+    mapInputs.erase(prevout);
+}
+
+void CStakeKernelCache::Remove(const uint256& hashTx)
+{
+    LOCK(cs);
+    map<COutPoint, CStakeKernelInput>::iterator it = mapInputs.lower_bound(COutPoint(hashTx, 0));
+    while (it != mapInputs.end() && it->first.hash == hashTx)
+        mapInputs.erase(it++);
+}
+
+bool CStakeKernelCache::Get(const COutPoint& prevout, CStakeKernelInput& inputRet) const
+{
+    LOCK(cs);
+    map<COutPoint, CStakeKernelInput>::const_iterator it = mapInputs.find(prevout);
+    if (it == mapInputs.end())
+    {
+        nMisses++;
+        return false;
+    }
+    nHits++;
+    inputRet = it->second;
+    return true;
+}
+
+void CStakeKernelCache::Clear()
+{
+    LOCK(cs);
+    mapInputs.clear();
+}
+
+size_t CStakeKernelCache::size() const
+{
+    LOCK(cs);
+    return mapInputs.size();
+}
+
+void CStakeKernelCache::GetStats(uint64_t& nHitsRet, uint64_t& nMissesRet) const
+{
+    LOCK(cs);
+    nHitsRet = nHits;
+    nMissesRet = nMisses;
+}
@@ -39,4 +39,51 @@ int64_t GetWeight(int64_t nIntervalBeginning, int64_t nIntervalEnd);
 // Convenient for searching a kernel
 bool CheckKernel(CBlockIndex* pindexPrev, unsigned int nBits, int64_t nTime, const COutPoint& prevout, int64_t* pBlockTime = NULL);
 
+// What the kernel hash needs to know of a stake input: enough to search
+// for a kernel without reading the transaction and its block from disk
+class CStakeKernelInput
+{
+public:
+    COutPoint prevout;
+    int64_t nValue;
+    unsigned int nTime;             // time of the transaction
+    unsigned int nTimeBlockFrom;    // time of the block containing it
+    uint256 hashBlockFrom;
+
+    CStakeKernelInput() : nValue(0), nTime(0), nTimeBlockFrom(0), hashBlockFrom(0) {}
+
+    CStakeKernelInput(const COutPoint& prevoutIn, int64_t nValueIn, unsigned int nTimeIn, unsigned int nTimeBlockFromIn, const uint256& hashBlockFromIn) :
+        prevout(prevoutIn), nValue(nValueIn), nTime(nTimeIn), nTimeBlockFrom(nTimeBlockFromIn), hashBlockFrom(hashBlockFromIn) {}
+};
+
+// Read a stake input of the main chain from disk
+bool ReadKernelInput(const COutPoint& prevout, CStakeKernelInput& inputRet);
+
+// CheckKernel() for an input already in memory
+bool CheckKernel(CBlockIndex* pindexPrev, unsigned int nBits, int64_t nTime, const CStakeKernelInput& input);
+
+// Stake inputs of a wallet, kept across staking rounds. Whoever fills it
+// must remove the outputs of a transaction whose block is disconnected.
+class CStakeKernelCache
+{
+private:
+    mutable CCriticalSection cs;
+    std::map<COutPoint, CStakeKernelInput> mapInputs;
+    mutable uint64_t nHits;
+    mutable uint64_t nMisses;
+
+public:
+    CStakeKernelCache() : nHits(0), nMisses(0) {}
+
+    void Add(const CStakeKernelInput& input);
+    void Remove(const COutPoint& prevout);
+    // Drop every output of a transaction
+    void Remove(const uint256& hashTx);
+    bool Get(const COutPoint& prevout, CStakeKernelInput& inputRet) const;
+    void Clear();
+
+    size_t size() const;
+    void GetStats(uint64_t& nHitsRet, uint64_t& nMissesRet) const;
+};
+
 #endif // PPCOIN_KERNEL_H
@@ -0,0 +1,217 @@
+// Copyright (c) 2014 The Sling developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "kernelsearch.h"
+
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+
+#include <limits>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+using namespace std;
+
+int nStakeSearchThreads = 1;
+
+static CCriticalSection cs_kernelSearchStats;
+static CKernelSearchStats kernelSearchStats;
+
+// Kernels hashed by one SHA256D56 call
+static const unsigned int KERNEL_SEARCH_BATCH = 32;
+
+void GetKernelSearchStats(CKernelSearchStats& statsRet)
+{
+    LOCK(cs_kernelSearchStats);
+    statsRet = kernelSearchStats;
+}
+
+CStakeKernelSearch::CStakeKernelSearch(CBlockIndex* pindexPrevIn, unsigned int nBitsIn) : pindexPrev(pindexPrevIn), nBits(nBitsIn)
+{
+    fProtocolV2 = IsProtocolV2(pindexPrev->nHeight+1);
+    bnTargetPerCoin.SetCompact(nBits);
+}
+
+// The message is serialized as CheckStakeKernelHashV2 streams it:
+// nStakeModifier, nTimeBlockFrom, txPrev.nTime, prevout.hash, prevout.n and
+// last nTimeTx, which is left out here
+void CStakeKernelSearch::Add(const CStakeKernelInput& input)
+{
+    size_t nPos = vMessages.size();
+    vMessages.resize(nPos + KERNEL_MESSAGE_SIZE);
+    unsigned char* p = &vMessages[nPos];
+    WriteLE64(p, pindexPrev->nStakeModifier);
+    WriteLE32(p + 8, input.nTimeBlockFrom);
+    WriteLE32(p + 12, input.nTime);
+    memcpy(p + 16, input.prevout.hash.begin(), 32);
+    WriteLE32(p + 48, input.prevout.n);
+    WriteLE32(p + 52, 0);
+
+    // Min age, and no earlier than the transaction itself
+    vTimeMin.push_back(max(input.nTimeBlockFrom + nStakeMinAge, input.nTime));
+
+    // A target past 2^256 is met by every hash, a negative one by none
+    CBigNum bnTarget = bnTargetPerCoin * CBigNum(input.nValue);
+    if (bnTarget < 0)
+        vTimeMin.back() = numeric_limits<unsigned int>::max();
+    vTargets.push_back(bnTarget.bitSize() > 256 ? ~uint256(0) : bnTarget.getuint256());
+
+    vPrevouts.push_back(input.prevout);
+}
+
+uint256 CStakeKernelSearch::GetKernelHash(size_t nIndex, unsigned int nTimeTx) const
+{
+    unsigned char vchMessage[KERNEL_MESSAGE_SIZE];
+    memcpy(vchMessage, &vMessages[nIndex * KERNEL_MESSAGE_SIZE], KERNEL_MESSAGE_SIZE);
+    WriteLE32(vchMessage + 52, nTimeTx);
+    uint256 hash;
+    SHA256D56(hash.begin(), vchMessage, 1);
+    return hash;
+}
+
+void CStakeKernelSearch::FindRange(CRange* prange, unsigned int nTime, unsigned int nInterval, volatile size_t* pnFoundRange, size_t nRange) const
+{
+    unsigned char vchBatch[KERNEL_SEARCH_BATCH * KERNEL_MESSAGE_SIZE];
+    uint256 vHashes[KERNEL_SEARCH_BATCH];
+    size_t vIndex[KERNEL_SEARCH_BATCH];
+    unsigned int vTime[KERNEL_SEARCH_BATCH];
+
+    prange->fFound = false;
+    prange->nHashes = 0;
+    size_t i = prange->nBegin;
+    unsigned int n = 0;
+    while (true)
+    {
+        // The next pairs to try: each input in turn, its timestamps from
+        // the latest. Before the earliest it may stake at none can be a
+        // kernel.
+        unsigned int nBatch = 0;
+        while (nBatch < KERNEL_SEARCH_BATCH && i < prange->nEnd)
+        {
+            if (n == nInterval || nTime - n < vTimeMin[i])
+            {
+                i++;
+                n = 0;
+                continue;
+            }
+            memcpy(&vchBatch[nBatch * KERNEL_MESSAGE_SIZE], &vMessages[i * KERNEL_MESSAGE_SIZE], KERNEL_MESSAGE_SIZE);
+            WriteLE32(&vchBatch[nBatch * KERNEL_MESSAGE_SIZE + 52], nTime - n);
+            vIndex[nBatch] = i;
+            vTime[nBatch] = nTime - n;
+            nBatch++;
+            n++;
+        }
+        if (nBatch == 0)
+            return;
+
+        SHA256D56(vHashes[0].begin(), vchBatch, nBatch);
+        prange->nHashes += nBatch;
+        for (unsigned int j = 0; j < nBatch; j++)
+        {
+            if (vHashes[j] > vTargets[vIndex[j]])
+                continue;
+
+            prange->fFound = true;
+            prange->nIndex = vIndex[j];
+            prange->nTime = vTime[j];
+
+            // Tell the ranges after this one to stop
+            size_t nFound = *pnFoundRange;
+            while (nRange < nFound)
+            {
+                size_t nSeen = __sync_val_compare_and_swap(pnFoundRange, nFound, nRange);
+                if (nSeen == nFound)
+                    break;
+                nFound = nSeen;
+            }
+            return;
+        }
+
+        if (*pnFoundRange < nRange)
+            return;
+    }
+}
+
+bool CStakeKernelSearch::Find(size_t nBegin, unsigned int nTime, unsigned int nInterval, size_t& nIndexRet, unsigned int& nTimeRet, int nThreads) const
+{
+    int64_t nStart = GetTimeMicros();
+    size_t nEnd = size();
+    nBegin = min(nBegin, nEnd);
+
+    vector<CRange> vRanges;
+    if (!fProtocolV2)
+    {
+        // The old protocol hashes the offset of the transaction in its
+        // block, which is not kept in memory
+        CRange range;
+        range.fFound = false;
+        range.nHashes = 0;
+        for (size_t i = nBegin; i < nEnd && !range.fFound; i++)
+        {
+            for (unsigned int n = 0; n < nInterval; n++)
+            {
+                range.nHashes++;
+                if (CheckKernel(pindexPrev, nBits, nTime - n, vPrevouts[i]))
+                {
+                    range.fFound = true;
+                    range.nIndex = i;
+                    range.nTime = nTime - n;
+                    break;
+                }
+            }
+        }
+        vRanges.push_back(range);
+    }
+    else
+    {
+        // Split the inputs into one range per thread, unless too few
+        size_t nRanges = 1;
+        if (nThreads > 1 && (uint64_t)(nEnd - nBegin) * nInterval >= KERNEL_SEARCH_PARALLEL_MIN)
+            nRanges = min((size_t)nThreads, nEnd - nBegin);
+        size_t nRangeSize = nRanges ? (nEnd - nBegin + nRanges - 1) / nRanges : 0;
+        vRanges.resize(nRanges);
+        for (size_t r = 0; r < nRanges; r++)
+        {
+            vRanges[r].nBegin = min(nBegin + r * nRangeSize, nEnd);
+            vRanges[r].nEnd = min(vRanges[r].nBegin + nRangeSize, nEnd);
+        }
+
+        volatile size_t nFoundRange = nRanges;
+        {
+            // The threads work on this stack frame, so they must be joined
+            boost::this_thread::disable_interruption di;
+            boost::thread_group threadGroup;
+            for (size_t r = 1; r < nRanges; r++)
+                threadGroup.create_thread(boost::bind(&CStakeKernelSearch::FindRange, this, &vRanges[r], nTime, nInterval, &nFoundRange, r));
+            FindRange(&vRanges[0], nTime, nInterval, &nFoundRange, 0);
+            threadGroup.join_all();
+        }
+    }
+
+    // The first range with a kernel has the first kernel
+    bool fFound = false;
+    uint64_t nHashes = 0;
+    for (size_t r = 0; r < vRanges.size(); r++)
+    {
+        nHashes += vRanges[r].nHashes;
+        if (vRanges[r].fFound && !fFound)
+        {
+            fFound = true;
+            nIndexRet = vRanges[r].nIndex;
+            nTimeRet = vRanges[r].nTime;
+        }
+    }
+
+    int64_t nMicros = GetTimeMicros() - nStart;
+    {
+        LOCK(cs_kernelSearchStats);
+        kernelSearchStats.nHashes += nHashes;
+        kernelSearchStats.nMicros += nMicros;
+        kernelSearchStats.nLastHashes = nHashes;
+        kernelSearchStats.nLastMicros = nMicros;
+    }
+    LogPrint("bench", "CStakeKernelSearch::Find : %u hashes in %dus by %u threads\n", nHashes, nMicros, max(vRanges.size(), (size_t)1));
+    return fFound;
+}
@@ -0,0 +1,97 @@
+// Copyright (c) 2014 The Sling developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef SLING_KERNELSEARCH_H
+#define SLING_KERNELSEARCH_H
+
+#include "kernel.h"
+
+#include <vector>
+
+/** Largest -stakethreads */
+static const int MAX_STAKE_SEARCH_THREADS = 16;
+/** Below this many hashes a search is always done by one thread */
+static const unsigned int KERNEL_SEARCH_PARALLEL_MIN = 4096;
+
+/** Number of threads hashing kernels, set by -stakethreads */
+extern int nStakeSearchThreads;
+
+class CKernelSearchStats
+{
+public:
+    uint64_t nHashes;
+    int64_t nMicros;
+    uint64_t nLastHashes;
+    int64_t nLastMicros;
+
+    CKernelSearchStats() : nHashes(0), nMicros(0), nLastHashes(0), nLastMicros(0) {}
+
+    double GetHashesPerSec() const
+    {
+        return nMicros ? 1000000.0 * nHashes / nMicros : 0.0;
+    }
+};
+
+/** Kernel hashes computed and time spent searching, since startup */
+void GetKernelSearchStats(CKernelSearchStats& statsRet);
+
+/*
+ * Searches stake inputs for a kernel, many (input, timestamp) pairs at a time.
+ *
+ * The kernel message of each input is laid out once in a flat array, all
+ * but the timestamp, and its target, the difficulty weighted by the value,
+ * worked out once as a 256-bit number. A search then only copies messages,
+ * hashes them in batches with SHA256D56 and compares the hashes with the
+ * targets. Large searches are split between up to nStakeSearchThreads
+ * threads.
+ *
+ * The kernel found is always the one CheckKernel() would find first trying
+ * the inputs in the order they were added and, for each, the timestamps
+ * from the latest back.
+ */
+class CStakeKernelSearch
+{
+private:
+    CBlockIndex* pindexPrev;
+    unsigned int nBits;
+    bool fProtocolV2;
+    CBigNum bnTargetPerCoin;
+
+    // One entry per input
+    std::vector<unsigned char> vMessages;  // KERNEL_MESSAGE_SIZE bytes each
+    std::vector<unsigned int> vTimeMin;    // earliest timestamp it may stake at
+    std::vector<uint256> vTargets;
+    std::vector<COutPoint> vPrevouts;
+
+    // The inputs one thread searches, and what it found
+    struct CRange
+    {
+        size_t nBegin;
+        size_t nEnd;
+        bool fFound;
+        size_t nIndex;
+        unsigned int nTime;
+        uint64_t nHashes;
+    };
+
+    // Search the inputs of range number nRange. Gives up once a range
+    // before it has found a kernel, as tracked in *pnFoundRange.
+    void FindRange(CRange* prange, unsigned int nTime, unsigned int nInterval, volatile size_t* pnFoundRange, size_t nRange) const;
+
+public:
+    static const size_t KERNEL_MESSAGE_SIZE = 56;
+
+    CStakeKernelSearch(CBlockIndex* pindexPrevIn, unsigned int nBitsIn);
+
+    void Add(const CStakeKernelInput& input);
+    size_t size() const { return vTimeMin.size(); }
+
+    // The kernel hash of input nIndex at timestamp nTimeTx
+    uint256 GetKernelHash(size_t nIndex, unsigned int nTimeTx) const;
+
+    // Find the first input from nBegin on that is a kernel at one of the
+    // nInterval timestamps up to nTime
+    bool Find(size_t nBegin, unsigned int nTime, unsigned int nInterval, size_t& nIndexRet, unsigned int& nTimeRet, int nThreads = nStakeSearchThreads) const;
+};
+
+#endif // SLING_KERNELSEARCH_H
@@ -2,9 +2,9 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
-// NOTE:  libsecp256k1 verification methods presently not working,
-//        so here, we include both openssl libs and libsecp256k1
-//        to at least gain what we can from it.
+// NOTE:  with USE_SECP256K1 signing and verification go through
+//        libsecp256k1. The OpenSSL code is still built: it handles the
+//        rest, and -checksigbackends compares the two.
 
 #include <openssl/ecdsa.h>
 #include <openssl/rand.h>
@@ -12,6 +12,8 @@
 #include <openssl/bn.h>
 
 #include "key.h"
+#include "sync.h"
+#include "util.h"
 
 #ifdef USE_SECP256K1
 #include <secp256k1.h>
@@ -28,7 +30,7 @@ class CSecp256k1Init {
 public:
     secp256k1_context_t* ctx;
     CSecp256k1Init() {
-        ctx = secp256k1_context_create(SECP256K1_CONTEXT_SIGN);
+        ctx = secp256k1_context_create(SECP256K1_CONTEXT_SIGN | SECP256K1_CONTEXT_VERIFY);
     }
     ~CSecp256k1Init() {
         secp256k1_context_destroy(ctx);
@@ -400,8 +402,188 @@ const unsigned char vchMaxModHalfOrder[32] = {
 
 const unsigned char vchZero[0] = {};
 
+#ifdef USE_SECP256K1
+// Order of secp256k1's generator.
+const unsigned char vchOrder[32] = {
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFE,
+    0xBA,0xAE,0xDC,0xE6,0xAF,0x48,0xA0,0x3B,
+    0xBF,0xD2,0x5E,0x8C,0xD0,0x36,0x41,0x41
+};
+
+// Read the length of a DER element at input[pos], the way OpenSSL before
+// 1.0.0p/1.0.1k did: long forms may be padded with zero bytes.
+bool ReadLaxDERLength(const unsigned char *input, size_t inputlen, size_t &pos, size_t &len) {
+    if (pos == inputlen)
+        return false;
+    size_t lenbyte = input[pos++];
+    if (!(lenbyte & 0x80)) {
+        len = lenbyte;
+        return true;
+    }
+    lenbyte -= 0x80;
+    if (lenbyte > inputlen - pos)
+        return false;
+    while (lenbyte > 0 && input[pos] == 0) {
+        pos++;
+        lenbyte--;
+    }
+    if (lenbyte >= 4)
+        return false;
+    len = 0;
+    while (lenbyte > 0) {
+        len = (len << 8) + input[pos];
+        pos++;
+        lenbyte--;
+    }
+    return true;
+}
+
+// Parse a DER signature as leniently as old OpenSSL did, so that every
+// signature already in the chain is still read the same way, and write its
+// r and s to r32 and s32. An r or s that is not below the group order comes
+// back as zero, which no verification accepts.
+bool ParseLaxDERSignature(const unsigned char *input, size_t inputlen, unsigned char r32[32], unsigned char s32[32]) {
+    size_t pos = 0, len, rpos, rlen, spos, slen;
+
+    // Sequence tag and length; the length itself is not checked
+    if (pos == inputlen || input[pos] != 0x30)
+        return false;
+    pos++;
+    if (pos == inputlen)
+        return false;
+    len = input[pos++];
+    if (len & 0x80) {
+        len -= 0x80;
+        if (len > inputlen - pos)
+            return false;
+        pos += len;
+    }
+
+    // Integer R
+    if (pos == inputlen || input[pos] != 0x02)
+        return false;
+    pos++;
+    if (!ReadLaxDERLength(input, inputlen, pos, rlen) || rlen > inputlen - pos)
+        return false;
+    rpos = pos;
+    pos += rlen;
+
+    // Integer S
+    if (pos == inputlen || input[pos] != 0x02)
+        return false;
+    pos++;
+    if (!ReadLaxDERLength(input, inputlen, pos, slen) || slen > inputlen - pos)
+        return false;
+    spos = pos;
+
+    while (rlen > 0 && input[rpos] == 0) {
+        rlen--;
+        rpos++;
+    }
+    while (slen > 0 && input[spos] == 0) {
+        slen--;
+        spos++;
+    }
+    memset(r32, 0, 32);
+    memset(s32, 0, 32);
+    if (rlen > 32 || slen > 32)
+        return true;
+    memcpy(r32 + 32 - rlen, input + rpos, rlen);
+    memcpy(s32 + 32 - slen, input + spos, slen);
+    if (CompareBigEndian(r32, 32, vchMaxModOrder, 32) > 0 || CompareBigEndian(s32, 32, vchMaxModOrder, 32) > 0) {
+        memset(r32, 0, 32);
+        memset(s32, 0, 32);
+    }
+    return true;
+}
+
+// Encode (r, s) as strict DER, with s replaced by order - s when it is in the
+// upper half. Both verify the same; libsecp256k1 only has to accept this form.
+void EncodeStrictDERSignature(const unsigned char r32[32], const unsigned char s32[32], std::vector<unsigned char> &vchSig) {
+    unsigned char sLow[32];
+    if (CompareBigEndian(s32, 32, vchMaxModHalfOrder, 32) > 0) {
+        int borrow = 0;
+        for (int i = 31; i >= 0; i--) {
+            int diff = vchOrder[i] - s32[i] - borrow;
+            borrow = diff < 0;
+            sLow[i] = (unsigned char)(diff + (borrow ? 256 : 0));
+        }
+    } else {
+        memcpy(sLow, s32, 32);
+    }
+
+    const unsigned char *pInt[2] = { r32, sLow };
+    std::vector<unsigned char> vchInts;
+    for (int i = 0; i < 2; i++) {
+        const unsigned char *p = pInt[i];
+        const unsigned char *pend = p + 32;
+        while (p < pend - 1 && *p == 0)
+            p++;
+        vchInts.push_back(0x02);
+        vchInts.push_back((unsigned char)((pend - p) + (*p & 0x80 ? 1 : 0)));
+        if (*p & 0x80)
+            vchInts.push_back(0x00);
+        vchInts.insert(vchInts.end(), p, pend);
+    }
+    vchSig.clear();
+    vchSig.push_back(0x30);
+    vchSig.push_back((unsigned char)vchInts.size());
+    vchSig.insert(vchSig.end(), vchInts.begin(), vchInts.end());
+}
+
+bool Secp256k1Verify(const CPubKey &pubkey, const uint256 &hash, const std::vector<unsigned char>& vchSig) {
+    unsigned char r32[32], s32[32];
+    if (vchSig.empty() || !ParseLaxDERSignature(&vchSig[0], vchSig.size(), r32, s32))
+        return false;
+    std::vector<unsigned char> vchStrict;
+    EncodeStrictDERSignature(r32, s32, vchStrict);
+    return secp256k1_ecdsa_verify(instance_of_csecp256k1.ctx, hash.begin(), &vchStrict[0], vchStrict.size(), pubkey.begin(), pubkey.size()) == 1;
+}
+
+bool Secp256k1Recover(CPubKey &pubkey, const uint256 &hash, const std::vector<unsigned char>& vchSig, bool fComp) {
+    int recid = (vchSig[0] - 27) & 3;
+    // the OpenSSL code never accepted recid 3, so neither do we
+    if (recid == 3)
+        return false;
+    unsigned char pub[65];
+    int pubkeylen = 65;
+    if (!secp256k1_ecdsa_recover_compact(instance_of_csecp256k1.ctx, hash.begin(), &vchSig[1], pub, &pubkeylen, fComp, recid))
+        return false;
+    pubkey.Set(pub, pub + pubkeylen);
+    return pubkey.IsValid();
+}
+
+// -checksigbackends bookkeeping
+CCriticalSection cs_sigBackendStats;
+uint64_t nSigBackendChecks = 0;
+uint64_t nSigBackendMismatches = 0;
+int64_t nSigBackendMicrosSecp = 0;
+int64_t nSigBackendMicrosOpenSSL = 0;
+
+void RecordSigBackendCheck(const char *pszWhat, bool fSecp, bool fOpenSSL, bool fAgree, int64_t nMicrosSecp, int64_t nMicrosOpenSSL,
+                           const CPubKey &pubkey, const uint256 &hash, const std::vector<unsigned char>& vchSig) {
+    LOCK(cs_sigBackendStats);
+    nSigBackendChecks++;
+    nSigBackendMicrosSecp += nMicrosSecp;
+    nSigBackendMicrosOpenSSL += nMicrosOpenSSL;
+    if (!fAgree) {
+        nSigBackendMismatches++;
+        LogPrintf("%s : backends disagree, secp256k1 %d openssl %d, pubkey %s hash %s sig %s\n", pszWhat, fSecp, fOpenSSL,
+            HexStr(pubkey.begin(), pubkey.end()), hash.ToString(), HexStr(vchSig));
+    }
+    if (nSigBackendChecks % 10000 == 0)
+        LogPrintf("checksigbackends: %u checks, %u mismatches, secp256k1 %.0f/s, openssl %.0f/s\n",
+            nSigBackendChecks, nSigBackendMismatches,
+            1000000.0 * nSigBackendChecks / std::max(nSigBackendMicrosSecp, (int64_t)1),
+            1000000.0 * nSigBackendChecks / std::max(nSigBackendMicrosOpenSSL, (int64_t)1));
+}
+#endif
+
 }; // end of anonymous namespace
 
+bool fCheckSigBackends = false;
+
 
 bool CKey::Check(const unsigned char *vch) {
     // Do not convert to OpenSSL's data structures for range-checking keys,
@@ -589,37 +771,62 @@ bool CKey::Load(CPrivKey &privkey, CPubKey &vchPubKey, bool fSkipCheck=false) {
 bool CPubKey::Verify(const uint256 &hash, const std::vector<unsigned char>& vchSig) const {
     if (!IsValid())
         return false;
-/*#ifdef USE_SECP256K1
-    if (secp256k1_ecdsa_verify(hash.begin(), 32, &vchSig[0], vchSig.size(), begin(), size()) != 1)
+#ifdef USE_SECP256K1
+    if (!fCheckSigBackends)
+        return Secp256k1Verify(*this, hash, vchSig);
+
+    int64_t nStart = GetTimeMicros();
+    bool fSecp = Secp256k1Verify(*this, hash, vchSig);
+    int64_t nMid = GetTimeMicros();
+    bool fOpenSSL = VerifyOpenSSL(hash, vchSig);
+    RecordSigBackendCheck("CPubKey::Verify()", fSecp, fOpenSSL, fSecp == fOpenSSL, nMid - nStart, GetTimeMicros() - nMid, *this, hash, vchSig);
+    return fOpenSSL;
+#else
+    return VerifyOpenSSL(hash, vchSig);
+#endif
+}
+
+bool CPubKey::VerifyOpenSSL(const uint256 &hash, const std::vector<unsigned char>& vchSig) const {
+    if (!IsValid())
         return false;
-#else*/
     CECKey key;
     if (!key.SetPubKey(*this))
         return false;
     if (!key.Verify(hash, vchSig))
         return false;
-//#endif
     return true;
 }
 
 bool CPubKey::RecoverCompact(const uint256 &hash, const std::vector<unsigned char>& vchSig) {
     if (vchSig.size() != 65)
         return false;
-    int recid = (vchSig[0] - 27) & 3;
+#ifdef USE_SECP256K1
     bool fComp = (vchSig[0] - 27) & 4;
-/*#ifdef USE_SECP256K1
-    int pubkeylen = 65;
-    if (!secp256k1_ecdsa_recover_compact(hash.begin(), 32, &vchSig[1], begin(), &pubkeylen, fComp, recid))
+    if (!fCheckSigBackends)
+        return Secp256k1Recover(*this, hash, vchSig, fComp);
+
+    CPubKey pubkeySecp;
+    int64_t nStart = GetTimeMicros();
+    bool fSecp = Secp256k1Recover(pubkeySecp, hash, vchSig, fComp);
+    int64_t nMid = GetTimeMicros();
+    bool fOpenSSL = RecoverCompactOpenSSL(hash, vchSig);
+    RecordSigBackendCheck("CPubKey::RecoverCompact()", fSecp, fOpenSSL, fSecp == fOpenSSL && (!fSecp || pubkeySecp == *this),
+        nMid - nStart, GetTimeMicros() - nMid, *this, hash, vchSig);
+    return fOpenSSL;
+#else
+    return RecoverCompactOpenSSL(hash, vchSig);
+#endif
+}
+
+bool CPubKey::RecoverCompactOpenSSL(const uint256 &hash, const std::vector<unsigned char>& vchSig) {
+    if (vchSig.size() != 65)
         return false;
-    assert((int)size() == pubkeylen);
-#else*/
+    int recid = (vchSig[0] - 27) & 3;
+    bool fComp = (vchSig[0] - 27) & 4;
     CECKey key;
-    //if (!key.Recover(hash, &vchSig[1], (vchSig[0] - 27) & ~4))
     if (!key.Recover(hash, &vchSig[1], recid))
         return false;
-    //key.GetPubKey(*this, (vchSig[0] - 27) & 4);
     key.GetPubKey(*this, fComp);
-//#endif
     return true;
 }
 
@@ -628,20 +835,13 @@ bool CPubKey::VerifyCompact(const uint256 &hash, const std::vector<unsigned char
         return false;
     if (vchSig.size() != 65)
         return false;
-    int recid = (vchSig[0] - 27) & 3;
-    bool fComp = IsCompressed();
+    // RecoverCompact takes the compression flag from the header byte;
+    // compare against a key in our own format instead
+    std::vector<unsigned char> vchSigComp(vchSig);
+    vchSigComp[0] = 27 + ((vchSig[0] - 27) & 3) + (IsCompressed() ? 4 : 0);
     CPubKey pubkeyRec;
-/*#ifdef USE_SECP256K1
-    int pubkeylen = 65;
-    if (!secp256k1_ecdsa_recover_compact(hash.begin(), 32, &vchSig[1], pubkeyRec.begin(), &pubkeylen, fComp, recid))
+    if (!pubkeyRec.RecoverCompact(hash, vchSigComp))
         return false;
-    assert((int)pubkeyRec.size() == pubkeylen);
-#else*/
-    CECKey key;
-    if (!key.Recover(hash, &vchSig[1], recid))
-        return false;
-    key.GetPubKey(pubkeyRec, IsCompressed());
-//#endif
     if (*this != pubkeyRec)
         return false;
     return true;
@@ -161,6 +161,12 @@ public:
     // Recover a public key from a compact signature.
     bool RecoverCompact(const uint256 &hash, const std::vector<unsigned char>& vchSig);
 
+    // The OpenSSL implementations of Verify and RecoverCompact. With
+    // USE_SECP256K1 the above use libsecp256k1; these are kept as the
+    // reference it is checked against (see -checksigbackends).
+    bool VerifyOpenSSL(const uint256 &hash, const std::vector<unsigned char>& vchSig) const;
+    bool RecoverCompactOpenSSL(const uint256 &hash, const std::vector<unsigned char>& vchSig);
+
     // Turn this public key into an uncompressed public key.
     bool Decompress();
 
@@ -323,4 +329,9 @@ struct CExtKey {
 /** Check that required EC support is available at runtime */
 bool ECC_InitSanityCheck(void);
 
+/** Run every signature check through both libsecp256k1 and OpenSSL, log any
+ *  disagreement and the verifications per second of each (-checksigbackends).
+ *  The OpenSSL result is the one returned. */
+extern bool fCheckSigBackends;
+
 #endif
@@ -0,0 +1,83 @@
+// Copyright (c) 2012-2013 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_LEVELDBBATCH_H
+#define BITCOIN_LEVELDBBATCH_H
+
+#include <string>
+#include <utility>
+
+#include <boost/unordered_map.hpp>
+
+#include <leveldb/slice.h>
+#include <leveldb/write_batch.h>
+
+/** A leveldb::WriteBatch together with a hash index of the writes it holds.
+ *  The databases read through their open batch so that a transaction sees
+ *  its own writes; the index turns that from a walk over every record in the
+ *  batch into a single lookup.
+ */
+class CLevelDBBatch
+{
+private:
+    leveldb::WriteBatch batch;
+
+    // key -> (erased, value), last write to a key wins
+    boost::unordered_map<std::string, std::pair<bool, std::string> > mapPending;
+
+    // bytes of keys and values written, including overwritten ones
+    size_t nSize;
+
+public:
+    CLevelDBBatch() : nSize(0) {}
+
+    void Put(const leveldb::Slice& key, const leveldb::Slice& value)
+    {
+        batch.Put(key, value);
+        std::pair<bool, std::string>& entry = mapPending[key.ToString()];
+        entry.first = false;
+        entry.second.assign(value.data(), value.size());
+        nSize += key.size() + value.size();
+    }
+
+    void Delete(const leveldb::Slice& key)
+    {
+        batch.Delete(key);
+        std::pair<bool, std::string>& entry = mapPending[key.ToString()];
+        entry.first = true;
+        entry.second.clear();
+        nSize += key.size();
+    }
+
+    // Add the final state of every key in other on top of this batch
+    void Append(const CLevelDBBatch& other)
+    {
+        boost::unordered_map<std::string, std::pair<bool, std::string> >::const_iterator it;
+        for (it = other.mapPending.begin(); it != other.mapPending.end(); ++it)
+        {
+            if (it->second.first)
+                Delete(it->first);
+            else
+                Put(it->first, it->second.second);
+        }
+    }
+
+    bool IsEmpty() const { return mapPending.empty(); }
+    size_t GetSize() const { return nSize; }
+
+    // Returns true if the batch writes or erases key; *deleted tells which
+    bool Lookup(const std::string& key, std::string* value, bool* deleted) const
+    {
+        boost::unordered_map<std::string, std::pair<bool, std::string> >::const_iterator it = mapPending.find(key);
+        if (it == mapPending.end())
+            return false;
+        *deleted = it->second.first;
+        if (!*deleted)
+            *value = it->second.second;
+        return true;
+    }
+
+    leveldb::WriteBatch* GetBatch() { return &batch; }
+};
+
+#endif // BITCOIN_LEVELDBBATCH_H
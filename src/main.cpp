@@ -10,10 +10,14 @@
 #include "alert.h"
 #include "chainparams.h"
 #include "checkpoints.h"
+#include "checkqueue.h"
 #include "db.h"
 #include "init.h"
 #include "kernel.h"
 #include "net.h"
+#include "sigcache.h"
+#include "sigverify.h"
+#include "txcache.h"
 #include "txdb.h"
 #include "txmempool.h"
 #include "ui_interface.h"
@@ -56,11 +60,25 @@ uint256 nBestInvalidTrust = 0;
 
 uint256 hashBestChain = 0;
 CBlockIndex* pindexBest = NULL;
+CChain chainActive;
+CHashCacheStats hashCacheStats = { 0, 0, 0, 0 };
+CHashCacheStats hashCacheStatsLastConnect = { 0, 0, 0, 0 };
+
+CHashCacheStats GetHashCacheStats()
+{
+    CHashCacheStats stats;
+    stats.nTxHashes = __sync_fetch_and_add(&hashCacheStats.nTxHashes, 0);
+    stats.nTxHits = __sync_fetch_and_add(&hashCacheStats.nTxHits, 0);
+    stats.nBlockHashes = __sync_fetch_and_add(&hashCacheStats.nBlockHashes, 0);
+    stats.nBlockHits = __sync_fetch_and_add(&hashCacheStats.nBlockHits, 0);
+    return stats;
+}
 int64_t nTimeBestReceived = 0;
 bool fImporting = false;
 bool fReindex = false;
 bool fAddrIndex = false;
 bool fHaveGUI = false;
+int nScriptCheckThreads = 0;
 
 struct COrphanBlock {
     uint256 hashBlock;
@@ -105,6 +123,8 @@ struct CMainSignals {
     boost::signals2::signal<void (const uint256 &)> Inventory;
     // Tells listeners to broadcast their data.
     boost::signals2::signal<void (bool)> Broadcast;
+    // Notifies listeners that a chain switch was aborted after blocks had been synced to them.
+    boost::signals2::signal<void ()> ChainSwitchAborted;
 } g_signals;
 }
 
@@ -115,9 +135,11 @@ void RegisterWallet(CWalletInterface* pwalletIn) {
     g_signals.SetBestChain.connect(boost::bind(&CWalletInterface::SetBestChain, pwalletIn, _1));
     g_signals.Inventory.connect(boost::bind(&CWalletInterface::Inventory, pwalletIn, _1));
     g_signals.Broadcast.connect(boost::bind(&CWalletInterface::ResendWalletTransactions, pwalletIn, _1));
+    g_signals.ChainSwitchAborted.connect(boost::bind(&CWalletInterface::RebuildStakeCoins, pwalletIn));
 }
 
 void UnregisterWallet(CWalletInterface* pwalletIn) {
+    g_signals.ChainSwitchAborted.disconnect(boost::bind(&CWalletInterface::RebuildStakeCoins, pwalletIn));
     g_signals.Broadcast.disconnect(boost::bind(&CWalletInterface::ResendWalletTransactions, pwalletIn, _1));
     g_signals.Inventory.disconnect(boost::bind(&CWalletInterface::Inventory, pwalletIn, _1));
     g_signals.SetBestChain.disconnect(boost::bind(&CWalletInterface::SetBestChain, pwalletIn, _1));
@@ -127,6 +149,7 @@ void UnregisterWallet(CWalletInterface* pwalletIn) {
 }
 
 void UnregisterAllWallets() {
+    g_signals.ChainSwitchAborted.disconnect_all_slots();
     g_signals.Broadcast.disconnect_all_slots();
     g_signals.Inventory.disconnect_all_slots();
     g_signals.SetBestChain.disconnect_all_slots();
@@ -430,7 +453,7 @@ bool AreInputsStandard(const CTransaction& tx, const MapPrevTx& mapInputs)
         // IsStandard() will have already returned false
         // and this method isn't called.
         vector<vector<unsigned char> > stack;
-        if (!EvalScript(stack, tx.vin[i].scriptSig, tx, i, SCRIPT_VERIFY_NONE, 0))
+        if (!EvalScript(stack, tx.vin[i].scriptSig, SCRIPT_VERIFY_NONE, BaseSignatureChecker()))
             return false;
 
         if (whichType == TX_SCRIPTHASH)
@@ -659,6 +682,7 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CTransaction &tx, bool fLimitFree,
     }
     }
 
+    CTxMemPoolEntry entry;
     {
         CTxDB txdb("r");
 
@@ -747,13 +771,29 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CTransaction &tx, bool fLimitFree,
         {
             return error("AcceptToMemoryPool: : BUG! PLEASE REPORT THIS! ConnectInputs failed against MANDATORY but not STANDARD flags %s", hash.ToString());
         }
+
+        // Priority is sum(valuein * age) / txsize, only inputs in the
+        // chain having an age
+        double dPriority = 0;
+        int64_t nValueInChain = 0;
+        BOOST_FOREACH(const CTxIn& txin, tx.vin)
+        {
+            if (pool.exists(txin.prevout.hash))
+                continue;
+            const CTxIndex& txindex = mapInputs[txin.prevout.hash].first;
+            int64_t nValueIn = mapInputs[txin.prevout.hash].second.vout[txin.prevout.n].nValue;
+            nValueInChain += nValueIn;
+            dPriority += (double)nValueIn * txindex.GetDepthInMainChain();
+        }
+        entry = CTxMemPoolEntry(nFees, nSize, nSigOps, dPriority / nSize, nValueInChain, nBestHeight);
     }
 
     // Store transaction in memory
-    pool.addUnchecked(hash, tx);
+    pool.addUnchecked(hash, tx, entry);
     setValidatedTx.insert(hash);
 
     SyncWithWallets(tx, NULL);
+    WakeStakeMiner();
 
     LogPrint("mempool", "AcceptToMemoryPool : accepted %s (poolsz %u)\n",
            hash.ToString(),
@@ -1037,22 +1077,26 @@ bool GetTransaction(const uint256 &hash, CTransaction &tx, uint256 &hashBlock)
 // CBlock and CBlockIndex
 //
 
-static CBlockIndex* pblockindexFBBHLast;
+void CChain::SetTip(CBlockIndex* pindex)
+{
+    LOCK(cs);
+    if (pindex == NULL)
+    {
+        vChain.clear();
+        return;
+    }
+    vChain.resize(pindex->nHeight + 1);
+    // walk back only as far as the fork with the previous best chain
+    while (pindex && vChain[pindex->nHeight] != pindex)
+    {
+        vChain[pindex->nHeight] = pindex;
+        pindex = pindex->pprev;
+    }
+}
+
 CBlockIndex* FindBlockByHeight(int nHeight)
 {
-    CBlockIndex *pblockindex;
-    if (nHeight < nBestHeight / 2)
-        pblockindex = pindexGenesisBlock;
-    else
-        pblockindex = pindexBest;
-    if (pblockindexFBBHLast && abs(nHeight - pblockindex->nHeight) > abs(nHeight - pblockindexFBBHLast->nHeight))
-        pblockindex = pblockindexFBBHLast;
-    while (pblockindex->nHeight > nHeight)
-        pblockindex = pblockindex->pprev;
-    while (pblockindex->nHeight < nHeight)
-        pblockindex = pblockindex->pnext;
-    pblockindexFBBHLast = pblockindex;
-    return pblockindex;
+    return chainActive[nHeight];
 }
 
 bool CBlock::ReadFromDisk(const CBlockIndex* pindex, bool fReadTransactions)
@@ -1400,8 +1444,8 @@ bool CTransaction::FetchInputs(CTxDB& txdb, const map<uint256, CTxIndex>& mapTes
         }
         else
         {
-            // Get prev tx from disk
-            if (!txPrev.ReadFromDisk(txindex.pos))
+            // Get prev tx from the cache of recently connected transactions, or from disk
+            if (!txcache.Get(prevout.hash, txPrev) && !txPrev.ReadFromDisk(txindex.pos))
                 return error("FetchInputs() : %s ReadFromDisk prev tx %s failed", GetHash().ToString(),  prevout.hash.ToString());
         }
     }
@@ -1452,8 +1496,29 @@ int64_t CTransaction::GetValueIn(const MapPrevTx& inputs) const
 
 }
 
+bool CScriptCheck::operator()() const
+{
+    const CScript &scriptSig = ptxTo->vin[nIn].scriptSig;
+    if (pcollector)
+    {
+        DeferringSignatureChecker checker(*ptxTo, nIn, psighashes.get());
+        if (VerifySingleSigScript(scriptSig, scriptPubKey, nFlags, checker))
+        {
+            pcollector->Add(checker.vDeferred);
+            return true;
+        }
+    }
+
+    // May run on a script check thread: only report the failure, the
+    // caller decides whether it counts against the peer
+    bool fStore = !(nFlags & SCRIPT_VERIFY_NOCACHE);
+    if (!VerifyScript(scriptSig, scriptPubKey, nFlags, CachingSignatureChecker(*ptxTo, nIn, fStore, psighashes.get())))
+        return error("CScriptCheck() : %s VerifySignature failed", ptxTo->GetHash().ToString());
+    return true;
+}
+
 bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs, map<uint256, CTxIndex>& mapTestPool, const CDiskTxPos& posThisTx,
-    const CBlockIndex* pindexBlock, bool fBlock, bool fMiner, unsigned int flags, bool fValidateSig)
+    const CBlockIndex* pindexBlock, bool fBlock, bool fMiner, unsigned int flags, bool fValidateSig, std::vector<CScriptCheck> *pvChecks)
 {
     // Take over previous transactions' spent pointers
     // fBlock is true when this is called from AcceptBlock when a new best-block is added to the blockchain
@@ -1492,6 +1557,7 @@ bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs, map<uint256, CTx
         // The first loop above does all the inexpensive checks.
         // Only if ALL inputs pass do we perform expensive ECDSA signature checks.
         // Helps prevent CPU exhaustion attacks.
+        boost::shared_ptr<const CSignatureHashCache> psighashes;
         for (unsigned int i = 0; i < vin.size(); i++)
         {
             COutPoint prevout = vin[i].prevout;
@@ -1513,7 +1579,13 @@ bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs, map<uint256, CTx
             if (!(fBlock && (nBestHeight < Checkpoints::GetTotalBlocksEstimate())))
             {
                 // Verify signature
-                if (!VerifySignature(txPrev, *this, i, flags, 0))
+                if (!psighashes)
+                    psighashes.reset(new CSignatureHashCache(*this));
+                CScriptCheck check(txPrev, *this, i, flags, psighashes);
+                if (pvChecks) {
+                    pvChecks->push_back(CScriptCheck());
+                    check.swap(pvChecks->back());
+                } else if (!check())
                 {
                     if (flags & STANDARD_NOT_MANDATORY_VERIFY_FLAGS) {
                         // Check whether the failure was caused by a
@@ -1522,7 +1594,8 @@ bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs, map<uint256, CTx
                         // if so, don't trigger DoS protection to
                         // avoid splitting the network between upgraded and
                         // non-upgraded nodes.
-                        if (VerifySignature(txPrev, *this, i, flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, 0))
+                        CScriptCheck checkMandatory(txPrev, *this, i, flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, psighashes);
+                        if (checkMandatory())
                             return error("ConnectInputs() : %s non-mandatory VerifySignature failed", GetHash().ToString());
                     }
                     // Failures of other flags indicate a transaction that is
@@ -1532,7 +1605,7 @@ bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs, map<uint256, CTx
                     // as to the correct behavior - we may want to continue
                     // peering with non-upgraded nodes even after a soft-fork
                     // super-majority vote has passed.
-                    return DoS(100,error("ConnectInputs() : %s VerifySignature failed", GetHash().ToString()));
+                    return DoS(100, error("ConnectInputs() : %s VerifySignature failed", GetHash().ToString()));
                 }
             }
 	   }
@@ -1629,7 +1702,7 @@ bool static BuildAddrIndex(const CScript &script, std::vector<uint160>& addrIds)
     }
 }
 
-bool FindTransactionsByDestination(const CTxDestination &dest, std::vector<uint256> &vtxhash) {
+bool FindTransactionsByDestination(const CTxDestination &dest, std::vector<uint256> &vtxhash, int nSkip, int nCount) {
     uint160 addrid = 0;
     const CKeyID *pkeyid = boost::get<CKeyID>(&dest);
     if (pkeyid)
@@ -1647,7 +1720,7 @@ bool FindTransactionsByDestination(const CTxDestination &dest, std::vector<uint2
 
     LOCK(cs_main);
     CTxDB txdb("r");
-    if(!txdb.ReadAddrIndex(addrid, vtxhash))
+    if(!txdb.ReadAddrIndex(addrid, vtxhash, nSkip, nCount))
     {
 	LogPrintf("FindTransactionsByDestination(): txdb.ReadAddrIndex failed\n");
 	return false;
@@ -1655,61 +1728,78 @@ bool FindTransactionsByDestination(const CTxDestination &dest, std::vector<uint2
     return true;
 }
 
-void CBlock::RebuildAddressIndex(CTxDB& txdb)
+// Add a transaction to the address index under every address it pays to and
+// every address whose output it spends (vSpent holds the spent scriptPubKeys)
+static void IndexTransactionAddresses(CTxDB& txdb, const CTransaction& tx, const vector<CScript>& vSpent, int nHeight, unsigned int nTxIndex)
 {
-    BOOST_FOREACH(CTransaction& tx, vtx)
+    uint256 hashTx = tx.GetHash();
+    std::vector<uint160> addrIds;
+    BOOST_FOREACH(const CScript& script, vSpent)
+        BuildAddrIndex(script, addrIds);
+    BOOST_FOREACH(const CTxOut& txout, tx.vout)
+        BuildAddrIndex(txout.scriptPubKey, addrIds);
+
+    // change and stake outputs usually pay back to an input's address
+    sort(addrIds.begin(), addrIds.end());
+    addrIds.erase(unique(addrIds.begin(), addrIds.end()), addrIds.end());
+    BOOST_FOREACH(const uint160& addrId, addrIds)
     {
-        uint256 hashTx = tx.GetHash();
-	// inputs
-	if(!tx.IsCoinBase()) 
-	{
+        if (!txdb.WriteAddrIndex(addrId, nHeight, nTxIndex, hashTx))
+            LogPrintf("IndexTransactionAddresses() : WriteAddrIndex failed addrId: %s txhash: %s\n", addrId.ToString(), hashTx.ToString());
+    }
+}
+
+void CBlock::RebuildAddressIndex(CTxDB& txdb, int nHeight)
+{
+    for (unsigned int nTxIndex = 0; nTxIndex < vtx.size(); nTxIndex++)
+    {
+        CTransaction& tx = vtx[nTxIndex];
+        vector<CScript> vSpent;
+        if (!tx.IsCoinBase())
+        {
             MapPrevTx mapInputs;
-	    map<uint256, CTxIndex> mapQueuedChangesT;
-	    bool fInvalid;
+            map<uint256, CTxIndex> mapQueuedChangesT;
+            bool fInvalid;
             if (!tx.FetchInputs(txdb, mapQueuedChangesT, true, false, mapInputs, fInvalid))
                 return;
-
-	    MapPrevTx::const_iterator mi;
-	    for(MapPrevTx::const_iterator mi = mapInputs.begin(); mi != mapInputs.end(); ++mi)
-	    {
-		    BOOST_FOREACH(const CTxOut &atxout, (*mi).second.second.vout)
-		    {
-			std::vector<uint160> addrIds;
-			if(BuildAddrIndex(atxout.scriptPubKey, addrIds))
-			{
-                            BOOST_FOREACH(uint160 addrId, addrIds)
-		            {
-			        if(!txdb.WriteAddrIndex(addrId, hashTx))
-				    LogPrintf("RebuildAddressIndex(): txins WriteAddrIndex failed addrId: %s txhash: %s\n", addrId.ToString().c_str(), hashTx.ToString().c_str());
-                            }
-			}
-		    }
-	    }
- 	    
+            BOOST_FOREACH(const CTxIn& txin, tx.vin)
+                vSpent.push_back(tx.GetOutputFor(txin, mapInputs).scriptPubKey);
         }
-	// outputs
-	BOOST_FOREACH(const CTxOut &atxout, tx.vout) {
-	    std::vector<uint160> addrIds;
-            if(BuildAddrIndex(atxout.scriptPubKey, addrIds))
-	    {
-		BOOST_FOREACH(uint160 addrId, addrIds)
-		{
-		    if(!txdb.WriteAddrIndex(addrId, hashTx))
-		        LogPrintf("RebuildAddressIndex(): txouts WriteAddrIndex failed addrId: %s txhash: %s\n", addrId.ToString().c_str(), hashTx.ToString().c_str());
-                }
-	    }
-	}
+        IndexTransactionAddresses(txdb, tx, vSpent, nHeight, nTxIndex);
     }
 }
 
 
+static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
+
+void ThreadScriptCheck() {
+    RenameThread("sling-scriptch");
+    scriptcheckqueue.Thread();
+}
+
 bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck)
 {
+    CHashCacheStats hashStatsStart = GetHashCacheStats();
+
     // Check it again in case a previous version let a bad block in, but skip BlockSig checking
     if (!CheckBlock(!fJustCheck, !fJustCheck, false))
         return false;
 
-    unsigned int flags = SCRIPT_VERIFY_NOCACHE;
+    // Single signature spends only have their signatures collected by the
+    // script checks; they are verified together at the end. Declared before
+    // control so that on an early return the checks still running are
+    // waited for before it goes away.
+    CSigVerifyCollector sigcollector;
+
+    CCheckQueueControl<CScriptCheck> control(nScriptCheckThreads ? &scriptcheckqueue : NULL);
+
+    // Outputs created here are likely to be spent again soon, often within
+    // this very block, so keep the bodies around instead of rereading them
+    if (!fJustCheck)
+        BOOST_FOREACH(const CTransaction& tx, vtx)
+            txcache.Add(tx);
+
+    unsigned int flags = MANDATORY_SCRIPT_VERIFY_FLAGS | SCRIPT_VERIFY_NOCACHE;
 
     //// issue here: it doesn't know the version
     unsigned int nTxPos;
@@ -1727,9 +1817,15 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck)
     int64_t nStakeReward = 0;
     unsigned int nSigOps = 0;    
     int nInputs = 0;
-    
-    BOOST_FOREACH(CTransaction& tx, vtx)
+
+    int64_t nStart = GetTimeMicros();
+    int64_t nTimeFetch = 0;
+    vector<CScriptCheck> vChecks;
+    // scriptPubKeys spent by each transaction, kept for the address index
+    vector<vector<CScript> > vSpentScripts(vtx.size());
+    for (unsigned int nTxIndex = 0; nTxIndex < vtx.size(); nTxIndex++)
     {
+        CTransaction& tx = vtx[nTxIndex];
         uint256 hashTx = tx.GetHash();
 	nInputs += tx.vin.size();
 
@@ -1766,8 +1862,17 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck)
         else
         {
             bool fInvalid;
+            int64_t nFetchStart = GetTimeMicros();
             if (!tx.FetchInputs(txdb, mapQueuedChanges, true, false, mapInputs, fInvalid))
                 return false;
+            nTimeFetch += GetTimeMicros() - nFetchStart;
+
+            if (!fJustCheck)
+            {
+                vSpentScripts[nTxIndex].reserve(tx.vin.size());
+                BOOST_FOREACH(const CTxIn& txin, tx.vin)
+                    vSpentScripts[nTxIndex].push_back(tx.GetOutputFor(txin, mapInputs).scriptPubKey);
+            }
 
             // Add in sigops done by pay-to-script-hash inputs;
             // this is to prevent a "rogue miner" from creating
@@ -1785,14 +1890,41 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck)
             if (tx.IsCoinStake())
                 nStakeReward = nTxValueOut - nTxValueIn;
 
-	    
-            if (!tx.ConnectInputs(txdb, mapInputs, mapQueuedChanges, posThisTx, pindex, true, false, flags))
+            if (!tx.ConnectInputs(txdb, mapInputs, mapQueuedChanges, posThisTx, pindex, true, false, flags, true, &vChecks))
                 return false;
+            BOOST_FOREACH(CScriptCheck& check, vChecks)
+                check.DeferSignatures(&sigcollector);
+            if (nScriptCheckThreads)
+                control.Add(vChecks);
+            else
+            {
+                BOOST_FOREACH(const CScriptCheck& check, vChecks)
+                    if (!check())
+                        return DoS(100, error("ConnectBlock() : script verification failed"));
+            }
+            // Add() leaves emptied checks behind
+            vChecks.clear();
         }
 
         mapQueuedChanges[hashTx] = CTxIndex(posThisTx, tx.vout.size());
     }
-    
+    int64_t nTime = GetTimeMicros() - nStart;
+    LogPrint("bench", "- Connect %u transactions: %.2fms (%.3fms/tx, %.3fms/txin)\n", (unsigned)vtx.size(), 0.001 * nTime, 0.001 * nTime / vtx.size(), nInputs <= 1 ? 0 : 0.001 * nTime / (nInputs-1));
+
+    // Blocks are only checked against the mandatory flags, so whichever way
+    // a script was checked, its failure makes the block invalid
+    if (!control.Wait())
+        return DoS(100, error("ConnectBlock() : script verification failed"));
+    vector<CSigVerifyItem> vSigs;
+    sigcollector.Take(vSigs);
+    unsigned int nSigs = vSigs.size();
+    if (nSigs > 0 && !sigverifier.Await(sigverifier.Submit(vSigs)))
+        return DoS(100, error("ConnectBlock() : signature verification failed"));
+    LogPrint("bench", "- Batch verified %u signatures\n", nSigs);
+    int64_t nTime2 = GetTimeMicros() - nStart;
+    LogPrint("bench", "- Verify %u txins: %.2fms (%.3fms/txin)\n", nInputs - 1, 0.001 * nTime2, nInputs <= 1 ? 0 : 0.001 * nTime2 / (nInputs-1));
+    int64_t nTimeVerify = nTime2 - nTimeFetch;
+
     if (IsProofOfWork())
     {
         int64_t nReward = GetProofOfWorkReward(nFees);
@@ -1825,59 +1957,13 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck)
         return true;
 
     // Write queued txindex changes
+    int64_t nWriteStart = GetTimeMicros();
     for (map<uint256, CTxIndex>::iterator mi = mapQueuedChanges.begin(); mi != mapQueuedChanges.end(); ++mi)
     {
         if (!txdb.UpdateTxIndex((*mi).first, (*mi).second))
             return error("ConnectBlock() : UpdateTxIndex failed");
     }
 
-
-    // Write Address Index
-    BOOST_FOREACH(CTransaction& tx, vtx)
-    {
-        uint256 hashTx = tx.GetHash();
-	// inputs
-	if(!tx.IsCoinBase()) 
-	{
-            MapPrevTx mapInputs;
-	    map<uint256, CTxIndex> mapQueuedChangesT;
-	    bool fInvalid;
-            if (!tx.FetchInputs(txdb, mapQueuedChangesT, true, false, mapInputs, fInvalid))
-                return false;
-
-	    MapPrevTx::const_iterator mi;
-	    for(MapPrevTx::const_iterator mi = mapInputs.begin(); mi != mapInputs.end(); ++mi)
-	    {
-		    BOOST_FOREACH(const CTxOut &atxout, (*mi).second.second.vout)
-		    {
-			std::vector<uint160> addrIds;
-			if(BuildAddrIndex(atxout.scriptPubKey, addrIds))
-			{
-                            BOOST_FOREACH(uint160 addrId, addrIds)
-		            {
-			        if(!txdb.WriteAddrIndex(addrId, hashTx))
-				    LogPrintf("ConnectBlock(): txins WriteAddrIndex failed addrId: %s txhash: %s\n", addrId.ToString().c_str(), hashTx.ToString().c_str());
-                            }
-			}
-		    }
-	    }
- 	    
-        }
-
-	// outputs
-	BOOST_FOREACH(const CTxOut &atxout, tx.vout) {
-	    std::vector<uint160> addrIds;
-            if(BuildAddrIndex(atxout.scriptPubKey, addrIds))
-	    {
-		BOOST_FOREACH(uint160 addrId, addrIds)
-		{
-		    if(!txdb.WriteAddrIndex(addrId, hashTx))
-		        LogPrintf("ConnectBlock(): txouts WriteAddrIndex failed addrId: %s txhash: %s\n", addrId.ToString().c_str(), hashTx.ToString().c_str());
-                }
-	    }
-	}
-    }
-
     // Update block index on disk without changing it in memory.
     // The memory index structure will be changed after the db commits.
     if (pindex->pprev)
@@ -1887,6 +1973,24 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck)
         if (!txdb.WriteBlockIndex(blockindexPrev))
             return error("ConnectBlock() : WriteBlockIndex failed");
     }
+    int64_t nTimeWrite = GetTimeMicros() - nWriteStart;
+
+    // Write Address Index, reusing the inputs fetched during validation
+    int64_t nIndexStart = GetTimeMicros();
+    for (unsigned int nTxIndex = 0; nTxIndex < vtx.size(); nTxIndex++)
+        IndexTransactionAddresses(txdb, vtx[nTxIndex], vSpentScripts[nTxIndex], pindex->nHeight, nTxIndex);
+    int64_t nTimeIndex = GetTimeMicros() - nIndexStart;
+
+    LogPrint("bench", "- ConnectBlock %d: fetch %.2fms, verify %.2fms, index %.2fms, write %.2fms\n",
+        pindex->nHeight, 0.001 * nTimeFetch, 0.001 * nTimeVerify, 0.001 * nTimeIndex, 0.001 * nTimeWrite);
+
+    CHashCacheStats hashStatsEnd = GetHashCacheStats();
+    hashCacheStatsLastConnect.nTxHashes = hashStatsEnd.nTxHashes - hashStatsStart.nTxHashes;
+    hashCacheStatsLastConnect.nTxHits = hashStatsEnd.nTxHits - hashStatsStart.nTxHits;
+    hashCacheStatsLastConnect.nBlockHashes = hashStatsEnd.nBlockHashes - hashStatsStart.nBlockHashes;
+    hashCacheStatsLastConnect.nBlockHits = hashStatsEnd.nBlockHits - hashStatsStart.nBlockHits;
+    LogPrint("bench", "- ConnectBlock %d: %u txs, %u tx hashes computed, %u answered from cache\n",
+        pindex->nHeight, vtx.size(), hashCacheStatsLastConnect.nTxHashes, hashCacheStatsLastConnect.nTxHits);
 
     // Watch for transactions paying to me
     BOOST_FOREACH(CTransaction& tx, vtx)
@@ -2005,11 +2109,16 @@ bool CBlock::SetBestChainInner(CTxDB& txdb, CBlockIndex *pindexNew)
     if (!ConnectBlock(txdb, pindexNew) || !txdb.WriteHashBestChain(hash))
     {
         txdb.TxnAbort();
+        // The wallets have already seen the block's transactions
+        g_signals.ChainSwitchAborted();
         InvalidChainFound(pindexNew);
         return false;
     }
     if (!txdb.TxnCommit())
+    {
+        g_signals.ChainSwitchAborted();
         return error("SetBestChain() : TxnCommit failed");
+    }
 
     // Add to current best branch
     pindexNew->pprev->pnext = pindexNew;
@@ -2063,6 +2172,8 @@ bool CBlock::SetBestChain(CTxDB& txdb, CBlockIndex* pindexNew)
         if (!Reorganize(txdb, pindexIntermediate))
         {
             txdb.TxnAbort();
+            // The wallets have already seen the blocks disconnected and connected
+            g_signals.ChainSwitchAborted();
             InvalidChainFound(pindexNew);
             return error("SetBestChain() : Reorganize failed");
         }
@@ -2097,11 +2208,12 @@ bool CBlock::SetBestChain(CTxDB& txdb, CBlockIndex* pindexNew)
     // New best block
     hashBestChain = hash;
     pindexBest = pindexNew;
-    pblockindexFBBHLast = NULL;
+    chainActive.SetTip(pindexNew);
     nBestHeight = pindexBest->nHeight;
     nBestChainTrust = pindexNew->nChainTrust;
     nTimeBestReceived = GetTime();
     mempool.AddTransactionsUpdated(1);
+    WakeStakeMiner();
 
     uint256 nBestBlockTrust = pindexBest->nHeight != 0 ? (pindexBest->nChainTrust - pindexBest->pprev->nChainTrust) : pindexBest->nChainTrust;
 
@@ -2412,7 +2524,7 @@ bool CBlock::CheckBlock(bool fCheckPOW, bool fCheckMerkleRoot, bool fCheckSig) c
         return DoS(100, error("CheckBlock() : out-of-bounds SigOpCount"));
 
     // Check merkle root
-    if (fCheckMerkleRoot && hashMerkleRoot != BuildMerkleTree())
+    if (fCheckMerkleRoot && hashMerkleRoot != BuildMerkleTree(nScriptCheckThreads))
         return DoS(100, error("CheckBlock() : hashMerkleRoot mismatch"));
 
 
@@ -2706,7 +2818,7 @@ bool ProcessBlock(CNode* pfrom, CBlock* pblock)
 
 #ifdef ENABLE_WALLET
 // novacoin: attempt to generate suitable proof-of-stake
-bool CBlock::SignBlock(CWallet& wallet, int64_t nFees)
+bool CBlock::SignBlock(CWallet& wallet, int64_t nFees, int64_t& nLastSearchTime)
 {
     // if we are trying to sign
     //    something except proof-of-stake block template
@@ -2718,8 +2830,6 @@ bool CBlock::SignBlock(CWallet& wallet, int64_t nFees)
     if (IsProofOfStake())
         return true;
 
-    static int64_t nLastCoinStakeSearchTime = GetAdjustedTime(); // startup timestamp
-
     CKey key;
     CTransaction txCoinStake;
     if (IsProtocolV2(nBestHeight+1))
@@ -2727,9 +2837,9 @@ bool CBlock::SignBlock(CWallet& wallet, int64_t nFees)
 
     int64_t nSearchTime = txCoinStake.nTime; // search to current time
 
-    if (nSearchTime > nLastCoinStakeSearchTime)
+    if (nSearchTime > nLastSearchTime)
     {
-        int64_t nSearchInterval = IsProtocolV2(nBestHeight+1) ? 1 : nSearchTime - nLastCoinStakeSearchTime;
+        int64_t nSearchInterval = IsProtocolV2(nBestHeight+1) ? 1 : nSearchTime - nLastSearchTime;
         if (wallet.CreateCoinStake(wallet, nBits, nSearchInterval, nFees, txCoinStake, key))
         {
             if (txCoinStake.nTime >= pindexBest->GetPastTimeLimit()+1)
@@ -2737,6 +2847,7 @@ bool CBlock::SignBlock(CWallet& wallet, int64_t nFees)
                 // make sure coinstake would meet timestamp protocol
                 //    as it would be the same as the block timestamp
                 vtx[0].nTime = nTime = txCoinStake.nTime;
+                vtx[0].InvalidateHash();
 
                 // we have to make sure that we have no future timestamps in
                 //    our transactions set
@@ -2750,8 +2861,8 @@ bool CBlock::SignBlock(CWallet& wallet, int64_t nFees)
                 return key.Sign(GetHash(), vchBlockSig);
             }
         }
-        nLastCoinStakeSearchInterval = nSearchTime - nLastCoinStakeSearchTime;
-        nLastCoinStakeSearchTime = nSearchTime;
+        nLastCoinStakeSearchInterval = nSearchTime - nLastSearchTime;
+        nLastSearchTime = nSearchTime;
     }
 
     return false;
@@ -3038,6 +3149,10 @@ bool LoadExternalBlockFile(FILE* fileIn)
         }
     }
     LogPrintf("Loaded %i blocks from external file in %dms\n", nLoaded, GetTimeMillis() - nStart);
+    uint64_t nCacheHits, nCacheMisses;
+    size_t nCacheSize;
+    txcache.GetStats(nCacheHits, nCacheMisses, nCacheSize);
+    LogPrint("bench", "- Transaction cache: %u hits, %u misses, %u bytes\n", nCacheHits, nCacheMisses, nCacheSize);
     return nLoaded > 0;
 }
 
@@ -9,12 +9,15 @@
 #include "bignum.h"
 #include "sync.h"
 #include "txmempool.h"
+#include "merkle.h"
 #include "net.h"
 #include "script.h"
 #include "scrypt.h"
 
 #include <list>
 
+#include <boost/shared_ptr.hpp>
+
 class CValidationState;
 
 #define START_MASTERNODE_PAYMENTS_TESTNET 1429456427 
@@ -85,6 +88,10 @@ static const int64_t MAX_MONEY = 4000000000 * COIN; // 1M PoW coins
 inline bool MoneyRange(int64_t nValue) { return (nValue >= 0 && nValue <= MAX_MONEY); }
 /** Threshold for nLockTime: below this value it is interpreted as block number, otherwise as UNIX timestamp. */
 static const unsigned int LOCKTIME_THRESHOLD = 500000000; // Tue Nov  5 00:53:20 1985 UTC
+/** Maximum number of script-checking threads allowed */
+static const int MAX_SCRIPTCHECK_THREADS = 16;
+/** -par default (number of script-checking threads, 0 = auto) */
+static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
 
 inline bool IsProtocolV1RetargetingFixed(int nHeight) { return TestNet() || nHeight > 0; }
 inline bool IsProtocolV2(int nHeight) { return TestNet() || nHeight > 0; }
@@ -119,6 +126,7 @@ extern bool fReindex;
 struct COrphanBlock;
 extern std::map<uint256, COrphanBlock*> mapOrphanBlocks;
 extern bool fHaveGUI;
+extern int nScriptCheckThreads;
 
 // Settings
 extern bool fUseFastIndex;
@@ -133,6 +141,8 @@ class CReserveKey;
 class CTxDB;
 class CTxIndex;
 class CWalletInterface;
+class CScriptCheck;
+class CSigVerifyCollector;
 
 /** Register a wallet to receive updates from core */
 void RegisterWallet(CWalletInterface* pwalletIn);
@@ -162,6 +172,8 @@ CBlockIndex* FindBlockByHeight(int nHeight);
 bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto, bool fSendTrickle);
 void ThreadImport(std::vector<boost::filesystem::path> vImportFiles);
+/** Run an instance of the script checking thread */
+void ThreadScriptCheck();
 
 bool CheckProofOfWork(uint256 hash, unsigned int nBits);
 unsigned int GetNextTargetRequired(const CBlockIndex* pindexLast, bool fProofOfStake);
@@ -175,6 +187,7 @@ bool GetTransaction(const uint256 &hash, CTransaction &tx, uint256 &hashBlock);
 uint256 WantedByOrphan(const COrphanBlock* pblockOrphan);
 const CBlockIndex* GetLastBlockIndex(const CBlockIndex* pindex, bool fProofOfStake);
 void ThreadStakeMiner(CWallet *pwallet);
+void WakeStakeMiner();
 
 
 /** (try to) add transaction to memory pool **/
@@ -185,7 +198,7 @@ bool AcceptableInputs(CTxMemPool& pool, const CTransaction &txo, bool fLimitFree
                         bool* pfMissingInputs);
 
 
-bool FindTransactionsByDestination(const CTxDestination &dest, std::vector<uint256> &vtxhash);
+bool FindTransactionsByDestination(const CTxDestination &dest, std::vector<uint256> &vtxhash, int nSkip = 0, int nCount = -1);
 
 int GetInputAge(CTxIn& vin);
 /** Abort with a message */
@@ -258,6 +271,31 @@ int64_t GetMinFee(const CTransaction& tx, unsigned int nBlockSize = 1, enum GetM
 
 
 
+/** How often CTransaction::GetHash() and CBlock::GetHash() had to hash and how
+ * often they were answered from the memoized value. The totals are counted
+ * with atomic increments from any thread; read them with GetHashCacheStats().
+ */
+struct CHashCacheStats
+{
+    uint64_t nTxHashes;
+    uint64_t nTxHits;
+    uint64_t nBlockHashes;
+    uint64_t nBlockHits;
+};
+extern CHashCacheStats hashCacheStats;
+extern CHashCacheStats hashCacheStatsLastConnect; // counted during the last ConnectBlock, under cs_main
+CHashCacheStats GetHashCacheStats();
+
+/** States of a memoized hash. Only the thread that moves it from NONE to
+ *  STORING writes the hash, and it is read only once STORED is seen, so
+ *  threads sharing an object never see a hash half written. */
+enum
+{
+    HASH_CACHE_NONE = 0,
+    HASH_CACHE_STORING = 1,
+    HASH_CACHE_STORED = 2
+};
+
 /** The basic transaction that is broadcasted on the network and contained in
  * blocks.  A transaction can contain multiple inputs and outputs.
  */
@@ -275,6 +313,12 @@ public:
     mutable int nDoS;
     bool DoS(int nDoSIn, bool fIn) const { nDoS += nDoSIn; return fIn; }
 
+protected:
+    // memory only: GetHash() result, see InvalidateHash()
+    mutable uint256 hashCached;
+    mutable volatile int nHashCacheState;
+
+public:
     CTransaction()
     {
         SetNull();
@@ -283,6 +327,8 @@ public:
 
     IMPLEMENT_SERIALIZE
     (
+        if (fRead)
+            nHashCacheState = HASH_CACHE_NONE;
         READWRITE(this->nVersion);
         nVersion = this->nVersion;
         READWRITE(nTime);
@@ -299,6 +345,7 @@ public:
         vout.clear();
         nLockTime = 0;
         nDoS = 0;  // Denial-of-service prevention
+        nHashCacheState = HASH_CACHE_NONE;
     }
 
     bool IsNull() const
@@ -306,9 +353,31 @@ public:
         return (vin.empty() && vout.empty());
     }
 
+    // The hash is computed once and kept until the transaction is reset or
+    // read again. Code that edits the fields of a transaction that may
+    // already have been hashed must call InvalidateHash() afterwards.
     uint256 GetHash() const
     {
-        return SerializeHash(*this);
+        if (nHashCacheState == HASH_CACHE_STORED)
+        {
+            __sync_synchronize();
+            __sync_fetch_and_add(&hashCacheStats.nTxHits, 1);
+            return hashCached;
+        }
+        __sync_fetch_and_add(&hashCacheStats.nTxHashes, 1);
+        uint256 hash = SerializeHash(*this);
+        if (__sync_bool_compare_and_swap(&nHashCacheState, HASH_CACHE_NONE, HASH_CACHE_STORING))
+        {
+            hashCached = hash;
+            __sync_synchronize();
+            nHashCacheState = HASH_CACHE_STORED;
+        }
+        return hash;
+    }
+
+    void InvalidateHash() const
+    {
+        nHashCacheState = HASH_CACHE_NONE;
     }
 
     bool IsCoinBase() const
@@ -434,11 +503,13 @@ public:
         @param[in] pindexBlock
         @param[in] fBlock	true if called from ConnectBlock
         @param[in] fMiner	true if called from CreateNewBlock
+        @param[out] pvChecks	if not NULL, script checks are pushed onto it instead of being performed inline
         @return Returns true if all checks succeed
      */
     bool ConnectInputs(CTxDB& txdb, MapPrevTx inputs,
                        std::map<uint256, CTxIndex>& mapTestPool, const CDiskTxPos& posThisTx,
-                       const CBlockIndex* pindexBlock, bool fBlock, bool fMiner, unsigned int flags = STANDARD_SCRIPT_VERIFY_FLAGS, bool fValidateSig = true);
+                       const CBlockIndex* pindexBlock, bool fBlock, bool fMiner, unsigned int flags = STANDARD_SCRIPT_VERIFY_FLAGS, bool fValidateSig = true,
+                       std::vector<CScriptCheck> *pvChecks = NULL);
     bool CheckTransaction() const;
     bool GetCoinAge(CTxDB& txdb, uint64_t& nCoinAge) const;  // ppcoin: get transaction coin age
 
@@ -448,6 +519,44 @@ public:
 
 
 
+/** Closure representing one script verification
+ *  Note that this stores references to the spending transaction */
+class CScriptCheck
+{
+private:
+    CScript scriptPubKey;
+    const CTransaction *ptxTo;
+    unsigned int nIn;
+    unsigned int nFlags;
+    boost::shared_ptr<const CSignatureHashCache> psighashes; // shared by the checks of one transaction
+    CSigVerifyCollector *pcollector;
+
+public:
+    CScriptCheck() : ptxTo(0), nIn(0), nFlags(0), pcollector(NULL) {}
+    CScriptCheck(const CTransaction& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn,
+                 const boost::shared_ptr<const CSignatureHashCache>& psighashesIn = boost::shared_ptr<const CSignatureHashCache>()) :
+        scriptPubKey(txFromIn.vout[txToIn.vin[nInIn].prevout.n].scriptPubKey),
+        ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), psighashes(psighashesIn), pcollector(NULL) { }
+
+    bool operator()() const;
+
+    // Leave the signature of a single signature spend to pcollectorIn
+    // instead of verifying it
+    void DeferSignatures(CSigVerifyCollector *pcollectorIn) { pcollector = pcollectorIn; }
+
+    void swap(CScriptCheck &check) {
+        scriptPubKey.swap(check.scriptPubKey);
+        std::swap(ptxTo, check.ptxTo);
+        std::swap(nIn, check.nIn);
+        std::swap(nFlags, check.nFlags);
+        psighashes.swap(check.psighashes);
+        std::swap(pcollector, check.pcollector);
+    }
+};
+
+
+
+
 /** wrapper for CTxOut that provides a more compact serialization */
 class CTxOutCompressor
 {
@@ -646,6 +755,15 @@ public:
     mutable int nDoS;
     bool DoS(int nDoSIn, bool fIn) const { nDoS += nDoSIn; return fIn; }
 
+private:
+    // memory only: the header the cached hash was computed from. The miner
+    // changes header fields in place, so the cache is checked against the
+    // current header instead of relying on callers to invalidate it.
+    mutable unsigned char pchHeaderCached[80];
+    mutable uint256 hashHeaderCached;
+    mutable volatile int nHeaderCacheState;
+
+public:
     CBlock()
     {
         SetNull();
@@ -686,6 +804,7 @@ public:
         vchBlockSig.clear();
         vMerkleTree.clear();
         nDoS = 0;
+        nHeaderCacheState = HASH_CACHE_NONE;
     }
 
     bool IsNull() const
@@ -696,7 +815,7 @@ public:
     uint256 GetHash() const
     {
         if (nVersion > 6)
-            return Hash(BEGIN(nVersion), END(nNonce));
+            return GetHeaderHash();
         else
             return GetPoWHash();
     }
@@ -704,7 +823,34 @@ public:
     uint256 GetPoWHash() const
     {
         //return scrypt_blockhash(CVOIDBEGIN(nVersion));
-	return Hash(BEGIN(nVersion), END(nNonce));
+	return GetHeaderHash();
+    }
+
+    uint256 GetHeaderHash() const
+    {
+        assert(END(nNonce) - BEGIN(nVersion) == sizeof(pchHeaderCached));
+        if (nHeaderCacheState == HASH_CACHE_STORED)
+        {
+            __sync_synchronize();
+            if (memcmp(pchHeaderCached, BEGIN(nVersion), sizeof(pchHeaderCached)) == 0)
+            {
+                __sync_fetch_and_add(&hashCacheStats.nBlockHits, 1);
+                return hashHeaderCached;
+            }
+        }
+        __sync_fetch_and_add(&hashCacheStats.nBlockHashes, 1);
+        uint256 hash = Hash(BEGIN(nVersion), END(nNonce));
+        // A stored hash only goes stale when the header is changed, which
+        // only the thread that owns the block may do
+        int nState = nHeaderCacheState;
+        if (nState != HASH_CACHE_STORING && __sync_bool_compare_and_swap(&nHeaderCacheState, nState, HASH_CACHE_STORING))
+        {
+            memcpy(pchHeaderCached, BEGIN(nVersion), sizeof(pchHeaderCached));
+            hashHeaderCached = hash;
+            __sync_synchronize();
+            nHeaderCacheState = HASH_CACHE_STORED;
+        }
+        return hash;
     }
 
     int64_t GetBlockTime() const
@@ -748,23 +894,23 @@ public:
         return maxTransactionTime;
     }
 
-    uint256 BuildMerkleTree() const
+    uint256 BuildMerkleTree(unsigned int nThreads = 1) const
     {
         vMerkleTree.clear();
+        vMerkleTree.reserve(GetMerkleTreeSize(vtx.size()));
         BOOST_FOREACH(const CTransaction& tx, vtx)
             vMerkleTree.push_back(tx.GetHash());
-        int j = 0;
-        for (int nSize = vtx.size(); nSize > 1; nSize = (nSize + 1) / 2)
-        {
-            for (int i = 0; i < nSize; i += 2)
-            {
-                int i2 = std::min(i+1, nSize-1);
-                vMerkleTree.push_back(Hash(BEGIN(vMerkleTree[j+i]),  END(vMerkleTree[j+i]),
-                                           BEGIN(vMerkleTree[j+i2]), END(vMerkleTree[j+i2])));
-            }
-            j += nSize;
-        }
-        return (vMerkleTree.empty() ? 0 : vMerkleTree.back());
+        return ComputeMerkleTree(vMerkleTree, vtx.size(), nThreads);
+    }
+
+    // Recompute the merkle root when only vtx[nIndex] changed since the tree
+    // was built, such as the coinbase of a block template
+    uint256 UpdateMerkleTree(unsigned int nIndex) const
+    {
+        if (vMerkleTree.size() != GetMerkleTreeSize(vtx.size()))
+            return BuildMerkleTree();
+        vMerkleTree[nIndex] = vtx[nIndex].GetHash();
+        return ::UpdateMerkleTree(vMerkleTree, vtx.size(), nIndex);
     }
 
     std::vector<uint256> GetMerkleBranch(int nIndex) const
@@ -883,9 +1029,10 @@ public:
     bool AddToBlockIndex(unsigned int nFile, unsigned int nBlockPos, const uint256& hashProof);
     bool CheckBlock(bool fCheckPOW=true, bool fCheckMerkleRoot=true, bool fCheckSig=true) const;
     bool AcceptBlock();
-    bool SignBlock(CWallet& keystore, int64_t nFees);
+    // Searches the stake timestamps after nLastSearchTime and advances it
+    bool SignBlock(CWallet& keystore, int64_t nFees, int64_t& nLastSearchTime);
     bool CheckBlockSignature() const;
-    void RebuildAddressIndex(CTxDB& txdb);
+    void RebuildAddressIndex(CTxDB& txdb, int nHeight);
 
 private:
     bool SetBestChainInner(CTxDB& txdb, CBlockIndex *pindexNew);
@@ -1215,6 +1362,32 @@ public:
 
 
 
+/** The blocks of the best chain, indexed by height. Kept in step with
+ *  pindexBest by SetBestChain, so a height lookup does not have to walk the
+ *  pprev/pnext pointers. */
+class CChain
+{
+private:
+    mutable CCriticalSection cs;
+    std::vector<CBlockIndex*> vChain;
+
+public:
+    /** Returns the best chain block at nHeight, or NULL if out of range */
+    CBlockIndex* operator[](int nHeight) const
+    {
+        LOCK(cs);
+        if (nHeight < 0 || nHeight >= (int)vChain.size())
+            return NULL;
+        return vChain[nHeight];
+    }
+
+    /** Make pindex the tip, replacing only the entries that changed */
+    void SetTip(CBlockIndex* pindex);
+};
+
+extern CChain chainActive;
+
+
 /** Describes a place in the block chain to another node such that if the
  * other node doesn't have the same branch, it can find a recent common trunk.
  * The further back it is, the further before the fork it may be.
@@ -1422,6 +1595,7 @@ protected:
     virtual void UpdatedTransaction(const uint256 &hash) =0;
     virtual void Inventory(const uint256 &hash) =0;
     virtual void ResendWalletTransactions(bool fForce) =0;
+    virtual void RebuildStakeCoins() =0;
     friend void ::RegisterWallet(CWalletInterface*);
     friend void ::UnregisterWallet(CWalletInterface*);
     friend void ::UnregisterAllWallets();
@@ -212,6 +212,7 @@ std::string SignMultiSigTransaction(std::string rawTxHex)
     bool fHashSingle = ((nHashType & ~SIGHASH_ANYONECANPAY) == SIGHASH_SINGLE);
 
     // Sign what we can:
+    CSignatureHashCache sighashes(mergedTx);
     for (unsigned int i = 0; i < mergedTx.vin.size(); i++)
     {
         CTxIn& txin = mergedTx.vin[i];
@@ -224,14 +225,15 @@ std::string SignMultiSigTransaction(std::string rawTxHex)
         txin.scriptSig.clear();
         // Only sign SIGHASH_SINGLE if there's a corresponding output:
         if (!fHashSingle || (i < mergedTx.vout.size()))
-            SignSignature(keystore, prevPubKey, mergedTx, i, nHashType);
+            SignSignature(keystore, prevPubKey, mergedTx, i, nHashType, &sighashes);
 
         // ... and merge in other signatures:
         BOOST_FOREACH(const CTransaction& txv, txVariants)
         {
-            txin.scriptSig = CombineSignatures(prevPubKey, mergedTx, i, txin.scriptSig, txv.vin[i].scriptSig);
+            txin.scriptSig = CombineSignatures(prevPubKey, mergedTx, i, txin.scriptSig, txv.vin[i].scriptSig, &sighashes);
         }
-        if (!VerifyScript(txin.scriptSig, prevPubKey, mergedTx, i, STANDARD_SCRIPT_VERIFY_FLAGS, 0))
+        mergedTx.InvalidateHash();
+        if (!VerifyScript(txin.scriptSig, prevPubKey, STANDARD_SCRIPT_VERIFY_FLAGS, SignatureChecker(mergedTx, i, &sighashes)))
         {
 	    LogPrintf("SignMultiSigTransaction(): couldn't verify script.\n");
         }
@@ -1366,61 +1368,20 @@ bool MarketDB::Open(const char* pszMode)
     return true;
 };
 
-class MarketDbBatchScanner : public leveldb::WriteBatch::Handler
-{
-public:
-    std::string needle;
-    bool* deleted;
-    std::string* foundValue;
-    bool foundEntry;
-
-    MarketDbBatchScanner() : foundEntry(false) {}
-
-    virtual void Put(const leveldb::Slice& key, const leveldb::Slice& value)
-    {
-        if (key.ToString() == needle)
-        {
-            foundEntry = true;
-            *deleted = false;
-            *foundValue = value.ToString();
-        };
-    };
-
-    virtual void Delete(const leveldb::Slice& key)
-    {
-        if (key.ToString() == needle)
-        {
-            foundEntry = true;
-            *deleted = true;
-        };
-    };
-};
-
 bool MarketDB::ScanBatch(const CDataStream& key, std::string* value, bool* deleted) const
 {
     if (!activeBatch)
         return false;
 
     *deleted = false;
-    MarketDbBatchScanner scanner;
-    scanner.needle = key.str();
-    scanner.deleted = deleted;
-    scanner.foundValue = value;
-    leveldb::Status s = activeBatch->Iterate(&scanner);
-    if (!s.ok())
-    {
-        LogPrintf("MarketDB ScanBatch error: %s", s.ToString().c_str());
-        return false;
-    };
-
-    return scanner.foundEntry;
+    return activeBatch->Lookup(key.str(), value, deleted);
 }
 
 bool MarketDB::TxnBegin()
 {
     if (activeBatch)
         return true;
-    activeBatch = new leveldb::WriteBatch();
+    activeBatch = new CLevelDBBatch();
     return true;
 };
 
@@ -1431,7 +1392,7 @@ bool MarketDB::TxnCommit()
 
     leveldb::WriteOptions writeOptions;
     writeOptions.sync = true;
-    leveldb::Status status = pdb->Write(writeOptions, activeBatch);
+    leveldb::Status status = pdb->Write(writeOptions, activeBatch->GetBatch());
     delete activeBatch;
     activeBatch = NULL;
 
@@ -10,6 +10,7 @@
 
 #include <leveldb/db.h>
 #include <leveldb/write_batch.h>
+#include "leveldbbatch.h"
 #include "db.h"
 
 #include "wallet.h"
@@ -627,7 +628,7 @@ public:
     bool ReadPaymentRequests(std::map<uint256, CPaymentRequest>& requests);
 
     leveldb::DB *pdb;       // points to the global instance
-    leveldb::WriteBatch *activeBatch;
+    CLevelDBBatch *activeBatch;
 };
 
 #endif
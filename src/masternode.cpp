@@ -25,7 +25,6 @@ std::map<CNetAddr, int64_t> askedForMasternodeList;
 // which masternodes we've asked for
 std::map<COutPoint, int64_t> askedForMasternodeListEntry;
 // cache block hashes as we calculate them
-std::map<int64_t, uint256> mapCacheBlockHashes;
 
 // manage the masternode connections
 void ProcessMasternodeConnections(){
@@ -527,34 +526,17 @@ bool GetBlockHash(uint256& hash, int nBlockHeight)
     if(nBlockHeight == 0)
         nBlockHeight = pindexBest->nHeight;
 
-    if(mapCacheBlockHashes.count(nBlockHeight)){
-        hash = mapCacheBlockHashes[nBlockHeight];
-        return true;
-    }
-
-    const CBlockIndex *BlockLastSolved = pindexBest;
-    const CBlockIndex *BlockReading = pindexBest;
-
-    if (BlockLastSolved == NULL || BlockLastSolved->nHeight == 0 || pindexBest->nHeight+1 < nBlockHeight) return false;
-
-    int nBlocksAgo = 0;
-    if(nBlockHeight > 0) nBlocksAgo = (pindexBest->nHeight+1)-nBlockHeight;
-    assert(nBlocksAgo >= 0);
+    if (pindexBest->nHeight == 0 || pindexBest->nHeight+1 < nBlockHeight) return false;
 
-    int n = 0;
-    for (unsigned int i = 1; BlockReading && BlockReading->nHeight > 0; i++) {
-        if(n >= nBlocksAgo){
-            hash = BlockReading->GetBlockHash();
-            mapCacheBlockHashes[nBlockHeight] = hash;
-            return true;
-        }
-        n++;
+    // the hash used for a given height is that of the block before it
+    int nHeight = nBlockHeight > 0 ? nBlockHeight - 1 : pindexBest->nHeight;
+    if (nHeight <= 0) return false;
 
-        if (BlockReading->pprev == NULL) { assert(BlockReading); break; }
-        BlockReading = BlockReading->pprev;
-    }
+    const CBlockIndex *pindex = FindBlockByHeight(nHeight);
+    if (pindex == NULL) return false;
 
-    return false;
+    hash = pindex->GetBlockHash();
+    return true;
 }
 
 //
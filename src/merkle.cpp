@@ -0,0 +1,124 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2013 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "merkle.h"
+
+#include "crypto/sha256.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include <boost/bind.hpp>
+#include <boost/static_assert.hpp>
+#include <boost/thread.hpp>
+
+using namespace std;
+
+// Pairs of nodes are hashed straight from the tree
+BOOST_STATIC_ASSERT(sizeof(uint256) == 32);
+
+// Hash a level of nIn nodes into the ceil(nIn / 2) nodes of the next
+static void HashLevel(const uint256* pIn, size_t nIn, uint256* pOut)
+{
+    SHA256D64(pOut->begin(), pIn->begin(), nIn / 2);
+    if (nIn & 1)
+    {
+        unsigned char buf[64];
+        memcpy(buf, pIn[nIn - 1].begin(), 32);
+        memcpy(buf + 32, pIn[nIn - 1].begin(), 32);
+        SHA256D64(pOut[nIn / 2].begin(), buf, 1);
+    }
+}
+
+// Offset in the tree of each level, the leaves first
+static void GetLevelOffsets(size_t nLeaves, vector<size_t>& vOffsets)
+{
+    vOffsets.clear();
+    size_t nOffset = 0;
+    for (size_t nSize = nLeaves; nSize > 0; nSize = (nSize == 1 ? 0 : (nSize + 1) / 2))
+    {
+        vOffsets.push_back(nOffset);
+        nOffset += nSize;
+    }
+    vOffsets.push_back(nOffset);
+}
+
+size_t GetMerkleTreeSize(size_t nLeaves)
+{
+    vector<size_t> vOffsets;
+    GetLevelOffsets(nLeaves, vOffsets);
+    return vOffsets.back();
+}
+
+// Hash levels 1 to nHeight of the subtree of 2^nHeight leaves starting at
+// leaf nBegin. The last subtree may have fewer leaves; its top node is still
+// at level nHeight, with its last node paired with itself on the way up.
+static void HashSubtree(uint256* pTree, const vector<size_t>* pvOffsets, size_t nLeaves, size_t nBegin, unsigned int nHeight)
+{
+    size_t nSize = min(nLeaves - nBegin, (size_t)1 << nHeight);
+    for (unsigned int h = 0; h < nHeight; h++)
+    {
+        size_t nPos = nBegin >> h;
+        HashLevel(pTree + (*pvOffsets)[h] + nPos, nSize, pTree + (*pvOffsets)[h + 1] + nPos / 2);
+        nSize = (nSize + 1) / 2;
+    }
+}
+
+uint256 ComputeMerkleTree(vector<uint256>& vTree, size_t nLeaves, unsigned int nThreads)
+{
+    if (nLeaves == 0)
+    {
+        vTree.clear();
+        return 0;
+    }
+
+    vector<size_t> vOffsets;
+    GetLevelOffsets(nLeaves, vOffsets);
+    vTree.resize(vOffsets.back());
+    uint256* pTree = &vTree[0];
+    unsigned int nLevels = vOffsets.size() - 1;
+
+    // Split the lower levels into subtrees of equal height, one per thread;
+    // the few nodes above them are hashed here
+    unsigned int nHeight = 0;
+    if (nThreads > 1 && nLeaves >= MERKLE_PARALLEL_MIN_LEAVES)
+    {
+        while (((nLeaves - 1) >> nHeight) + 1 > nThreads)
+            nHeight++;
+        size_t nSubtrees = ((nLeaves - 1) >> nHeight) + 1;
+
+        boost::thread_group threadGroup;
+        for (size_t i = 1; i < nSubtrees; i++)
+            threadGroup.create_thread(boost::bind(&HashSubtree, pTree, &vOffsets, nLeaves, i << nHeight, nHeight));
+        HashSubtree(pTree, &vOffsets, nLeaves, 0, nHeight);
+        threadGroup.join_all();
+    }
+
+    for (unsigned int h = nHeight; h + 1 < nLevels; h++)
+        HashLevel(pTree + vOffsets[h], vOffsets[h + 1] - vOffsets[h], pTree + vOffsets[h + 1]);
+    return vTree.back();
+}
+
+uint256 UpdateMerkleTree(vector<uint256>& vTree, size_t nLeaves, size_t nIndex)
+{
+    vector<size_t> vOffsets;
+    GetLevelOffsets(nLeaves, vOffsets);
+    assert(nIndex < nLeaves && vTree.size() == vOffsets.back());
+
+    for (unsigned int h = 0; h + 2 < vOffsets.size(); h++)
+    {
+        size_t nSize = vOffsets[h + 1] - vOffsets[h];
+        size_t nLeft = nIndex & ~(size_t)1;
+        const uint256& left = vTree[vOffsets[h] + nLeft];
+        const uint256& right = vTree[vOffsets[h] + min(nLeft + 1, nSize - 1)];
+
+        unsigned char buf[64];
+        memcpy(buf, left.begin(), 32);
+        memcpy(buf + 32, right.begin(), 32);
+        nIndex >>= 1;
+        SHA256D64(vTree[vOffsets[h + 1] + nIndex].begin(), buf, 1);
+    }
+    return vTree.back();
+}
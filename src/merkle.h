@@ -0,0 +1,36 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2013 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_MERKLE_H
+#define BITCOIN_MERKLE_H
+
+#include "uint256.h"
+
+#include <vector>
+
+/** Below this many leaves a tree is always hashed by one thread */
+static const size_t MERKLE_PARALLEL_MIN_LEAVES = 2048;
+
+/*
+ * Merkle trees of transaction hashes, stored the way CBlock::vMerkleTree has
+ * always been: the leaves, then each level above them, up to the root. A
+ * level with an odd number of nodes pairs its last node with itself.
+ *
+ * The nodes of a level are hashed pairwise with SHA256D64, which works on
+ * several pairs at once where the CPU allows.
+ */
+
+/** Number of nodes in the tree of nLeaves leaves */
+size_t GetMerkleTreeSize(size_t nLeaves);
+
+/** Hash the levels above the first nLeaves entries of vTree, which must hold
+ *  the leaves, and return the root (0 for no leaves). Large trees are split
+ *  into subtrees hashed by up to nThreads threads. */
+uint256 ComputeMerkleTree(std::vector<uint256>& vTree, size_t nLeaves, unsigned int nThreads = 1);
+
+/** Rehash the branch above leaf nIndex of a complete tree after only that
+ *  leaf changed, and return the new root. */
+uint256 UpdateMerkleTree(std::vector<uint256>& vTree, size_t nLeaves, size_t nIndex);
+
+#endif // BITCOIN_MERKLE_H
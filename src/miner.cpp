@@ -55,51 +55,288 @@ void SHA256Transform(void* pstate, void* pinput, const void* pinit)
         ((uint32_t*)pstate)[i] = ctx.h[i];
 }
 
-// Some explaining would be appreciated
-class COrphan
+uint64_t nLastBlockTx = 0;
+uint64_t nLastBlockSize = 0;
+int64_t nLastCoinStakeSearchInterval = 0;
+
+CBlockAssembler::CBlockAssembler(CBlock* pblockIn, CBlockIndex* pindexPrevIn, bool fProofOfStakeIn, CTxDB* ptxdbIn) :
+    pblock(pblockIn), pindexPrev(pindexPrevIn), fProofOfStake(fProofOfStakeIn), ptxdb(ptxdbIn),
+    nBlockSize(1000), nBlockTx(0), nBlockSigOps(100), nFees(0), fTimeLimited(false)
 {
-public:
-    CTransaction* ptx;
-    set<uint256> setDependsOn;
-    double dPriority;
-    double dFeePerKb;
+    nHeight = pindexPrev->nHeight + 1;
+
+    // Largest block you're willing to create:
+    nBlockMaxSize = GetArg("-blockmaxsize", MAX_BLOCK_SIZE_GEN/2);
+    // Limit to betweeen 1K and MAX_BLOCK_SIZE-1K for sanity:
+    nBlockMaxSize = std::max((unsigned int)1000, std::min((unsigned int)(MAX_BLOCK_SIZE-1000), nBlockMaxSize));
+
+    // How much of the block should be dedicated to high-priority transactions,
+    // included regardless of the fees they pay
+    nBlockPrioritySize = GetArg("-blockprioritysize", 27000);
+    nBlockPrioritySize = std::min(nBlockMaxSize, nBlockPrioritySize);
+
+    // Minimum block size you want to create; block will be filled with free transactions
+    // until there are no more or the block reaches this size:
+    nBlockMinSize = GetArg("-blockminsize", 0);
+    nBlockMinSize = std::min(nBlockMaxSize, nBlockMinSize);
+
+    // Fee-per-kilobyte amount considered the same as "free"
+    // Be careful setting this: if you set it to zero then
+    // a transaction spammer can cheaply fill blocks using
+    // 1-satoshi-fee transactions. It should be set above the real
+    // cost to you of processing a transaction.
+    nMinTxFee = MIN_TX_FEE;
+    if (mapArgs.count("-mintxfee"))
+        ParseMoney(mapArgs["-mintxfee"], nMinTxFee);
+}
+
+bool CBlockAssembler::TestAndAdd(const CTxMemPoolEntry& entry)
+{
+    CTransaction& tx = *entry.ptx;
+    if (tx.IsCoinBase() || tx.IsCoinStake())
+        return false;
 
-    COrphan(CTransaction* ptxIn)
+    if (!IsFinalTx(tx, nHeight))
     {
-        ptx = ptxIn;
-        dPriority = dFeePerKb = 0;
+        fTimeLimited = true;
+        return false;
     }
-};
 
+    // Size limits
+    if (nBlockSize + entry.nTxSize >= nBlockMaxSize)
+        return false;
 
-uint64_t nLastBlockTx = 0;
-uint64_t nLastBlockSize = 0;
-int64_t nLastCoinStakeSearchInterval = 0;
- 
-// We want to sort transactions by priority and fee, so:
-typedef boost::tuple<double, double, CTransaction*> TxPriority;
-class TxPriorityCompare
+    // Limits on sigOps:
+    if (nBlockSigOps + entry.nSigOps >= MAX_BLOCK_SIGOPS)
+        return false;
+
+    // Timestamp limit
+    if (tx.nTime > GetAdjustedTime() || (fProofOfStake && tx.nTime > pblock->vtx[0].nTime))
+    {
+        fTimeLimited = true;
+        return false;
+    }
+
+    // Transaction fee
+    if (entry.nFee < GetMinFee(tx, nBlockSize, GMF_BLOCK))
+        return false;
+
+    if (ptxdb)
+    {
+        // Connecting shouldn't fail due to dependency on other memory pool transactions
+        // because ancestors are always added first. Only the entries of mapTestPool
+        // it touches are put back if it does fail.
+        MapPrevTx mapInputs;
+        bool fInvalid;
+        if (!tx.FetchInputs(*ptxdb, mapTestPool, false, true, mapInputs, fInvalid))
+            return false;
+
+        map<uint256, CTxIndex> mapUndo;
+        BOOST_FOREACH(const CTxIn& txin, tx.vin)
+        {
+            map<uint256, CTxIndex>::iterator mi = mapTestPool.find(txin.prevout.hash);
+            if (mi != mapTestPool.end())
+                mapUndo.insert(*mi);
+        }
+
+        // Note that flags: we don't want to set mempool/IsStandard()
+        // policy here, but we still have to ensure that the block we
+        // create only contains transactions that are valid in new blocks.
+        if (!tx.ConnectInputs(*ptxdb, mapInputs, mapTestPool, CDiskTxPos(1,1,1), pindexPrev, false, true, MANDATORY_SCRIPT_VERIFY_FLAGS))
+        {
+            BOOST_FOREACH(const CTxIn& txin, tx.vin)
+            {
+                map<uint256, CTxIndex>::iterator mi = mapUndo.find(txin.prevout.hash);
+                if (mi != mapUndo.end())
+                    mapTestPool[txin.prevout.hash] = mi->second;
+                else
+                    mapTestPool.erase(txin.prevout.hash);
+            }
+            return false;
+        }
+        mapTestPool[entry.hash] = CTxIndex(CDiskTxPos(1,1,1), tx.vout.size());
+    }
+
+    // Added
+    pblock->vtx.push_back(tx);
+    setInBlock.insert(entry.hash);
+    nBlockSize += entry.nTxSize;
+    ++nBlockTx;
+    nBlockSigOps += entry.nSigOps;
+    nFees += entry.nFee;
+
+    if (fDebug && GetBoolArg("-printpriority", false))
+    {
+        LogPrintf("priority %.1f feeperkb %.1f txid %s\n",
+               entry.GetPriority(nHeight - 1), (double)entry.nFee * 1000 / entry.nTxSize, entry.hash.ToString());
+    }
+
+    return true;
+}
+
+bool CBlockAssembler::AddWithAncestors(const CTxMemPool& pool, const CTxMemPoolEntry& entry)
 {
-    bool byFee;
-public:
-    TxPriorityCompare(bool _byFee) : byFee(_byFee) { }
-    bool operator()(const TxPriority& a, const TxPriority& b)
+    // Ancestors not in the block yet, parents before children: a
+    // transaction has more ancestors than any of its own
+    set<uint256> setAncestors;
+    pool.CalculateAncestors(entry, setAncestors);
+    vector<pair<unsigned int, const CTxMemPoolEntry*> > vPackage;
+    BOOST_FOREACH(const uint256& hash, setAncestors)
     {
-        if (byFee)
+        if (setInBlock.count(hash))
+            continue;
+        map<uint256, CTxMemPoolEntry>::const_iterator mi = pool.mapEntry.find(hash);
+        if (setFailed.count(hash) || mi == pool.mapEntry.end())
         {
-            if (a.get<1>() == b.get<1>())
-                return a.get<0>() < b.get<0>();
-            return a.get<1>() < b.get<1>();
+            setFailed.insert(entry.hash);
+            return false;
         }
+        const CTxMemPoolEntry& ancestor = mi->second;
+        vPackage.push_back(make_pair(ancestor.nAncestors, &ancestor));
+    }
+    sort(vPackage.begin(), vPackage.end());
+    vPackage.push_back(make_pair(entry.nAncestors, &entry));
+
+    for (unsigned int i = 0; i < vPackage.size(); i++)
+    {
+        if (!TestAndAdd(*vPackage[i].second))
+        {
+            // Nor can anything that spends it go in
+            for (; i < vPackage.size(); i++)
+                setFailed.insert(vPackage[i].second->hash);
+            return false;
+        }
+        UpdatePackagesForAdded(pool, *vPackage[i].second);
+    }
+    return true;
+}
+
+void CBlockAssembler::UpdatePackagesForAdded(const CTxMemPool& pool, const CTxMemPoolEntry& entry)
+{
+    map<uint256, CTxMemPoolModifiedEntry>::iterator mi = mapModified.find(entry.hash);
+    if (mi != mapModified.end())
+    {
+        setModified.erase(&mi->second);
+        mapModified.erase(mi);
+    }
+
+    // Everything that spends it has that much less to bring along now
+    set<uint256> setDone;
+    vector<uint256> vTodo(entry.setChildren.begin(), entry.setChildren.end());
+    while (!vTodo.empty())
+    {
+        uint256 hash = vTodo.back();
+        vTodo.pop_back();
+        if (!setDone.insert(hash).second)
+            continue;
+        map<uint256, CTxMemPoolEntry>::const_iterator it = pool.mapEntry.find(hash);
+        if (it == pool.mapEntry.end())
+            continue;
+        const CTxMemPoolEntry& descendant = it->second;
+
+        mi = mapModified.find(hash);
+        if (mi == mapModified.end())
+            mi = mapModified.insert(make_pair(hash, CTxMemPoolModifiedEntry(descendant))).first;
         else
+            setModified.erase(&mi->second);
+        mi->second.nAncestorFee -= entry.nFee;
+        mi->second.nAncestorSize -= entry.nTxSize;
+        if (!setFailed.count(hash))
+            setModified.insert(&mi->second);
+
+        vTodo.insert(vTodo.end(), descendant.setChildren.begin(), descendant.setChildren.end());
+    }
+}
+
+void CBlockAssembler::AddTransactions(CTxMemPool& pool)
+{
+    AssertLockHeld(pool.cs);
+
+    // High-priority transactions first, regardless of the fees they pay
+    if (nBlockPrioritySize > 0)
+    {
+        pool.UpdatePriorities(pindexPrev->nHeight);
+        for (CTxMemPool::indexed_by_priority::iterator it = pool.setByPriority.begin(); it != pool.setByPriority.end(); ++it)
+        {
+            const CTxMemPoolEntry& entry = **it;
+            if (nBlockSize + entry.nTxSize >= nBlockPrioritySize || entry.dPriorityKey < COIN * 144 / 250)
+                break;
+            if (!setInBlock.count(entry.hash) && !setFailed.count(entry.hash))
+                AddWithAncestors(pool, entry);
+        }
+    }
+
+    // Then by fee rate, until the rest pay too little or the block is full.
+    // Entries with ancestors in the block already are taken from setModified,
+    // which is merged with the pool's index as it goes.
+    unsigned int nConsecutiveFailed = 0;
+    CTxMemPool::indexed_by_fee::iterator it = pool.setByFee.begin();
+    while (it != pool.setByFee.end() || !setModified.empty())
+    {
+        if (it != pool.setByFee.end() &&
+            (setInBlock.count((*it)->hash) || setFailed.count((*it)->hash) || mapModified.count((*it)->hash)))
+        {
+            ++it;
+            continue;
+        }
+
+        const CTxMemPoolEntry* pentry;
+        int64_t nPackageFee;
+        unsigned int nPackageSize;
+        bool fModified = !setModified.empty();
+        if (fModified && it != pool.setByFee.end())
+        {
+            CTxMemPoolModifiedEntry unmodified(**it);
+            fModified = CompareModifiedEntryByAncestorFee()(*setModified.begin(), &unmodified);
+        }
+        if (fModified)
         {
-            if (a.get<0>() == b.get<0>())
-                return a.get<1>() < b.get<1>();
-            return a.get<0>() < b.get<0>();
+            const CTxMemPoolModifiedEntry* pmodified = *setModified.begin();
+            setModified.erase(setModified.begin());
+            pentry = pmodified->pentry;
+            nPackageFee = pmodified->nAncestorFee;
+            nPackageSize = pmodified->nAncestorSize;
+            if (setInBlock.count(pentry->hash) || setFailed.count(pentry->hash))
+                continue;
+        }
+        else
+        {
+            pentry = *it;
+            nPackageFee = pentry->nAncestorFee;
+            nPackageSize = pentry->nAncestorSize;
+            ++it;
         }
+        const CTxMemPoolEntry& entry = *pentry;
+
+        // Skip free transactions if we're past the minimum block size:
+        if ((double)nPackageFee * 1000 / nPackageSize < nMinTxFee && nBlockSize + nPackageSize >= nBlockMinSize)
+            break;
+
+        if (AddWithAncestors(pool, entry))
+            nConsecutiveFailed = 0;
+        else if (nBlockSize + 1000 >= nBlockMaxSize && ++nConsecutiveFailed >= 1000)
+            break;
     }
+}
+
+// The transactions last chosen for a block. The next block on the same tip
+// takes them again while the memory pool has not changed, unless some were
+// left out only for being too new.
+class CBlockTemplateTxs
+{
+public:
+    uint256 hashPrevBlock;
+    unsigned int nTransactionsUpdated;
+    bool fProofOfStake;
+    std::vector<CTransaction> vtx;
+    uint64_t nBlockSize;
+    int64_t nFees;
+
+    CBlockTemplateTxs() : nTransactionsUpdated(0), fProofOfStake(false), nBlockSize(0), nFees(0) {}
 };
 
+static CBlockTemplateTxs blockTemplateTxs; // guarded by cs_main
+
 // CreateNewBlock: create new block (without proof-of-work/proof-of-stake)
 CBlock* CreateNewBlock(CReserveKey& reservekey, bool fProofOfStake, int64_t* pFees)
 {
@@ -136,229 +373,60 @@ CBlock* CreateNewBlock(CReserveKey& reservekey, bool fProofOfStake, int64_t* pFe
     // Add our coinbase tx as first transaction
     pblock->vtx.push_back(txNew);
 
-    // Largest block you're willing to create:
-    unsigned int nBlockMaxSize = GetArg("-blockmaxsize", MAX_BLOCK_SIZE_GEN/2);
-    // Limit to betweeen 1K and MAX_BLOCK_SIZE-1K for sanity:
-    nBlockMaxSize = std::max((unsigned int)1000, std::min((unsigned int)(MAX_BLOCK_SIZE-1000), nBlockMaxSize));
-
-    // How much of the block should be dedicated to high-priority transactions,
-    // included regardless of the fees they pay
-    unsigned int nBlockPrioritySize = GetArg("-blockprioritysize", 27000);
-    nBlockPrioritySize = std::min(nBlockMaxSize, nBlockPrioritySize);
-
-    // Minimum block size you want to create; block will be filled with free transactions
-    // until there are no more or the block reaches this size:
-    unsigned int nBlockMinSize = GetArg("-blockminsize", 0);
-    nBlockMinSize = std::min(nBlockMaxSize, nBlockMinSize);
-
-    // Fee-per-kilobyte amount considered the same as "free"
-    // Be careful setting this: if you set it to zero then
-    // a transaction spammer can cheaply fill blocks using
-    // 1-satoshi-fee transactions. It should be set above the real
-    // cost to you of processing a transaction.
-    int64_t nMinTxFee = MIN_TX_FEE;
-    if (mapArgs.count("-mintxfee"))
-        ParseMoney(mapArgs["-mintxfee"], nMinTxFee);
-
     pblock->nBits = GetNextTargetRequired(pindexPrev, fProofOfStake);
 
 
     // Collect memory pool transactions into the block
     int64_t nFees = 0;
     {
+        int64_t nStart = GetTimeMicros();
         LOCK2(cs_main, mempool.cs);
-        CTxDB txdb("r");
+        int64_t nLocked = GetTimeMicros();
 //>SLING<
-        // Priority order to process transactions
-        list<COrphan> vOrphan; // list memory doesn't move
-        map<uint256, vector<COrphan*> > mapDependers;
-
-        // This vector will be sorted into a priority queue:
-        vector<TxPriority> vecPriority;
-        vecPriority.reserve(mempool.mapTx.size());
-        for (map<uint256, CTransaction>::iterator mi = mempool.mapTx.begin(); mi != mempool.mapTx.end(); ++mi)
-        {
-            CTransaction& tx = (*mi).second;
-            if (tx.IsCoinBase() || tx.IsCoinStake() || !IsFinalTx(tx, nHeight))
-                continue;
-
-            COrphan* porphan = NULL;
-            double dPriority = 0;
-            int64_t nTotalIn = 0;
-            bool fMissingInputs = false;
-            BOOST_FOREACH(const CTxIn& txin, tx.vin)
-            {
-                // Read prev transaction
-                CTransaction txPrev;
-                CTxIndex txindex;
-                if (!txPrev.ReadFromDisk(txdb, txin.prevout, txindex))
-                {
-                    // This should never happen; all transactions in the memory
-                    // pool should connect to either transactions in the chain
-                    // or other transactions in the memory pool.
-                    if (!mempool.mapTx.count(txin.prevout.hash))
-                    {
-                        LogPrintf("ERROR: mempool transaction missing input\n");
-                        if (fDebug) assert("mempool transaction missing input" == 0);
-                        fMissingInputs = true;
-                        if (porphan)
-                            vOrphan.pop_back();
-                        break;
-                    }
-
-                    // Has to wait for dependencies
-                    if (!porphan)
-                    {
-                        // Use list for automatic deletion
-                        vOrphan.push_back(COrphan(&tx));
-                        porphan = &vOrphan.back();
-                    }
-                    mapDependers[txin.prevout.hash].push_back(porphan);
-                    porphan->setDependsOn.insert(txin.prevout.hash);
-                    nTotalIn += mempool.mapTx[txin.prevout.hash].vout[txin.prevout.n].nValue;
-                    continue;
-                }
-                int64_t nValueIn = txPrev.vout[txin.prevout.n].nValue;
-                nTotalIn += nValueIn;
-
-                int nConf = txindex.GetDepthInMainChain();
-                dPriority += (double)nValueIn * nConf;
-            }
-            if (fMissingInputs) continue;
 
-            // Priority is sum(valuein * age) / txsize
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            dPriority /= nTxSize;
-
-            // This is a more accurate fee-per-kilobyte than is used by the client code, because the
-            // client code rounds up the size to the nearest 1K. That's good, because it gives an
-            // incentive to create smaller transactions.
-            double dFeePerKb =  double(nTotalIn-tx.GetValueOut()) / (double(nTxSize)/1000.0);
-
-            if (porphan)
-            {
-                porphan->dPriority = dPriority;
-                porphan->dFeePerKb = dFeePerKb;
-            }
-            else
-                vecPriority.push_back(TxPriority(dPriority, dFeePerKb, &(*mi).second));
+        uint64_t nBlockSize, nBlockTx;
+        CBlockTemplateTxs& last = blockTemplateTxs;
+        bool fReuse = last.hashPrevBlock == pindexPrev->GetBlockHash() && last.fProofOfStake == fProofOfStake &&
+                      last.nTransactionsUpdated == mempool.GetTransactionsUpdated();
+        if (fReuse)
+        {
+            pblock->vtx.insert(pblock->vtx.end(), last.vtx.begin(), last.vtx.end());
+            nBlockSize = last.nBlockSize;
+            nBlockTx = last.vtx.size();
+            nFees = last.nFees;
         }
-
-        // Collect transactions into block
-        map<uint256, CTxIndex> mapTestPool;
-        uint64_t nBlockSize = 1000;
-        uint64_t nBlockTx = 0;
-        int nBlockSigOps = 100;
-        bool fSortedByFee = (nBlockPrioritySize <= 0);
-
-        TxPriorityCompare comparer(fSortedByFee);
-        std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
-
-        while (!vecPriority.empty())
+        else
         {
-            // Take highest priority transaction off the priority queue:
-            double dPriority = vecPriority.front().get<0>();
-            double dFeePerKb = vecPriority.front().get<1>();
-            CTransaction& tx = *(vecPriority.front().get<2>());
-
-            std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            vecPriority.pop_back();
-
-            // Size limits
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            if (nBlockSize + nTxSize >= nBlockMaxSize)
-                continue;
-
-            // Legacy limits on sigOps:
-            unsigned int nTxSigOps = GetLegacySigOpCount(tx);
-            if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
-                continue;
-
-            // Timestamp limit
-            if (tx.nTime > GetAdjustedTime() || (fProofOfStake && tx.nTime > pblock->vtx[0].nTime))
-                continue;
-
-            // Transaction fee
-            int64_t nMinFee = GetMinFee(tx, nBlockSize, GMF_BLOCK);
-
-            // Skip free transactions if we're past the minimum block size:
-            if (fSortedByFee && (dFeePerKb < nMinTxFee) && (nBlockSize + nTxSize >= nBlockMinSize))
-                continue;
-
-            // Prioritize by fee once past the priority size or we run out of high-priority
-            // transactions:
-            if (!fSortedByFee &&
-                ((nBlockSize + nTxSize >= nBlockPrioritySize) || (dPriority < COIN * 144 / 250)))
-            {
-                fSortedByFee = true;
-                comparer = TxPriorityCompare(fSortedByFee);
-                std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            }
-
-            // Connecting shouldn't fail due to dependency on other memory pool transactions
-            // because we're already processing them in order of dependency
-            map<uint256, CTxIndex> mapTestPoolTmp(mapTestPool);
-            MapPrevTx mapInputs;
-            bool fInvalid;
-            if (!tx.FetchInputs(txdb, mapTestPoolTmp, false, true, mapInputs, fInvalid))
-                continue;
-
-            int64_t nTxFees = tx.GetValueIn(mapInputs)-tx.GetValueOut();
-            if (nTxFees < nMinFee)
-                continue;
-
-            nTxSigOps += GetP2SHSigOpCount(tx, mapInputs);
-            if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
-                continue;
-
-            // Note that flags: we don't want to set mempool/IsStandard()
-            // policy here, but we still have to ensure that the block we
-            // create only contains transactions that are valid in new blocks.
-            if (!tx.ConnectInputs(txdb, mapInputs, mapTestPoolTmp, CDiskTxPos(1,1,1), pindexPrev, false, true, MANDATORY_SCRIPT_VERIFY_FLAGS))
-                continue;
-            mapTestPoolTmp[tx.GetHash()] = CTxIndex(CDiskTxPos(1,1,1), tx.vout.size());
-            swap(mapTestPool, mapTestPoolTmp);
-
-            // Added
-            pblock->vtx.push_back(tx);
-            nBlockSize += nTxSize;
-            ++nBlockTx;
-            nBlockSigOps += nTxSigOps;
-            nFees += nTxFees;
-
-            if (fDebug && GetBoolArg("-printpriority", false))
-            {
-                LogPrintf("priority %.1f feeperkb %.1f txid %s\n",
-                       dPriority, dFeePerKb, tx.GetHash().ToString());
-            }
-
-            // Add transactions that depend on this one to the priority queue
-            uint256 hash = tx.GetHash();
-            if (mapDependers.count(hash))
-            {
-                BOOST_FOREACH(COrphan* porphan, mapDependers[hash])
-                {
-                    if (!porphan->setDependsOn.empty())
-                    {
-                        porphan->setDependsOn.erase(hash);
-                        if (porphan->setDependsOn.empty())
-                        {
-                            vecPriority.push_back(TxPriority(porphan->dPriority, porphan->dFeePerKb, porphan->ptx));
-                            std::push_heap(vecPriority.begin(), vecPriority.end(), comparer);
-                        }
-                    }
-                }
-            }
+            CTxDB txdb("r");
+            CBlockAssembler assembler(pblock.get(), pindexPrev, fProofOfStake, &txdb);
+            assembler.AddTransactions(mempool);
+            nBlockSize = assembler.nBlockSize;
+            nBlockTx = assembler.nBlockTx;
+            nFees = assembler.nFees;
+
+            last.hashPrevBlock = assembler.fTimeLimited ? 0 : pindexPrev->GetBlockHash();
+            last.nTransactionsUpdated = mempool.GetTransactionsUpdated();
+            last.fProofOfStake = fProofOfStake;
+            last.vtx.assign(pblock->vtx.begin() + 1, pblock->vtx.end());
+            last.nBlockSize = nBlockSize;
+            last.nFees = nFees;
         }
 
         nLastBlockTx = nBlockTx;
         nLastBlockSize = nBlockSize;
 
+        LogPrint("bench", "CreateNewBlock() : %u of %u transactions%s in %.2fms, %.2fms holding cs_main\n",
+                 nBlockTx, mempool.mapTx.size(), fReuse ? " reused" : "",
+                 0.001 * (GetTimeMicros() - nStart), 0.001 * (GetTimeMicros() - nLocked));
+
         if (fDebug && GetBoolArg("-printpriority", false))
             LogPrintf("CreateNewBlock(): total size %u\n", nBlockSize);
 // >SLING<
         if (!fProofOfStake)
+        {
             pblock->vtx[0].vout[0].nValue = GetProofOfWorkReward(nFees);
+            pblock->vtx[0].InvalidateHash();
+        }
 
         if (pFees)
             *pFees = nFees;
@@ -389,8 +457,9 @@ void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int&
     unsigned int nHeight = pindexPrev->nHeight+1; // Height first in coinbase required for block.version=2
     pblock->vtx[0].vin[0].scriptSig = (CScript() << nHeight << CBigNum(nExtraNonce)) + COINBASE_FLAGS;
     assert(pblock->vtx[0].vin[0].scriptSig.size() <= 100);
+    pblock->vtx[0].InvalidateHash();
 
-    pblock->hashMerkleRoot = pblock->BuildMerkleTree();
+    pblock->hashMerkleRoot = pblock->UpdateMerkleTree(0);
 }
 
 
@@ -517,6 +586,57 @@ bool CheckStake(CBlock* pblock, CWallet& wallet)
     return true;
 }
 
+// Set by WakeStakeMiner() to when it was first called since the stake
+// miner last woke up, 0 if it has not been
+static boost::mutex csStakeMinerWake;
+static boost::condition_variable condStakeMinerWake;
+static int64_t nStakeMinerWakeTime = 0;
+
+static CCriticalSection cs_stakeMinerStats;
+static CStakeMinerStats stakeMinerStats;
+
+void WakeStakeMiner()
+{
+    {
+        boost::lock_guard<boost::mutex> lock(csStakeMinerWake);
+        if (!nStakeMinerWakeTime)
+            nStakeMinerWakeTime = GetTimeMicros();
+    }
+    condStakeMinerWake.notify_one();
+}
+
+// Sleep for up to nMillis, or until woken. Returns when WakeStakeMiner()
+// was called, 0 if it was not.
+static int64_t WaitStakeMiner(int64_t nMillis)
+{
+    boost::unique_lock<boost::mutex> lock(csStakeMinerWake);
+    if (!nStakeMinerWakeTime && nMillis > 0)
+        condStakeMinerWake.timed_wait(lock, boost::posix_time::milliseconds(nMillis));
+    int64_t nWakeTime = nStakeMinerWakeTime;
+    nStakeMinerWakeTime = 0;
+    return nWakeTime;
+}
+
+void GetStakeMinerStats(CStakeMinerStats& statsRet)
+{
+    LOCK(cs_stakeMinerStats);
+    statsRet = stakeMinerStats;
+}
+
+// The timestamp SignBlock() would search for a block on pindexPrev now, and
+// how far apart those timestamps are
+static int64_t GetStakeSearchTime(const CBlockIndex* pindexPrev, int64_t& nStepRet)
+{
+    int64_t nTime = GetAdjustedTime();
+    nStepRet = 1;
+    if (IsProtocolV2(pindexPrev->nHeight+1))
+    {
+        nTime &= ~STAKE_TIMESTAMP_MASK;
+        nStepRet = STAKE_TIMESTAMP_MASK + 1;
+    }
+    return nTime;
+}
+
 void ThreadStakeMiner(CWallet *pwallet)
 {
     SetThreadPriority(THREAD_PRIORITY_LOWEST);
@@ -526,21 +646,37 @@ void ThreadStakeMiner(CWallet *pwallet)
 
     CReserveKey reservekey(pwallet);
 
+    // Start staking as soon as the wallet is unlocked
+    boost::signals2::scoped_connection connStatus(pwallet->NotifyStatusChanged.connect(boost::bind(&WakeStakeMiner)));
+
     bool fTryToSync = true;
 
+    // The tip searched on, and the last timestamp searched on it
+    CBlockIndex* pindexSearched = NULL;
+    int64_t nLastSearchTime = GetAdjustedTime();
+
+    // Blocks are copied from a template, made again when the tip or the
+    // memory pool changes, but for the memory pool no more often than
+    // every -minersleep milliseconds unless a search needs it
+    auto_ptr<CBlock> pblockTemplate;
+    int64_t nTemplateFees = 0;
+    unsigned int nTemplateTxUpdated = 0;
+    int64_t nTemplateTime = 0;
+
+    int64_t nWakeTime = 0;
     while (true)
     {
         while (pwallet->IsLocked())
         {
             nLastCoinStakeSearchInterval = 0;
-            MilliSleep(1000);
+            WaitStakeMiner(60000);
         }
 
         while (vNodes.empty() || IsInitialBlockDownload())
         {
             nLastCoinStakeSearchInterval = 0;
             fTryToSync = true;
-            MilliSleep(1000);
+            WaitStakeMiner(1000);
         }
 
         if (fTryToSync)
@@ -553,23 +689,73 @@ void ThreadStakeMiner(CWallet *pwallet)
             }
         }
 
-        //
-        // Create new block
-        //
-        int64_t nFees;
-        auto_ptr<CBlock> pblock(CreateNewBlock(reservekey, true, &nFees));
-        if (!pblock.get())
-            return;
+        // A new tip has not been searched at any timestamp
+        CBlockIndex* pindexPrev = pindexBest;
+        int64_t nStep;
+        int64_t nSearchTime = GetStakeSearchTime(pindexPrev, nStep);
+        if (pindexPrev != pindexSearched)
+        {
+            pindexSearched = pindexPrev;
+            nLastSearchTime = min(nLastSearchTime, nSearchTime - 1);
+        }
+        bool fSearch = nSearchTime > nLastSearchTime;
+
+        int64_t nStart = GetTimeMicros();
+        bool fStale = !pblockTemplate.get() || pblockTemplate->hashPrevBlock != pindexPrev->GetBlockHash() ||
+                      nTemplateTxUpdated != mempool.GetTransactionsUpdated();
+        int64_t nTemplateMicros = -1;
+        if (fStale && (fSearch || GetTimeMillis() - nTemplateTime >= nMinerSleep))
+        {
+            //
+            // Create new block
+            //
+            nTemplateTxUpdated = mempool.GetTransactionsUpdated();
+            pblockTemplate.reset(CreateNewBlock(reservekey, true, &nTemplateFees));
+            if (!pblockTemplate.get())
+                return;
+            nTemplateTime = GetTimeMillis();
+            nTemplateMicros = GetTimeMicros() - nStart;
+            fStale = false;
+
+            LOCK(cs_stakeMinerStats);
+            stakeMinerStats.nTemplates++;
+            stakeMinerStats.nLastTemplateMicros = nTemplateMicros;
+        }
 
-        // Trying to sign a block
-        if (pblock->SignBlock(*pwallet, nFees))
+        if (fSearch)
         {
-            SetThreadPriority(THREAD_PRIORITY_NORMAL);
-            CheckStake(pblock.get(), *pwallet);
-            SetThreadPriority(THREAD_PRIORITY_LOWEST);
-            MilliSleep(500);
+            // Trying to sign a block
+            int64_t nSearchStart = GetTimeMicros();
+            CBlock block(*pblockTemplate);
+            bool fSigned = block.SignBlock(*pwallet, nTemplateFees, nLastSearchTime);
+            int64_t nEnd = GetTimeMicros();
+            {
+                LOCK(cs_stakeMinerStats);
+                stakeMinerStats.nRounds++;
+                stakeMinerStats.nLastRoundMicros = nEnd - (nTemplateMicros >= 0 ? nStart : nSearchStart);
+                stakeMinerStats.nLastRoundTime = GetTime();
+                if (nWakeTime)
+                    stakeMinerStats.nLastLatencyMicros = nSearchStart - nWakeTime;
+            }
+            LogPrint("coinstake", "ThreadStakeMiner : searched %d at height %d in %dus\n", nSearchTime, pindexPrev->nHeight+1, nEnd - nSearchStart);
+
+            if (fSigned)
+            {
+                // Not again at this timestamp, should the block be refused
+                nLastSearchTime = max(nLastSearchTime, (int64_t)block.nTime);
+
+                SetThreadPriority(THREAD_PRIORITY_NORMAL);
+                CheckStake(&block, *pwallet);
+                SetThreadPriority(THREAD_PRIORITY_LOWEST);
+            }
         }
-        else
-            MilliSleep(nMinerSleep);
+
+        // Sleep until the next timestamp, or until the tip, the wallet or
+        // the memory pool changes
+        int64_t nOffset = GetAdjustedTime() - GetTime();
+        int64_t nWait = (nLastSearchTime + nStep - nOffset) * 1000 - GetTimeMillis();
+        if (fStale)
+            nWait = min(nWait, nTemplateTime + nMinerSleep - GetTimeMillis());
+        nWakeTime = WaitStakeMiner(max(nWait, (int64_t)1));
     }
 }
@@ -9,6 +9,85 @@
 #include "main.h"
 #include "wallet.h"
 
+class CTxDB;
+
+/** The ancestor totals of a pool entry without those of its ancestors
+ *  already in the block being assembled */
+class CTxMemPoolModifiedEntry
+{
+public:
+    const CTxMemPoolEntry* pentry;
+    int64_t nAncestorFee;
+    unsigned int nAncestorSize;
+
+    CTxMemPoolModifiedEntry(const CTxMemPoolEntry& entry) :
+        pentry(&entry), nAncestorFee(entry.nAncestorFee), nAncestorSize(entry.nAncestorSize) {}
+};
+
+class CompareModifiedEntryByAncestorFee
+{
+public:
+    bool operator()(const CTxMemPoolModifiedEntry* a, const CTxMemPoolModifiedEntry* b) const
+    {
+        double f1 = (double)a->nAncestorFee * b->nAncestorSize;
+        double f2 = (double)b->nAncestorFee * a->nAncestorSize;
+        if (f1 != f2)
+            return f1 > f2;
+        return a->pentry->hash < b->pentry->hash;
+    }
+};
+
+/*
+ * Chooses the memory pool transactions for a new block.
+ *
+ * It walks the pool's indexes from the top: the transactions with the
+ * highest priority first, up to -blockprioritysize, then the ones with the
+ * highest fee rate counting their ancestors in the pool. Ancestors not in
+ * the block yet go in just before the transaction, so a child can pay for
+ * its parents. Once some of its ancestors are in the block, a transaction
+ * is ranked by what it still brings along, through setModified. Only the
+ * transactions it takes are checked against the chain, not the whole pool.
+ */
+class CBlockAssembler
+{
+private:
+    CBlock* pblock;
+    CBlockIndex* pindexPrev;
+    int nHeight;
+    bool fProofOfStake;
+    CTxDB* ptxdb;
+
+    unsigned int nBlockMaxSize;
+    unsigned int nBlockPrioritySize;
+    unsigned int nBlockMinSize;
+    int64_t nMinTxFee;
+
+    std::set<uint256> setInBlock;
+    std::set<uint256> setFailed;
+    std::map<uint256, CTxIndex> mapTestPool;
+
+    // Entries with ancestors in the block, best first by what is left
+    std::map<uint256, CTxMemPoolModifiedEntry> mapModified;
+    std::set<CTxMemPoolModifiedEntry*, CompareModifiedEntryByAncestorFee> setModified;
+
+    bool TestAndAdd(const CTxMemPoolEntry& entry);
+    bool AddWithAncestors(const CTxMemPool& pool, const CTxMemPoolEntry& entry);
+    void UpdatePackagesForAdded(const CTxMemPool& pool, const CTxMemPoolEntry& entry);
+
+public:
+    uint64_t nBlockSize;
+    uint64_t nBlockTx;
+    int nBlockSigOps;
+    int64_t nFees;
+    bool fTimeLimited;   // left out a transaction only for its timestamp or lock time
+
+    // Checks the transactions against the chain in *ptxdbIn, unless it is NULL
+    CBlockAssembler(CBlock* pblockIn, CBlockIndex* pindexPrevIn, bool fProofOfStakeIn, CTxDB* ptxdbIn);
+
+    // Needs pool.cs, and cs_main to check against the chain
+    void AddTransactions(CTxMemPool& pool);
+};
+
 /* Generate a new block, without valid proof-of-work */
 CBlock* CreateNewBlock(CReserveKey& reservekey, bool fProofOfStake=false, int64_t* pFees = 0);
 
@@ -24,6 +103,22 @@ bool CheckWork(CBlock* pblock, CWallet& wallet, CReserveKey& reservekey);
 /** Check mined proof-of-stake block */
 bool CheckStake(CBlock* pblock, CWallet& wallet);
 
+class CStakeMinerStats
+{
+public:
+    uint64_t nRounds;            // stake timestamps searched
+    uint64_t nTemplates;         // block templates made
+    int64_t nLastRoundMicros;    // the last search, and the template if one was made for it
+    int64_t nLastTemplateMicros;
+    int64_t nLastLatencyMicros;  // from a new tip, unlock or transaction to the search
+    int64_t nLastRoundTime;
+
+    CStakeMinerStats() : nRounds(0), nTemplates(0), nLastRoundMicros(0), nLastTemplateMicros(0), nLastLatencyMicros(0), nLastRoundTime(0) {}
+};
+
+/** Timing of the stake miner rounds */
+void GetStakeMinerStats(CStakeMinerStats& statsRet);
+
 /** Base sha256 mining transform */
 void SHA256Transform(void* pstate, void* pinput, const void* pinit);
 
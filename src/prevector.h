@@ -0,0 +1,352 @@
+// Copyright (c) 2009-2013 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_PREVECTOR_H
+#define BITCOIN_PREVECTOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <iterator>
+#include <new>
+#include <stdexcept>
+#include <vector>
+
+#include <boost/type_traits/integral_constant.hpp>
+#include <boost/type_traits/is_integral.hpp>
+
+/** STL-like vector that stores up to N elements in the object itself and
+ *  only allocates once it grows past that. Meant for short lived containers
+ *  that are nearly always small, like the script interpreter's stacks.
+ *
+ *  Iterators are plain pointers. Elements are copied, never moved, when the
+ *  storage is reallocated.
+ */
+template <unsigned int N, typename T>
+class prevector
+{
+public:
+    typedef T value_type;
+    typedef unsigned int size_type;
+    typedef ptrdiff_t difference_type;
+    typedef T& reference;
+    typedef const T& const_reference;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef T* iterator;
+    typedef const T* const_iterator;
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+private:
+    size_type nSize;
+    size_type nCapacity;
+    T* pbegin; // points into direct while nCapacity <= N
+    union
+    {
+        char buf[N * sizeof(T)];
+        int64_t nAlign;
+        double dAlign;
+        void* pAlign;
+    } direct;
+
+    T* direct_ptr() { return reinterpret_cast<T*>(direct.buf); }
+    bool is_direct() const { return nCapacity <= N; }
+
+    void init()
+    {
+        nSize = 0;
+        nCapacity = N;
+        pbegin = direct_ptr();
+    }
+
+    void destroy(T* first, T* last)
+    {
+        for (; first != last; ++first)
+            first->~T();
+    }
+
+    void grow(size_type nNewCapacity)
+    {
+        T* pnew = static_cast<T*>(::operator new(sizeof(T) * nNewCapacity));
+        size_type i = 0;
+        try
+        {
+            for (; i < nSize; i++)
+                new (pnew + i) T(pbegin[i]);
+        }
+        catch (...)
+        {
+            destroy(pnew, pnew + i);
+            ::operator delete(pnew);
+            throw;
+        }
+        destroy(pbegin, pbegin + nSize);
+        if (!is_direct())
+            ::operator delete(pbegin);
+        pbegin = pnew;
+        nCapacity = nNewCapacity;
+    }
+
+    void make_room(size_type nExtra)
+    {
+        if (nSize + nExtra > nCapacity)
+            grow(std::max(nSize + nExtra, nCapacity * 2));
+    }
+
+public:
+    prevector() { init(); }
+
+    explicit prevector(size_type n, const T& value = T())
+    {
+        init();
+        insert(end(), n, value);
+    }
+
+    template<typename InputIterator>
+    prevector(InputIterator first, InputIterator last)
+    {
+        init();
+        assign(first, last);
+    }
+
+    prevector(const prevector& other)
+    {
+        init();
+        assign(other.begin(), other.end());
+    }
+
+    ~prevector()
+    {
+        clear();
+        if (!is_direct())
+            ::operator delete(pbegin);
+    }
+
+    prevector& operator=(const prevector& other)
+    {
+        if (&other != this)
+            assign(other.begin(), other.end());
+        return *this;
+    }
+
+    template<typename InputIterator>
+    void assign(InputIterator first, InputIterator last)
+    {
+        clear();
+        insert(end(), first, last);
+    }
+
+    size_type size() const { return nSize; }
+    bool empty() const { return nSize == 0; }
+    size_type capacity() const { return nCapacity; }
+
+    void reserve(size_type n)
+    {
+        if (n > nCapacity)
+            grow(n);
+    }
+
+    iterator begin() { return pbegin; }
+    const_iterator begin() const { return pbegin; }
+    iterator end() { return pbegin + nSize; }
+    const_iterator end() const { return pbegin + nSize; }
+    reverse_iterator rbegin() { return reverse_iterator(end()); }
+    const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+    reverse_iterator rend() { return reverse_iterator(begin()); }
+    const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+
+    T* data() { return pbegin; }
+    const T* data() const { return pbegin; }
+
+    T& operator[](size_type pos) { return pbegin[pos]; }
+    const T& operator[](size_type pos) const { return pbegin[pos]; }
+
+    T& at(size_type pos)
+    {
+        if (pos >= nSize)
+            throw std::out_of_range("prevector::at() : out of range");
+        return pbegin[pos];
+    }
+
+    const T& at(size_type pos) const
+    {
+        if (pos >= nSize)
+            throw std::out_of_range("prevector::at() : out of range");
+        return pbegin[pos];
+    }
+
+    T& front() { return pbegin[0]; }
+    const T& front() const { return pbegin[0]; }
+    T& back() { return pbegin[nSize - 1]; }
+    const T& back() const { return pbegin[nSize - 1]; }
+
+    void push_back(const T& value)
+    {
+        if (nSize == nCapacity)
+        {
+            // value may live in this container
+            T copy(value);
+            make_room(1);
+            new (pbegin + nSize) T(copy);
+        }
+        else
+            new (pbegin + nSize) T(value);
+        nSize++;
+    }
+
+    void pop_back()
+    {
+        pbegin[--nSize].~T();
+    }
+
+    void clear()
+    {
+        destroy(pbegin, pbegin + nSize);
+        nSize = 0;
+    }
+
+    void resize(size_type n, const T& value = T())
+    {
+        if (n < nSize)
+        {
+            destroy(pbegin + n, pbegin + nSize);
+            nSize = n;
+        }
+        else if (n > nSize)
+            insert(end(), n - nSize, value);
+    }
+
+    iterator insert(iterator pos, const T& value)
+    {
+        return insert(pos, 1, value);
+    }
+
+    iterator insert(iterator pos, size_type n, const T& value)
+    {
+        size_type nPos = pos - pbegin;
+        if (n == 0)
+            return pos;
+        T copy(value);
+        make_room(n);
+        for (size_type i = 0; i < n; i++)
+            push_back_unchecked(copy);
+        std::rotate(pbegin + nPos, pbegin + nSize - n, pbegin + nSize);
+        return pbegin + nPos;
+    }
+
+    template<typename InputIterator>
+    iterator insert(iterator pos, InputIterator first, InputIterator last)
+    {
+        // prevector<N, int>(3, 0) is a count and a value, not a range
+        return insert_dispatch(pos, first, last, boost::is_integral<InputIterator>());
+    }
+
+    iterator erase(iterator pos)
+    {
+        return erase(pos, pos + 1);
+    }
+
+    iterator erase(iterator first, iterator last)
+    {
+        iterator newend = std::copy(last, end(), first);
+        destroy(newend, end());
+        nSize = newend - pbegin;
+        return first;
+    }
+
+    void swap(prevector& other)
+    {
+        if (!is_direct() && !other.is_direct())
+        {
+            std::swap(nSize, other.nSize);
+            std::swap(nCapacity, other.nCapacity);
+            std::swap(pbegin, other.pbegin);
+        }
+        else
+        {
+            prevector tmp(*this);
+            *this = other;
+            other = tmp;
+        }
+    }
+
+    bool operator==(const prevector& other) const
+    {
+        return nSize == other.nSize && std::equal(begin(), end(), other.begin());
+    }
+
+    bool operator!=(const prevector& other) const
+    {
+        return !(*this == other);
+    }
+
+    bool operator<(const prevector& other) const
+    {
+        return std::lexicographical_compare(begin(), end(), other.begin(), other.end());
+    }
+
+    // Bytes allocated outside the object
+    size_t allocated_memory() const
+    {
+        return is_direct() ? 0 : sizeof(T) * nCapacity;
+    }
+
+private:
+    void push_back_unchecked(const T& value)
+    {
+        new (pbegin + nSize) T(value);
+        nSize++;
+    }
+
+    template<typename Integer>
+    iterator insert_dispatch(iterator pos, Integer n, Integer value, boost::true_type)
+    {
+        return insert(pos, (size_type)n, (T)value);
+    }
+
+    template<typename InputIterator>
+    iterator insert_dispatch(iterator pos, InputIterator first, InputIterator last, boost::false_type)
+    {
+        size_type nPos = pos - pbegin;
+        size_type nOldSize = nSize;
+        size_type n = std::distance(first, last);
+        if (nSize + n > nCapacity)
+        {
+            // the range may live in this container
+            std::vector<T> vCopy(first, last);
+            make_room(n);
+            for (typename std::vector<T>::const_iterator it = vCopy.begin(); it != vCopy.end(); ++it)
+                push_back_unchecked(*it);
+        }
+        else
+        {
+            for (; first != last; ++first)
+                push_back_unchecked(*first);
+        }
+        std::rotate(pbegin + nPos, pbegin + nOldSize, pbegin + nSize);
+        return pbegin + nPos;
+    }
+};
+
+template <unsigned int N, typename T>
+inline void swap(prevector<N, T>& a, prevector<N, T>& b)
+{
+    a.swap(b);
+}
+
+/** Get begin pointer of prevector, as begin_ptr() does for std::vector */
+template <unsigned int N, typename T>
+inline T* begin_ptr(prevector<N, T>& v)
+{
+    return v.data();
+}
+
+template <unsigned int N, typename T>
+inline const T* begin_ptr(const prevector<N, T>& v)
+{
+    return v.data();
+}
+
+#endif
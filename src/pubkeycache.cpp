@@ -0,0 +1,119 @@
+// Copyright (c) 2009-2013 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "pubkeycache.h"
+
+#include "hash.h"
+
+using namespace std;
+
+CPubKeyCache pubkeyCache;
+
+CPubKeyCache::CPubKeyCache(size_t nMaxEntriesIn) : nMaxEntries(nMaxEntriesIn), nHits(0), nMisses(0), nEvictions(0)
+{
+}
+
+void CPubKeyCache::Trim()
+{
+    while (mapEntries.size() > nMaxEntries)
+    {
+        mapEntries.erase(listEntries.back().first);
+        listEntries.pop_back();
+        nEvictions++;
+    }
+    while (mapRecovered.size() > nMaxEntries)
+    {
+        mapRecovered.erase(listRecovered.back().first);
+        listRecovered.pop_back();
+        nEvictions++;
+    }
+}
+
+bool CPubKeyCache::Get(const CPubKey& pubkey, CPubKey& pubkeyRet)
+{
+    if (!pubkey.IsCompressed())
+    {
+        pubkeyRet = pubkey;
+        return pubkey.IsValid();
+    }
+
+    {
+        LOCK(cs);
+        map_type::iterator mi = mapEntries.find(pubkey);
+        if (mi != mapEntries.end())
+        {
+            listEntries.splice(listEntries.begin(), listEntries, mi->second);
+            pubkeyRet = mi->second->second;
+            nHits++;
+            return pubkeyRet.IsValid();
+        }
+        nMisses++;
+    }
+
+    // Decompress() asserts on a point that is not on the curve
+    pubkeyRet = CPubKey();
+    if (pubkey.IsFullyValid())
+    {
+        pubkeyRet = pubkey;
+        if (!pubkeyRet.Decompress())
+            pubkeyRet = CPubKey();
+    }
+
+    LOCK(cs);
+    if (nMaxEntries > 0 && !mapEntries.count(pubkey))
+    {
+        listEntries.push_front(make_pair(pubkey, pubkeyRet));
+        mapEntries.insert(make_pair(pubkey, listEntries.begin()));
+        Trim();
+    }
+    return pubkeyRet.IsValid();
+}
+
+bool CPubKeyCache::GetRecovered(const uint256& hash, const vector<unsigned char>& vchSig, CPubKey& pubkeyRet)
+{
+    uint256 hashEntry = Hash(hash.begin(), hash.end(), vchSig.begin(), vchSig.end());
+
+    {
+        LOCK(cs);
+        recovered_map_type::iterator mi = mapRecovered.find(hashEntry);
+        if (mi != mapRecovered.end())
+        {
+            listRecovered.splice(listRecovered.begin(), listRecovered, mi->second);
+            pubkeyRet = mi->second->second;
+            nHits++;
+            return pubkeyRet.IsValid();
+        }
+        nMisses++;
+    }
+
+    if (!pubkeyRet.RecoverCompact(hash, vchSig))
+        pubkeyRet = CPubKey();
+
+    LOCK(cs);
+    if (nMaxEntries > 0 && !mapRecovered.count(hashEntry))
+    {
+        listRecovered.push_front(make_pair(hashEntry, pubkeyRet));
+        mapRecovered.insert(make_pair(hashEntry, listRecovered.begin()));
+        Trim();
+    }
+    return pubkeyRet.IsValid();
+}
+
+void CPubKeyCache::SetMaxEntries(size_t nMaxEntriesIn)
+{
+    LOCK(cs);
+    nMaxEntries = nMaxEntriesIn;
+    Trim();
+}
+
+void CPubKeyCache::GetStats(CPubKeyCacheStats& statsRet) const
+{
+    LOCK(cs);
+    statsRet.nHits = nHits;
+    statsRet.nMisses = nMisses;
+    statsRet.nEvictions = nEvictions;
+    statsRet.nEntries = mapEntries.size();
+    statsRet.nRecoveredEntries = mapRecovered.size();
+    statsRet.nMaxEntries = nMaxEntries;
+}
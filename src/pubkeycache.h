@@ -0,0 +1,93 @@
+// Copyright (c) 2009-2013 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_PUBKEYCACHE_H
+#define BITCOIN_PUBKEYCACHE_H
+
+#include "key.h"
+#include "sync.h"
+
+#include <list>
+#include <map>
+
+/** Default and largest -pubkeycachesize, in keys */
+static const unsigned int DEFAULT_PUBKEY_CACHE_SIZE = 4096;
+static const unsigned int MAX_PUBKEY_CACHE_SIZE = 1000000;
+
+class CPubKeyCacheStats
+{
+public:
+    uint64_t nHits;
+    uint64_t nMisses;
+    uint64_t nEvictions;
+    unsigned int nEntries;
+    unsigned int nRecoveredEntries;
+    unsigned int nMaxEntries;
+
+    CPubKeyCacheStats() : nHits(0), nMisses(0), nEvictions(0), nEntries(0), nRecoveredEntries(0), nMaxEntries(0) {}
+
+    double GetHitRate() const
+    {
+        return (nHits + nMisses) ? (double)nHits / (nHits + nMisses) : 0.0;
+    }
+};
+
+/*
+ * Compressed public keys already parsed, keyed by their serialized bytes.
+ *
+ * A compressed key has to be decompressed, a modular square root, before a
+ * signature can be checked against it, by libsecp256k1 and OpenSSL alike.
+ * Most signatures the node checks are by a few keys seen over and over: the
+ * masternodes, pools and exchanges, and every message of the masternode,
+ * darksend and instantx protocols. This keeps the uncompressed form of the
+ * keys used most recently, and remembers keys that are not on the curve at
+ * all. Uncompressed keys parse cheaply and are not cached.
+ *
+ * Compact signatures name their key instead of being checked against one, so
+ * for those the key recovered from each (hash, signature) is kept instead,
+ * up to the same number of entries.
+ *
+ * Shared by all threads; the least recently used key goes first.
+ */
+class CPubKeyCache
+{
+private:
+    // Key -> its uncompressed form, or an invalid key if it is not a point
+    // on the curve. The list holds the most recently used first.
+    typedef std::list<std::pair<CPubKey, CPubKey> > list_type;
+    typedef std::map<CPubKey, list_type::iterator> map_type;
+    // Hash of (message hash, compact signature) -> the key it recovers to,
+    // or an invalid key if it recovers to none
+    typedef std::list<std::pair<uint256, CPubKey> > recovered_list_type;
+    typedef std::map<uint256, recovered_list_type::iterator> recovered_map_type;
+
+    mutable CCriticalSection cs;
+    list_type listEntries;
+    map_type mapEntries;
+    recovered_list_type listRecovered;
+    recovered_map_type mapRecovered;
+    size_t nMaxEntries;
+    uint64_t nHits;
+    uint64_t nMisses;
+    uint64_t nEvictions;
+
+    void Trim();
+
+public:
+    CPubKeyCache(size_t nMaxEntriesIn = DEFAULT_PUBKEY_CACHE_SIZE);
+
+    // Set pubkeyRet to the key in the form signatures are checked against
+    // fastest: uncompressed. False if pubkey is not a valid point.
+    bool Get(const CPubKey& pubkey, CPubKey& pubkeyRet);
+
+    // Set pubkeyRet to the key the compact signature vchSig of hash
+    // recovers to. False if it recovers to none.
+    bool GetRecovered(const uint256& hash, const std::vector<unsigned char>& vchSig, CPubKey& pubkeyRet);
+
+    void SetMaxEntries(size_t nMaxEntriesIn);
+    void GetStats(CPubKeyCacheStats& statsRet) const;
+};
+
+extern CPubKeyCache pubkeyCache;
+
+#endif // BITCOIN_PUBKEYCACHE_H
@@ -1375,11 +1375,7 @@ void BitcoinGUI::updateWeight()
     if (!lockMain)
         return;
 
-    TRY_LOCK(pwalletMain->cs_wallet, lockWallet);
-    if (!lockWallet)
-        return;
-
-    nWeight = pwalletMain->GetStakeWeight();
+    nWeight = pwalletMain->GetStakeWeight(nBestHeight);
 }
 
 void BitcoinGUI::updateStakingIcon()
@@ -53,61 +53,20 @@ bool RichListDB::Open(const char* pszMode)
     return true;
 };
 
-class RichListDbBatchScanner : public leveldb::WriteBatch::Handler
-{
-public:
-    std::string needle;
-    bool* deleted;
-    std::string* foundValue;
-    bool foundEntry;
-
-    RichListDbBatchScanner() : foundEntry(false) {}
-
-    virtual void Put(const leveldb::Slice& key, const leveldb::Slice& value)
-    {
-        if (key.ToString() == needle)
-        {
-            foundEntry = true;
-            *deleted = false;
-            *foundValue = value.ToString();
-        };
-    };
-
-    virtual void Delete(const leveldb::Slice& key)
-    {
-        if (key.ToString() == needle)
-        {
-            foundEntry = true;
-            *deleted = true;
-        };
-    };
-};
-
 bool RichListDB::ScanBatch(const CDataStream& key, std::string* value, bool* deleted) const
 {
     if (!activeBatch)
         return false;
 
     *deleted = false;
-    RichListDbBatchScanner scanner;
-    scanner.needle = key.str();
-    scanner.deleted = deleted;
-    scanner.foundValue = value;
-    leveldb::Status s = activeBatch->Iterate(&scanner);
-    if (!s.ok())
-    {
-        LogPrintf("RichListDB ScanBatch error: %s", s.ToString().c_str());
-        return false;
-    };
-
-    return scanner.foundEntry;
+    return activeBatch->Lookup(key.str(), value, deleted);
 }
 
 bool RichListDB::TxnBegin()
 {
     if (activeBatch)
         return true;
-    activeBatch = new leveldb::WriteBatch();
+    activeBatch = new CLevelDBBatch();
     return true;
 };
 
@@ -118,7 +77,7 @@ bool RichListDB::TxnCommit()
 
     leveldb::WriteOptions writeOptions;
     writeOptions.sync = true;
-    leveldb::Status status = pdb->Write(writeOptions, activeBatch);
+    leveldb::Status status = pdb->Write(writeOptions, activeBatch->GetBatch());
     delete activeBatch;
     activeBatch = NULL;
 
@@ -7,6 +7,7 @@
 #include "richlistdata.h"
 #include <leveldb/db.h>
 #include <leveldb/write_batch.h>
+#include "leveldbbatch.h"
 #include "db.h"
 
 extern CCriticalSection cs_richlistdb; // for locking leveldb operations
@@ -42,7 +43,7 @@ public:
     bool ReadRichList(CRichListData& richListData);
 
     leveldb::DB *pdb;       // points to the global instance
-    leveldb::WriteBatch *activeBatch;
+    CLevelDBBatch *activeBatch;
 
 };
 
@@ -7,6 +7,10 @@
 #include "main.h"
 #include "kernel.h"
 #include "checkpoints.h"
+#include "pubkeycache.h"
+#include "sigcache.h"
+#include "sigverify.h"
+#include "txdb.h"
 
 using namespace json_spirit;
 using namespace std;
@@ -196,6 +200,137 @@ Value getdifficulty(const Array& params, bool fHelp)
 }
 
 
+Value gethashstats(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "gethashstats\n"
+            "Returns how many transaction and block hashes were computed and how many\n"
+            "were answered from the memoized value, in total and for the last connected block.");
+
+    CHashCacheStats total = GetHashCacheStats();
+    CHashCacheStats last;
+    {
+        LOCK(cs_main);
+        last = hashCacheStatsLastConnect;
+    }
+
+    Object obj;
+    obj.push_back(Pair("txhashes",                   (uint64_t)total.nTxHashes));
+    obj.push_back(Pair("txhashhits",                 (uint64_t)total.nTxHits));
+    obj.push_back(Pair("blockhashes",                (uint64_t)total.nBlockHashes));
+    obj.push_back(Pair("blockhashhits",              (uint64_t)total.nBlockHits));
+
+    Object objLast;
+    objLast.push_back(Pair("txhashes",               (uint64_t)last.nTxHashes));
+    objLast.push_back(Pair("txhashhits",             (uint64_t)last.nTxHits));
+    objLast.push_back(Pair("blockhashes",            (uint64_t)last.nBlockHashes));
+    objLast.push_back(Pair("blockhashhits",          (uint64_t)last.nBlockHits));
+    obj.push_back(Pair("lastconnectblock",           objLast));
+    return obj;
+}
+
+
+Value getsigcacheinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getsigcacheinfo\n"
+            "Returns the size of the verified signature cache and how often it was used.");
+
+    uint64_t nHits, nMisses, nInserts, nEvictions;
+    signatureCache.GetStats(nHits, nMisses, nInserts, nEvictions);
+
+    Object obj;
+    obj.push_back(Pair("maxentries",                 (uint64_t)signatureCache.GetMaxEntries()));
+    obj.push_back(Pair("hits",                       nHits));
+    obj.push_back(Pair("misses",                     nMisses));
+    obj.push_back(Pair("inserts",                    nInserts));
+    obj.push_back(Pair("evictions",                  nEvictions));
+    return obj;
+}
+
+
+static Array HistogramToJSON(const uint64_t* vBuckets)
+{
+    Array ret;
+    for (unsigned int i = 0; i < CSigVerifyStats::HISTOGRAM_BUCKETS; i++)
+    {
+        if (vBuckets[i] == 0)
+            continue;
+        Object bucket;
+        bucket.push_back(Pair("from",                (uint64_t)1 << i));
+        bucket.push_back(Pair("count",               vBuckets[i]));
+        ret.push_back(bucket);
+    }
+    return ret;
+}
+
+Value getsigverifyinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getsigverifyinfo\n"
+            "Returns statistics of the signature verification service: signatures\n"
+            "verified, batch sizes, the parsed public key cache, and histograms of\n"
+            "batch sizes and of the time from submitting a batch to its results and\n"
+            "of single verifications, in microseconds. Each histogram bucket counts\n"
+            "the values from \"from\" up to twice that.");
+
+    CSigVerifyStats stats;
+    sigverifier.GetStats(stats);
+    CPubKeyCacheStats cachestats;
+    pubkeyCache.GetStats(cachestats);
+
+    Object obj;
+    obj.push_back(Pair("verified",                   stats.nVerified));
+    obj.push_back(Pair("invalid",                    stats.nInvalid));
+    obj.push_back(Pair("single",                     stats.nSingle));
+    obj.push_back(Pair("batches",                    stats.nBatches));
+    obj.push_back(Pair("duplicates",                 stats.nDuplicates));
+    obj.push_back(Pair("pubkeyhits",                 cachestats.nHits));
+    obj.push_back(Pair("pubkeymisses",               cachestats.nMisses));
+    obj.push_back(Pair("pubkeyevictions",            cachestats.nEvictions));
+    obj.push_back(Pair("pubkeyentries",              (int)cachestats.nEntries));
+    obj.push_back(Pair("recoveredentries",           (int)cachestats.nRecoveredEntries));
+    obj.push_back(Pair("pubkeymaxentries",           (int)cachestats.nMaxEntries));
+    obj.push_back(Pair("batchsizes",                 HistogramToJSON(stats.vBatchSize)));
+    obj.push_back(Pair("batchmicros",                HistogramToJSON(stats.vBatchMicros)));
+    obj.push_back(Pair("singlemicros",               HistogramToJSON(stats.vSingleMicros)));
+    return obj;
+}
+
+
+Value getdbstats(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getdbstats\n"
+            "Returns LevelDB's own statistics, the approximate size on disk of each\n"
+            "kind of record in the transaction database and the block commits not yet written.");
+
+    CTxDB txdb("r");
+
+    Object obj;
+    string strStats;
+    if (txdb.GetProperty("leveldb.stats", strStats))
+        obj.push_back(Pair("leveldb.stats",          strStats));
+
+    Object objSizes;
+    const char* pszTypes[] = { "tx", "blockindex", "adx", "adr" };
+    for (unsigned int i = 0; i < sizeof(pszTypes) / sizeof(pszTypes[0]); i++)
+        objSizes.push_back(Pair(pszTypes[i],         txdb.GetApproximateSize(pszTypes[i])));
+    obj.push_back(Pair("approximatesizes",           objSizes));
+
+    unsigned int nCommits;
+    size_t nBytes;
+    txdb.GetDeferredStats(nCommits, nBytes);
+    obj.push_back(Pair("pendingcommits",             (int)nCommits));
+    obj.push_back(Pair("pendingbytes",               (uint64_t)nBytes));
+    return obj;
+}
+
+
 Value getrawmempool(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() != 0)
@@ -262,13 +397,7 @@ Value getblockbynumber(const Array& params, bool fHelp)
         throw runtime_error("Block number out of range.");
 
     CBlock block;
-    CBlockIndex* pblockindex = mapBlockIndex[hashBestChain];
-    while (pblockindex->nHeight > nHeight)
-        pblockindex = pblockindex->pprev;
-
-    uint256 hash = *pblockindex->phashBlock;
-
-    pblockindex = mapBlockIndex[hash];
+    CBlockIndex* pblockindex = FindBlockByHeight(nHeight);
     block.ReadFromDisk(pblockindex, true);
 
     return blockToJSON(block, pblockindex, params.size() > 1 ? params[1].get_bool() : false);
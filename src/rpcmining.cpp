@@ -11,6 +11,7 @@
 #include "init.h"
 #include "miner.h"
 #include "kernel.h"
+#include "kernelsearch.h"
 
 #include <boost/assign/list_of.hpp>
 
@@ -83,9 +84,12 @@ Value getmininginfo(const Array& params, bool fHelp)
             "getmininginfo\n"
             "Returns an object containing mining-related information.");
 
+    LOCK(cs_main);
+
+    // The wallet keeps its stake weight up to date, it needs no cs_wallet
     uint64_t nWeight = 0;
     if (pwalletMain)
-        nWeight = pwalletMain->GetStakeWeight();
+        nWeight = pwalletMain->GetStakeWeight(nBestHeight);
 
     Object obj, diff, weight;
     obj.push_back(Pair("blocks",        (int)nBestHeight));
@@ -119,9 +123,11 @@ Value getstakinginfo(const Array& params, bool fHelp)
             "getstakinginfo\n"
             "Returns an object containing staking-related information.");
 
+    LOCK(cs_main);
+
     uint64_t nWeight = 0;
     if (pwalletMain)
-        nWeight = pwalletMain->GetStakeWeight();
+        nWeight = pwalletMain->GetStakeWeight(nBestHeight);
 
     uint64_t nNetworkWeight = GetPoSKernelPS();
     bool staking = nLastCoinStakeSearchInterval && nWeight;
@@ -145,6 +151,35 @@ Value getstakinginfo(const Array& params, bool fHelp)
 
     obj.push_back(Pair("expectedtime", nExpectedTime));
 
+    if (pwalletMain)
+    {
+        uint64_t nHits, nMisses;
+        pwalletMain->stakeKernelCache.GetStats(nHits, nMisses);
+        Object kernelcache;
+        kernelcache.push_back(Pair("entries", (uint64_t)pwalletMain->stakeKernelCache.size()));
+        kernelcache.push_back(Pair("hits", nHits));
+        kernelcache.push_back(Pair("misses", nMisses));
+        obj.push_back(Pair("kernelcache", kernelcache));
+
+        CKernelSearchStats searchStats;
+        GetKernelSearchStats(searchStats);
+        obj.push_back(Pair("stakethreads", nStakeSearchThreads));
+        obj.push_back(Pair("kernelhashes", searchStats.nHashes));
+        obj.push_back(Pair("kernelhashps", searchStats.GetHashesPerSec()));
+        obj.push_back(Pair("lastsearchtime", (double)searchStats.nLastMicros / 1000));
+
+        CStakeMinerStats minerStats;
+        GetStakeMinerStats(minerStats);
+        Object rounds;
+        rounds.push_back(Pair("count", minerStats.nRounds));
+        rounds.push_back(Pair("templates", minerStats.nTemplates));
+        rounds.push_back(Pair("lasttime", minerStats.nLastRoundTime));
+        rounds.push_back(Pair("lastround", (double)minerStats.nLastRoundMicros / 1000));
+        rounds.push_back(Pair("lasttemplate", (double)minerStats.nLastTemplateMicros / 1000));
+        rounds.push_back(Pair("lastlatency", (double)minerStats.nLastLatencyMicros / 1000));
+        obj.push_back(Pair("rounds", rounds));
+    }
+
     return obj;
 }
 
@@ -218,6 +253,7 @@ Value checkkernel(const Array& params, bool fHelp)
     auto_ptr<CBlock> pblock(CreateNewBlock(*pMiningKey, true, &nFees));
 
     pblock->nTime = pblock->vtx[0].nTime = nTime;
+    pblock->vtx[0].InvalidateHash();
 
     CDataStream ss(SER_DISK, PROTOCOL_VERSION);
     ss << *pblock;
@@ -355,8 +391,9 @@ Value getworkex(const Array& params, bool fHelp)
             pblock->vtx[0].vin[0].scriptSig = mapNewBlock[pdata->hashMerkleRoot].second;
         else
             CDataStream(coinbase, SER_NETWORK, PROTOCOL_VERSION) >> pblock->vtx[0]; // FIXME - HACK!
+        pblock->vtx[0].InvalidateHash();
 
-        pblock->hashMerkleRoot = pblock->BuildMerkleTree();
+        pblock->hashMerkleRoot = pblock->UpdateMerkleTree(0);
 
         assert(pwalletMain != NULL);
         return CheckWork(pblock, *pwalletMain, *pMiningKey);
@@ -472,7 +509,8 @@ Value getwork(const Array& params, bool fHelp)
         pblock->nTime = pdata->nTime;
         pblock->nNonce = pdata->nNonce;
         pblock->vtx[0].vin[0].scriptSig = mapNewBlock[pdata->hashMerkleRoot].second;
-        pblock->hashMerkleRoot = pblock->BuildMerkleTree();
+        pblock->vtx[0].InvalidateHash();
+        pblock->hashMerkleRoot = pblock->UpdateMerkleTree(0);
 
         assert(pwalletMain != NULL);
         return CheckWork(pblock, *pwalletMain, *pMiningKey);
@@ -8,6 +8,7 @@
 #include "main.h"
 #include "net.h"
 #include "netbase.h"
+#include "pubkeycache.h"
 #include "rpcserver.h"
 #include "timedata.h"
 #include "util.h"
@@ -62,6 +63,10 @@ Value getinfo(const Array& params, bool fHelp)
     obj.push_back(Pair("difficulty",    diff));
 
     obj.push_back(Pair("testnet",       TestNet()));
+
+    CPubKeyCacheStats cachestats;
+    pubkeyCache.GetStats(cachestats);
+    obj.push_back(Pair("pubkeycachehitrate", cachestats.GetHitRate()));
 #ifdef ENABLE_WALLET
     if (pwalletMain) {
         obj.push_back(Pair("keypoololdest", (int64_t)pwalletMain->GetOldestKeyPoolTime()));
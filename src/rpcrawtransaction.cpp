@@ -519,6 +519,7 @@ Value signrawtransaction(const Array& params, bool fHelp)
     bool fHashSingle = ((nHashType & ~SIGHASH_ANYONECANPAY) == SIGHASH_SINGLE);
 
     // Sign what we can:
+    CSignatureHashCache sighashes(mergedTx);
     for (unsigned int i = 0; i < mergedTx.vin.size(); i++)
     {
         CTxIn& txin = mergedTx.vin[i];
@@ -532,14 +533,15 @@ Value signrawtransaction(const Array& params, bool fHelp)
         txin.scriptSig.clear();
         // Only sign SIGHASH_SINGLE if there's a corresponding output:
         if (!fHashSingle || (i < mergedTx.vout.size()))
-            SignSignature(keystore, prevPubKey, mergedTx, i, nHashType);
+            SignSignature(keystore, prevPubKey, mergedTx, i, nHashType, &sighashes);
 
         // ... and merge in other signatures:
         BOOST_FOREACH(const CTransaction& txv, txVariants)
         {
-            txin.scriptSig = CombineSignatures(prevPubKey, mergedTx, i, txin.scriptSig, txv.vin[i].scriptSig);
+            txin.scriptSig = CombineSignatures(prevPubKey, mergedTx, i, txin.scriptSig, txv.vin[i].scriptSig, &sighashes);
         }
-        if (!VerifyScript(txin.scriptSig, prevPubKey, mergedTx, i, STANDARD_SCRIPT_VERIFY_FLAGS, 0))
+        mergedTx.InvalidateHash();
+        if (!VerifyScript(txin.scriptSig, prevPubKey, STANDARD_SCRIPT_VERIFY_FLAGS, SignatureChecker(mergedTx, i, &sighashes)))
             fComplete = false;
     }
 
@@ -609,10 +611,6 @@ Value searchrawtransactions(const Array &params, bool fHelp)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid Bitcoin address");
     CTxDestination dest = address.Get();
 
-    std::vector<uint256> vtxhash;
-    if (!FindTransactionsByDestination(dest, vtxhash))
-        throw JSONRPCError(RPC_DATABASE_ERROR, "Cannot search for address");
-
     int nSkip = 0;
     int nCount = 100;
     bool fVerbose = true;
@@ -623,18 +621,34 @@ Value searchrawtransactions(const Array &params, bool fHelp)
     if (params.size() > 3)
         nCount = params[3].get_int();
 
-    if (nSkip < 0)
-        nSkip += vtxhash.size();
-    if (nSkip < 0)
-        nSkip = 0;
     if (nCount < 0)
         nCount = 0;
 
+    std::vector<uint256> vtxhash;
+    if (nSkip >= 0)
+    {
+        // page through the index directly
+        if (!FindTransactionsByDestination(dest, vtxhash, nSkip, nCount))
+            throw JSONRPCError(RPC_DATABASE_ERROR, "Cannot search for address");
+    }
+    else
+    {
+        // negative skip counts from the most recent transaction, so the
+        // whole history is needed to find where to start
+        if (!FindTransactionsByDestination(dest, vtxhash))
+            throw JSONRPCError(RPC_DATABASE_ERROR, "Cannot search for address");
+        nSkip += vtxhash.size();
+        if (nSkip < 0)
+            nSkip = 0;
+        vtxhash.erase(vtxhash.begin(), vtxhash.begin() + nSkip);
+        if ((int)vtxhash.size() > nCount)
+            vtxhash.resize(nCount);
+    }
+
     std::vector<uint256>::const_iterator it = vtxhash.begin();
-    while (it != vtxhash.end() && nSkip--) it++;
 
     Array result;
-    while (it != vtxhash.end() && nCount--) {
+    while (it != vtxhash.end()) {
         CTransaction tx;
         uint256 hashBlock;
         if (!GetTransaction(*it, tx, hashBlock))
@@ -229,6 +229,10 @@ static const CRPCCommand vRPCCommands[] =
     { "ping",                   &ping,                   true,      false,     false },
     { "getnettotals",           &getnettotals,           true,      true,      false },
     { "getdifficulty",          &getdifficulty,          true,      false,     false },
+    { "gethashstats",           &gethashstats,           true,      false,     false },
+    { "getdbstats",             &getdbstats,             true,      false,     false },
+    { "getsigcacheinfo",        &getsigcacheinfo,        true,      false,     false },
+    { "getsigverifyinfo",       &getsigverifyinfo,       true,      false,     false },
     { "getinfo",                &getinfo,                true,      false,     false },
     { "getrawmempool",          &getrawmempool,          true,      false,     false },
     { "getblock",               &getblock,               false,     false,     false },
@@ -261,8 +265,8 @@ static const CRPCCommand vRPCCommands[] =
 
 
 #ifdef ENABLE_WALLET
-    { "getmininginfo",          &getmininginfo,          true,      false,     false },
-    { "getstakinginfo",         &getstakinginfo,         true,      false,     false },
+    { "getmininginfo",          &getmininginfo,          true,      true,      false },
+    { "getstakinginfo",         &getstakinginfo,         true,      true,      false },
     { "getnewaddress",          &getnewaddress,          true,      false,     true },
     { "getnewpubkey",           &getnewpubkey,           true,      false,     true },
     { "getaccountaddress",      &getaccountaddress,      true,      false,     true },
@@ -172,6 +172,10 @@ extern json_spirit::Value sendrawtransaction(const json_spirit::Array& params, b
 extern json_spirit::Value getbestblockhash(const json_spirit::Array& params, bool fHelp); // in rpcblockchain.cpp
 extern json_spirit::Value getblockcount(const json_spirit::Array& params, bool fHelp); // in rpcblockchain.cpp
 extern json_spirit::Value getdifficulty(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value gethashstats(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getdbstats(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getsigcacheinfo(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getsigverifyinfo(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value settxfee(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getrawmempool(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getblockhash(const json_spirit::Array& params, bool fHelp);
@@ -14,17 +14,25 @@
 #include <boost/foreach.hpp>
 #include <boost/variant.hpp>
 
+#include "crypto/sha256.h"
 #include "keystore.h"
 #include "bignum.h"
+#include "prevector.h"
 #include "util.h"
 #include "stealth.h"
 
 typedef std::vector<unsigned char> valtype;
 
+/** Stack of the script interpreter. Elements of up to 75 bytes, everything a
+ *  single byte push opcode can push including signatures and public keys,
+ *  are stored inline, as are the first 16 elements. */
+typedef prevector<16, prevector<75, unsigned char> > CScriptStack;
+
 class CKeyStore;
 class CTransaction;
 
 class BaseSignatureChecker;
+class CSignatureHashCache;
 
 static const unsigned int MAX_SCRIPT_ELEMENT_SIZE = 520; // bytes
 static const unsigned int MAX_OP_RETURN_RELAY = 40;      // bytes
@@ -97,7 +105,7 @@ enum
 enum
 {
     SCRIPT_VERIFY_NONE      = 0,
-    SCRIPT_VERIFY_NOCACHE   = (1U << 0),
+
     // Evaluate P2SH subscripts (softfork safe, BIP16).
     SCRIPT_VERIFY_P2SH      = (1U << 0),
 
@@ -134,8 +142,12 @@ enum
     // discouraged NOPs fails the script. This verification flag will never be
     // a mandatory flag applied to scripts in a block. NOPs that are not
     // executed, e.g.  within an unexecuted IF ENDIF block, are *not* rejected.
-    SCRIPT_VERIFY_DISCOURAGE_UPGRADABLE_NOPS  = (1U << 7)
+    SCRIPT_VERIFY_DISCOURAGE_UPGRADABLE_NOPS  = (1U << 7),
 
+    // Not a script rule: signatures verified under this flag are not added
+    // to the signature cache (used when connecting blocks, whose signatures
+    // will not be seen again).
+    SCRIPT_VERIFY_NOCACHE   = (1U << 8)
 };
 
 // Mandatory script verification flags that all new blocks must comply with for
@@ -143,13 +155,14 @@ enum
 //
 // Failing one of these tests may trigger a DoS ban - see ConnectInputs() for
 // details.
-static const unsigned int MANDATORY_SCRIPT_VERIFY_FLAGS = SCRIPT_VERIFY_NONE;
+static const unsigned int MANDATORY_SCRIPT_VERIFY_FLAGS = SCRIPT_VERIFY_P2SH;
 
 // Standard script verification flags that standard transactions will comply
 // with. However scripts violating these flags may still be present in valid
 // blocks and we must accept those blocks.
 static const unsigned int STANDARD_SCRIPT_VERIFY_FLAGS = MANDATORY_SCRIPT_VERIFY_FLAGS |
                                                          SCRIPT_VERIFY_STRICTENC |
+                                                         SCRIPT_VERIFY_LOW_S |
                                                          SCRIPT_VERIFY_NULLDUMMY |
                                                          SCRIPT_VERIFY_DISCOURAGE_UPGRADABLE_NOPS;
 
@@ -333,27 +346,6 @@ enum opcodetype
 const char* GetOpName(opcodetype opcode);
 
 
-
-inline std::string ValueString(const std::vector<unsigned char>& vch)
-{
-    if (vch.size() <= 4)
-        return strprintf("%d", CBigNum(vch).getint());
-    else
-        return HexStr(vch);
-}
-
-inline std::string StackString(const std::vector<std::vector<unsigned char> >& vStack)
-{
-    std::string str;
-    BOOST_FOREACH(const std::vector<unsigned char>& vch, vStack)
-    {
-        if (!str.empty())
-            str += " ";
-        str += ValueString(vch);
-    }
-    return str;
-}
-
 class scriptnum_error : public std::runtime_error
 {
 public:
@@ -377,7 +369,9 @@ public:
         m_value = n;
     }
 
-    explicit CScriptNum(const std::vector<unsigned char>& vch, bool fRequireMinimal)
+    // vch is a std::vector or a stack element of the interpreter
+    template<typename T>
+    explicit CScriptNum(const T& vch, bool fRequireMinimal)
     {
         if (vch.size() > nMaxNumSize) {
             throw scriptnum_error("script number overflow");
@@ -467,14 +461,29 @@ public:
         return serialize(m_value);
     }
 
+    template<typename T>
+    void getvch(T& vchRet) const
+    {
+        serialize(m_value, vchRet);
+    }
+
     static std::vector<unsigned char> serialize(const int64_t& value)
     {
+        std::vector<unsigned char> result;
+        serialize(value, result);
+        return result;
+    }
+
+    template<typename T>
+    static void serialize(const int64_t& value, T& result)
+    {
+        result.clear();
         if(value == 0)
-            return std::vector<unsigned char>();
+            return;
 
-        std::vector<unsigned char> result;
         const bool neg = value < 0;
-        uint64_t absvalue = neg ? -value : value;
+        // negate as unsigned, -value overflows for the minimum int64_t
+        uint64_t absvalue = neg ? -(uint64_t)value : (uint64_t)value;
 
         while(absvalue)
         {
@@ -496,14 +505,13 @@ public:
             result.push_back(neg ? 0x80 : 0);
         else if (neg)
             result.back() |= 0x80;
-
-        return result;
     }
 
     static const size_t nMaxNumSize = 4;
 
 private:
-    static int64_t set_vch(const std::vector<unsigned char>& vch)
+    template<typename T>
+    static int64_t set_vch(const T& vch)
     {
       if (vch.empty())
           return 0;
@@ -523,6 +531,26 @@ private:
     int64_t m_value;
 };
 
+inline std::string ValueString(const std::vector<unsigned char>& vch)
+{
+    if (vch.size() <= 4)
+        return strprintf("%d", CScriptNum(vch, false).getint());
+    else
+        return HexStr(vch);
+}
+
+inline std::string StackString(const std::vector<std::vector<unsigned char> >& vStack)
+{
+    std::string str;
+    BOOST_FOREACH(const std::vector<unsigned char>& vch, vStack)
+    {
+        if (!str.empty())
+            str += " ";
+        str += ValueString(vch);
+    }
+    return str;
+}
+
 
 
 
@@ -538,8 +566,7 @@ protected:
         }
         else
         {
-            CBigNum bn(n);
-            *this << bn.getvch();
+            *this << CScriptNum::serialize(n);
         }
         return *this;
     }
@@ -694,7 +721,7 @@ public:
     bool GetOp(iterator& pc, opcodetype& opcodeRet)
     {
          const_iterator pc2 = pc;
-         bool fRet = GetOp2(pc2, opcodeRet, NULL);
+         bool fRet = GetOp2(pc2, opcodeRet, (std::vector<unsigned char>*)NULL);
          pc = begin() + (pc2 - begin());
          return fRet;
     }
@@ -706,10 +733,19 @@ public:
 
     bool GetOp(const_iterator& pc, opcodetype& opcodeRet) const
     {
-        return GetOp2(pc, opcodeRet, NULL);
+        return GetOp2(pc, opcodeRet, (std::vector<unsigned char>*)NULL);
+    }
+
+    // Reads the pushed data into any container with assign(), such as a
+    // stack element of the interpreter
+    template<typename T>
+    bool GetOp(const_iterator& pc, opcodetype& opcodeRet, T& vchRet) const
+    {
+        return GetOp2(pc, opcodeRet, &vchRet);
     }
 
-    bool GetOp2(const_iterator& pc, opcodetype& opcodeRet, std::vector<unsigned char>* pvchRet) const
+    template<typename T>
+    bool GetOp2(const_iterator& pc, opcodetype& opcodeRet, T* pvchRet) const
     {
         opcodeRet = OP_INVALIDOPCODE;
         if (pvchRet)
@@ -950,7 +986,7 @@ public:
 
 
 bool IsDERSignature(const valtype &vchSig, bool haveHashType = true);
-bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType);
+bool EvalScript(CScriptStack& stack, const CScript& script, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* error = NULL);
 bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript& script, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* error = NULL);
 bool Solver(const CScript& scriptPubKey, txnouttype& typeRet, std::vector<std::vector<unsigned char> >& vSolutionsRet);
 int ScriptSigArgsExpected(txnouttype t, const std::vector<std::vector<unsigned char> >& vSolutions);
@@ -960,23 +996,59 @@ bool IsMine(const CKeyStore& keystore, const CTxDestination &dest);
 void ExtractAffectedKeys(const CKeyStore &keystore, const CScript& scriptPubKey, std::vector<CKeyID> &vKeys);
 bool ExtractDestination(const CScript& scriptPubKey, CTxDestination& addressRet);
 bool ExtractDestinations(const CScript& scriptPubKey, txnouttype& typeRet, std::vector<CTxDestination>& addressRet, int& nRequiredRet);
-bool SignSignature(const CKeyStore& keystore, const CScript& fromPubKey, CTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL);
-bool SignSignature(const CKeyStore& keystore, const CTransaction& txFrom, CTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL);
-bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType);
-bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType);
+bool SignSignature(const CKeyStore& keystore, const CScript& fromPubKey, CTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL, const CSignatureHashCache* psighashes = NULL);
+bool SignSignature(const CKeyStore& keystore, const CTransaction& txFrom, CTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL, const CSignatureHashCache* psighashes = NULL);
+bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsigned int nIn, unsigned int flags);
+// Verify a spend of a standard scriptPubKey (or P2SH redeem script) without
+// running the interpreter. Returns true only where VerifyScript would; false
+// means the spend has to go through EvalScript.
+bool VerifyStandardScript(const CScript& scriptSig, const CScript& scriptPubKey, unsigned int flags, const BaseSignatureChecker& checker);
+// VerifyStandardScript for pay-to-pubkey and pay-to-pubkey-hash spends only,
+// bare or through P2SH. These are decided by exactly one signature check, so
+// a checker may report it valid and leave the actual verification for later:
+// the spend is valid if this returns true and that signature verifies.
+bool VerifySingleSigScript(const CScript& scriptSig, const CScript& scriptPubKey, unsigned int flags, const BaseSignatureChecker& checker);
 
 bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* error = NULL);
 
 // Given two sets of signatures for scriptPubKey, possibly with OP_0 placeholders,
 // combine them intelligently and return the result.
-CScript CombineSignatures(CScript scriptPubKey, const CTransaction& txTo, unsigned int nIn, const CScript& scriptSig1, const CScript& scriptSig2);
+CScript CombineSignatures(CScript scriptPubKey, const CTransaction& txTo, unsigned int nIn, const CScript& scriptSig1, const CScript& scriptSig2, const CSignatureHashCache* psighashes = NULL);
 
 CScript GetScriptForDestination(const CTxDestination& dest);
 CScript GetScriptForMultisig(int nRequired, const std::vector<CPubKey>& keys);
 
 bool Solver(const CKeyStore& keystore, const CScript& scriptPubKey, uint256 hash, int nHashType,
                   CScript& scriptSigRet, txnouttype& whichTypeRet);
-//uint256 SignatureHash(const CScript &scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType);
+uint256 SignatureHash(CScript scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType);
+
+/** The parts of a transaction that SignatureHash serializes identically for
+ *  every input: the inputs with their scriptSigs blanked, the outputs, and
+ *  the SHA256 state after each prefix of blanked inputs. SignatureHash
+ *  copies and reserializes the whole transaction for each input it signs or
+ *  checks, which makes a transaction quadratic to verify in its number of
+ *  inputs; build one of these per transaction instead and share it across
+ *  inputs. Only the scriptSigs of txTo may change while it is in use.
+ */
+class CSignatureHashCache
+{
+private:
+    const CTransaction& txTo;
+    std::vector<unsigned char> vchHeader;      // nVersion, nTime
+    std::vector<unsigned char> vchInputs;      // blanked inputs
+    std::vector<unsigned char> vchInputsNoSeq; // blanked inputs with nSequence 0
+    std::vector<size_t> vInputPos;             // offset of input i in both, and the end
+    std::vector<unsigned char> vchOutputs;     // output count and outputs
+    std::vector<size_t> vOutputPos;            // offset of output i, and the end
+    std::vector<unsigned char> vchNullOutput;
+    std::vector<CSHA256> vMidstate;            // after header, count and vchInputs up to input i
+
+public:
+    explicit CSignatureHashCache(const CTransaction& txToIn);
+
+    // Same result as ::SignatureHash(scriptCode, txTo, nIn, nHashType)
+    uint256 SignatureHash(CScript scriptCode, unsigned int nIn, int nHashType) const;
+};
 
 
 class BaseSignatureChecker
@@ -995,12 +1067,13 @@ class SignatureChecker : public BaseSignatureChecker
 private:
     const CTransaction& txTo;
     unsigned int nIn;
+    const CSignatureHashCache* psighashes;
 
 protected:
     virtual bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
 
 public:
-    SignatureChecker(const CTransaction& txToIn, unsigned int nInIn) : txTo(txToIn), nIn(nInIn) {}
+    SignatureChecker(const CTransaction& txToIn, unsigned int nInIn, const CSignatureHashCache* psighashesIn = NULL) : txTo(txToIn), nIn(nInIn), psighashes(psighashesIn) {}
     bool CheckSig(const std::vector<unsigned char>& scriptSig, const std::vector<unsigned char>& vchPubKey, const CScript& scriptCode) const;
 };
 
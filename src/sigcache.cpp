@@ -0,0 +1,134 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2013 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "sigcache.h"
+
+#include "crypto/sha256.h"
+#include "sigverify.h"
+#include "util.h"
+
+#include <limits>
+
+using namespace std;
+
+CSignatureCache signatureCache;
+
+CSignatureCache::CSignatureCache() : salt(0), nBuckets(0), nHits(0), nMisses(0), nInserts(0), nEvictions(0)
+{
+}
+
+void CSignatureCache::SetMaxSize(size_t nMaxSizeBytes)
+{
+    boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
+    salt = GetRandHash();
+    nBuckets = nMaxSizeBytes / (sizeof(uint256) * BUCKET_ENTRIES);
+    vTable.assign(nBuckets * BUCKET_ENTRIES, uint256(0));
+}
+
+uint256 CSignatureCache::ComputeEntry(const uint256& sighash, const vector<unsigned char>& vchSig, const CPubKey& pubkey) const
+{
+    uint256 entry;
+    CSHA256 hasher;
+    hasher.Write(salt.begin(), 32).Write(sighash.begin(), 32).Write(pubkey.begin(), pubkey.size());
+    if (!vchSig.empty())
+        hasher.Write(&vchSig[0], vchSig.size());
+    hasher.Finalize(entry.begin());
+    // all-zero marks a free slot
+    if (entry == 0)
+        entry = 1;
+    return entry;
+}
+
+size_t CSignatureCache::GetBucket(const uint256& entry) const
+{
+    return (size_t)(entry.Get64(0) % nBuckets);
+}
+
+size_t CSignatureCache::GetMaxEntries() const
+{
+    boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
+    return vTable.size();
+}
+
+bool CSignatureCache::Get(const uint256& sighash, const vector<unsigned char>& vchSig, const CPubKey& pubkey)
+{
+    boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
+    if (nBuckets == 0)
+        return false;
+
+    uint256 entry = ComputeEntry(sighash, vchSig, pubkey);
+    size_t nFirst = GetBucket(entry) * BUCKET_ENTRIES;
+    for (size_t i = nFirst; i < nFirst + BUCKET_ENTRIES; i++)
+    {
+        if (vTable[i] == entry)
+        {
+            __sync_fetch_and_add(&nHits, 1);
+            return true;
+        }
+    }
+    __sync_fetch_and_add(&nMisses, 1);
+    return false;
+}
+
+void CSignatureCache::Set(const uint256& sighash, const vector<unsigned char>& vchSig, const CPubKey& pubkey)
+{
+    boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
+    if (nBuckets == 0)
+        return;
+
+    uint256 entry = ComputeEntry(sighash, vchSig, pubkey);
+    size_t nFirst = GetBucket(entry) * BUCKET_ENTRIES;
+    size_t nFree = nFirst + BUCKET_ENTRIES;
+    for (size_t i = nFirst; i < nFirst + BUCKET_ENTRIES; i++)
+    {
+        if (vTable[i] == entry)
+            return;
+        if (vTable[i] == 0 && nFree == nFirst + BUCKET_ENTRIES)
+            nFree = i;
+    }
+
+    if (nFree == nFirst + BUCKET_ENTRIES)
+    {
+        // Bucket full: evict a random half of it
+        unsigned int nEvict = 0;
+        uint64_t nRand = GetRand(std::numeric_limits<uint64_t>::max());
+        for (unsigned int i = 0; i < BUCKET_ENTRIES && nEvict < BUCKET_ENTRIES / 2; i++)
+        {
+            if (!((nRand >> i) & 1) && BUCKET_ENTRIES - i > BUCKET_ENTRIES / 2 - nEvict)
+                continue;
+            vTable[nFirst + i] = 0;
+            nEvict++;
+        }
+        nFree = nFirst;
+        while (vTable[nFree] != 0)
+            nFree++;
+        nEvictions += nEvict;
+    }
+
+    vTable[nFree] = entry;
+    nInserts++;
+}
+
+void CSignatureCache::GetStats(uint64_t& nHitsRet, uint64_t& nMissesRet, uint64_t& nInsertsRet, uint64_t& nEvictionsRet) const
+{
+    boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
+    nHitsRet = nHits;
+    nMissesRet = nMisses;
+    nInsertsRet = nInserts;
+    nEvictionsRet = nEvictions;
+}
+
+bool CachingSignatureChecker::VerifySignature(const vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
+{
+    if (signatureCache.Get(sighash, vchSig, pubkey))
+        return true;
+
+    if (!sigverifier.Verify(CSigVerifyItem(sighash, vchSig, pubkey)))
+        return false;
+
+    if (store)
+        signatureCache.Set(sighash, vchSig, pubkey);
+    return true;
+}
@@ -0,0 +1,83 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2013 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_SIGCACHE_H
+#define BITCOIN_SIGCACHE_H
+
+#include "key.h"
+#include "script.h"
+#include "sync.h"
+#include "uint256.h"
+
+#include <vector>
+
+#include <boost/thread/shared_mutex.hpp>
+
+/** Default and largest -sigcachesize, in megabytes */
+static const unsigned int DEFAULT_MAX_SIG_CACHE_SIZE = 32;
+static const unsigned int MAX_MAX_SIG_CACHE_SIZE = 1024;
+
+/*
+ * Valid signature cache, to avoid doing expensive ECDSA signature checking
+ * twice for every transaction (once when accepted into memory pool, and
+ * again when accepted into the block chain).
+ *
+ * Each valid (signature hash, public key, signature) is stored as a single
+ * salted SHA256 of the three, in a table of buckets allocated once at
+ * startup. Lookups take a shared lock, so they run in parallel with each
+ * other and only wait for inserts, which take it exclusively. When a bucket
+ * is full, half of it, picked at random, is evicted at once, so an attacker
+ * cannot predict which entries go.
+ */
+class CSignatureCache
+{
+public:
+    static const unsigned int BUCKET_ENTRIES = 8;
+
+private:
+    mutable boost::shared_mutex cs_sigcache;
+    uint256 salt;
+    std::vector<uint256> vTable;
+    size_t nBuckets;
+
+    // statistics; hits and misses are counted with atomic increments under
+    // the shared lock, the others under the exclusive one
+    uint64_t nHits;
+    uint64_t nMisses;
+    uint64_t nInserts;
+    uint64_t nEvictions;
+
+    uint256 ComputeEntry(const uint256& sighash, const std::vector<unsigned char>& vchSig, const CPubKey& pubkey) const;
+    size_t GetBucket(const uint256& entry) const;
+
+public:
+    CSignatureCache();
+
+    // Allocate the table, dropping all entries; 0 disables the cache
+    void SetMaxSize(size_t nMaxSizeBytes);
+
+    bool Get(const uint256& sighash, const std::vector<unsigned char>& vchSig, const CPubKey& pubkey);
+    void Set(const uint256& sighash, const std::vector<unsigned char>& vchSig, const CPubKey& pubkey);
+
+    size_t GetMaxEntries() const;
+    void GetStats(uint64_t& nHitsRet, uint64_t& nMissesRet, uint64_t& nInsertsRet, uint64_t& nEvictionsRet) const;
+};
+
+extern CSignatureCache signatureCache;
+
+/** SignatureChecker that looks signatures up in signatureCache before
+ *  verifying them, and adds the ones it verifies if store is set. */
+class CachingSignatureChecker : public SignatureChecker
+{
+private:
+    bool store;
+
+public:
+    CachingSignatureChecker(const CTransaction& txToIn, unsigned int nInIn, bool storeIn, const CSignatureHashCache* psighashesIn = NULL) :
+        SignatureChecker(txToIn, nInIn, psighashesIn), store(storeIn) {}
+
+    bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
+};
+
+#endif // BITCOIN_SIGCACHE_H
@@ -0,0 +1,229 @@
+// Copyright (c) 2009-2013 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "sigverify.h"
+
+#include "sigcache.h"
+#include "util.h"
+
+#include <algorithm>
+
+#include <boost/foreach.hpp>
+
+using namespace std;
+
+CSignatureVerifier sigverifier(16);
+
+class CSigVerifyBatch
+{
+public:
+    vector<CSigVerifyItem> vItems;
+    vector<unsigned int> vFirst;   // index of the first item identical to item i
+    vector<unsigned int> vTodo;    // indexes of the distinct items
+    vector<char> vResults;         // by index, set for the distinct items
+    unsigned int nNext;            // position in vTodo of the next item to hand out
+    unsigned int nPending;         // distinct items not verified yet
+    int64_t nSubmitTime;
+
+    CSigVerifyBatch() : nNext(0), nPending(0), nSubmitTime(0) {}
+};
+
+CSigVerifyStats::CSigVerifyStats() : nVerified(0), nInvalid(0), nSingle(0), nBatches(0), nDuplicates(0)
+{
+    for (unsigned int i = 0; i < HISTOGRAM_BUCKETS; i++)
+        vBatchSize[i] = vBatchMicros[i] = vSingleMicros[i] = 0;
+}
+
+unsigned int CSigVerifyStats::GetBucket(uint64_t n)
+{
+    unsigned int nBucket = 0;
+    while (n > 1 && nBucket < HISTOGRAM_BUCKETS - 1)
+    {
+        n >>= 1;
+        nBucket++;
+    }
+    return nBucket;
+}
+
+CSignatureVerifier::CSignatureVerifier(unsigned int nChunkSizeIn, CPubKeyCache* pcacheIn) :
+    nWorkers(0), nChunkSize(nChunkSizeIn), pcache(pcacheIn)
+{
+}
+
+void CSignatureVerifier::Count(uint64_t& n, uint64_t nAdd)
+{
+    __sync_fetch_and_add(&n, nAdd);
+}
+
+bool CSignatureVerifier::VerifyItem(const CSigVerifyItem& item)
+{
+    bool fValid;
+    CPubKey pubkeyParsed;
+    if (item.fCompact)
+    {
+        // The key the signature names by its header has to be the one
+        // expected, as for CDarkSendSigner::VerifyMessage() before
+        CPubKey pubkeyRecovered;
+        fValid = pcache->GetRecovered(item.hash, item.vchSig, pubkeyRecovered) && pubkeyRecovered.GetID() == item.pubkey.GetID();
+    }
+    else
+    {
+        // The uncompressed form of a valid key verifies exactly the same
+        // signatures; an invalid key verifies none
+        fValid = pcache->Get(item.pubkey, pubkeyParsed) && pubkeyParsed.Verify(item.hash, item.vchSig);
+    }
+
+    Count(stats.nVerified);
+    if (!fValid)
+        Count(stats.nInvalid);
+    return fValid;
+}
+
+bool CSignatureVerifier::Verify(const CSigVerifyItem& item)
+{
+    int64_t nStart = GetTimeMicros();
+    bool fValid = VerifyItem(item);
+    Count(stats.nSingle);
+    Count(stats.vSingleMicros[CSigVerifyStats::GetBucket(GetTimeMicros() - nStart)]);
+    return fValid;
+}
+
+CSigVerifyBatchRef CSignatureVerifier::Submit(vector<CSigVerifyItem>& vItems)
+{
+    CSigVerifyBatchRef batch(new CSigVerifyBatch());
+    batch->nSubmitTime = GetTimeMicros();
+    batch->vItems.swap(vItems);
+
+    // Find the duplicates before anything is handed out
+    unsigned int nItems = batch->vItems.size();
+    batch->vFirst.resize(nItems);
+    batch->vResults.resize(nItems, 0);
+    map<CSigVerifyItem, unsigned int> mapFirst;
+    for (unsigned int i = 0; i < nItems; i++)
+    {
+        pair<map<CSigVerifyItem, unsigned int>::iterator, bool> ret = mapFirst.insert(make_pair(batch->vItems[i], i));
+        batch->vFirst[i] = ret.first->second;
+        if (ret.second)
+            batch->vTodo.push_back(i);
+    }
+    batch->nPending = batch->vTodo.size();
+
+    Count(stats.nBatches);
+    Count(stats.nDuplicates, nItems - batch->vTodo.size());
+    Count(stats.vBatchSize[CSigVerifyStats::GetBucket(nItems)]);
+
+    if (batch->nPending > 0)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        queue.push_back(batch);
+        if (batch->nPending == 1)
+            condWorker.notify_one();
+        else
+            condWorker.notify_all();
+    }
+    return batch;
+}
+
+// Verify the next chunk of a batch; lock is held on entry and on return
+void CSignatureVerifier::RunChunk(boost::unique_lock<boost::mutex>& lock, const CSigVerifyBatchRef& batch)
+{
+    // Aim for smaller chunks as the batch runs out, so that everyone
+    // working on it finishes at about the same time
+    unsigned int nLeft = batch->vTodo.size() - batch->nNext;
+    unsigned int nNow = max(1U, min(nChunkSize, nLeft / (nWorkers + 1)));
+    unsigned int nBegin = batch->nNext;
+    batch->nNext += nNow;
+    if (batch->nNext == batch->vTodo.size())
+        queue.erase(find(queue.begin(), queue.end(), batch));
+
+    lock.unlock();
+    for (unsigned int i = nBegin; i < nBegin + nNow; i++)
+    {
+        unsigned int n = batch->vTodo[i];
+        batch->vResults[n] = VerifyItem(batch->vItems[n]);
+    }
+    lock.lock();
+
+    batch->nPending -= nNow;
+    if (batch->nPending == 0)
+        condDone.notify_all();
+}
+
+bool CSignatureVerifier::Await(const CSigVerifyBatchRef& batch, vector<bool>* pvResults)
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (batch->nNext < batch->vTodo.size())
+            RunChunk(lock, batch);
+        while (batch->nPending > 0)
+            condDone.wait(lock);
+    }
+
+    Count(stats.vBatchMicros[CSigVerifyStats::GetBucket(GetTimeMicros() - batch->nSubmitTime)]);
+
+    bool fAllValid = true;
+    if (pvResults)
+        pvResults->resize(batch->vItems.size());
+    for (unsigned int i = 0; i < batch->vItems.size(); i++)
+    {
+        bool fValid = batch->vResults[batch->vFirst[i]];
+        fAllValid &= fValid;
+        if (pvResults)
+            (*pvResults)[i] = fValid;
+    }
+    return fAllValid;
+}
+
+void CSignatureVerifier::Thread()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    nWorkers++;
+    try
+    {
+        while (true)
+        {
+            while (queue.empty())
+                condWorker.wait(lock);
+            // Hold on to the batch, the awaiting thread may finish it first
+            CSigVerifyBatchRef batch = queue.front();
+            RunChunk(lock, batch);
+        }
+    }
+    catch (...)
+    {
+        nWorkers--;
+        throw;
+    }
+}
+
+void CSignatureVerifier::GetStats(CSigVerifyStats& statsRet) const
+{
+    statsRet = stats;
+}
+
+void ThreadSigVerify()
+{
+    RenameThread("sling-sigverify");
+    sigverifier.Thread();
+}
+
+void CSigVerifyCollector::Add(const vector<CSigVerifyItem>& vItemsIn)
+{
+    LOCK(cs);
+    vItems.insert(vItems.end(), vItemsIn.begin(), vItemsIn.end());
+}
+
+void CSigVerifyCollector::Take(vector<CSigVerifyItem>& vItemsRet)
+{
+    LOCK(cs);
+    vItemsRet.clear();
+    vItemsRet.swap(vItems);
+}
+
+bool DeferringSignatureChecker::VerifySignature(const vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
+{
+    if (!signatureCache.Get(sighash, vchSig, pubkey))
+        vDeferred.push_back(CSigVerifyItem(sighash, vchSig, pubkey));
+    return true;
+}
@@ -0,0 +1,173 @@
+// Copyright (c) 2009-2013 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_SIGVERIFY_H
+#define BITCOIN_SIGVERIFY_H
+
+#include "key.h"
+#include "pubkeycache.h"
+#include "script.h"
+#include "sync.h"
+#include "uint256.h"
+
+#include <deque>
+#include <map>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+/** A signature to verify: a DER signature of hash by pubkey or, if fCompact,
+ *  a compact signature of hash that has to recover to pubkey's key id */
+class CSigVerifyItem
+{
+public:
+    uint256 hash;
+    std::vector<unsigned char> vchSig;
+    CPubKey pubkey;
+    bool fCompact;
+
+    CSigVerifyItem() : fCompact(false) {}
+    CSigVerifyItem(const uint256& hashIn, const std::vector<unsigned char>& vchSigIn, const CPubKey& pubkeyIn, bool fCompactIn = false) :
+        hash(hashIn), vchSig(vchSigIn), pubkey(pubkeyIn), fCompact(fCompactIn) {}
+
+    friend bool operator<(const CSigVerifyItem& a, const CSigVerifyItem& b)
+    {
+        if (a.hash != b.hash)
+            return a.hash < b.hash;
+        if (a.pubkey != b.pubkey)
+            return a.pubkey < b.pubkey;
+        if (a.fCompact != b.fCompact)
+            return a.fCompact < b.fCompact;
+        return a.vchSig < b.vchSig;
+    }
+};
+
+class CSigVerifyBatch;
+typedef boost::shared_ptr<CSigVerifyBatch> CSigVerifyBatchRef;
+
+/** Counters of CSignatureVerifier. Histogram bucket i counts the values
+ *  from 2^i to 2^(i+1)-1, the last one everything above. */
+class CSigVerifyStats
+{
+public:
+    static const unsigned int HISTOGRAM_BUCKETS = 24;
+
+    uint64_t nVerified;        // signatures verified, each duplicate once
+    uint64_t nInvalid;
+    uint64_t nSingle;          // of which outside a batch
+    uint64_t nBatches;
+    uint64_t nDuplicates;      // batch items answered by an identical one
+    uint64_t vBatchSize[HISTOGRAM_BUCKETS];     // items per batch
+    uint64_t vBatchMicros[HISTOGRAM_BUCKETS];   // submit to results, microseconds
+    uint64_t vSingleMicros[HISTOGRAM_BUCKETS];  // one signature outside a batch
+
+    CSigVerifyStats();
+
+    static unsigned int GetBucket(uint64_t n);
+};
+
+/** Signature verification service for every ECDSA check the node makes:
+ *  script signatures of transactions and blocks, the coinstake of a
+ *  proof-of-stake block, and the compact message signatures of the
+ *  masternode, darksend, instantx and spork messages.
+ *
+ *  A caller with many signatures to check submits them as one batch and
+ *  later awaits the results. Worker threads (see ThreadSigVerify) take the
+ *  batch apart in chunks; the awaiting thread helps with its own batch, so
+ *  batches also complete when there are no workers. Identical items in a
+ *  batch are verified once. A single signature can be verified directly
+ *  with Verify().
+ *
+ *  Public keys are parsed through the shared CPubKeyCache.
+ */
+class CSignatureVerifier
+{
+private:
+    // Protects queue and the batches in it
+    boost::mutex mutex;
+
+    // Worker threads block on this when out of work
+    boost::condition_variable condWorker;
+
+    // Awaiting threads block on this until their batch is done
+    boost::condition_variable condDone;
+
+    // Batches with items not yet handed out, oldest first
+    std::deque<CSigVerifyBatchRef> queue;
+
+    // The number of worker threads
+    int nWorkers;
+
+    // The largest number of items a thread takes at once
+    unsigned int nChunkSize;
+
+    // Parsed public keys
+    CPubKeyCache* pcache;
+
+    // Updated with atomic increments
+    CSigVerifyStats stats;
+
+    bool VerifyItem(const CSigVerifyItem& item);
+    void RunChunk(boost::unique_lock<boost::mutex>& lock, const CSigVerifyBatchRef& batch);
+    void Count(uint64_t& n, uint64_t nAdd = 1);
+
+public:
+    CSignatureVerifier(unsigned int nChunkSizeIn, CPubKeyCache* pcacheIn = &pubkeyCache);
+
+    // Verify one signature in the calling thread
+    bool Verify(const CSigVerifyItem& item);
+
+    // Queue vItems for verification; they are swapped out of the vector.
+    // Every batch has to be awaited.
+    CSigVerifyBatchRef Submit(std::vector<CSigVerifyItem>& vItems);
+
+    // Wait for a batch, helping with it meanwhile. Returns whether all its
+    // signatures are valid and, if pvResults is given, sets it to each one's
+    // result in the order they were submitted.
+    bool Await(const CSigVerifyBatchRef& batch, std::vector<bool>* pvResults = NULL);
+
+    // Worker thread
+    void Thread();
+
+    void GetStats(CSigVerifyStats& statsRet) const;
+};
+
+extern CSignatureVerifier sigverifier;
+
+/** Run an instance of the signature verification thread */
+void ThreadSigVerify();
+
+/** Signatures set aside by the script checks of a block, to be verified as
+ *  one batch once all scripts have run. Safe to add to from the script
+ *  checking threads. */
+class CSigVerifyCollector
+{
+private:
+    CCriticalSection cs;
+    std::vector<CSigVerifyItem> vItems;
+
+public:
+    void Add(const std::vector<CSigVerifyItem>& vItemsIn);
+
+    // Move the collected items into vItemsRet
+    void Take(std::vector<CSigVerifyItem>& vItemsRet);
+};
+
+/** SignatureChecker that reports every signature the signature cache does not
+ *  know as valid and only records it. For use with VerifySingleSigScript:
+ *  the spend is valid if that succeeds and everything in vDeferred verifies.
+ */
+class DeferringSignatureChecker : public SignatureChecker
+{
+public:
+    mutable std::vector<CSigVerifyItem> vDeferred;
+
+    DeferringSignatureChecker(const CTransaction& txToIn, unsigned int nInIn, const CSignatureHashCache* psighashesIn = NULL) :
+        SignatureChecker(txToIn, nInIn, psighashesIn) {}
+
+    bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
+};
+
+#endif // BITCOIN_SIGVERIFY_H
@@ -220,66 +220,24 @@ bool SecMsgDB::Open(const char* pszMode)
 };
 
 
-class SecMsgBatchScanner : public leveldb::WriteBatch::Handler
-{
-public:
-    std::string needle;
-    bool* deleted;
-    std::string* foundValue;
-    bool foundEntry;
-
-    SecMsgBatchScanner() : foundEntry(false) {}
-
-    virtual void Put(const leveldb::Slice& key, const leveldb::Slice& value)
-    {
-        if (key.ToString() == needle)
-        {
-            foundEntry = true;
-            *deleted = false;
-            *foundValue = value.ToString();
-        };
-    };
-
-    virtual void Delete(const leveldb::Slice& key)
-    {
-        if (key.ToString() == needle)
-        {
-            foundEntry = true;
-            *deleted = true;
-        };
-    };
-};
-
 // When performing a read, if we have an active batch we need to check it first
 // before reading from the database, as the rest of the code assumes that once
-// a database transaction begins reads are consistent with it. It would be good
-// to change that assumption in future and avoid the performance hit, though in
-// practice it does not appear to be large.
+// a database transaction begins reads are consistent with it. CLevelDBBatch
+// keeps its pending writes indexed, so this is a hash lookup.
 bool SecMsgDB::ScanBatch(const CDataStream& key, std::string* value, bool* deleted) const
 {
     if (!activeBatch)
         return false;
 
     *deleted = false;
-    SecMsgBatchScanner scanner;
-    scanner.needle = key.str();
-    scanner.deleted = deleted;
-    scanner.foundValue = value;
-    leveldb::Status s = activeBatch->Iterate(&scanner);
-    if (!s.ok())
-    {
-        LogPrintf("SecMsgDB ScanBatch error: %s\n", s.ToString().c_str());
-        return false;
-    };
-
-    return scanner.foundEntry;
+    return activeBatch->Lookup(key.str(), value, deleted);
 }
 
 bool SecMsgDB::TxnBegin()
 {
     if (activeBatch)
         return true;
-    activeBatch = new leveldb::WriteBatch();
+    activeBatch = new CLevelDBBatch();
     return true;
 };
 
@@ -290,7 +248,7 @@ bool SecMsgDB::TxnCommit()
 
     leveldb::WriteOptions writeOptions;
     writeOptions.sync = true;
-    leveldb::Status status = pdb->Write(writeOptions, activeBatch);
+    leveldb::Status status = pdb->Write(writeOptions, activeBatch->GetBatch());
     delete activeBatch;
     activeBatch = NULL;
 
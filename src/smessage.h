@@ -6,6 +6,7 @@
 
 #include <leveldb/db.h>
 #include <leveldb/write_batch.h>
+#include "leveldbbatch.h"
 
 #include "net.h"
 #include "db.h"
@@ -315,7 +316,7 @@ public:
     bool EraseSmesg(uint8_t* chKey);
 
     leveldb::DB *pdb;       // points to the global instance
-    leveldb::WriteBatch *activeBatch;
+    CLevelDBBatch *activeBatch;
 
 };
 
@@ -0,0 +1,266 @@
+#include <boost/test/unit_test.hpp>
+
+#include "bignum.h"
+#include "kernel.h"
+#include "kernelsearch.h"
+#include "main.h"
+#include "util.h"
+
+using namespace std;
+
+// An input confirmed long enough ago to stake at nTime
+static CStakeKernelInput RandomInput(unsigned int nTime)
+{
+    COutPoint prevout(GetRandHash(), GetRandInt(4));
+    unsigned int nTimeBlockFrom = nTime - nStakeMinAge - GetRandInt(1000000);
+    return CStakeKernelInput(prevout, (1 + GetRandInt(1000)) * COIN, nTimeBlockFrom - GetRandInt(600), nTimeBlockFrom, GetRandHash());
+}
+
+BOOST_AUTO_TEST_SUITE(kernel_tests)
+
+BOOST_AUTO_TEST_CASE(kernel_cache)
+{
+    CStakeKernelCache cache;
+    CStakeKernelInput input;
+
+    // Outputs of three transactions, the middle one with several
+    uint256 hash1 = GetRandHash(), hash2 = hash1 + 1, hash3 = hash1 + 2;
+    cache.Add(CStakeKernelInput(COutPoint(hash1, 0), 10, 1, 2, 3));
+    for (unsigned int n = 0; n < 5; n++)
+        cache.Add(CStakeKernelInput(COutPoint(hash2, n), 20 + n, 1, 2, 3));
+    cache.Add(CStakeKernelInput(COutPoint(hash3, 1), 30, 1, 2, 3));
+    BOOST_CHECK_EQUAL(cache.size(), 7U);
+
+    BOOST_CHECK(cache.Get(COutPoint(hash2, 3), input));
+    BOOST_CHECK_EQUAL(input.nValue, 23);
+    BOOST_CHECK(!cache.Get(COutPoint(hash3, 0), input));
+
+    // A coin spent, then a transaction disconnected
+    cache.Remove(COutPoint(hash2, 1));
+    BOOST_CHECK(!cache.Get(COutPoint(hash2, 1), input));
+    BOOST_CHECK_EQUAL(cache.size(), 6U);
+    cache.Remove(hash2);
+    BOOST_CHECK_EQUAL(cache.size(), 2U);
+    BOOST_CHECK(cache.Get(COutPoint(hash1, 0), input));
+    BOOST_CHECK(cache.Get(COutPoint(hash3, 1), input));
+
+    uint64_t nHits, nMisses;
+    cache.GetStats(nHits, nMisses);
+    BOOST_CHECK_EQUAL(nHits, 3U);
+    BOOST_CHECK_EQUAL(nMisses, 2U);
+
+    cache.Clear();
+    BOOST_CHECK_EQUAL(cache.size(), 0U);
+}
+
+// The kernel found from memory must be the one found from the transaction
+// and its block
+BOOST_AUTO_TEST_CASE(kernel_cached_check)
+{
+    CBlockIndex indexPrev;
+    indexPrev.nHeight = 100000;
+    indexPrev.nStakeModifier = GetRand(std::numeric_limits<uint64_t>::max());
+
+    // About one in ten of the coins meets the target
+    unsigned int nBits = CBigNum(~uint256(0) >> 30).GetCompact();
+    unsigned int nTime = 1500000000 & ~STAKE_TIMESTAMP_MASK;
+
+    int nFound = 0;
+    for (int i = 0; i < 2000; i++)
+    {
+        CStakeKernelInput input = RandomInput(nTime);
+
+        CTransaction txPrev;
+        txPrev.nTime = input.nTime;
+        txPrev.vout.resize(input.prevout.n + 1);
+        txPrev.vout[input.prevout.n].nValue = input.nValue;
+        CBlock blockFrom;
+        blockFrom.nTime = input.nTimeBlockFrom;
+
+        uint256 hashProofOfStake, targetProofOfStake;
+        bool fKernel = CheckStakeKernelHash(&indexPrev, nBits, blockFrom, 0, txPrev, input.prevout, nTime, hashProofOfStake, targetProofOfStake);
+        BOOST_CHECK_EQUAL(CheckKernel(&indexPrev, nBits, nTime, input), fKernel);
+        nFound += fKernel;
+    }
+    BOOST_CHECK(nFound > 0 && nFound < 2000);
+
+    // Too young
+    CStakeKernelInput input = RandomInput(nTime);
+    input.nTimeBlockFrom = nTime - nStakeMinAge + 1;
+    BOOST_CHECK(!CheckKernel(&indexPrev, ~0U, nTime, input));
+}
+
+// A staking round: each coin is looked up in the cache and hashed at the
+// round's timestamp, with the same result as from the input itself
+BOOST_AUTO_TEST_CASE(kernel_cache_round)
+{
+    CBlockIndex indexPrev;
+    indexPrev.nHeight = 100000;
+    indexPrev.nStakeModifier = GetRand(std::numeric_limits<uint64_t>::max());
+    unsigned int nBits = CBigNum(~uint256(0) >> 30).GetCompact();
+    unsigned int nTime = 1500000000 & ~STAKE_TIMESTAMP_MASK;
+
+    CStakeKernelCache cache;
+    vector<CStakeKernelInput> vInputs;
+    for (int n = 0; n < 200; n++)
+    {
+        vInputs.push_back(RandomInput(nTime));
+        cache.Add(vInputs.back());
+    }
+    BOOST_CHECK_EQUAL(cache.size(), vInputs.size());
+
+    int nFound = 0;
+    BOOST_FOREACH(const CStakeKernelInput& inputAdded, vInputs)
+    {
+        CStakeKernelInput input;
+        BOOST_CHECK(cache.Get(inputAdded.prevout, input));
+        BOOST_CHECK(input.nValue == inputAdded.nValue && input.nTime == inputAdded.nTime &&
+                    input.nTimeBlockFrom == inputAdded.nTimeBlockFrom && input.hashBlockFrom == inputAdded.hashBlockFrom);
+        bool fKernel = CheckKernel(&indexPrev, nBits, nTime, input);
+        BOOST_CHECK_EQUAL(fKernel, CheckKernel(&indexPrev, nBits, nTime, inputAdded));
+        nFound += fKernel;
+    }
+    BOOST_CHECK(nFound > 0);
+}
+
+// Kernel hashes of fixed inputs, recorded from CheckStakeKernelHash before
+// the batched search existed
+struct RecordedKernel
+{
+    uint64_t nStakeModifier;
+    unsigned int nTimeBlockFrom;
+    unsigned int nTimeTxPrev;
+    const char* pszHash;
+    unsigned int n;
+    unsigned int nTimeTx;
+    const char* pszHashProofOfStake;
+};
+
+static const RecordedKernel vRecorded[] = {
+    {0x5f1c2c7a9e13b6d4ULL, 1429570544, 1429570512, "e1d3c8a4f0b2976554b1d3f8a7c60e9d2b4f6a8c1e3d5f7092b4d6f8a1c3e5f7", 1, 1430001232,
+     "7063bf1844155df00244f57e8abfaf1e4c6f4481c87b36dbb5ba3ae32f79949f"},
+    {0x0000000000000000ULL, 1400000000, 1400000000, "0000000000000000000000000000000000000000000000000000000000000001", 0, 1400028800,
+     "49e2404814072b74fd1a8f6a915c6703e30dd6d1ca23941dac8fb1153f81aefc"},
+    {0xfedcba9876543210ULL, 1468401600, 1468401001, "3a7bd3e2360a3d29eea436fcfb7e44c735d117c42d1c1835420b6b9942dd4f1b", 7, 1468500000,
+     "ab188a90dbeb17c811f74918575d14f686bc8cfae6197918e166226e188d9e53"},
+    {0x123456789abcdef0ULL, 1500000000, 1499999872, "8c8ee0e0b1e7a1ec1a0a4e3e86c6d1a7a45b2d6f1e9c3b7a5d2f4e6c8b0a9d1e", 3, 1500100016,
+     "f331625601f866e696275ab0c0a4d4478d6cbed8a0665befd9ac078c014c9cfd"}
+};
+
+BOOST_AUTO_TEST_CASE(kernel_search_recorded)
+{
+    SHA256AutoDetect();
+    for (unsigned int i = 0; i < sizeof(vRecorded)/sizeof(vRecorded[0]); i++)
+    {
+        const RecordedKernel& k = vRecorded[i];
+        CBlockIndex indexPrev;
+        indexPrev.nHeight = 100000;
+        indexPrev.nStakeModifier = k.nStakeModifier;
+        CStakeKernelInput input(COutPoint(uint256(k.pszHash), k.n), 1000 * COIN, k.nTimeTxPrev, k.nTimeBlockFrom, 0);
+
+        CStakeKernelSearch search(&indexPrev, 0x1d00ffff);
+        search.Add(input);
+        BOOST_CHECK_EQUAL(search.GetKernelHash(0, k.nTimeTx).GetHex(), k.pszHashProofOfStake);
+
+        CTransaction txPrev;
+        txPrev.nTime = k.nTimeTxPrev;
+        txPrev.vout.resize(k.n + 1);
+        txPrev.vout[k.n].nValue = input.nValue;
+        CBlock blockFrom;
+        blockFrom.nTime = k.nTimeBlockFrom;
+        uint256 hashProofOfStake, targetProofOfStake;
+        CheckStakeKernelHash(&indexPrev, 0x1d00ffff, blockFrom, 0, txPrev, input.prevout, k.nTimeTx, hashProofOfStake, targetProofOfStake);
+        BOOST_CHECK_EQUAL(hashProofOfStake.GetHex(), k.pszHashProofOfStake);
+    }
+}
+
+// Every kernel the search finds, in order, against CheckKernel() on each
+// input and timestamp
+BOOST_AUTO_TEST_CASE(kernel_search_compare)
+{
+    SHA256AutoDetect();
+    CBlockIndex indexPrev;
+    indexPrev.nHeight = 100000;
+    indexPrev.nStakeModifier = GetRand(std::numeric_limits<uint64_t>::max());
+    unsigned int nTime = 1500000000 & ~STAKE_TIMESTAMP_MASK;
+
+    vector<CStakeKernelInput> vInputs;
+    for (int i = 0; i < 5000; i++)
+    {
+        CStakeKernelInput input = RandomInput(nTime);
+        // Some just old enough for part of the window, or younger than it
+        if (i % 97 == 0)
+            input.nTimeBlockFrom = nTime - nStakeMinAge - GetRandInt(20);
+        if (i % 89 == 0)
+            input.nTime = nTime - GetRandInt(20);
+        if (i % 83 == 0)
+            input.nTimeBlockFrom = nTime - nStakeMinAge + 1 + GetRandInt(1000);
+        vInputs.push_back(input);
+    }
+
+    const unsigned int vIntervals[] = {1, 16, 60};
+    for (unsigned int k = 0; k < sizeof(vIntervals)/sizeof(vIntervals[0]); k++)
+    {
+        unsigned int nInterval = vIntervals[k];
+
+        // About ten kernels among all the inputs and timestamps
+        unsigned int nBits = (CBigNum(~uint256(0)) / CBigNum((int64_t)(100 * COIN * vInputs.size() * nInterval / 10))).GetCompact();
+
+        vector<pair<size_t, unsigned int> > vExpected;
+        for (size_t i = 0; i < vInputs.size(); i++)
+            for (unsigned int n = 0; n < nInterval; n++)
+                if (CheckKernel(&indexPrev, nBits, nTime - n, vInputs[i]))
+                {
+                    vExpected.push_back(make_pair(i, nTime - n));
+                    break;
+                }
+        BOOST_CHECK(!vExpected.empty());
+
+        CStakeKernelSearch search(&indexPrev, nBits);
+        BOOST_FOREACH(const CStakeKernelInput& input, vInputs)
+            search.Add(input);
+        for (int nThreads = 1; nThreads <= 8; nThreads++)
+        {
+            vector<pair<size_t, unsigned int> > vFound;
+            size_t nIndex = 0;
+            unsigned int nTimeKernel;
+            for (; search.Find(nIndex, nTime, nInterval, nIndex, nTimeKernel, nThreads); nIndex++)
+                vFound.push_back(make_pair(nIndex, nTimeKernel));
+            BOOST_CHECK_MESSAGE(vFound == vExpected, strprintf("interval %u, %d threads", nInterval, nThreads));
+        }
+    }
+
+    // Nothing past the end
+    CStakeKernelSearch search(&indexPrev, ~0U >> 1);
+    size_t nIndex;
+    unsigned int nTimeKernel;
+    BOOST_CHECK(!search.Find(0, nTime, 1, nIndex, nTimeKernel));
+}
+
+// With a target no hash meets, every input is tried at every timestamp
+// whether the search runs on one thread or several
+BOOST_AUTO_TEST_CASE(kernel_search_exhaustive)
+{
+    SHA256AutoDetect();
+    CBlockIndex indexPrev;
+    indexPrev.nHeight = 100000;
+    indexPrev.nStakeModifier = GetRand(std::numeric_limits<uint64_t>::max());
+    unsigned int nTime = 1500000000 & ~STAKE_TIMESTAMP_MASK;
+
+    CStakeKernelSearch search(&indexPrev, 0x01010000);
+    for (int i = 0; i < 1000; i++)
+        search.Add(RandomInput(nTime));
+
+    for (int nThreads = 1; nThreads <= 2; nThreads++)
+    {
+        size_t nIndex;
+        unsigned int nTimeKernel;
+        BOOST_CHECK(!search.Find(0, nTime, 16, nIndex, nTimeKernel, nThreads));
+
+        CKernelSearchStats stats;
+        GetKernelSearchStats(stats);
+        BOOST_CHECK_EQUAL(stats.nLastHashes, 16000U);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
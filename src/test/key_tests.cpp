@@ -1,3 +1,4 @@
+#include <boost/foreach.hpp>
 #include <boost/test/unit_test.hpp>
 
 #include <string>
@@ -138,4 +139,114 @@ BOOST_AUTO_TEST_CASE(key_test1)
     }
 }
 
+// Split a strict DER signature as produced by CKey::Sign into r and s
+static void SplitDERSignature(const vector<unsigned char>& vchSig, vector<unsigned char>& r, vector<unsigned char>& s)
+{
+    unsigned int nLenR = vchSig[3];
+    r.assign(vchSig.begin() + 4, vchSig.begin() + 4 + nLenR);
+    unsigned int nLenS = vchSig[5 + nLenR];
+    s.assign(vchSig.begin() + 6 + nLenR, vchSig.begin() + 6 + nLenR + nLenS);
+}
+
+static vector<unsigned char> JoinDERSignature(const vector<unsigned char>& r, const vector<unsigned char>& s)
+{
+    vector<unsigned char> vchSig;
+    vchSig.push_back(0x30);
+    vchSig.push_back(4 + r.size() + s.size());
+    vchSig.push_back(0x02);
+    vchSig.push_back(r.size());
+    vchSig.insert(vchSig.end(), r.begin(), r.end());
+    vchSig.push_back(0x02);
+    vchSig.push_back(s.size());
+    vchSig.insert(vchSig.end(), s.begin(), s.end());
+    return vchSig;
+}
+
+// order - s, for a big-endian s of at most 32 bytes
+static vector<unsigned char> NegateModOrder(const vector<unsigned char>& s)
+{
+    static const unsigned char order[32] = {
+        0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFE,
+        0xBA,0xAE,0xDC,0xE6,0xAF,0x48,0xA0,0x3B,0xBF,0xD2,0x5E,0x8C,0xD0,0x36,0x41,0x41
+    };
+    unsigned char s32[32] = {0};
+    unsigned int nSkip = s.size() > 32 ? s.size() - 32 : 0;
+    memcpy(s32 + 32 - (s.size() - nSkip), &s[nSkip], s.size() - nSkip);
+    vector<unsigned char> result(33, 0);
+    int borrow = 0;
+    for (int i = 31; i >= 0; i--)
+    {
+        int diff = order[i] - s32[i] - borrow;
+        borrow = diff < 0;
+        result[i + 1] = diff + (borrow ? 256 : 0);
+    }
+    // keep the DER integer positive and minimal
+    while (result.size() > 1 && result[0] == 0 && !(result[1] & 0x80))
+        result.erase(result.begin());
+    return result;
+}
+
+// Both signature backends must agree on every signature; with USE_SECP256K1
+// Verify and RecoverCompact use libsecp256k1, the *OpenSSL variants do not.
+// To run the same comparison over a whole chain, start the node with
+// -checksigbackends and -loadblock or -reindex.
+BOOST_AUTO_TEST_CASE(key_backends)
+{
+    for (int n = 0; n < 64; n++)
+    {
+        CKey key;
+        key.MakeNewKey(n % 2 == 0);
+        CPubKey pubkey = key.GetPubKey();
+        uint256 hash = GetRandHash();
+        uint256 hashOther = GetRandHash();
+
+        vector<unsigned char> vchSig;
+        BOOST_CHECK(key.Sign(hash, vchSig));
+
+        vector<vector<unsigned char> > vSigs;
+        vSigs.push_back(vchSig);
+
+        vector<unsigned char> r, s;
+        SplitDERSignature(vchSig, r, s);
+        // high S
+        vSigs.push_back(JoinDERSignature(r, NegateModOrder(s)));
+        // corrupted S
+        vector<unsigned char> sBad(s);
+        sBad[sBad.size() / 2] ^= 0x01;
+        vSigs.push_back(JoinDERSignature(r, sBad));
+        // truncated
+        vSigs.push_back(vector<unsigned char>(vchSig.begin(), vchSig.end() - 1));
+
+        BOOST_FOREACH(const vector<unsigned char>& vchTest, vSigs)
+        {
+            BOOST_CHECK_EQUAL(pubkey.Verify(hash, vchTest), pubkey.VerifyOpenSSL(hash, vchTest));
+            BOOST_CHECK_EQUAL(pubkey.Verify(hashOther, vchTest), pubkey.VerifyOpenSSL(hashOther, vchTest));
+        }
+        BOOST_CHECK(pubkey.Verify(hash, vSigs[0]));
+        BOOST_CHECK(pubkey.Verify(hash, vSigs[1]));
+
+#ifdef USE_SECP256K1
+        // BER with a padded R, as old OpenSSL accepted it; newer OpenSSL
+        // releases reject it, so only the lax parser is checked here
+        vector<unsigned char> rPadded(r);
+        rPadded.insert(rPadded.begin(), 0x00);
+        BOOST_CHECK(pubkey.Verify(hash, JoinDERSignature(rPadded, s)));
+#endif
+
+        vector<unsigned char> vchCompact;
+        BOOST_CHECK(key.SignCompact(hash, vchCompact));
+        CPubKey pubkeyRec, pubkeyRecOpenSSL;
+        BOOST_CHECK(pubkeyRec.RecoverCompact(hash, vchCompact));
+        BOOST_CHECK(pubkeyRecOpenSSL.RecoverCompactOpenSSL(hash, vchCompact));
+        BOOST_CHECK(pubkeyRec == pubkey);
+        BOOST_CHECK(pubkeyRecOpenSSL == pubkey);
+
+        bool fRec = pubkeyRec.RecoverCompact(hashOther, vchCompact);
+        bool fRecOpenSSL = pubkeyRecOpenSSL.RecoverCompactOpenSSL(hashOther, vchCompact);
+        BOOST_CHECK_EQUAL(fRec, fRecOpenSSL);
+        if (fRec && fRecOpenSSL)
+            BOOST_CHECK(pubkeyRec == pubkeyRecOpenSSL);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
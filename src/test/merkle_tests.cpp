@@ -0,0 +1,127 @@
+#include <boost/test/unit_test.hpp>
+
+#include "main.h"
+#include "merkle.h"
+#include "util.h"
+
+using namespace std;
+
+// The tree as CBlock::BuildMerkleTree used to build it
+static uint256 BuildMerkleTreeOld(const vector<uint256>& vLeaves, vector<uint256>& vMerkleTree)
+{
+    vMerkleTree = vLeaves;
+    int j = 0;
+    for (int nSize = vLeaves.size(); nSize > 1; nSize = (nSize + 1) / 2)
+    {
+        for (int i = 0; i < nSize; i += 2)
+        {
+            int i2 = std::min(i+1, nSize-1);
+            vMerkleTree.push_back(Hash(BEGIN(vMerkleTree[j+i]),  END(vMerkleTree[j+i]),
+                                       BEGIN(vMerkleTree[j+i2]), END(vMerkleTree[j+i2])));
+        }
+        j += nSize;
+    }
+    return (vMerkleTree.empty() ? 0 : vMerkleTree.back());
+}
+
+static void CheckTree(const vector<uint256>& vLeaves, unsigned int nThreads)
+{
+    vector<uint256> vOld, vNew(vLeaves);
+    uint256 hashOld = BuildMerkleTreeOld(vLeaves, vOld);
+    uint256 hashNew = ComputeMerkleTree(vNew, vLeaves.size(), nThreads);
+    BOOST_CHECK_MESSAGE(hashNew == hashOld, strprintf("%u leaves, %u threads", vLeaves.size(), nThreads));
+    BOOST_CHECK(vNew == vOld);
+    BOOST_CHECK_EQUAL(GetMerkleTreeSize(vLeaves.size()), vOld.size());
+}
+
+BOOST_AUTO_TEST_SUITE(merkle_tests)
+
+BOOST_AUTO_TEST_CASE(merkle_compare)
+{
+    SHA256AutoDetect();
+    for (int nLeaves = 0; nLeaves <= 70; nLeaves++)
+    {
+        vector<uint256> vLeaves;
+        for (int i = 0; i < nLeaves; i++)
+            vLeaves.push_back(GetRandHash());
+        CheckTree(vLeaves, 1);
+
+        // The last leaf repeated, as when a tree is attacked with the
+        // duplicated transactions of CVE-2012-2459, and leaves all alike
+        if (nLeaves >= 2)
+        {
+            vLeaves[nLeaves - 1] = vLeaves[nLeaves - 2];
+            CheckTree(vLeaves, 1);
+            vLeaves.assign(nLeaves, vLeaves[0]);
+            CheckTree(vLeaves, 1);
+        }
+    }
+
+    // Enough leaves to split among threads, with every kind of last subtree
+    const size_t vSizes[] = {MERKLE_PARALLEL_MIN_LEAVES - 1, MERKLE_PARALLEL_MIN_LEAVES, 2049, 3000, 4095, 4097, 5001};
+    for (unsigned int n = 0; n < sizeof(vSizes)/sizeof(vSizes[0]); n++)
+    {
+        vector<uint256> vLeaves;
+        for (size_t i = 0; i < vSizes[n]; i++)
+            vLeaves.push_back(GetRandHash());
+        for (unsigned int nThreads = 1; nThreads <= 16; nThreads *= 2)
+            CheckTree(vLeaves, nThreads);
+        CheckTree(vLeaves, 3);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(merkle_update)
+{
+    for (int nLeaves = 1; nLeaves <= 40; nLeaves++)
+    {
+        vector<uint256> vLeaves;
+        for (int i = 0; i < nLeaves; i++)
+            vLeaves.push_back(GetRandHash());
+        vector<uint256> vTree(vLeaves);
+        ComputeMerkleTree(vTree, nLeaves);
+
+        // Replace leaves one at a time, sometimes with their neighbour's hash
+        for (int i = 0; i < nLeaves; i++)
+        {
+            vLeaves[i] = (i > 0 && i % 3 == 0) ? vLeaves[i - 1] : GetRandHash();
+            vTree[i] = vLeaves[i];
+            uint256 hashUpdated = UpdateMerkleTree(vTree, nLeaves, i);
+
+            vector<uint256> vOld;
+            BOOST_CHECK(hashUpdated == BuildMerkleTreeOld(vLeaves, vOld));
+            BOOST_CHECK(vTree == vOld);
+        }
+    }
+}
+
+// A block template whose coinbase changes, as with the extra nonce
+BOOST_AUTO_TEST_CASE(merkle_block)
+{
+    CBlock block;
+    for (int i = 0; i < 11; i++)
+    {
+        CTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout.SetNull();
+        tx.vin[0].scriptSig = CScript() << i;
+        tx.vout.resize(1);
+        block.vtx.push_back(tx);
+    }
+
+    BOOST_CHECK(block.UpdateMerkleTree(0) == block.BuildMerkleTree());
+    for (unsigned int nExtraNonce = 1; nExtraNonce < 5; nExtraNonce++)
+    {
+        block.vtx[0].vin[0].scriptSig = CScript() << 0 << (int64_t)nExtraNonce;
+        block.vtx[0].InvalidateHash();
+        uint256 hashUpdated = block.UpdateMerkleTree(0);
+
+        CBlock blockCopy(block);
+        BOOST_CHECK(hashUpdated == blockCopy.BuildMerkleTree());
+
+        // Branches still lead to the root
+        for (unsigned int i = 0; i < block.vtx.size(); i++)
+            BOOST_CHECK(CBlock::CheckMerkleBranch(block.vtx[i].GetHash(), block.GetMerkleBranch(i), i) == hashUpdated);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
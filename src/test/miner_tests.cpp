@@ -0,0 +1,231 @@
+#include <boost/test/unit_test.hpp>
+
+#include "main.h"
+#include "miner.h"
+#include "util.h"
+
+using namespace std;
+
+// A transaction spending prevout, or a made up coin if it is null
+static CTransaction MakeTx(const COutPoint& prevout, int64_t nValue)
+{
+    CTransaction tx;
+    tx.nTime = GetAdjustedTime() - 600;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = prevout.IsNull() ? COutPoint(GetRandHash(), 0) : prevout;
+    tx.vin[0].scriptSig = CScript() << vector<unsigned char>(72, 1) << vector<unsigned char>(33, 2);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = nValue;
+    tx.vout[0].scriptPubKey = CScript() << OP_DUP << OP_HASH160 << vector<unsigned char>(20, 3) << OP_EQUALVERIFY << OP_CHECKSIG;
+    return tx;
+}
+
+static uint256 AddTx(CTxMemPool& pool, CTransaction tx, int64_t nFee, double dPriority = 0)
+{
+    uint256 hash = tx.GetHash();
+    pool.addUnchecked(hash, tx, CTxMemPoolEntry(nFee, 0, 0, dPriority, 0, 100));
+    return hash;
+}
+
+// A coinbase for a proof-of-stake block on pindexPrev
+static void MakeBlock(CBlock& block, CBlockIndex* pindexPrev)
+{
+    CTransaction txNew;
+    txNew.vin.resize(1);
+    txNew.vin[0].prevout.SetNull();
+    txNew.vin[0].scriptSig = CScript() << (pindexPrev->nHeight + 1);
+    txNew.vout.resize(1);
+    txNew.vout[0].SetEmpty();
+    block.vtx.assign(1, txNew);
+}
+
+BOOST_AUTO_TEST_SUITE(miner_tests)
+
+BOOST_AUTO_TEST_CASE(mempool_ancestors)
+{
+    CTxMemPool pool;
+    LOCK(pool.cs);
+
+    CTransaction txParent = MakeTx(COutPoint(), 10 * COIN);
+    uint256 hashParent = AddTx(pool, txParent, 1000);
+    CTransaction txChild = MakeTx(COutPoint(hashParent, 0), 9 * COIN);
+    uint256 hashChild = AddTx(pool, txChild, 100000);
+    CTransaction txGrandchild = MakeTx(COutPoint(hashChild, 0), 8 * COIN);
+    uint256 hashGrandchild = AddTx(pool, txGrandchild, 2000);
+    uint256 hashOther = AddTx(pool, MakeTx(COutPoint(), COIN), 20000);
+
+    const CTxMemPoolEntry& parent = pool.mapEntry[hashParent];
+    const CTxMemPoolEntry& child = pool.mapEntry[hashChild];
+    const CTxMemPoolEntry& grandchild = pool.mapEntry[hashGrandchild];
+    BOOST_CHECK(parent.setChildren.count(hashChild) && child.setParents.count(hashParent));
+    BOOST_CHECK_EQUAL(parent.nAncestors, 1U);
+    BOOST_CHECK_EQUAL(grandchild.nAncestors, 3U);
+    BOOST_CHECK_EQUAL(grandchild.nAncestorFee, 103000);
+    BOOST_CHECK_EQUAL(grandchild.nAncestorSize, parent.nTxSize + child.nTxSize + grandchild.nTxSize);
+
+    set<uint256> setAncestors;
+    pool.CalculateAncestors(grandchild, setAncestors);
+    BOOST_CHECK(setAncestors.size() == 2 && setAncestors.count(hashParent) && setAncestors.count(hashChild));
+
+    // The child pays for its parent, so they go in first, parent first. The
+    // grandchild pays less than the other by itself, and that is what counts
+    // once its ancestors are in.
+    BOOST_CHECK_EQUAL((*pool.setByFee.begin())->hash.ToString(), hashChild.ToString());
+    CBlockIndex index;
+    index.nHeight = 100;
+    CBlock block;
+    MakeBlock(block, &index);
+    CBlockAssembler assembler(&block, &index, true, NULL);
+    assembler.AddTransactions(pool);
+    BOOST_CHECK_EQUAL(block.vtx.size(), 5U);
+    BOOST_CHECK_EQUAL(assembler.nBlockTx, 4U);
+    BOOST_CHECK_EQUAL(assembler.nFees, 123000);
+    BOOST_CHECK(block.vtx[1].GetHash() == hashParent && block.vtx[2].GetHash() == hashChild);
+    BOOST_CHECK(block.vtx[3].GetHash() == hashOther && block.vtx[4].GetHash() == hashGrandchild);
+
+    // Confirmed, the parent no longer counts for what spends it
+    pool.remove(txParent);
+    BOOST_CHECK_EQUAL(pool.mapEntry.size(), 3U);
+    BOOST_CHECK(pool.mapEntry[hashChild].setParents.empty());
+    BOOST_CHECK_EQUAL(pool.mapEntry[hashGrandchild].nAncestors, 2U);
+    BOOST_CHECK_EQUAL(pool.mapEntry[hashGrandchild].nAncestorFee, 102000);
+    BOOST_CHECK_EQUAL(pool.setByFee.size(), 3U);
+
+    // Conflicted, it goes with everything that spends it
+    pool.remove(txChild, true);
+    BOOST_CHECK_EQUAL(pool.mapEntry.size(), 1U);
+    BOOST_CHECK_EQUAL(pool.setByFee.size(), 1U);
+    BOOST_CHECK_EQUAL(pool.setByPriority.size(), 1U);
+    BOOST_CHECK(pool.mapEntry.count(hashOther));
+}
+
+BOOST_AUTO_TEST_CASE(mempool_parent_added_last)
+{
+    CTxMemPool pool;
+    LOCK(pool.cs);
+
+    // A reorganization puts the parent back after what spends it
+    CTransaction txParent = MakeTx(COutPoint(), 10 * COIN);
+    uint256 hashParent = txParent.GetHash();
+    CTransaction txChild = MakeTx(COutPoint(hashParent, 0), 9 * COIN);
+    uint256 hashChild = AddTx(pool, txChild, 100000);
+    uint256 hashGrandchild = AddTx(pool, MakeTx(COutPoint(hashChild, 0), 8 * COIN), 2000);
+    AddTx(pool, txParent, 1000);
+
+    const CTxMemPoolEntry& parent = pool.mapEntry[hashParent];
+    const CTxMemPoolEntry& child = pool.mapEntry[hashChild];
+    const CTxMemPoolEntry& grandchild = pool.mapEntry[hashGrandchild];
+    BOOST_CHECK(parent.setChildren.count(hashChild) && child.setParents.count(hashParent));
+    BOOST_CHECK_EQUAL(child.nAncestors, 2U);
+    BOOST_CHECK_EQUAL(child.nAncestorFee, 101000);
+    BOOST_CHECK_EQUAL(grandchild.nAncestors, 3U);
+    BOOST_CHECK_EQUAL(grandchild.nAncestorFee, 103000);
+    BOOST_CHECK_EQUAL(grandchild.nAncestorSize, parent.nTxSize + child.nTxSize + grandchild.nTxSize);
+
+    CBlockIndex index;
+    index.nHeight = 100;
+    CBlock block;
+    MakeBlock(block, &index);
+    CBlockAssembler assembler(&block, &index, true, NULL);
+    assembler.AddTransactions(pool);
+    BOOST_CHECK_EQUAL(assembler.nBlockTx, 3U);
+    BOOST_CHECK(block.vtx[1].GetHash() == hashParent && block.vtx[2].GetHash() == hashChild);
+    BOOST_CHECK(block.vtx[3].GetHash() == hashGrandchild);
+}
+
+BOOST_AUTO_TEST_CASE(mempool_package_in_block)
+{
+    CTxMemPool pool;
+    LOCK(pool.cs);
+
+    // A large parent paying the least fee goes in for its priority. Its
+    // child pays well by itself, though not counting the parent.
+    CTransaction txParent = MakeTx(COutPoint(), 10 * COIN);
+    txParent.vout.resize(200, txParent.vout[0]);
+    uint256 hashParent = AddTx(pool, txParent, 1000, COIN);
+    uint256 hashChild = AddTx(pool, MakeTx(COutPoint(hashParent, 0), 9 * COIN), 2000);
+    BOOST_CHECK(pool.mapEntry[hashChild].GetAncestorFeePerKb() < MIN_TX_FEE);
+
+    CBlockIndex index;
+    index.nHeight = 100;
+    CBlock block;
+    MakeBlock(block, &index);
+    CBlockAssembler assembler(&block, &index, true, NULL);
+    assembler.AddTransactions(pool);
+    BOOST_CHECK_EQUAL(assembler.nBlockTx, 2U);
+    BOOST_CHECK(block.vtx.size() == 3 && block.vtx[1].GetHash() == hashParent && block.vtx[2].GetHash() == hashChild);
+}
+
+BOOST_AUTO_TEST_CASE(mempool_priority)
+{
+    CTxMemPool pool;
+    LOCK(pool.cs);
+
+    CTransaction txOld = MakeTx(COutPoint(), COIN);
+    uint256 hashOld = txOld.GetHash();
+    pool.addUnchecked(hashOld, txOld, CTxMemPoolEntry(0, 0, 0, 10 * COIN, 100 * COIN, 100));
+    CTransaction txNew = MakeTx(COutPoint(), COIN);
+    uint256 hashNew = txNew.GetHash();
+    pool.addUnchecked(hashNew, txNew, CTxMemPoolEntry(0, 0, 0, 20 * COIN, 0, 100));
+
+    // Priority grows with the age of the inputs in the chain
+    pool.UpdatePriorities(100);
+    BOOST_CHECK_EQUAL((*pool.setByPriority.begin())->hash.ToString(), hashNew.ToString());
+    pool.UpdatePriorities(100 + 2 * pool.mapEntry[hashOld].nTxSize);
+    BOOST_CHECK_EQUAL((*pool.setByPriority.begin())->hash.ToString(), hashOld.ToString());
+
+    // High priority goes first, whatever the fee, but below the minimum
+    // fee nothing goes in
+    pool.clear();
+    uint256 hashRich = AddTx(pool, MakeTx(COutPoint(), COIN), 50000);
+    uint256 hashOldCoins = AddTx(pool, MakeTx(COutPoint(), COIN), 1000, COIN);
+    AddTx(pool, MakeTx(COutPoint(), COIN), 100, COIN);
+
+    CBlockIndex index;
+    index.nHeight = 100;
+    CBlock block;
+    MakeBlock(block, &index);
+    CBlockAssembler assembler(&block, &index, true, NULL);
+    assembler.AddTransactions(pool);
+    BOOST_CHECK_EQUAL(assembler.nBlockTx, 2U);
+    BOOST_CHECK(block.vtx[1].GetHash() == hashOldCoins && block.vtx[2].GetHash() == hashRich);
+}
+
+BOOST_AUTO_TEST_CASE(miner_template_order)
+{
+    // Independent transactions and short chains of them, with fees and
+    // priorities all over the place
+    CTxMemPool pool;
+    LOCK(pool.cs);
+    uint256 hashPrev;
+    for (unsigned int i = 0; i < 200; i++)
+    {
+        COutPoint prevout;
+        if (i % 5 != 0)
+            prevout = COutPoint(hashPrev, 0);
+        int64_t nFee = 1000 + GetRand(100000);
+        double dPriority = (i % 50 == 0) ? (double)GetRand(COIN) : 0;
+        hashPrev = AddTx(pool, MakeTx(prevout, COIN), nFee, dPriority);
+    }
+
+    CBlockIndex index;
+    index.nHeight = 100;
+    CBlock block;
+    MakeBlock(block, &index);
+    CBlockAssembler assembler(&block, &index, true, NULL);
+    assembler.AddTransactions(pool);
+    BOOST_CHECK_EQUAL(assembler.nBlockTx, 200U);
+    BOOST_CHECK_EQUAL(block.vtx.size(), assembler.nBlockTx + 1);
+    BOOST_CHECK(assembler.nBlockSize <= MAX_BLOCK_SIZE_GEN/2);
+
+    // Every transaction comes after the one it spends
+    set<uint256> setSeen;
+    for (unsigned int i = 1; i < block.vtx.size(); i++)
+    {
+        const COutPoint& prevout = block.vtx[i].vin[0].prevout;
+        BOOST_CHECK(!pool.mapTx.count(prevout.hash) || setSeen.count(prevout.hash));
+        setSeen.insert(block.vtx[i].GetHash());
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,254 @@
+#include <boost/test/unit_test.hpp>
+#include <boost/foreach.hpp>
+
+#include "key.h"
+#include "keystore.h"
+#include "main.h"
+#include "script.h"
+#include "sigcache.h"
+#include "util.h"
+
+using namespace std;
+
+static bool StackTopTrue(const vector<valtype>& stack)
+{
+    if (stack.empty())
+        return false;
+    const valtype& vch = stack.back();
+    for (unsigned int i = 0; i < vch.size(); i++)
+        if (vch[i] != 0)
+            return !(i == vch.size() - 1 && vch[i] == 0x80);
+    return false;
+}
+
+// VerifyScript without the standard template fast path
+static bool VerifyScriptInterpreted(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn, unsigned int flags)
+{
+    SignatureChecker checker(txTo, nIn);
+    if ((flags & SCRIPT_VERIFY_SIGPUSHONLY) && !scriptSig.IsPushOnly())
+        return false;
+    vector<valtype> stack, stackCopy;
+    if (!EvalScript(stack, scriptSig, flags, checker))
+        return false;
+    stackCopy = stack;
+    if (!EvalScript(stack, scriptPubKey, flags, checker) || !StackTopTrue(stack))
+        return false;
+    if ((flags & SCRIPT_VERIFY_P2SH) && scriptPubKey.IsPayToScriptHash())
+    {
+        if (!scriptSig.IsPushOnly())
+            return false;
+        const valtype vchRedeemScript = stackCopy.back();
+        stackCopy.pop_back();
+        CScript redeemScript(vchRedeemScript.begin(), vchRedeemScript.end());
+        if (!EvalScript(stackCopy, redeemScript, flags, checker))
+            return false;
+        return StackTopTrue(stackCopy);
+    }
+    return true;
+}
+
+static vector<valtype> ScriptPushes(const CScript& script)
+{
+    vector<valtype> vPushes;
+    CScript::const_iterator pc = script.begin();
+    opcodetype opcode;
+    valtype vch;
+    while (pc < script.end() && script.GetOp(pc, opcode, vch))
+        vPushes.push_back(vch);
+    return vPushes;
+}
+
+static CScript PushAll(const vector<valtype>& vPushes)
+{
+    CScript script;
+    BOOST_FOREACH(const valtype& vch, vPushes)
+    {
+        if (vch.empty())
+            script << OP_0;
+        else
+            script << vch;
+    }
+    return script;
+}
+
+// Mutations of a valid scriptSig, most of them invalid
+static vector<CScript> ScriptSigVariants(const CScript& scriptSig)
+{
+    vector<CScript> vVariants;
+    vVariants.push_back(scriptSig);
+    vVariants.push_back(CScript());
+
+    vector<valtype> vPushes = ScriptPushes(scriptSig);
+    for (unsigned int i = 0; i < vPushes.size(); i++)
+    {
+        // flip a bit in the middle and in the last (hash type) byte
+        vector<valtype> v = vPushes;
+        if (!v[i].empty())
+        {
+            v[i][v[i].size() / 2] ^= 0x01;
+            vVariants.push_back(PushAll(v));
+            v = vPushes;
+            v[i][v[i].size() - 1] ^= 0x02;
+            vVariants.push_back(PushAll(v));
+        }
+        // drop it
+        v = vPushes;
+        v.erase(v.begin() + i);
+        vVariants.push_back(PushAll(v));
+        // non-null element in its place
+        v = vPushes;
+        v[i] = valtype(1, 0x01);
+        vVariants.push_back(PushAll(v));
+    }
+    if (vPushes.size() > 1)
+    {
+        vector<valtype> v = vPushes;
+        swap(v[v.size() - 1], v[v.size() - 2]);
+        vVariants.push_back(PushAll(v));
+        if (vPushes.size() > 2)
+        {
+            v = vPushes;
+            swap(v[1], v[2]);
+            vVariants.push_back(PushAll(v));
+        }
+    }
+
+    // extra element at the bottom, non-push opcode, non-minimal push
+    vVariants.push_back((CScript() << OP_0) + scriptSig);
+    vVariants.push_back((CScript() << OP_NOP) + scriptSig);
+    vVariants.push_back((CScript() << OP_1) + scriptSig);
+    if (!vPushes.empty() && vPushes[0].size() < 0x4c)
+    {
+        CScript script;
+        script.push_back(OP_PUSHDATA1);
+        script.push_back(vPushes[0].size());
+        script.insert(script.end(), vPushes[0].begin(), vPushes[0].end());
+        vector<valtype> v(vPushes.begin() + 1, vPushes.end());
+        vVariants.push_back(script + PushAll(v));
+    }
+    return vVariants;
+}
+
+BOOST_AUTO_TEST_SUITE(script_standard_tests)
+
+// The fast path must never accept a spend the interpreter rejects, and
+// VerifyScript must agree with the interpreter everywhere
+BOOST_AUTO_TEST_CASE(script_standard_conformance)
+{
+    CBasicKeyStore keystore;
+    vector<CKey> keys(4);
+    vector<CPubKey> pubkeys;
+    for (unsigned int i = 0; i < keys.size(); i++)
+    {
+        keys[i].MakeNewKey(i % 2 == 0);
+        keystore.AddKey(keys[i]);
+        pubkeys.push_back(keys[i].GetPubKey());
+    }
+
+    vector<CScript> vScriptPubKey;
+    vScriptPubKey.push_back(CScript() << pubkeys[0].Raw() << OP_CHECKSIG);
+    vScriptPubKey.push_back(CScript() << pubkeys[1].Raw() << OP_CHECKSIG);
+    vScriptPubKey.push_back(GetScriptForDestination(pubkeys[0].GetID()));
+    vScriptPubKey.push_back(GetScriptForDestination(pubkeys[1].GetID()));
+    vector<CPubKey> vMultisigKeys(pubkeys.begin(), pubkeys.begin() + 3);
+    vScriptPubKey.push_back(GetScriptForMultisig(1, vMultisigKeys));
+    vScriptPubKey.push_back(GetScriptForMultisig(2, vMultisigKeys));
+    vScriptPubKey.push_back(GetScriptForMultisig(3, vMultisigKeys));
+    unsigned int nBare = vScriptPubKey.size();
+    for (unsigned int i = 0; i < nBare; i++)
+    {
+        keystore.AddCScript(vScriptPubKey[i]);
+        vScriptPubKey.push_back(GetScriptForDestination(CScriptID(vScriptPubKey[i].GetID())));
+    }
+
+    CTransaction txFrom;
+    BOOST_FOREACH(const CScript& scriptPubKey, vScriptPubKey)
+        txFrom.vout.push_back(CTxOut(1000, scriptPubKey));
+
+    static const int vHashTypes[] = {SIGHASH_ALL, SIGHASH_NONE, SIGHASH_SINGLE | SIGHASH_ANYONECANPAY};
+    static const unsigned int vFlags[] = {
+        SCRIPT_VERIFY_NONE, SCRIPT_VERIFY_P2SH, SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_STRICTENC,
+        SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_NULLDUMMY, STANDARD_SCRIPT_VERIFY_FLAGS,
+        STANDARD_SCRIPT_VERIFY_FLAGS | SCRIPT_VERIFY_MINIMALDATA | SCRIPT_VERIFY_SIGPUSHONLY
+    };
+
+    int nFast = 0, nValid = 0, nChecked = 0;
+    for (unsigned int h = 0; h < sizeof(vHashTypes) / sizeof(vHashTypes[0]); h++)
+    {
+        CTransaction txTo;
+        for (unsigned int i = 0; i < txFrom.vout.size(); i++)
+        {
+            txTo.vin.push_back(CTxIn(txFrom.GetHash(), i));
+            txTo.vout.push_back(CTxOut(900, CScript() << OP_1));
+        }
+        for (unsigned int i = 0; i < txTo.vin.size(); i++)
+            BOOST_CHECK_MESSAGE(SignSignature(keystore, txFrom, txTo, i, vHashTypes[h]), strprintf("sign %d", i));
+
+        for (unsigned int i = 0; i < txTo.vin.size(); i++)
+        {
+            const CScript& scriptPubKey = txFrom.vout[i].scriptPubKey;
+            vector<CScript> vVariants = ScriptSigVariants(txTo.vin[i].scriptSig);
+            for (unsigned int v = 0; v < vVariants.size(); v++)
+            {
+                for (unsigned int f = 0; f < sizeof(vFlags) / sizeof(vFlags[0]); f++)
+                {
+                    bool fInterpreted = VerifyScriptInterpreted(vVariants[v], scriptPubKey, txTo, i, vFlags[f]);
+                    bool fFast = VerifyStandardScript(vVariants[v], scriptPubKey, vFlags[f], SignatureChecker(txTo, i));
+                    bool fVerify = VerifyScript(vVariants[v], scriptPubKey, vFlags[f], CachingSignatureChecker(txTo, i, true));
+                    string strMessage = strprintf("input %d variant %d flags %x: %s", i, v, vFlags[f], vVariants[v].ToString());
+                    BOOST_CHECK_MESSAGE(!fFast || fInterpreted, strMessage);
+                    BOOST_CHECK_MESSAGE(fVerify == fInterpreted, strMessage);
+                    // P2SH spends only take the fast path when P2SH is on
+                    if (v == 0 && (i < nBare || (vFlags[f] & SCRIPT_VERIFY_P2SH)))
+                        BOOST_CHECK_MESSAGE(fFast, strMessage);
+                    nFast += fFast;
+                    nValid += fInterpreted;
+                    nChecked++;
+                }
+            }
+        }
+    }
+    BOOST_TEST_MESSAGE(strprintf("script_standard: %d scripts, %d valid, %d through the fast path", nChecked, nValid, nFast));
+}
+
+// Time a block's worth of pay-to-pubkey-hash spends through the interpreter
+// and through the fast path
+BOOST_AUTO_TEST_CASE(script_standard_throughput)
+{
+    const int nInputs = 1000;
+
+    CBasicKeyStore keystore;
+    CTransaction txFrom;
+    for (int i = 0; i < 10; i++)
+    {
+        CKey key;
+        key.MakeNewKey(true);
+        keystore.AddKey(key);
+        txFrom.vout.push_back(CTxOut(1000, GetScriptForDestination(key.GetPubKey().GetID())));
+    }
+
+    CTransaction txTo;
+    for (int i = 0; i < nInputs; i++)
+        txTo.vin.push_back(CTxIn(txFrom.GetHash(), i % txFrom.vout.size()));
+    txTo.vout.push_back(CTxOut(900, CScript() << OP_1));
+    CSignatureHashCache sighashes(txTo);
+    for (int i = 0; i < nInputs; i++)
+        BOOST_CHECK(SignSignature(keystore, txFrom, txTo, i, SIGHASH_ALL, &sighashes));
+
+    // SignatureChecker keeps the signature cache out of the timing
+    unsigned int flags = STANDARD_SCRIPT_VERIFY_FLAGS;
+
+    int64_t nStart = GetTimeMicros();
+    for (int i = 0; i < nInputs; i++)
+        BOOST_CHECK(VerifyScriptInterpreted(txTo.vin[i].scriptSig, txFrom.vout[i % txFrom.vout.size()].scriptPubKey, txTo, i, flags));
+    int64_t nInterpreted = GetTimeMicros() - nStart;
+
+    nStart = GetTimeMicros();
+    for (int i = 0; i < nInputs; i++)
+        BOOST_CHECK(VerifyStandardScript(txTo.vin[i].scriptSig, txFrom.vout[i % txFrom.vout.size()].scriptPubKey, flags, SignatureChecker(txTo, i)));
+    int64_t nFast = GetTimeMicros() - nStart;
+
+    BOOST_TEST_MESSAGE(strprintf("script_standard: %d P2PKH inputs, interpreter %dus, fast path %dus", nInputs, nInterpreted, nFast));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,265 @@
+#include <boost/test/unit_test.hpp>
+
+#include "bignum.h"
+#include "main.h"
+#include "script.h"
+#include "util.h"
+
+using namespace std;
+
+// The numeric opcodes as they were evaluated with CBigNum, kept here as the
+// reference CScriptNum is checked against.
+static CBigNum RefNum(const valtype& vch)
+{
+    if (vch.size() > 4)
+        throw runtime_error("RefNum() : overflow");
+    return CBigNum(vch);
+}
+
+static bool RefEvalScript(vector<valtype>& stack, const CScript& script)
+{
+    static const CBigNum bnZero(0);
+    static const CBigNum bnOne(1);
+
+    CScript::const_iterator pc = script.begin();
+    opcodetype opcode;
+    valtype vchPushValue;
+    try
+    {
+        while (pc < script.end())
+        {
+            if (!script.GetOp(pc, opcode, vchPushValue))
+                return false;
+            if (0 <= opcode && opcode <= OP_PUSHDATA4)
+            {
+                stack.push_back(vchPushValue);
+                continue;
+            }
+
+            switch (opcode)
+            {
+            case OP_1NEGATE:
+            case OP_1: case OP_2: case OP_3: case OP_4: case OP_5: case OP_6: case OP_7: case OP_8:
+            case OP_9: case OP_10: case OP_11: case OP_12: case OP_13: case OP_14: case OP_15: case OP_16:
+                stack.push_back(CBigNum((int)opcode - (int)(OP_1 - 1)).getvch());
+                break;
+
+            case OP_DEPTH:
+                stack.push_back(CBigNum((int)stack.size()).getvch());
+                break;
+
+            case OP_DUP:
+            case OP_SIZE:
+                if (stack.size() < 1)
+                    return false;
+                if (opcode == OP_DUP)
+                    stack.push_back(stack.back());
+                else
+                    stack.push_back(CBigNum((int)stack.back().size()).getvch());
+                break;
+
+            case OP_PICK:
+            {
+                if (stack.size() < 2)
+                    return false;
+                int n = RefNum(stack.back()).getint();
+                stack.pop_back();
+                if (n < 0 || n >= (int)stack.size())
+                    return false;
+                stack.push_back(stack[stack.size() - n - 1]);
+                break;
+            }
+
+            case OP_1ADD:
+            case OP_1SUB:
+            case OP_NEGATE:
+            case OP_ABS:
+            case OP_NOT:
+            case OP_0NOTEQUAL:
+            {
+                if (stack.size() < 1)
+                    return false;
+                CBigNum bn = RefNum(stack.back());
+                switch (opcode)
+                {
+                case OP_1ADD:       bn += bnOne; break;
+                case OP_1SUB:       bn -= bnOne; break;
+                case OP_NEGATE:     bn = -bn; break;
+                case OP_ABS:        if (bn < bnZero) bn = -bn; break;
+                case OP_NOT:        bn = CBigNum(bn == bnZero ? 1 : 0); break;
+                case OP_0NOTEQUAL:  bn = CBigNum(bn != bnZero ? 1 : 0); break;
+                default:            break;
+                }
+                stack.back() = bn.getvch();
+                break;
+            }
+
+            case OP_ADD:
+            case OP_SUB:
+            case OP_BOOLAND:
+            case OP_BOOLOR:
+            case OP_NUMEQUAL:
+            case OP_NUMEQUALVERIFY:
+            case OP_NUMNOTEQUAL:
+            case OP_LESSTHAN:
+            case OP_GREATERTHAN:
+            case OP_LESSTHANOREQUAL:
+            case OP_GREATERTHANOREQUAL:
+            case OP_MIN:
+            case OP_MAX:
+            {
+                if (stack.size() < 2)
+                    return false;
+                CBigNum bn1 = RefNum(stack[stack.size() - 2]);
+                CBigNum bn2 = RefNum(stack.back());
+                CBigNum bn;
+                switch (opcode)
+                {
+                case OP_ADD:                bn = bn1 + bn2; break;
+                case OP_SUB:                bn = bn1 - bn2; break;
+                case OP_BOOLAND:            bn = CBigNum(bn1 != bnZero && bn2 != bnZero ? 1 : 0); break;
+                case OP_BOOLOR:             bn = CBigNum(bn1 != bnZero || bn2 != bnZero ? 1 : 0); break;
+                case OP_NUMEQUAL:
+                case OP_NUMEQUALVERIFY:     bn = CBigNum(bn1 == bn2 ? 1 : 0); break;
+                case OP_NUMNOTEQUAL:        bn = CBigNum(bn1 != bn2 ? 1 : 0); break;
+                case OP_LESSTHAN:           bn = CBigNum(bn1 < bn2 ? 1 : 0); break;
+                case OP_GREATERTHAN:        bn = CBigNum(bn1 > bn2 ? 1 : 0); break;
+                case OP_LESSTHANOREQUAL:    bn = CBigNum(bn1 <= bn2 ? 1 : 0); break;
+                case OP_GREATERTHANOREQUAL: bn = CBigNum(bn1 >= bn2 ? 1 : 0); break;
+                case OP_MIN:                bn = (bn1 < bn2 ? bn1 : bn2); break;
+                case OP_MAX:                bn = (bn1 > bn2 ? bn1 : bn2); break;
+                default:                    break;
+                }
+                stack.pop_back();
+                stack.pop_back();
+                stack.push_back(bn.getvch());
+                if (opcode == OP_NUMEQUALVERIFY)
+                {
+                    if (bn == bnZero)
+                        return false;
+                    stack.pop_back();
+                }
+                break;
+            }
+
+            case OP_WITHIN:
+            {
+                if (stack.size() < 3)
+                    return false;
+                CBigNum bn1 = RefNum(stack[stack.size() - 3]);
+                CBigNum bn2 = RefNum(stack[stack.size() - 2]);
+                CBigNum bn3 = RefNum(stack.back());
+                bool fValue = (bn2 <= bn1 && bn1 < bn3);
+                stack.resize(stack.size() - 3);
+                stack.push_back(fValue ? valtype(1, 1) : valtype());
+                break;
+            }
+
+            default:
+                return false;
+            }
+        }
+    }
+    catch (...)
+    {
+        return false;
+    }
+    return true;
+}
+
+// Random numbers of up to 5 bytes, with extra weight on the edge cases:
+// leading zeros, negative zero and the 4-byte limits
+static valtype RandomNum()
+{
+    valtype vch(GetRandInt(6));
+    for (unsigned int i = 0; i < vch.size(); i++)
+        vch[i] = GetRandInt(256);
+    if (!vch.empty())
+    {
+        switch (GetRandInt(4))
+        {
+        case 0: vch.back() = 0x00; break;
+        case 1: vch.back() = 0x80; break;
+        case 2: vch.back() |= 0x7f; break;
+        default: break;
+        }
+    }
+    return vch;
+}
+
+static CScript RandomNumericScript()
+{
+    static const opcodetype oplist[] = {
+        OP_1NEGATE, OP_1, OP_2, OP_16, OP_DEPTH, OP_DUP, OP_SIZE, OP_PICK,
+        OP_1ADD, OP_1SUB, OP_NEGATE, OP_ABS, OP_NOT, OP_0NOTEQUAL,
+        OP_ADD, OP_SUB, OP_BOOLAND, OP_BOOLOR, OP_NUMEQUAL, OP_NUMEQUALVERIFY, OP_NUMNOTEQUAL,
+        OP_LESSTHAN, OP_GREATERTHAN, OP_LESSTHANOREQUAL, OP_GREATERTHANOREQUAL, OP_MIN, OP_MAX, OP_WITHIN
+    };
+
+    CScript script;
+    int nOps = 1 + GetRandInt(20);
+    for (int i = 0; i < nOps; i++)
+    {
+        if (GetRandInt(3) == 0)
+            script << RandomNum();
+        else
+            script << oplist[GetRandInt(sizeof(oplist) / sizeof(oplist[0]))];
+    }
+    return script;
+}
+
+BOOST_AUTO_TEST_SUITE(scriptnum_tests)
+
+BOOST_AUTO_TEST_CASE(scriptnum_vs_bignum)
+{
+    for (int i = 0; i < 10000; i++)
+    {
+        valtype vch = RandomNum();
+        if (vch.size() <= CScriptNum::nMaxNumSize)
+        {
+            CScriptNum num(vch, false);
+            CBigNum bn(vch);
+            BOOST_CHECK(num.getvch() == bn.getvch());
+            BOOST_CHECK_EQUAL(num.getint(), bn.getint());
+        }
+        else
+            BOOST_CHECK_THROW(CScriptNum(vch, false), scriptnum_error);
+
+        int64_t n = (int64_t)(GetRand(std::numeric_limits<uint64_t>::max()) >> (1 + GetRandInt(63)));
+        BOOST_CHECK(CScriptNum::serialize(n) == CBigNum(n).getvch());
+        BOOST_CHECK(CScriptNum::serialize(-n) == CBigNum(-n).getvch());
+    }
+
+    int64_t nMin = std::numeric_limits<int64_t>::min();
+    BOOST_CHECK(CScriptNum::serialize(nMin) == CBigNum(nMin).getvch());
+    BOOST_CHECK(CScript() << nMin == CScript() << CBigNum(nMin).getvch());
+}
+
+// The interpreter, on both kinds of stack, against the CBigNum reference over
+// random numeric scripts
+BOOST_AUTO_TEST_CASE(scriptnum_eval_fuzz)
+{
+    int nFailed = 0;
+    for (int i = 0; i < 20000; i++)
+    {
+        CScript script = RandomNumericScript();
+
+        vector<valtype> stackRef, stackVector;
+        CScriptStack stack;
+        bool fRef = RefEvalScript(stackRef, script);
+        bool fVector = EvalScript(stackVector, script, SCRIPT_VERIFY_NONE, BaseSignatureChecker());
+        bool fStack = EvalScript(stack, script, SCRIPT_VERIFY_NONE, BaseSignatureChecker());
+
+        vector<valtype> stackCopy;
+        for (unsigned int j = 0; j < stack.size(); j++)
+            stackCopy.push_back(valtype(stack[j].begin(), stack[j].end()));
+        BOOST_CHECK_MESSAGE(fVector == fRef && (!fRef || stackVector == stackRef), script.ToString());
+        BOOST_CHECK_MESSAGE(fStack == fRef && (!fRef || stackCopy == stackRef), script.ToString());
+        if (!fRef)
+            nFailed++;
+    }
+    // make sure the scripts are not all trivially failing
+    BOOST_CHECK(nFailed < 15000);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
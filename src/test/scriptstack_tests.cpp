@@ -0,0 +1,226 @@
+#include <boost/test/unit_test.hpp>
+
+#include <new>
+
+#include "key.h"
+#include "keystore.h"
+#include "main.h"
+#include "prevector.h"
+#include "script.h"
+#include "util.h"
+
+using namespace std;
+
+// Heap allocations made while fCountAllocations is set. Replacing the global
+// operator new is the only way to see the ones std::vector makes.
+static bool fCountAllocations = false;
+static unsigned int nAllocations = 0;
+
+void* operator new(size_t n)
+{
+    if (fCountAllocations)
+        nAllocations++;
+    void* p = malloc(n ? n : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) throw()
+{
+    free(p);
+}
+
+template<typename T>
+static bool IsTrue(const T& vch)
+{
+    for (unsigned int i = 0; i < vch.size(); i++)
+        if (vch[i] != 0)
+            return !(i == vch.size() - 1 && vch[i] == 0x80);
+    return false;
+}
+
+// The interpreted path of VerifyScript, on either kind of stack
+template<typename Stack>
+static bool VerifyOnStack(const CScript& scriptSig, const CScript& scriptPubKey, unsigned int flags, const BaseSignatureChecker& checker)
+{
+    Stack stack, stackCopy;
+    if (!EvalScript(stack, scriptSig, flags, checker))
+        return false;
+    stackCopy = stack;
+    if (!EvalScript(stack, scriptPubKey, flags, checker) || stack.empty() || !IsTrue(stack.back()))
+        return false;
+    if ((flags & SCRIPT_VERIFY_P2SH) && scriptPubKey.IsPayToScriptHash())
+    {
+        CScript redeemScript(stackCopy.back().begin(), stackCopy.back().end());
+        stackCopy.pop_back();
+        if (!EvalScript(stackCopy, redeemScript, flags, checker))
+            return false;
+        return !stackCopy.empty() && IsTrue(stackCopy.back());
+    }
+    return true;
+}
+
+template<typename Stack>
+static unsigned int CountAllocations(const CScript& scriptSig, const CScript& scriptPubKey, unsigned int flags, const BaseSignatureChecker& checker)
+{
+    nAllocations = 0;
+    fCountAllocations = true;
+    bool fOk = VerifyOnStack<Stack>(scriptSig, scriptPubKey, flags, checker);
+    fCountAllocations = false;
+    BOOST_CHECK(fOk);
+    return nAllocations;
+}
+
+BOOST_AUTO_TEST_SUITE(scriptstack_tests)
+
+// Random operations on a prevector of prevectors and on a vector of vectors
+// must leave them with the same contents
+BOOST_AUTO_TEST_CASE(scriptstack_prevector)
+{
+    typedef prevector<8, unsigned char> element;
+    for (int nRound = 0; nRound < 200; nRound++)
+    {
+        vector<valtype> ref;
+        prevector<4, element> test;
+        for (int nOp = 0; nOp < 200; nOp++)
+        {
+            int r = GetRandInt(10);
+            if (r < 3)
+            {
+                valtype vch(GetRandInt(20));
+                for (unsigned int i = 0; i < vch.size(); i++)
+                    vch[i] = GetRandInt(256);
+                ref.push_back(vch);
+                test.push_back(element(vch.begin(), vch.end()));
+            }
+            else if (r == 3 && !ref.empty())
+            {
+                ref.pop_back();
+                test.pop_back();
+            }
+            else if (r == 4 && ref.size() >= 2)
+            {
+                int a = GetRandInt(ref.size()), b = GetRandInt(ref.size());
+                swap(ref[a], ref[b]);
+                swap(test[a], test[b]);
+            }
+            else if (r == 5 && !ref.empty())
+            {
+                int a = GetRandInt(ref.size());
+                ref.erase(ref.begin() + a);
+                test.erase(test.begin() + a);
+            }
+            else if (r == 6 && !ref.empty())
+            {
+                int a = GetRandInt(ref.size() + 1), b = GetRandInt(ref.size());
+                valtype vch = ref[b];
+                ref.insert(ref.begin() + a, vch);
+                test.insert(test.begin() + a, test[b]);
+            }
+            else if (r == 7 && !ref.empty())
+            {
+                // element of the container itself, while it may reallocate
+                ref.push_back(valtype(ref.back()));
+                test.push_back(test.back());
+            }
+            else if (r == 8 && !ref.empty())
+            {
+                // range of the container itself, while it may reallocate
+                int a = GetRandInt(ref.size() + 1), b = GetRandInt(ref.size()), c = b + 1 + GetRandInt(ref.size() - b);
+                vector<valtype> vRange(ref.begin() + b, ref.begin() + c);
+                ref.insert(ref.begin() + a, vRange.begin(), vRange.end());
+                test.insert(test.begin() + a, test.begin() + b, test.begin() + c);
+            }
+            else if (r == 9)
+            {
+                prevector<4, element> copy(test);
+                test = copy;
+                ref.resize(ref.size() / 2);
+                test.resize(test.size() / 2);
+            }
+
+            BOOST_REQUIRE_EQUAL(ref.size(), test.size());
+            for (unsigned int i = 0; i < ref.size(); i++)
+                BOOST_REQUIRE(valtype(test[i].begin(), test[i].end()) == ref[i]);
+        }
+    }
+
+    prevector<3, int> count(5, 7);
+    BOOST_CHECK_EQUAL(count.size(), 5U);
+    BOOST_CHECK_EQUAL(count[4], 7);
+    BOOST_CHECK_THROW(count.at(5), out_of_range);
+}
+
+// A script that only moves data around never touches the heap
+BOOST_AUTO_TEST_CASE(scriptstack_no_allocations)
+{
+    valtype vchPreimage(32, 0x42);
+    CScript scriptPubKey;
+    scriptPubKey << OP_HASH160 << ToByteVector(Hash160(vchPreimage)) << OP_EQUALVERIFY
+                 << OP_1 << OP_2 << OP_ADD << OP_DUP << OP_TOALTSTACK << OP_FROMALTSTACK
+                 << OP_IF << OP_3 << OP_ELSE << OP_4 << OP_ENDIF << OP_EQUAL;
+    CScript scriptSig;
+    scriptSig << vchPreimage;
+
+    // first calls set up the interpreter's static constants
+    BaseSignatureChecker checker;
+    BOOST_CHECK(VerifyOnStack<CScriptStack>(scriptSig, scriptPubKey, SCRIPT_VERIFY_NONE, checker));
+    BOOST_CHECK(VerifyOnStack<vector<valtype> >(scriptSig, scriptPubKey, SCRIPT_VERIFY_NONE, checker));
+
+    BOOST_CHECK_EQUAL(CountAllocations<CScriptStack>(scriptSig, scriptPubKey, SCRIPT_VERIFY_NONE, checker), 0U);
+    BOOST_CHECK(CountAllocations<vector<valtype> >(scriptSig, scriptPubKey, SCRIPT_VERIFY_NONE, checker) > 0);
+}
+
+// Allocations per input, std::vector stack against CScriptStack, for the
+// standard script types. What is left with CScriptStack is signature hashing
+// and checking.
+BOOST_AUTO_TEST_CASE(scriptstack_allocations_per_input)
+{
+    const int nInputs = 20;
+
+    CBasicKeyStore keystore;
+    vector<CPubKey> pubkeys;
+    for (int i = 0; i < 3; i++)
+    {
+        CKey key;
+        key.MakeNewKey(true);
+        keystore.AddKey(key);
+        pubkeys.push_back(key.GetPubKey());
+    }
+
+    vector<pair<string, CScript> > vTypes;
+    vTypes.push_back(make_pair(string("P2PK"), CScript() << pubkeys[0].Raw() << OP_CHECKSIG));
+    vTypes.push_back(make_pair(string("P2PKH"), GetScriptForDestination(pubkeys[0].GetID())));
+    CScript multisig = GetScriptForMultisig(2, pubkeys);
+    keystore.AddCScript(multisig);
+    vTypes.push_back(make_pair(string("2-of-3"), multisig));
+    vTypes.push_back(make_pair(string("P2SH 2-of-3"), GetScriptForDestination(CScriptID(multisig.GetID()))));
+
+    for (unsigned int t = 0; t < vTypes.size(); t++)
+    {
+        CTransaction txFrom;
+        txFrom.vout.push_back(CTxOut(1000, vTypes[t].second));
+        CTransaction txTo;
+        for (int i = 0; i < nInputs; i++)
+            txTo.vin.push_back(CTxIn(txFrom.GetHash(), 0));
+        txTo.vout.push_back(CTxOut(900, CScript() << OP_1));
+        CSignatureHashCache sighashes(txTo);
+        for (int i = 0; i < nInputs; i++)
+            BOOST_CHECK(SignSignature(keystore, txFrom, txTo, i, SIGHASH_ALL, &sighashes));
+
+        unsigned int nVector = 0, nStack = 0;
+        for (int i = 0; i < nInputs; i++)
+        {
+            SignatureChecker checker(txTo, i, &sighashes);
+            const CScript& scriptSig = txTo.vin[i].scriptSig;
+            nVector += CountAllocations<vector<valtype> >(scriptSig, vTypes[t].second, STANDARD_SCRIPT_VERIFY_FLAGS, checker);
+            nStack += CountAllocations<CScriptStack>(scriptSig, vTypes[t].second, STANDARD_SCRIPT_VERIFY_FLAGS, checker);
+        }
+        BOOST_CHECK(nStack < nVector);
+        BOOST_TEST_MESSAGE(strprintf("scriptstack: %s, allocations per input: std::vector stack %.1f, CScriptStack %.1f",
+            vTypes[t].first, (double)nVector / nInputs, (double)nStack / nInputs));
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,178 @@
+#include <boost/test/unit_test.hpp>
+
+#include "crypto/sha256.h"
+#include "hash.h"
+#include "util.h"
+
+using namespace std;
+
+// OpenSSL's SHA-256, which hash.h uses, is the reference
+static uint256 RefSHA256(const unsigned char* p, size_t n)
+{
+    uint256 hash;
+    SHA256(p, n, (unsigned char*)&hash);
+    return hash;
+}
+
+static uint256 CSHA256Hash(const unsigned char* p, size_t n, size_t nSplit)
+{
+    uint256 hash;
+    CSHA256().Write(p, nSplit).Write(p + nSplit, n - nSplit).Finalize((unsigned char*)&hash);
+    return hash;
+}
+
+typedef struct {
+    const char *pszData;
+    const char *pszHash;
+} testvec_t;
+
+// FIPS 180-2 examples
+static const testvec_t vtest[] = {
+    {"", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"},
+    {"abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"},
+    {"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+     "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"},
+};
+
+// CSHA256, SHA256D64 and SHA256D56 with whatever implementation is selected
+static void CheckImplementation()
+{
+    for (unsigned int i = 0; i < sizeof(vtest)/sizeof(vtest[0]); i++)
+    {
+        const unsigned char* p = (const unsigned char*)vtest[i].pszData;
+        vector<unsigned char> vchHash(CSHA256::OUTPUT_SIZE);
+        CSHA256().Write(p, strlen(vtest[i].pszData)).Finalize(&vchHash[0]);
+        BOOST_CHECK_EQUAL(HexStr(vchHash), vtest[i].pszHash);
+    }
+
+    string strMillion(1000000, 'a');
+    vector<unsigned char> vchHash(CSHA256::OUTPUT_SIZE);
+    CSHA256 hasher;
+    for (unsigned int i = 0; i < strMillion.size(); i += 999)
+        hasher.Write((const unsigned char*)&strMillion[i], min((size_t)999, strMillion.size() - i));
+    hasher.Finalize(&vchHash[0]);
+    BOOST_CHECK_EQUAL(HexStr(vchHash), "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+
+    // Every length around the block boundaries, written in two parts
+    vector<unsigned char> vchData(64 * 20);
+    for (unsigned int i = 0; i < vchData.size(); i++)
+        vchData[i] = i * 7 + 3;
+    for (size_t n = 0; n <= 260; n++)
+        BOOST_CHECK(CSHA256Hash(&vchData[0], n, n / 3) == RefSHA256(&vchData[0], n));
+
+    // Batches of every size up to 20 messages, against Hash()
+    for (size_t nBlocks = 0; nBlocks <= 20; nBlocks++)
+    {
+        vector<uint256> vHashes(nBlocks);
+        SHA256D64((unsigned char*)&vHashes[0], &vchData[0], nBlocks);
+        for (size_t i = 0; i < nBlocks; i++)
+            BOOST_CHECK(vHashes[i] == Hash(vchData.begin() + 64 * i, vchData.begin() + 64 * (i + 1)));
+    }
+
+    // And of 56-byte messages, the size of a stake kernel
+    for (size_t nBlocks = 0; nBlocks <= 20; nBlocks++)
+    {
+        vector<uint256> vHashes(nBlocks);
+        SHA256D56((unsigned char*)&vHashes[0], &vchData[0], nBlocks);
+        for (size_t i = 0; i < nBlocks; i++)
+            BOOST_CHECK(vHashes[i] == Hash(vchData.begin() + 56 * i, vchData.begin() + 56 * (i + 1)));
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(sha256_tests)
+
+BOOST_AUTO_TEST_CASE(sha256_vectors)
+{
+    // The portable code until detection, then the fastest this CPU has
+    CheckImplementation();
+    BOOST_TEST_MESSAGE("sha256: using " + SHA256AutoDetect());
+    CheckImplementation();
+}
+
+// RFC 4231 test cases 1, 2, 4, 6 and 7, through CSHA256
+BOOST_AUTO_TEST_CASE(sha256_hmac)
+{
+    static const testvec_t vhmac[] = {
+        {"4869205468657265", "b0344c61d8db38535ca8afceaf0bf12b881dc200c9833da726e9376c2e32cff7"},
+        {"7768617420646f2079612077616e7420666f72206e6f7468696e673f",
+         "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843"},
+        {"cdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcd",
+         "82558a389a443c0ea4cc819899f2083a85f0faa3e578f8077a2e3ff46729665b"},
+        {"54657374205573696e67204c6172676572205468616e20426c6f636b2d53697a65204b6579202d2048617368204b6579204669727374",
+         "60e431591ee0b67f0d8a26aacbf5b77f8e0bc6213728c5140546040f0ee37f54"},
+        {"5468697320697320612074657374207573696e672061206c6172676572207468616e20626c6f636b2d73697a65206b657920616e642061206c6172676572207468616e20626c6f636b2d73697a6520646174612e20546865206b6579206e6565647320746f20626520686173686564206265666f7265206265696e6720757365642062792074686520484d414320616c676f726974686d2e",
+         "9b09ffa71b942fcb27635fbcd5b0e944bfdc63644f0713938a7f51535c3a35e2"},
+    };
+    static const char* vkey[] = {
+        "0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b",
+        "4a656665",
+        "0102030405060708090a0b0c0d0e0f10111213141516171819",
+        "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"
+        "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"
+        "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"
+        "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"
+        "aaaaaa",
+        "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"
+        "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"
+        "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"
+        "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"
+        "aaaaaa",
+    };
+    for (unsigned int i = 0; i < sizeof(vhmac)/sizeof(vhmac[0]); i++)
+    {
+        vector<unsigned char> vchKey = ParseHex(vkey[i]);
+        vector<unsigned char> vchData = ParseHex(vhmac[i].pszData);
+
+        // Keys longer than a block are hashed first
+        unsigned char rkey[64] = {0};
+        if (vchKey.size() <= 64)
+            memcpy(rkey, &vchKey[0], vchKey.size());
+        else
+            CSHA256().Write(&vchKey[0], vchKey.size()).Finalize(rkey);
+
+        unsigned char ipad[64], opad[64];
+        for (int n = 0; n < 64; n++)
+        {
+            ipad[n] = rkey[n] ^ 0x36;
+            opad[n] = rkey[n] ^ 0x5c;
+        }
+        vector<unsigned char> vchInner(CSHA256::OUTPUT_SIZE), vchMAC(CSHA256::OUTPUT_SIZE);
+        CSHA256().Write(ipad, 64).Write(&vchData[0], vchData.size()).Finalize(&vchInner[0]);
+        CSHA256().Write(opad, 64).Write(&vchInner[0], vchInner.size()).Finalize(&vchMAC[0]);
+        BOOST_CHECK_EQUAL(HexStr(vchMAC), vhmac[i].pszHash);
+    }
+}
+
+// Throughput of the streaming hasher and of the batched double hash, for
+// comparison between machines and implementations
+BOOST_AUTO_TEST_CASE(sha256_throughput)
+{
+    SHA256AutoDetect();
+    vector<unsigned char> vchData(1 << 20);
+    vector<unsigned char> vchOut(vchData.size() / 2);
+    unsigned char hash[CSHA256::OUTPUT_SIZE];
+
+    int64_t nStart = GetTimeMicros();
+    for (int i = 0; i < 20; i++)
+        CSHA256().Write(&vchData[0], vchData.size()).Finalize(hash);
+    int64_t nStream = GetTimeMicros() - nStart;
+
+    nStart = GetTimeMicros();
+    for (int i = 0; i < 20; i++)
+        SHA256D64(&vchOut[0], &vchData[0], vchData.size() / 64);
+    int64_t nBatch = GetTimeMicros() - nStart;
+
+    nStart = GetTimeMicros();
+    for (int i = 0; i < 20; i++)
+        for (size_t n = 0; n < vchData.size(); n += 64)
+            Hash(vchData.begin() + n, vchData.begin() + n + 64);
+    int64_t nOne = GetTimeMicros() - nStart;
+
+    uint256 hash0 = Hash(vchData.begin(), vchData.begin() + 64);
+    BOOST_CHECK(memcmp(&vchOut[0], hash0.begin(), 32) == 0);
+
+    BOOST_TEST_MESSAGE(strprintf("sha256: CSHA256 %.1f MB/s, 64-byte double hashes: SHA256D64 %.1f MB/s, Hash() %.1f MB/s",
+        20.0 * 1000000 / max(nStream, (int64_t)1), 20.0 * 1000000 / max(nBatch, (int64_t)1), 20.0 * 1000000 / max(nOne, (int64_t)1)));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
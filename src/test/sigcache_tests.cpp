@@ -0,0 +1,159 @@
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+#include "sigcache.h"
+#include "util.h"
+
+using namespace std;
+
+static vector<unsigned char> RandomSig(unsigned int nLen)
+{
+    vector<unsigned char> vch(nLen);
+    RandAddSeedPerfmon();
+    for (unsigned int i = 0; i < nLen; i++)
+        vch[i] = GetRandInt(256);
+    return vch;
+}
+
+static void LookupThread(CSignatureCache* cache, const vector<uint256>* vHash, const vector<unsigned char>* vchSig, const CPubKey* pubkey, int nRounds, int* pnFound)
+{
+    int nFound = 0;
+    for (int n = 0; n < nRounds; n++)
+        for (unsigned int i = 0; i < vHash->size(); i++)
+            if (cache->Get((*vHash)[i], *vchSig, *pubkey))
+                nFound++;
+    *pnFound = nFound;
+}
+
+static void InsertThread(CSignatureCache* cache, const vector<uint256>* vHash, const vector<unsigned char>* vchSig, const CPubKey* pubkey)
+{
+    for (unsigned int i = 0; i < vHash->size(); i++)
+        cache->Set((*vHash)[i], *vchSig, *pubkey);
+}
+
+BOOST_AUTO_TEST_SUITE(sigcache_tests)
+
+BOOST_AUTO_TEST_CASE(sigcache_get_set)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CPubKey pubkey = key.GetPubKey();
+    vector<unsigned char> vchSig = RandomSig(71);
+    uint256 hash = GetRandHash();
+
+    CSignatureCache cache;
+    // unallocated cache never hits
+    cache.Set(hash, vchSig, pubkey);
+    BOOST_CHECK(!cache.Get(hash, vchSig, pubkey));
+
+    cache.SetMaxSize(1 << 16);
+    BOOST_CHECK_EQUAL(cache.GetMaxEntries(), (size_t)((1 << 16) / 32));
+    BOOST_CHECK(!cache.Get(hash, vchSig, pubkey));
+    cache.Set(hash, vchSig, pubkey);
+    BOOST_CHECK(cache.Get(hash, vchSig, pubkey));
+
+    // any change to the triple misses
+    vector<unsigned char> vchSig2 = vchSig;
+    vchSig2[10] ^= 1;
+    BOOST_CHECK(!cache.Get(hash, vchSig2, pubkey));
+    BOOST_CHECK(!cache.Get(hash ^ 1, vchSig, pubkey));
+    CKey key2;
+    key2.MakeNewKey(true);
+    BOOST_CHECK(!cache.Get(hash, vchSig, key2.GetPubKey()));
+
+    // resizing drops everything
+    cache.SetMaxSize(1 << 16);
+    BOOST_CHECK(!cache.Get(hash, vchSig, pubkey));
+
+    uint64_t nHits, nMisses, nInserts, nEvictions;
+    cache.GetStats(nHits, nMisses, nInserts, nEvictions);
+    BOOST_CHECK_EQUAL(nHits, 1U);
+    BOOST_CHECK_EQUAL(nMisses, 5U);
+    BOOST_CHECK_EQUAL(nInserts, 1U);
+    BOOST_CHECK_EQUAL(nEvictions, 0U);
+}
+
+// Fill a small cache well past its capacity: it must never grow, and the
+// most recent entries must still mostly be found
+BOOST_AUTO_TEST_CASE(sigcache_eviction)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CPubKey pubkey = key.GetPubKey();
+    vector<unsigned char> vchSig = RandomSig(72);
+
+    CSignatureCache cache;
+    cache.SetMaxSize(32 * CSignatureCache::BUCKET_ENTRIES * 64);
+    size_t nMaxEntries = cache.GetMaxEntries();
+    BOOST_CHECK_EQUAL(nMaxEntries, 512U);
+
+    vector<uint256> vHash;
+    for (unsigned int i = 0; i < nMaxEntries * 4; i++)
+    {
+        vHash.push_back(GetRandHash());
+        cache.Set(vHash.back(), vchSig, pubkey);
+    }
+    BOOST_CHECK_EQUAL(cache.GetMaxEntries(), nMaxEntries);
+
+    unsigned int nFound = 0;
+    for (unsigned int i = 0; i < vHash.size(); i++)
+        if (cache.Get(vHash[i], vchSig, pubkey))
+            nFound++;
+    BOOST_CHECK(nFound <= nMaxEntries);
+    BOOST_CHECK(nFound >= nMaxEntries / 4);
+
+    // the very last insert always survives
+    BOOST_CHECK(cache.Get(vHash.back(), vchSig, pubkey));
+
+    uint64_t nHits, nMisses, nInserts, nEvictions;
+    cache.GetStats(nHits, nMisses, nInserts, nEvictions);
+    BOOST_CHECK_EQUAL(nInserts, vHash.size());
+    BOOST_CHECK(nInserts - nEvictions <= nMaxEntries);
+}
+
+// Lookups run without the lock while another thread inserts; every entry
+// inserted before the readers started and never evicted must stay visible
+BOOST_AUTO_TEST_CASE(sigcache_contention)
+{
+    const int nThreads = 4;
+    const int nRounds = 20;
+
+    CKey key;
+    key.MakeNewKey(true);
+    CPubKey pubkey = key.GetPubKey();
+    vector<unsigned char> vchSig = RandomSig(71);
+
+    CSignatureCache cache;
+    cache.SetMaxSize(1 << 22);
+
+    vector<uint256> vHash, vHashNew;
+    for (int i = 0; i < 2000; i++)
+    {
+        vHash.push_back(GetRandHash());
+        vHashNew.push_back(GetRandHash());
+    }
+    InsertThread(&cache, &vHash, &vchSig, &pubkey);
+
+    int vFound[nThreads];
+    int64_t nStart = GetTimeMicros();
+    boost::thread_group threads;
+    for (int i = 0; i < nThreads; i++)
+        threads.create_thread(boost::bind(&LookupThread, &cache, &vHash, &vchSig, &pubkey, nRounds, &vFound[i]));
+    threads.create_thread(boost::bind(&InsertThread, &cache, &vHashNew, &vchSig, &pubkey));
+    threads.join_all();
+    int64_t nElapsed = GetTimeMicros() - nStart;
+
+    uint64_t nHits, nMisses, nInserts, nEvictions;
+    cache.GetStats(nHits, nMisses, nInserts, nEvictions);
+    // 4000 entries spread over 16384 buckets of 8: nothing gets evicted
+    BOOST_CHECK_EQUAL(nEvictions, 0U);
+    for (int i = 0; i < nThreads; i++)
+        BOOST_CHECK_EQUAL(vFound[i], nRounds * (int)vHash.size());
+    BOOST_CHECK_EQUAL(nInserts, 4000U);
+
+    BOOST_TEST_MESSAGE(strprintf("sigcache: %d lookups in %dus (%.0f/s) with %d threads",
+        nThreads * nRounds * (int)vHash.size(), nElapsed,
+        nThreads * nRounds * vHash.size() * 1000000.0 / max(nElapsed, (int64_t)1), nThreads));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
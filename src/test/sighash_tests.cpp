@@ -0,0 +1,121 @@
+#include <boost/test/unit_test.hpp>
+
+#include "main.h"
+#include "script.h"
+#include "util.h"
+
+using namespace std;
+
+static void RandomScript(CScript& script)
+{
+    static const opcodetype oplist[] = {OP_FALSE, OP_1, OP_2, OP_3, OP_CHECKSIG, OP_IF, OP_VERIF, OP_RETURN, OP_CODESEPARATOR};
+    script = CScript();
+    int ops = GetRandInt(10);
+    for (int i = 0; i < ops; i++)
+        script << oplist[GetRandInt(sizeof(oplist) / sizeof(oplist[0]))];
+}
+
+static void RandomTransaction(CTransaction& tx, int nInputs, int nOutputs)
+{
+    tx.nVersion = GetRandInt(4);
+    tx.nTime = GetRandInt(2000000000);
+    tx.vin.clear();
+    tx.vout.clear();
+    tx.nLockTime = (GetRandInt(2)) ? GetRandInt(1000000) : 0;
+    for (int in = 0; in < nInputs; in++)
+    {
+        tx.vin.push_back(CTxIn());
+        CTxIn& txin = tx.vin.back();
+        txin.prevout.hash = GetRandHash();
+        txin.prevout.n = GetRandInt(4);
+        RandomScript(txin.scriptSig);
+        txin.nSequence = (GetRandInt(2)) ? GetRandInt(1000000) : (unsigned int)-1;
+    }
+    for (int out = 0; out < nOutputs; out++)
+    {
+        tx.vout.push_back(CTxOut());
+        CTxOut& txout = tx.vout.back();
+        txout.nValue = GetRand(100000000);
+        RandomScript(txout.scriptPubKey);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(sighash_tests)
+
+// CSignatureHashCache must give the same digest as SignatureHash for every
+// hash type, including the out of range SIGHASH_SINGLE case
+BOOST_AUTO_TEST_CASE(sighash_cache_matches)
+{
+    static const int vHashTypes[] = {
+        SIGHASH_ALL, SIGHASH_NONE, SIGHASH_SINGLE,
+        SIGHASH_ALL | SIGHASH_ANYONECANPAY, SIGHASH_NONE | SIGHASH_ANYONECANPAY, SIGHASH_SINGLE | SIGHASH_ANYONECANPAY,
+        0, 4, 0x21, 0x7f
+    };
+
+    for (int nTest = 0; nTest < 200; nTest++)
+    {
+        CTransaction tx;
+        RandomTransaction(tx, 1 + GetRandInt(8), GetRandInt(8));
+        CSignatureHashCache sighashes(tx);
+
+        for (unsigned int nIn = 0; nIn < tx.vin.size(); nIn++)
+        {
+            CScript scriptCode;
+            RandomScript(scriptCode);
+            for (unsigned int i = 0; i < sizeof(vHashTypes) / sizeof(vHashTypes[0]); i++)
+                BOOST_CHECK(sighashes.SignatureHash(scriptCode, nIn, vHashTypes[i]) == SignatureHash(scriptCode, tx, nIn, vHashTypes[i]));
+            int nHashType = GetRandInt(0x7fffffff) * (GetRandInt(2) ? 1 : -1);
+            BOOST_CHECK(sighashes.SignatureHash(scriptCode, nIn, nHashType) == SignatureHash(scriptCode, tx, nIn, nHashType));
+        }
+        BOOST_CHECK(sighashes.SignatureHash(CScript(), tx.vin.size(), SIGHASH_ALL) == 1);
+    }
+}
+
+// Changing scriptSigs does not invalidate the cache
+BOOST_AUTO_TEST_CASE(sighash_cache_scriptsig)
+{
+    CTransaction tx;
+    RandomTransaction(tx, 5, 3);
+    CSignatureHashCache sighashes(tx);
+    CScript scriptCode;
+    RandomScript(scriptCode);
+
+    for (unsigned int nIn = 0; nIn < tx.vin.size(); nIn++)
+    {
+        RandomScript(tx.vin[nIn].scriptSig);
+        for (unsigned int i = 0; i < tx.vin.size(); i++)
+            BOOST_CHECK(sighashes.SignatureHash(scriptCode, i, SIGHASH_ALL) == SignatureHash(scriptCode, tx, i, SIGHASH_ALL));
+    }
+}
+
+// Time hashing every input of transactions of growing size, both ways
+BOOST_AUTO_TEST_CASE(sighash_cache_scaling)
+{
+    static const int vInputs[] = {1, 10, 100, 500, 2000};
+
+    CScript scriptCode;
+    scriptCode << OP_DUP << OP_HASH160 << vector<unsigned char>(20, 0x42) << OP_EQUALVERIFY << OP_CHECKSIG;
+
+    for (unsigned int n = 0; n < sizeof(vInputs) / sizeof(vInputs[0]); n++)
+    {
+        CTransaction tx;
+        RandomTransaction(tx, vInputs[n], 2);
+        vector<uint256> vHash(tx.vin.size());
+
+        int64_t nStart = GetTimeMicros();
+        for (unsigned int i = 0; i < tx.vin.size(); i++)
+            vHash[i] = SignatureHash(scriptCode, tx, i, SIGHASH_ALL);
+        int64_t nPlain = GetTimeMicros() - nStart;
+
+        nStart = GetTimeMicros();
+        CSignatureHashCache sighashes(tx);
+        for (unsigned int i = 0; i < tx.vin.size(); i++)
+            BOOST_CHECK(sighashes.SignatureHash(scriptCode, i, SIGHASH_ALL) == vHash[i]);
+        int64_t nCached = GetTimeMicros() - nStart;
+
+        BOOST_TEST_MESSAGE(strprintf("sighash: %d inputs, SignatureHash %dus, CSignatureHashCache %dus",
+            vInputs[n], nPlain, nCached));
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
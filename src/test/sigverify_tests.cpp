@@ -0,0 +1,204 @@
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+#include <limits>
+
+#include "key.h"
+#include "sigverify.h"
+#include "util.h"
+
+using namespace std;
+
+static void WorkerThread(CSignatureVerifier* verifier)
+{
+    verifier->Thread();
+}
+
+// Signatures by a few keys, some of them corrupted, some repeated, in DER and
+// compact form; the expected result of each
+static void MakeItems(vector<CSigVerifyItem>& vItems, vector<bool>& vExpected)
+{
+    vector<CKey> keys(4);
+    for (unsigned int i = 0; i < keys.size(); i++)
+        keys[i].MakeNewKey(i % 2 == 0);
+
+    for (int i = 0; i < 200; i++)
+    {
+        const CKey& key = keys[i % keys.size()];
+        uint256 hash = GetRandHash();
+        vector<unsigned char> vchSig;
+        bool fCompact = (i % 5 == 0);
+        if (fCompact)
+            BOOST_CHECK(key.SignCompact(hash, vchSig));
+        else
+            BOOST_CHECK(key.Sign(hash, vchSig));
+
+        bool fValid = true;
+        switch (i % 7)
+        {
+        case 1: vchSig[vchSig.size() / 2] ^= 0x10; fValid = false; break;
+        case 2: hash ^= 1; fValid = false; break;
+        case 3: if (fCompact) { vchSig[0] ^= 4; fValid = false; } break; // compression flag
+        case 4: if (fCompact) { vchSig[0] ^= 1; fValid = false; } break; // recid
+        default: break;
+        }
+        // wrong key
+        CPubKey pubkey = key.GetPubKey();
+        if (i % 11 == 3)
+        {
+            pubkey = keys[(i + 1) % keys.size()].GetPubKey();
+            fValid = false;
+        }
+
+        CSigVerifyItem item(hash, vchSig, pubkey, fCompact);
+        vItems.push_back(item);
+        vExpected.push_back(fValid);
+        if (i % 13 == 0)
+        {
+            vItems.push_back(item);
+            vExpected.push_back(fValid);
+        }
+    }
+
+    // a compressed key that is not on the curve
+    vector<unsigned char> vchBad(33, 0);
+    vchBad[0] = 0x02;
+    vchBad[32] = 0x05;
+    vItems.push_back(CSigVerifyItem(vItems[1].hash, vItems[1].vchSig, CPubKey(vchBad)));
+    vExpected.push_back(false);
+}
+
+BOOST_AUTO_TEST_SUITE(sigverify_tests)
+
+// Batches must give exactly what verifying each signature by itself gives,
+// with and without worker threads
+BOOST_AUTO_TEST_CASE(sigverify_batch)
+{
+    vector<CSigVerifyItem> vItems;
+    vector<bool> vExpected;
+    MakeItems(vItems, vExpected);
+
+    for (int nThreads = 0; nThreads <= 3; nThreads += 3)
+    {
+        CPubKeyCache cache(2);
+        CSignatureVerifier verifier(4, &cache);
+        boost::thread_group threadGroup;
+        for (int i = 0; i < nThreads; i++)
+            threadGroup.create_thread(boost::bind(&WorkerThread, &verifier));
+
+        for (unsigned int i = 0; i < vItems.size(); i++)
+            BOOST_CHECK_MESSAGE(verifier.Verify(vItems[i]) == vExpected[i], strprintf("item %u", i));
+
+        vector<CSigVerifyItem> vBatch1(vItems), vBatch2(vItems.begin(), vItems.begin() + 50);
+        CSigVerifyBatchRef batch1 = verifier.Submit(vBatch1);
+        CSigVerifyBatchRef batch2 = verifier.Submit(vBatch2);
+        BOOST_CHECK(vBatch1.empty());
+
+        vector<bool> vResults1, vResults2;
+        BOOST_CHECK(!verifier.Await(batch2, &vResults2));
+        BOOST_CHECK(!verifier.Await(batch1, &vResults1));
+        BOOST_CHECK(vResults1 == vExpected);
+        BOOST_CHECK(vResults2 == vector<bool>(vExpected.begin(), vExpected.begin() + 50));
+
+        // all valid, and empty
+        vector<CSigVerifyItem> vValid, vEmpty;
+        for (unsigned int i = 0; i < vItems.size(); i++)
+            if (vExpected[i])
+                vValid.push_back(vItems[i]);
+        BOOST_CHECK(verifier.Await(verifier.Submit(vValid)));
+        BOOST_CHECK(verifier.Await(verifier.Submit(vEmpty)));
+
+        threadGroup.interrupt_all();
+        threadGroup.join_all();
+
+        CSigVerifyStats stats;
+        verifier.GetStats(stats);
+        BOOST_CHECK_EQUAL(stats.nBatches, 4U);
+        BOOST_CHECK(stats.nDuplicates > 0U);
+        uint64_t nBatches = 0;
+        for (unsigned int i = 0; i < CSigVerifyStats::HISTOGRAM_BUCKETS; i++)
+            nBatches += stats.vBatchSize[i];
+        BOOST_CHECK_EQUAL(nBatches, 4U);
+
+        CPubKeyCacheStats cachestats;
+        cache.GetStats(cachestats);
+        BOOST_CHECK(cachestats.nHits > 0U);
+        BOOST_CHECK(cachestats.nEvictions > 0U);
+        BOOST_CHECK_EQUAL(cachestats.nEntries, 2U);
+    }
+}
+
+// The least recently used key goes first, and keys that are not on the
+// curve are remembered as such
+BOOST_AUTO_TEST_CASE(sigverify_pubkeycache)
+{
+    vector<CPubKey> pubkeys;
+    for (int i = 0; i < 4; i++)
+    {
+        CKey key;
+        key.MakeNewKey(true);
+        pubkeys.push_back(key.GetPubKey());
+    }
+    vector<unsigned char> vchBad(33, 0);
+    vchBad[0] = 0x02;
+    vchBad[32] = 0x05;
+
+    CPubKeyCache cache(3);
+    CPubKey pubkeyFull;
+    for (int i = 0; i < 3; i++)
+    {
+        BOOST_CHECK(cache.Get(pubkeys[i], pubkeyFull));
+        BOOST_CHECK(!pubkeyFull.IsCompressed());
+        BOOST_CHECK(pubkeyFull.GetID() != pubkeys[i].GetID());
+    }
+    // Use the oldest, so that the second is dropped instead
+    BOOST_CHECK(cache.Get(pubkeys[0], pubkeyFull));
+    BOOST_CHECK(cache.Get(pubkeys[3], pubkeyFull));
+    BOOST_CHECK(!cache.Get(CPubKey(vchBad), pubkeyFull));
+    BOOST_CHECK(!cache.Get(CPubKey(vchBad), pubkeyFull));
+
+    CPubKeyCacheStats stats;
+    cache.GetStats(stats);
+    BOOST_CHECK_EQUAL(stats.nHits, 2U);
+    BOOST_CHECK_EQUAL(stats.nMisses, 5U);
+    BOOST_CHECK_EQUAL(stats.nEvictions, 2U);
+
+    BOOST_CHECK(cache.Get(pubkeys[0], pubkeyFull));
+    BOOST_CHECK(cache.Get(pubkeys[1], pubkeyFull));
+    cache.GetStats(stats);
+    BOOST_CHECK_EQUAL(stats.nHits, 3U);
+    BOOST_CHECK_EQUAL(stats.nEntries, 3U);
+
+    // Uncompressed keys are used as they are
+    BOOST_CHECK(cache.Get(pubkeyFull, pubkeyFull));
+    cache.GetStats(stats);
+    BOOST_CHECK_EQUAL(stats.nHits + stats.nMisses, 9U);
+
+    // Compact signatures are remembered by the key they recover to
+    CKey key;
+    key.MakeNewKey(true);
+    uint256 hash = GetRandHash();
+    vector<unsigned char> vchSig;
+    BOOST_CHECK(key.SignCompact(hash, vchSig));
+    for (int i = 0; i < 2; i++)
+    {
+        BOOST_CHECK(cache.GetRecovered(hash, vchSig, pubkeyFull));
+        BOOST_CHECK(pubkeyFull == key.GetPubKey());
+    }
+    cache.GetStats(stats);
+    BOOST_CHECK_EQUAL(stats.nHits, 4U);
+    BOOST_CHECK_EQUAL(stats.nRecoveredEntries, 1U);
+    BOOST_CHECK_EQUAL(stats.nEntries, 3U);
+}
+
+BOOST_AUTO_TEST_CASE(sigverify_histogram)
+{
+    BOOST_CHECK_EQUAL(CSigVerifyStats::GetBucket(0), 0U);
+    BOOST_CHECK_EQUAL(CSigVerifyStats::GetBucket(1), 0U);
+    BOOST_CHECK_EQUAL(CSigVerifyStats::GetBucket(2), 1U);
+    BOOST_CHECK_EQUAL(CSigVerifyStats::GetBucket(3), 1U);
+    BOOST_CHECK_EQUAL(CSigVerifyStats::GetBucket(1024), 10U);
+    BOOST_CHECK_EQUAL(CSigVerifyStats::GetBucket(std::numeric_limits<uint64_t>::max()), CSigVerifyStats::HISTOGRAM_BUCKETS - 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,122 @@
+#include <boost/test/unit_test.hpp>
+
+#include "main.h"
+#include "util.h"
+#include "wallet.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(stakecoins_tests)
+
+BOOST_AUTO_TEST_CASE(stake_coins_maturity)
+{
+    CStakeCoinSet coins;
+    const unsigned int nTime = 1400000000;
+    COutPoint a(GetRandHash(), 0), b(GetRandHash(), 1), c(GetRandHash(), 0);
+
+    // Past the height at once, old enough in an hour
+    coins.Add(a, 10 * COIN, 100, nTime + 3600);
+    // Old enough, mature in ten blocks, like a coinstake
+    coins.Add(b, 20 * COIN, 110, nTime);
+    BOOST_CHECK_EQUAL(coins.size(), 2U);
+    BOOST_CHECK_EQUAL(coins.GetWeight(100, nTime, 0), 0);
+    BOOST_CHECK_EQUAL(coins.GetWeight(100, nTime + 3600, 0), 10 * COIN);
+    BOOST_CHECK_EQUAL(coins.GetWeight(110, nTime + 3600, 0), 30 * COIN);
+
+    // Adding a coin again changes nothing
+    coins.Add(b, 20 * COIN, 110, nTime);
+    BOOST_CHECK_EQUAL(coins.GetWeight(110, nTime + 3600, 0), 30 * COIN);
+
+    // Spent
+    coins.Remove(a);
+    BOOST_CHECK_EQUAL(coins.GetWeight(110, nTime + 3600, 0), 20 * COIN);
+    coins.Remove(a);
+    BOOST_CHECK_EQUAL(coins.size(), 1U);
+
+    // A reorganization takes the chain back below its maturity
+    BOOST_CHECK_EQUAL(coins.GetWeight(109, nTime + 3600, 0), 0);
+    BOOST_CHECK_EQUAL(coins.GetWeight(110, nTime + 3600, 0), 20 * COIN);
+
+    // Disconnected
+    coins.Add(c, 5 * COIN, 105, nTime);
+    BOOST_CHECK_EQUAL(coins.GetWeight(110, nTime + 3600, 0), 25 * COIN);
+    coins.Remove(c.hash);
+    BOOST_CHECK_EQUAL(coins.GetWeight(110, nTime + 3600, 0), 20 * COIN);
+
+    // Too small to stake, but still part of the balance
+    int64_t nMinimumInputValueSaved = nMinimumInputValue;
+    nMinimumInputValue = 10 * COIN;
+    coins.Add(c, 5 * COIN, 105, nTime);
+    BOOST_CHECK_EQUAL(coins.GetWeight(110, nTime + 3600, 0), 20 * COIN);
+    BOOST_CHECK_EQUAL(coins.GetWeight(110, nTime + 3600, 20 * COIN), 20 * COIN);
+    nMinimumInputValue = nMinimumInputValueSaved;
+    BOOST_CHECK_EQUAL(coins.GetWeight(110, nTime + 3600, 0), 25 * COIN);
+
+    coins.Clear();
+    BOOST_CHECK_EQUAL(coins.size(), 0U);
+    BOOST_CHECK_EQUAL(coins.GetWeight(110, nTime + 3600, 0), 0);
+}
+
+BOOST_AUTO_TEST_CASE(stake_coins_reserve)
+{
+    CStakeCoinSet coins;
+    const unsigned int nTime = 1400000000;
+    vector<COutPoint> vPrevouts;
+    for (int i = 0; i < 4; i++)
+        vPrevouts.push_back(COutPoint(GetRandHash(), i));
+    sort(vPrevouts.begin(), vPrevouts.end());
+
+    // In wallet order: 1, 2, 4, and one too young of 8
+    coins.Add(vPrevouts[0], 1 * COIN, 0, nTime);
+    coins.Add(vPrevouts[1], 2 * COIN, 0, nTime);
+    coins.Add(vPrevouts[2], 4 * COIN, 0, nTime);
+    coins.Add(vPrevouts[3], 8 * COIN, 0, nTime + 1);
+
+    BOOST_CHECK_EQUAL(coins.GetWeight(10, nTime, 0), 7 * COIN);
+    // Keeping back the young coin leaves all that may stake
+    BOOST_CHECK_EQUAL(coins.GetWeight(10, nTime, 8 * COIN), 7 * COIN);
+    // The coins are taken in order until they cover what is not reserved
+    BOOST_CHECK_EQUAL(coins.GetWeight(10, nTime, 13 * COIN), 2 * COIN + COIN);
+    BOOST_CHECK_EQUAL(coins.GetWeight(10, nTime, 14 * COIN), COIN);
+    BOOST_CHECK_EQUAL(coins.GetWeight(10, nTime, 15 * COIN), 0);
+    BOOST_CHECK_EQUAL(coins.GetWeight(10, nTime, 20 * COIN), 0);
+    BOOST_CHECK_EQUAL(coins.GetWeight(10, nTime + 1, 10 * COIN), 7 * COIN);
+}
+
+BOOST_AUTO_TEST_CASE(stake_weight_incremental)
+{
+    // Kept up to date block after block, as coins are spent and new ones
+    // confirmed, the weight is what counting all the coins again gives
+    CStakeCoinSet coins;
+    const unsigned int nTime = 1400000000;
+    const int nHeight = 1000;
+    map<COutPoint, pair<int64_t, pair<int, unsigned int> > > mapAdded;
+    for (unsigned int i = 0; i < 200; i++)
+    {
+        COutPoint prevout(GetRandHash(), i % 2);
+        int64_t nValue = 1 + GetRand(100 * COIN);
+        int nHeightMature = nHeight - 10 + i % 20;
+        unsigned int nTimeMature = nTime - 600 + i % 1200;
+        coins.Add(prevout, nValue, nHeightMature, nTimeMature);
+        mapAdded[prevout] = make_pair(nValue, make_pair(nHeightMature, nTimeMature));
+    }
+    coins.GetWeight(nHeight - 20, nTime - 1200, 0);
+
+    for (int n = 0; n < 30; n++)
+    {
+        coins.Remove(mapAdded.begin()->first);
+        mapAdded.erase(mapAdded.begin());
+        COutPoint prevout(GetRandHash(), 0);
+        coins.Add(prevout, COIN, nHeight + n, nTime + n * 60);
+        mapAdded[prevout] = make_pair(COIN, make_pair(nHeight + n, nTime + n * 60));
+
+        CStakeCoinSet recount;
+        for (map<COutPoint, pair<int64_t, pair<int, unsigned int> > >::const_iterator it = mapAdded.begin(); it != mapAdded.end(); ++it)
+            recount.Add(it->first, it->second.first, it->second.second.first, it->second.second.second);
+        BOOST_CHECK_EQUAL(coins.GetWeight(nHeight + n, nTime + n * 60, 0), recount.GetWeight(nHeight + n, nTime + n * 60, 0));
+        BOOST_CHECK_EQUAL(coins.GetWeight(nHeight + n, nTime + n * 60, 50 * COIN), recount.GetWeight(nHeight + n, nTime + n * 60, 50 * COIN));
+    }
+    BOOST_CHECK(coins.GetWeight(nHeight + 30, nTime + 1800, 0) > 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,78 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2013 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "txcache.h"
+
+using namespace std;
+
+CTxCache txcache;
+
+CTxCache::CTxCache() : nSize(0), nMaxSize(0), nHits(0), nMisses(0)
+{
+}
+
+void CTxCache::SetMaxSize(size_t nMaxSizeIn)
+{
+    LOCK(cs);
+    nMaxSize = nMaxSizeIn;
+    Evict();
+}
+
+void CTxCache::Evict()
+{
+    while (nSize > nMaxSize && !vOrder.empty())
+    {
+        map<uint256, CTransaction>::iterator it = mapTx.find(vOrder.front());
+        vOrder.pop_front();
+        if (it == mapTx.end())
+            continue;
+        nSize -= ::GetSerializeSize(it->second, SER_DISK, CLIENT_VERSION);
+        mapTx.erase(it);
+    }
+}
+
+void CTxCache::Add(const CTransaction& tx)
+{
+    LOCK(cs);
+    if (nMaxSize == 0)
+        return;
+    uint256 hash = tx.GetHash();
+    if (mapTx.count(hash))
+        return;
+    mapTx.insert(make_pair(hash, tx));
+    vOrder.push_back(hash);
+    nSize += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
+    Evict();
+}
+
+bool CTxCache::Get(const uint256& hash, CTransaction& tx)
+{
+    LOCK(cs);
+    map<uint256, CTransaction>::const_iterator it = mapTx.find(hash);
+    if (it == mapTx.end())
+    {
+        nMisses++;
+        return false;
+    }
+    nHits++;
+    tx = it->second;
+    return true;
+}
+
+void CTxCache::Clear()
+{
+    LOCK(cs);
+    mapTx.clear();
+    vOrder.clear();
+    nSize = 0;
+}
+
+void CTxCache::GetStats(uint64_t& nHitsRet, uint64_t& nMissesRet, size_t& nSizeRet) const
+{
+    LOCK(cs);
+    nHitsRet = nHits;
+    nMissesRet = nMisses;
+    nSizeRet = nSize;
+}
@@ -0,0 +1,50 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2013 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_TXCACHE_H
+#define BITCOIN_TXCACHE_H
+
+#include "main.h"
+#include "sync.h"
+
+#include <deque>
+#include <map>
+
+/*
+ * CTxCache keeps the bodies of recently connected transactions in memory,
+ * so that FetchInputs and CTxDB::ReadDiskTx can skip the seek and
+ * deserialization from blk*.dat when a recent output is spent.
+ *
+ * Entries are keyed by transaction hash and never go stale, so a reorg
+ * needs no invalidation; spentness and position still come from the
+ * CTxIndex in LevelDB. The oldest entries are evicted once the total
+ * serialized size goes over the limit (a share of -dbcache).
+ */
+class CTxCache
+{
+private:
+    mutable CCriticalSection cs;
+    std::map<uint256, CTransaction> mapTx;
+    std::deque<uint256> vOrder; // insertion order, oldest first
+    size_t nSize;
+    size_t nMaxSize;
+    uint64_t nHits;
+    uint64_t nMisses;
+
+    void Evict();
+
+public:
+    CTxCache();
+
+    void SetMaxSize(size_t nMaxSizeIn);
+    void Add(const CTransaction& tx);
+    bool Get(const uint256& hash, CTransaction& tx);
+    void Clear();
+
+    void GetStats(uint64_t& nHitsRet, uint64_t& nMissesRet, size_t& nSizeRet) const;
+};
+
+extern CTxCache txcache;
+
+#endif /* BITCOIN_TXCACHE_H */
@@ -8,6 +8,8 @@
 #include <boost/version.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
 
 #include <leveldb/env.h>
 #include <leveldb/cache.h>
@@ -16,21 +18,49 @@
 
 #include "kernel.h"
 #include "checkpoints.h"
+#include "txcache.h"
 #include "txdb.h"
 #include "util.h"
 #include "main.h"
 #include "chainparams.h"
+#include "ui_interface.h"
 
 using namespace std;
 using namespace boost;
 
 leveldb::DB *txdb; // global pointer for LevelDB object instance
 
+// Block commits held back during initial download so that several of them go
+// to LevelDB as one write. Every read consults it after activeBatch; every
+// write outside a batch flushes it first, so the database is always seen in
+// commit order. Losing it in a crash only loses whole, consecutive commits.
+static CCriticalSection cs_deferred;
+static CLevelDBBatch *pdeferredBatch = NULL;
+// Whether pdeferredBatch is set, for readers to check without cs_deferred.
+// Set before the first deferred commit returns and cleared only once the
+// batch is in the database, so a reader that sees it clear finds
+// everything there.
+static volatile int fDeferredPending = 0;
+static unsigned int nDeferredCommits = 0;
+static unsigned int nMaxDeferredCommits = 0;
+static size_t nMaxDeferredSize = 0;
+
 static leveldb::Options GetOptions() {
     leveldb::Options options;
+    // with -txcache, the other half of -dbcache goes to the transaction cache
     int nCacheSizeMB = GetArg("-dbcache", 25);
-    options.block_cache = leveldb::NewLRUCache(nCacheSizeMB * 1048576);
+    size_t nBlockCacheSize = (size_t)nCacheSizeMB * 1048576;
+    if (GetBoolArg("-txcache", true))
+        nBlockCacheSize /= 2;
+    options.block_cache = leveldb::NewLRUCache(nBlockCacheSize);
     options.filter_policy = leveldb::NewBloomFilterPolicy(10);
+    options.write_buffer_size = max((int64_t)1, GetArg("-dbwritebuffer", 4)) * 1048576;
+    options.max_open_files = max((int64_t)20, GetArg("-dbmaxopenfiles", 1000));
+    options.block_size = max((int64_t)1, GetArg("-dbblocksize", 4)) * 1024;
+    options.compression = GetBoolArg("-dbcompression", true) ? leveldb::kSnappyCompression : leveldb::kNoCompression;
+
+    nMaxDeferredCommits = max((int64_t)0, GetArg("-dbcoalesce", 100));
+    nMaxDeferredSize = options.write_buffer_size;
     return options;
 }
 
@@ -81,7 +111,6 @@ CTxDB::CTxDB(const char* pszMode)
 
     options = GetOptions();
     options.create_if_missing = fCreate;
-    options.filter_policy = leveldb::NewBloomFilterPolicy(10);
 
     init_blockindex(options); // Init directory
     pdb = txdb;
@@ -123,6 +152,7 @@ CTxDB::CTxDB(const char* pszMode)
 
 void CTxDB::Close()
 {
+    Flush();
     delete txdb;
     txdb = pdb = NULL;
     delete options.filter_policy;
@@ -136,16 +166,58 @@ void CTxDB::Close()
 bool CTxDB::TxnBegin()
 {
     assert(!activeBatch);
-    activeBatch = new leveldb::WriteBatch();
+    activeBatch = new CLevelDBBatch();
     return true;
 }
 
 bool CTxDB::TxnCommit()
 {
     assert(activeBatch);
-    leveldb::Status status = pdb->Write(leveldb::WriteOptions(), activeBatch);
-    delete activeBatch;
+    // IsInitialBlockDownload() takes cs_main, so ask before cs_deferred
+    bool fDefer = nMaxDeferredCommits > 0 && IsInitialBlockDownload();
+
+    LOCK(cs_deferred);
+    if (!fDefer && !pdeferredBatch)
+    {
+        leveldb::Status status = pdb->Write(leveldb::WriteOptions(), activeBatch->GetBatch());
+        delete activeBatch;
+        activeBatch = NULL;
+        if (!status.ok()) {
+            LogPrintf("LevelDB batch commit failure: %s\n", status.ToString());
+            return false;
+        }
+        return true;
+    }
+
+    if (!pdeferredBatch)
+    {
+        pdeferredBatch = activeBatch;
+        __sync_fetch_and_or(&fDeferredPending, 1);
+    }
+    else
+    {
+        pdeferredBatch->Append(*activeBatch);
+        delete activeBatch;
+    }
     activeBatch = NULL;
+    nDeferredCommits++;
+
+    if (fDefer && nDeferredCommits < nMaxDeferredCommits && pdeferredBatch->GetSize() < nMaxDeferredSize)
+        return true;
+    return Flush();
+}
+
+bool CTxDB::Flush()
+{
+    LOCK(cs_deferred);
+    if (!pdeferredBatch)
+        return true;
+    leveldb::Status status = pdb->Write(leveldb::WriteOptions(), pdeferredBatch->GetBatch());
+    LogPrint("bench", "CTxDB::Flush() : wrote %u commits, %u bytes\n", nDeferredCommits, pdeferredBatch->GetSize());
+    delete pdeferredBatch;
+    pdeferredBatch = NULL;
+    __sync_fetch_and_and(&fDeferredPending, 0);
+    nDeferredCommits = 0;
     if (!status.ok()) {
         LogPrintf("LevelDB batch commit failure: %s\n", status.ToString());
         return false;
@@ -153,75 +225,241 @@ bool CTxDB::TxnCommit()
     return true;
 }
 
-class CBatchScanner : public leveldb::WriteBatch::Handler {
-public:
-    std::string needle;
-    bool *deleted;
-    std::string *foundValue;
-    bool foundEntry;
-
-    CBatchScanner() : foundEntry(false) {}
-
-    virtual void Put(const leveldb::Slice& key, const leveldb::Slice& value) {
-        if (key.ToString() == needle) {
-            foundEntry = true;
-            *deleted = false;
-            *foundValue = value.ToString();
-        }
-    }
-
-    virtual void Delete(const leveldb::Slice& key) {
-        if (key.ToString() == needle) {
-            foundEntry = true;
-            *deleted = true;
-        }
-    }
-};
-
 // When performing a read, if we have an active batch we need to check it first
 // before reading from the database, as the rest of the code assumes that once
-// a database transaction begins reads are consistent with it. It would be good
-// to change that assumption in future and avoid the performance hit, though in
-// practice it does not appear to be large.
+// a database transaction begins reads are consistent with it. Commits still
+// held back in the deferred batch come next. CLevelDBBatch keeps its pending
+// writes indexed, so each of these is a hash lookup. Outside of initial block
+// download there is no deferred batch, and reads do not touch cs_deferred.
 bool CTxDB::ScanBatch(const CDataStream &key, string *value, bool *deleted) const {
-    assert(activeBatch);
     *deleted = false;
-    CBatchScanner scanner;
-    scanner.needle = key.str();
-    scanner.deleted = deleted;
-    scanner.foundValue = value;
-    leveldb::Status status = activeBatch->Iterate(&scanner);
-    if (!status.ok()) {
-        throw runtime_error(status.ToString());
+    if (activeBatch && activeBatch->Lookup(key.str(), value, deleted))
+        return true;
+    __sync_synchronize();
+    if (!fDeferredPending)
+        return false;
+    LOCK(cs_deferred);
+    return pdeferredBatch && pdeferredBatch->Lookup(key.str(), value, deleted);
+}
+
+bool CTxDB::GetProperty(const string& strName, string& strValue)
+{
+    return pdb->GetProperty(strName, &strValue);
+}
+
+// Approximate on-disk size of all keys of one type, e.g. "tx" or "blockindex"
+uint64_t CTxDB::GetApproximateSize(const string& strType)
+{
+    CDataStream ssStart(SER_DISK, CLIENT_VERSION);
+    ssStart << strType;
+    string strStart = ssStart.str();
+    string strLimit = strStart;
+    strLimit[strLimit.size() - 1]++;
+
+    leveldb::Range range(strStart, strLimit);
+    uint64_t nSize = 0;
+    pdb->GetApproximateSizes(&range, 1, &nSize);
+    return nSize;
+}
+
+void CTxDB::GetDeferredStats(unsigned int& nCommits, size_t& nBytes)
+{
+    LOCK(cs_deferred);
+    nCommits = nDeferredCommits;
+    nBytes = pdeferredBatch ? pdeferredBatch->GetSize() : 0;
+}
+
+bool CTxDB::WriteAddrIndex(uint160 addrHash, int nHeight, unsigned int nTxIndex, uint256 txHash)
+{
+    return Write(make_pair(string("adx"), CAddrIndexKey(addrHash, nHeight, nTxIndex, txHash)), '\0');
+}
+
+// Note that this reads straight from LevelDB, so entries still pending in
+// activeBatch are not returned. Deferred block commits are flushed first.
+bool CTxDB::ReadAddrIndex(uint160 addrHash, std::vector<uint256>& txHashes, int nSkip, int nCount)
+{
+    txHashes.clear();
+    if (!Flush())
+        return false;
+
+    CDataStream ssStartKey(SER_DISK, CLIENT_VERSION);
+    ssStartKey << make_pair(string("adx"), addrHash);
+    string strPrefix = ssStartKey.str();
+
+    // A transaction that was disconnected and mined again in a later block
+    // is indexed at both heights; only report it once.
+    set<uint256> setSeen;
+    leveldb::Iterator *iterator = pdb->NewIterator(leveldb::ReadOptions());
+    for (iterator->Seek(strPrefix); iterator->Valid() && nCount != 0; iterator->Next())
+    {
+        if (!iterator->key().starts_with(strPrefix))
+            break;
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey.write(iterator->key().data(), iterator->key().size());
+        string strType;
+        CAddrIndexKey key;
+        ssKey >> strType >> key;
+        if (!setSeen.insert(key.txHash).second)
+            continue;
+        if (nSkip > 0)
+        {
+            nSkip--;
+            continue;
+        }
+        txHashes.push_back(key.txHash);
+        if (nCount > 0)
+            nCount--;
     }
-    return scanner.foundEntry;
+    leveldb::Status status = iterator->status();
+    delete iterator;
+    if (!status.ok())
+        return error("ReadAddrIndex() : %s", status.ToString());
+    return true;
 }
 
-bool CTxDB::WriteAddrIndex(uint160 addrHash, uint256 txHash)
+// Convert the address index from the old layout, one ("adr", addrHash) record
+// holding the whole vector of transaction hashes, to one ("adx", CAddrIndexKey)
+// record per transaction. Runs once; the old records are erased as we go.
+bool CTxDB::MigrateAddrIndex()
 {
-    std::vector<uint256> txHashes;
-    if(!ReadAddrIndex(addrHash, txHashes))
+    leveldb::Iterator *iterator = pdb->NewIterator(leveldb::ReadOptions());
+    CDataStream ssStartKey(SER_DISK, CLIENT_VERSION);
+    ssStartKey << make_pair(string("adr"), uint160(0));
+    iterator->Seek(ssStartKey.str());
+
+    int64_t nStart = GetTimeMillis();
+    unsigned int nAddrs = 0, nEntries = 0, nSkipped = 0;
+    bool fStarted = false;
+    // block position -> (height, tx hashes in block order); transactions of
+    // one address tend to be clustered, so this saves most block reads
+    map<pair<unsigned int, unsigned int>, pair<int, vector<uint256> > > mapBlockTxs;
+    vector<CAddrIndexKey> vKeys;
+    vector<uint160> vOldAddrs;
+    while (iterator->Valid())
+    {
+        boost::this_thread::interruption_point();
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey.write(iterator->key().data(), iterator->key().size());
+        string strType;
+        ssKey >> strType;
+        if (strType != "adr")
+            break;
+        if (!fStarted)
+        {
+            LogPrintf("Upgrading address index to keyed layout...\n");
+            uiInterface.InitMessage(_("Upgrading address index..."));
+            fStarted = true;
+        }
+        uint160 addrHash;
+        ssKey >> addrHash;
+        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        ssValue.write(iterator->value().data(), iterator->value().size());
+        vector<uint256> vtxhash;
+        ssValue >> vtxhash;
+
+        BOOST_FOREACH(const uint256& hashTx, vtxhash)
+        {
+            CTxIndex txindex;
+            if (!ReadTxIndex(hashTx, txindex))
+            {
+                LogPrint("db", "MigrateAddrIndex() : %s of %s has no txindex\n", hashTx.ToString(), addrHash.ToString());
+                nSkipped++;
+                continue;
+            }
+            pair<unsigned int, unsigned int> pos = make_pair(txindex.pos.nFile, txindex.pos.nBlockPos);
+            map<pair<unsigned int, unsigned int>, pair<int, vector<uint256> > >::iterator mi = mapBlockTxs.find(pos);
+            if (mi == mapBlockTxs.end())
+            {
+                if (mapBlockTxs.size() >= 1000)
+                    mapBlockTxs.clear();
+                CBlock block;
+                map<uint256, CBlockIndex*>::iterator bi;
+                if (!block.ReadFromDisk(pos.first, pos.second) ||
+                    (bi = mapBlockIndex.find(block.GetHash())) == mapBlockIndex.end() || !bi->second->IsInMainChain())
+                {
+                    LogPrint("db", "MigrateAddrIndex() : %s of %s is not in the main chain\n", hashTx.ToString(), addrHash.ToString());
+                    nSkipped++;
+                    continue;
+                }
+                mi = mapBlockTxs.insert(make_pair(pos, make_pair(bi->second->nHeight, vector<uint256>()))).first;
+                BOOST_FOREACH(const CTransaction& tx, block.vtx)
+                    mi->second.second.push_back(tx.GetHash());
+            }
+            const vector<uint256>& vBlockTxs = mi->second.second;
+            unsigned int nTxIndex = find(vBlockTxs.begin(), vBlockTxs.end(), hashTx) - vBlockTxs.begin();
+            if (nTxIndex < vBlockTxs.size())
+                vKeys.push_back(CAddrIndexKey(addrHash, mi->second.first, nTxIndex, hashTx));
+            else
+            {
+                LogPrint("db", "MigrateAddrIndex() : %s of %s is not in its block\n", hashTx.ToString(), addrHash.ToString());
+                nSkipped++;
+            }
+        }
+        vOldAddrs.push_back(addrHash);
+        nAddrs++;
+        iterator->Next();
+
+        if (vOldAddrs.size() >= 1000)
+        {
+            TxnBegin();
+            BOOST_FOREACH(const CAddrIndexKey& key, vKeys)
+                Write(make_pair(string("adx"), key), '\0');
+            BOOST_FOREACH(const uint160& addrOld, vOldAddrs)
+                Erase(make_pair(string("adr"), addrOld));
+            if (!TxnCommit())
+            {
+                delete iterator;
+                return error("MigrateAddrIndex() : TxnCommit failed");
+            }
+            nEntries += vKeys.size();
+            vKeys.clear();
+            vOldAddrs.clear();
+        }
+    }
+    leveldb::Status status = iterator->status();
+    delete iterator;
+    if (!status.ok())
+        return error("MigrateAddrIndex() : %s", status.ToString());
+
+    if (!vOldAddrs.empty())
     {
-	txHashes.push_back(txHash);
-        return Write(make_pair(string("adr"), addrHash), txHashes);
+        TxnBegin();
+        BOOST_FOREACH(const CAddrIndexKey& key, vKeys)
+            Write(make_pair(string("adx"), key), '\0');
+        BOOST_FOREACH(const uint160& addrOld, vOldAddrs)
+            Erase(make_pair(string("adr"), addrOld));
+        if (!TxnCommit())
+            return error("MigrateAddrIndex() : TxnCommit failed");
+        nEntries += vKeys.size();
     }
-    else
+
+    if (fStarted)
+        LogPrintf("Upgraded address index: %u addresses, %u entries in %dms\n", nAddrs, nEntries, GetTimeMillis() - nStart);
+
+    // What could not be placed is lost from the index, so have it rebuilt
+    // from the blocks, as -reindexaddr does
+    if (nSkipped > 0)
     {
-	if(std::find(txHashes.begin(), txHashes.end(), txHash) == txHashes.end()) 
-    	{
-    	    txHashes.push_back(txHash);
-            return Write(make_pair(string("adr"), addrHash), txHashes);
-	}
-	else
-	{
-	    return true; // already have this tx hash
-	}
+        LogPrintf("MigrateAddrIndex() : %u entries could not be upgraded, the address index will be rebuilt\n", nSkipped);
+        if (!WriteAddrIndexRebuild())
+            return error("MigrateAddrIndex() : WriteAddrIndexRebuild failed");
     }
+    return true;
+}
+
+bool CTxDB::ReadAddrIndexRebuild()
+{
+    return Exists(string("addrindexrebuild"));
+}
+
+bool CTxDB::WriteAddrIndexRebuild()
+{
+    return Write(string("addrindexrebuild"), '\0');
 }
 
-bool CTxDB::ReadAddrIndex(uint160 addrHash, std::vector<uint256>& txHashes)
+bool CTxDB::EraseAddrIndexRebuild()
 {
-    return Read(make_pair(string("adr"), addrHash), txHashes);
+    return Erase(string("addrindexrebuild"));
 }
 
 bool CTxDB::ReadTxIndex(uint256 hash, CTxIndex& txindex)
@@ -260,6 +498,8 @@ bool CTxDB::ReadDiskTx(uint256 hash, CTransaction& tx, CTxIndex& txindex)
     tx.SetNull();
     if (!ReadTxIndex(hash, txindex))
         return false;
+    if (txcache.Get(hash, tx))
+        return true;
     return (tx.ReadFromDisk(txindex.pos));
 }
 
@@ -345,13 +585,8 @@ static CBlockIndex *InsertBlockIndex(uint256 hash)
     return pindexNew;
 }
 
-bool CTxDB::LoadBlockIndex()
+bool CTxDB::LoadBlockIndexGuts()
 {
-    if (mapBlockIndex.size() > 0) {
-        // Already loaded once in this session. It can happen during migration
-        // from BDB.
-        return true;
-    }
     // The block index is an in-memory structure that maps hashes to on-disk
     // locations where the contents of the block can be found. Here, we scan it
     // out of the DB and into mapBlockIndex.
@@ -433,6 +668,259 @@ bool CTxDB::LoadBlockIndex()
         pindex->nChainTrust = (pindex->pprev ? pindex->pprev->nChainTrust : 0) + pindex->GetBlockTrust();
     }
 
+    return true;
+}
+
+// Block index snapshot
+//
+// A flat copy of mapBlockIndex written at clean shutdown, sorted by height so
+// that every entry's pprev is already loaded when it is read back. Records are
+// fixed size and the whole file is mapped, so loading is one sequential pass
+// with no LevelDB iteration, deserialization or chain trust recalculation.
+// The file is removed as soon as it has been read: from then on LevelDB is the
+// only copy, and a crash can never leave a stale snapshot behind.
+
+static const uint32_t BLOCKINDEX_SNAPSHOT_MAGIC = 0x69626c73; // "slbi"
+static const uint32_t BLOCKINDEX_SNAPSHOT_VERSION = 1;
+
+struct CBlockIndexSnapshotHeader
+{
+    uint32_t nMagic;
+    uint32_t nVersion;
+    uint32_t nRecordSize;
+    uint32_t nRecords;
+    uint256 hashBestChain;
+    uint256 hashChecksum; // Hash() of all records
+};
+
+struct CBlockIndexSnapshotRecord
+{
+    uint256 hashBlock;
+    uint256 hashPrev;
+    uint256 nChainTrust;
+    uint256 hashProof;
+    uint256 hashMerkleRoot;
+    uint256 hashPrevoutStake;
+    int64_t nMint;
+    int64_t nMoneySupply;
+    uint64_t nStakeModifier;
+    uint32_t nFile;
+    uint32_t nBlockPos;
+    int32_t nHeight;
+    uint32_t nFlags;
+    uint32_t nPrevoutStake;
+    uint32_t nStakeTime;
+    int32_t nVersion;
+    uint32_t nTime;
+    uint32_t nBits;
+    uint32_t nNonce;
+    uint32_t fMainChainNext; // this block is pprev->pnext
+    uint32_t nPadding;
+};
+
+static boost::filesystem::path BlockIndexSnapshotPath()
+{
+    return GetDataDir() / "blkindex.snap";
+}
+
+bool WriteBlockIndexSnapshot()
+{
+    if (!pindexBest || mapBlockIndex.empty())
+        return false;
+
+    int64_t nStart = GetTimeMillis();
+    vector<pair<int, CBlockIndex*> > vSortedByHeight;
+    vSortedByHeight.reserve(mapBlockIndex.size());
+    BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
+        vSortedByHeight.push_back(make_pair(item.second->nHeight, item.second));
+    sort(vSortedByHeight.begin(), vSortedByHeight.end());
+
+    filesystem::path pathTmp = GetDataDir() / "blkindex.snap.new";
+    FILE* file = fopen(pathTmp.string().c_str(), "wb");
+    if (!file)
+        return error("WriteBlockIndexSnapshot() : cannot open %s", pathTmp.string());
+
+    CBlockIndexSnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    header.nMagic = BLOCKINDEX_SNAPSHOT_MAGIC;
+    header.nVersion = BLOCKINDEX_SNAPSHOT_VERSION;
+    header.nRecordSize = sizeof(CBlockIndexSnapshotRecord);
+    header.nRecords = vSortedByHeight.size();
+    header.hashBestChain = hashBestChain;
+    bool fOk = fwrite(&header, sizeof(header), 1, file) == 1;
+
+    CHashWriter hasher(SER_GETHASH, 0);
+    BOOST_FOREACH(const PAIRTYPE(int, CBlockIndex*)& item, vSortedByHeight)
+    {
+        const CBlockIndex* pindex = item.second;
+        CBlockIndexSnapshotRecord rec;
+        memset(&rec, 0, sizeof(rec));
+        rec.hashBlock        = pindex->GetBlockHash();
+        rec.hashPrev         = pindex->pprev ? pindex->pprev->GetBlockHash() : 0;
+        rec.nChainTrust      = pindex->nChainTrust;
+        rec.hashProof        = pindex->hashProof;
+        rec.hashMerkleRoot   = pindex->hashMerkleRoot;
+        rec.hashPrevoutStake = pindex->prevoutStake.hash;
+        rec.nMint            = pindex->nMint;
+        rec.nMoneySupply     = pindex->nMoneySupply;
+        rec.nStakeModifier   = pindex->nStakeModifier;
+        rec.nFile            = pindex->nFile;
+        rec.nBlockPos        = pindex->nBlockPos;
+        rec.nHeight          = pindex->nHeight;
+        rec.nFlags           = pindex->nFlags;
+        rec.nPrevoutStake    = pindex->prevoutStake.n;
+        rec.nStakeTime       = pindex->nStakeTime;
+        rec.nVersion         = pindex->nVersion;
+        rec.nTime            = pindex->nTime;
+        rec.nBits            = pindex->nBits;
+        rec.nNonce           = pindex->nNonce;
+        rec.fMainChainNext   = (pindex->pprev && pindex->pprev->pnext == pindex);
+        hasher.write((const char*)&rec, sizeof(rec));
+        if (fOk)
+            fOk = fwrite(&rec, sizeof(rec), 1, file) == 1;
+    }
+    header.hashChecksum = hasher.GetHash();
+    if (fOk)
+        fOk = fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+    if (fOk)
+        FileCommit(file);
+    fclose(file);
+
+    if (!fOk || !RenameOver(pathTmp, BlockIndexSnapshotPath()))
+    {
+        filesystem::remove(pathTmp);
+        return error("WriteBlockIndexSnapshot() : failed to write %s", pathTmp.string());
+    }
+    LogPrintf("Wrote block index snapshot, %u entries in %dms\n", header.nRecords, GetTimeMillis() - nStart);
+    return true;
+}
+
+static void ClearBlockIndex()
+{
+    BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
+        delete item.second;
+    mapBlockIndex.clear();
+    setStakeSeen.clear();
+    pindexGenesisBlock = NULL;
+}
+
+static bool LoadBlockIndexSnapshot(const unsigned char* pbegin, size_t nSize, uint256 hashBestChainDB)
+{
+    CBlockIndexSnapshotHeader header;
+    if (nSize < sizeof(header))
+        return false;
+    memcpy(&header, pbegin, sizeof(header));
+    if (header.nMagic != BLOCKINDEX_SNAPSHOT_MAGIC || header.nVersion != BLOCKINDEX_SNAPSHOT_VERSION ||
+        header.nRecordSize != sizeof(CBlockIndexSnapshotRecord) ||
+        nSize != sizeof(header) + (size_t)header.nRecords * sizeof(CBlockIndexSnapshotRecord))
+        return error("LoadBlockIndexSnapshot() : bad header");
+    if (header.hashBestChain != hashBestChainDB)
+        return error("LoadBlockIndexSnapshot() : snapshot is stale");
+
+    const unsigned char* pstart = pbegin + sizeof(header);
+    const unsigned char* pend = pbegin + nSize;
+    if (Hash(pstart, pend) != header.hashChecksum)
+        return error("LoadBlockIndexSnapshot() : checksum mismatch");
+
+    for (const unsigned char* p = pstart; p < pend; p += sizeof(CBlockIndexSnapshotRecord))
+    {
+        CBlockIndexSnapshotRecord rec;
+        memcpy(&rec, p, sizeof(rec));
+
+        CBlockIndex* pindexNew = new CBlockIndex();
+        map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.insert(make_pair(rec.hashBlock, pindexNew)).first;
+        if (mi->second != pindexNew)
+        {
+            delete pindexNew;
+            ClearBlockIndex();
+            return error("LoadBlockIndexSnapshot() : duplicate entry %s", rec.hashBlock.ToString());
+        }
+        pindexNew->phashBlock = &((*mi).first);
+        if (rec.hashPrev != 0)
+        {
+            map<uint256, CBlockIndex*>::iterator miPrev = mapBlockIndex.find(rec.hashPrev);
+            if (miPrev == mapBlockIndex.end())
+            {
+                ClearBlockIndex();
+                return error("LoadBlockIndexSnapshot() : missing parent of %s", rec.hashBlock.ToString());
+            }
+            pindexNew->pprev = miPrev->second;
+            if (rec.fMainChainNext)
+                pindexNew->pprev->pnext = pindexNew;
+        }
+        pindexNew->nFile          = rec.nFile;
+        pindexNew->nBlockPos      = rec.nBlockPos;
+        pindexNew->nChainTrust    = rec.nChainTrust;
+        pindexNew->nHeight        = rec.nHeight;
+        pindexNew->nMint          = rec.nMint;
+        pindexNew->nMoneySupply   = rec.nMoneySupply;
+        pindexNew->nFlags         = rec.nFlags;
+        pindexNew->nStakeModifier = rec.nStakeModifier;
+        pindexNew->prevoutStake   = COutPoint(rec.hashPrevoutStake, rec.nPrevoutStake);
+        pindexNew->nStakeTime     = rec.nStakeTime;
+        pindexNew->hashProof      = rec.hashProof;
+        pindexNew->nVersion       = rec.nVersion;
+        pindexNew->hashMerkleRoot = rec.hashMerkleRoot;
+        pindexNew->nTime          = rec.nTime;
+        pindexNew->nBits          = rec.nBits;
+        pindexNew->nNonce         = rec.nNonce;
+
+        // Watch for genesis block
+        if (pindexGenesisBlock == NULL && rec.hashBlock == Params().HashGenesisBlock())
+            pindexGenesisBlock = pindexNew;
+
+        if (!pindexNew->CheckIndex())
+        {
+            ClearBlockIndex();
+            return error("LoadBlockIndexSnapshot() : CheckIndex failed at %d", pindexNew->nHeight);
+        }
+
+        // NovaCoin: build setStakeSeen
+        if (pindexNew->IsProofOfStake())
+            setStakeSeen.insert(make_pair(pindexNew->prevoutStake, pindexNew->nStakeTime));
+    }
+    return true;
+}
+
+// Returns true if mapBlockIndex was filled from the snapshot file
+static bool ReadBlockIndexSnapshot(uint256 hashBestChainDB)
+{
+    filesystem::path pathSnapshot = BlockIndexSnapshotPath();
+    if (!filesystem::exists(pathSnapshot))
+        return false;
+
+    bool fLoaded = false;
+    try {
+        boost::interprocess::file_mapping mapping(pathSnapshot.string().c_str(), boost::interprocess::read_only);
+        boost::interprocess::mapped_region region(mapping, boost::interprocess::read_only);
+        fLoaded = LoadBlockIndexSnapshot((const unsigned char*)region.get_address(), region.get_size(), hashBestChainDB);
+    }
+    catch (std::exception &e) {
+        LogPrintf("ReadBlockIndexSnapshot() : %s\n", e.what());
+    }
+    filesystem::remove(pathSnapshot);
+    return fLoaded;
+}
+
+bool CTxDB::LoadBlockIndex()
+{
+    if (mapBlockIndex.size() > 0) {
+        // Already loaded once in this session. It can happen during migration
+        // from BDB.
+        return true;
+    }
+
+    int64_t nStart = GetTimeMillis();
+    uint256 hashBestChainDB = 0;
+    ReadHashBestChain(hashBestChainDB);
+    bool fSnapshot = ReadBlockIndexSnapshot(hashBestChainDB);
+    if (!fSnapshot && !LoadBlockIndexGuts())
+        return false;
+    LogPrintf("LoadBlockIndex(): loaded %u entries from %s in %dms\n", mapBlockIndex.size(),
+        fSnapshot ? "snapshot" : "database", GetTimeMillis() - nStart);
+
+    boost::this_thread::interruption_point();
+
     // Load hashBestChain pointer to end of best chain
     if (!ReadHashBestChain(hashBestChain))
     {
@@ -443,6 +931,7 @@ bool CTxDB::LoadBlockIndex()
     if (!mapBlockIndex.count(hashBestChain))
         return error("CTxDB::LoadBlockIndex() : hashBestChain not found in the block index");
     pindexBest = mapBlockIndex[hashBestChain];
+    chainActive.SetTip(pindexBest);
     nBestHeight = pindexBest->nHeight;
     nBestChainTrust = pindexBest->nChainTrust;
 
@@ -460,133 +949,414 @@ bool CTxDB::LoadBlockIndex()
     ReadBestInvalidTrust(bnBestInvalidTrust);
     nBestInvalidTrust = bnBestInvalidTrust.getuint256();
 
-    // Verify blocks in the best chain
-    int nCheckLevel = GetArg("-checklevel", 1);
-    int nCheckDepth = GetArg( "-checkblocks", 500);
-    if (nCheckDepth == 0)
-        nCheckDepth = 1000000000; // suffices until the year 19000
-    if (nCheckDepth > nBestHeight)
-        nCheckDepth = nBestHeight;
-    LogPrintf("Verifying last %i blocks at level %i\n", nCheckDepth, nCheckLevel);
-    CBlockIndex* pindexFork = NULL;
-    map<pair<unsigned int, unsigned int>, CBlockIndex*> mapBlockPos;
-    for (CBlockIndex* pindex = pindexBest; pindex && pindex->pprev; pindex = pindex->pprev)
+    // Convert an address index written by older versions
+    if (!MigrateAddrIndex())
+        return error("CTxDB::LoadBlockIndex() : address index upgrade failed");
+
+    return true;
+}
+
+bool CTxDB::ReadVerifyProgress(CVerifyProgress& progress)
+{
+    return Read(string("verifyprogress"), progress);
+}
+
+bool CTxDB::WriteVerifyProgress(const CVerifyProgress& progress)
+{
+    return Write(string("verifyprogress"), progress);
+}
+
+bool CTxDB::EraseVerifyProgress()
+{
+    return Erase(string("verifyprogress"));
+}
+
+// Startup block verification
+//
+// One thread reads the blocks to check from disk, staying at most a few
+// blocks per worker ahead, and a pool of workers runs the checks selected by
+// -checklevel. A run that is interrupted saves how far it got, and the next
+// startup picks up from there.
+
+typedef map<pair<unsigned int, unsigned int>, int> BlockPosMap;
+
+// Height of the main chain block at a disk position, or -1 if there is none.
+// mapBlockPos has the blocks of the main chain when the check started; one
+// connected since, in the background, is looked up in the block index.
+static int GetMainChainHeight(unsigned int nFile, unsigned int nBlockPos, const BlockPosMap& mapBlockPos)
+{
+    BlockPosMap::const_iterator mi = mapBlockPos.find(make_pair(nFile, nBlockPos));
+    if (mi != mapBlockPos.end())
+        return mi->second;
+
+    CBlock block;
+    if (!block.ReadFromDisk(nFile, nBlockPos, false))
+        return -1;
+    LOCK(cs_main);
+    map<uint256, CBlockIndex*>::iterator it = mapBlockIndex.find(block.GetHash());
+    if (it == mapBlockIndex.end())
+        return -1;
+    const CBlockIndex* pindex = it->second;
+    if (pindex->nFile != nFile || pindex->nBlockPos != nBlockPos || !pindex->IsInMainChain())
+        return -1;
+    return pindex->nHeight;
+}
+
+// Returns false if the block or the index entries of its transactions are bad.
+// mapBlockPos maps the disk position of every main chain block from the
+// lowest one being checked up to the tip to its height.
+static bool VerifyBlock(CTxDB& txdb, const CBlock& block, const CBlockIndex* pindex, int nCheckLevel, const BlockPosMap& mapBlockPos)
+{
+    bool fOk = true;
+    // check level 1: verify block validity
+    // check level 7: verify block signature too
+    if (nCheckLevel>0 && !block.CheckBlock(true, true, (nCheckLevel>6)))
     {
-        boost::this_thread::interruption_point();
-        if (pindex->nHeight < nBestHeight-nCheckDepth)
-            break;
-        CBlock block;
-        if (!block.ReadFromDisk(pindex))
-            return error("LoadBlockIndex() : block.ReadFromDisk failed");
-        // check level 1: verify block validity
-        // check level 7: verify block signature too
-        if (nCheckLevel>0 && !block.CheckBlock(true, true, (nCheckLevel>6)))
-        {
-            LogPrintf("LoadBlockIndex() : *** found bad block at %d, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
-            pindexFork = pindex->pprev;
-        }
-        // check level 2: verify transaction index validity
-        if (nCheckLevel>1)
+        LogPrintf("VerifyBlock() : *** found bad block at %d, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
+        fOk = false;
+    }
+    // check level 2: verify transaction index validity
+    if (nCheckLevel>1)
+    {
+        BOOST_FOREACH(const CTransaction &tx, block.vtx)
         {
-            pair<unsigned int, unsigned int> pos = make_pair(pindex->nFile, pindex->nBlockPos);
-            mapBlockPos[pos] = pindex;
-            BOOST_FOREACH(const CTransaction &tx, block.vtx)
+            uint256 hashTx = tx.GetHash();
+            CTxIndex txindex;
+            if (txdb.ReadTxIndex(hashTx, txindex))
             {
-                uint256 hashTx = tx.GetHash();
-                CTxIndex txindex;
-                if (ReadTxIndex(hashTx, txindex))
+                // check level 3: checker transaction hashes
+                if (nCheckLevel>2 || pindex->nFile != txindex.pos.nFile || pindex->nBlockPos != txindex.pos.nBlockPos)
                 {
-                    // check level 3: checker transaction hashes
-                    if (nCheckLevel>2 || pindex->nFile != txindex.pos.nFile || pindex->nBlockPos != txindex.pos.nBlockPos)
+                    // either an error or a duplicate transaction
+                    CTransaction txFound;
+                    if (!txFound.ReadFromDisk(txindex.pos))
                     {
-                        // either an error or a duplicate transaction
-                        CTransaction txFound;
-                        if (!txFound.ReadFromDisk(txindex.pos))
+                        LogPrintf("VerifyBlock() : *** cannot read mislocated transaction %s\n", hashTx.ToString());
+                        fOk = false;
+                    }
+                    else
+                        if (txFound.GetHash() != hashTx) // not a duplicate tx
                         {
-                            LogPrintf("LoadBlockIndex() : *** cannot read mislocated transaction %s\n", hashTx.ToString());
-                            pindexFork = pindex->pprev;
+                            LogPrintf("VerifyBlock(): *** invalid tx position for %s\n", hashTx.ToString());
+                            fOk = false;
                         }
-                        else
-                            if (txFound.GetHash() != hashTx) // not a duplicate tx
-                            {
-                                LogPrintf("LoadBlockIndex(): *** invalid tx position for %s\n", hashTx.ToString());
-                                pindexFork = pindex->pprev;
-                            }
-                    }
-                    // check level 4: check whether spent txouts were spent within the main chain
-                    unsigned int nOutput = 0;
-                    if (nCheckLevel>3)
+                }
+                // check level 4: check whether spent txouts were spent within the main chain
+                unsigned int nOutput = 0;
+                if (nCheckLevel>3)
+                {
+                    BOOST_FOREACH(const CDiskTxPos &txpos, txindex.vSpent)
                     {
-                        BOOST_FOREACH(const CDiskTxPos &txpos, txindex.vSpent)
+                        if (!txpos.IsNull())
                         {
-                            if (!txpos.IsNull())
+                            if (GetMainChainHeight(txpos.nFile, txpos.nBlockPos, mapBlockPos) < pindex->nHeight)
                             {
-                                pair<unsigned int, unsigned int> posFind = make_pair(txpos.nFile, txpos.nBlockPos);
-                                if (!mapBlockPos.count(posFind))
+                                LogPrintf("VerifyBlock(): *** found bad spend at %d, hashBlock=%s, hashTx=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString(), hashTx.ToString());
+                                fOk = false;
+                            }
+                            // check level 6: check whether spent txouts were spent by a valid transaction that consume them
+                            if (nCheckLevel>5)
+                            {
+                                CTransaction txSpend;
+                                if (!txSpend.ReadFromDisk(txpos))
                                 {
-                                    LogPrintf("LoadBlockIndex(): *** found bad spend at %d, hashBlock=%s, hashTx=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString(), hashTx.ToString());
-                                    pindexFork = pindex->pprev;
+                                    LogPrintf("VerifyBlock(): *** cannot read spending transaction of %s:%i from disk\n", hashTx.ToString(), nOutput);
+                                    fOk = false;
                                 }
-                                // check level 6: check whether spent txouts were spent by a valid transaction that consume them
-                                if (nCheckLevel>5)
+                                else if (!txSpend.CheckTransaction())
                                 {
-                                    CTransaction txSpend;
-                                    if (!txSpend.ReadFromDisk(txpos))
-                                    {
-                                        LogPrintf("LoadBlockIndex(): *** cannot read spending transaction of %s:%i from disk\n", hashTx.ToString(), nOutput);
-                                        pindexFork = pindex->pprev;
-                                    }
-                                    else if (!txSpend.CheckTransaction())
-                                    {
-                                        LogPrintf("LoadBlockIndex(): *** spending transaction of %s:%i is invalid\n", hashTx.ToString(), nOutput);
-                                        pindexFork = pindex->pprev;
-                                    }
-                                    else
+                                    LogPrintf("VerifyBlock(): *** spending transaction of %s:%i is invalid\n", hashTx.ToString(), nOutput);
+                                    fOk = false;
+                                }
+                                else
+                                {
+                                    bool fFound = false;
+                                    BOOST_FOREACH(const CTxIn &txin, txSpend.vin)
+                                        if (txin.prevout.hash == hashTx && txin.prevout.n == nOutput)
+                                            fFound = true;
+                                    if (!fFound)
                                     {
-                                        bool fFound = false;
-                                        BOOST_FOREACH(const CTxIn &txin, txSpend.vin)
-                                            if (txin.prevout.hash == hashTx && txin.prevout.n == nOutput)
-                                                fFound = true;
-                                        if (!fFound)
-                                        {
-                                            LogPrintf("LoadBlockIndex(): *** spending transaction of %s:%i does not spend it\n", hashTx.ToString(), nOutput);
-                                            pindexFork = pindex->pprev;
-                                        }
+                                        LogPrintf("VerifyBlock(): *** spending transaction of %s:%i does not spend it\n", hashTx.ToString(), nOutput);
+                                        fOk = false;
                                     }
                                 }
                             }
-                            nOutput++;
                         }
+                        nOutput++;
                     }
                 }
-                // check level 5: check whether all prevouts are marked spent
-                if (nCheckLevel>4)
-                {
-                     BOOST_FOREACH(const CTxIn &txin, tx.vin)
-                     {
-                          CTxIndex txindex;
-                          if (ReadTxIndex(txin.prevout.hash, txindex))
-                              if (txindex.vSpent.size()-1 < txin.prevout.n || txindex.vSpent[txin.prevout.n].IsNull())
-                              {
-                                  LogPrintf("LoadBlockIndex(): *** found unspent prevout %s:%i in %s\n", txin.prevout.hash.ToString(), txin.prevout.n, hashTx.ToString());
-                                  pindexFork = pindex->pprev;
-                              }
-                     }
-                }
+            }
+            // check level 5: check whether all prevouts are marked spent
+            if (nCheckLevel>4)
+            {
+                 BOOST_FOREACH(const CTxIn &txin, tx.vin)
+                 {
+                      CTxIndex txindex;
+                      if (txdb.ReadTxIndex(txin.prevout.hash, txindex))
+                          if (txindex.vSpent.size()-1 < txin.prevout.n || txindex.vSpent[txin.prevout.n].IsNull())
+                          {
+                              LogPrintf("VerifyBlock(): *** found unspent prevout %s:%i in %s\n", txin.prevout.hash.ToString(), txin.prevout.n, hashTx.ToString());
+                              fOk = false;
+                          }
+                 }
             }
         }
     }
-    if (pindexFork)
+    return fOk;
+}
+
+// Blocks waiting to be checked, shared by the reading thread and the workers
+class CBlockVerifyQueue
+{
+private:
+    boost::mutex mutex;
+    boost::condition_variable condWork;  // a block was queued or reading ended
+    boost::condition_variable condSpace; // a block was taken off the queue
+
+    struct CItem
     {
-        boost::this_thread::interruption_point();
+        size_t nIndex;
+        const CBlockIndex* pindex;
+        CBlock* pblock;
+    };
+    deque<CItem> queue;
+    size_t nMaxSize;
+    bool fDone;
+
+    // Blocks pushed, and those of them queued or being checked, which may
+    // finish in any order
+    size_t nPushed;
+    set<size_t> setUnchecked;
+
+    int nCheckLevel;
+    const BlockPosMap& mapBlockPos;
+
+public:
+    int nChecked;
+    const CBlockIndex* pindexBad; // lowest bad block found
+
+    CBlockVerifyQueue(size_t nMaxSizeIn, int nCheckLevelIn, const BlockPosMap& mapBlockPosIn) :
+        nMaxSize(nMaxSizeIn), fDone(false), nPushed(0), nCheckLevel(nCheckLevelIn), mapBlockPos(mapBlockPosIn),
+        nChecked(0), pindexBad(NULL) {}
+
+    ~CBlockVerifyQueue()
+    {
+        for (unsigned int i = 0; i < queue.size(); i++)
+            delete queue[i].pblock;
+    }
+
+    // Blocks are pushed in the order they are to be checked
+    void Push(const CBlockIndex* pindex, CBlock* pblock)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (queue.size() >= nMaxSize)
+            condSpace.wait(lock);
+        CItem item;
+        item.nIndex = nPushed++;
+        item.pindex = pindex;
+        item.pblock = pblock;
+        queue.push_back(item);
+        setUnchecked.insert(item.nIndex);
+        condWork.notify_one();
+    }
+
+    void SetDone()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fDone = true;
+        condWork.notify_all();
+    }
+
+    const CBlockIndex* GetBad()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        return pindexBad;
+    }
+
+    int GetChecked()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        return nChecked;
+    }
+
+    // Index of the first block pushed that is not checked yet; every block
+    // before it is
+    size_t GetFirstUnchecked()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        return setUnchecked.empty() ? nPushed : *setUnchecked.begin();
+    }
+
+    void Thread()
+    {
+        CTxDB txdb("r");
+        while (true)
+        {
+            CItem item;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (queue.empty() && !fDone)
+                    condWork.wait(lock);
+                if (queue.empty())
+                    return;
+                item = queue.front();
+                queue.pop_front();
+                condSpace.notify_one();
+            }
+            bool fOk = VerifyBlock(txdb, *item.pblock, item.pindex, nCheckLevel, mapBlockPos);
+            delete item.pblock;
+
+            boost::unique_lock<boost::mutex> lock(mutex);
+            nChecked++;
+            setUnchecked.erase(item.nIndex);
+            if (!fOk && (pindexBad == NULL || item.pindex->nHeight < pindexBad->nHeight))
+                pindexBad = item.pindex;
+        }
+    }
+};
+
+static void ThreadBlockVerifyWorker(CBlockVerifyQueue* pqueue)
+{
+    RenameThread("sling-verify");
+    pqueue->Thread();
+}
+
+bool VerifyBlocks(int nCheckLevel, int nCheckDepth, bool fBackground)
+{
+    int64_t nStart = GetTimeMillis();
+    CTxDB txdb;
+
+    // Collect the blocks to check: the last nCheckDepth blocks of the best
+    // chain, plus whatever an interrupted earlier run did not get to
+    vector<const CBlockIndex*> vToCheck;
+    BlockPosMap mapBlockPos;
+    CVerifyProgress progress;
+    {
+        LOCK(cs_main);
+        if (nCheckDepth == 0)
+            nCheckDepth = 1000000000; // suffices until the year 19000
+        if (nCheckDepth > nBestHeight)
+            nCheckDepth = nBestHeight;
+        int nStopHeight = nBestHeight - nCheckDepth;
+
+        int nResumeHeight = -1, nResumeStop = nStopHeight;
+        if (txdb.ReadVerifyProgress(progress) && mapBlockIndex.count(progress.hashTip) &&
+            mapBlockIndex[progress.hashTip]->IsInMainChain())
+        {
+            LogPrintf("Resuming block verification at height %d\n", progress.nHeightNext);
+            nResumeHeight = progress.nHeightNext;
+            nResumeStop = progress.nHeightStop;
+            nCheckLevel = max(nCheckLevel, progress.nCheckLevel);
+        }
+
+        LogPrintf("Verifying last %i blocks at level %i\n", nCheckDepth, nCheckLevel);
+        for (const CBlockIndex* pindex = pindexBest; pindex && pindex->pprev; pindex = pindex->pprev)
+        {
+            if (pindex->nHeight < nStopHeight && pindex->nHeight < nResumeStop)
+                break;
+            mapBlockPos[make_pair(pindex->nFile, pindex->nBlockPos)] = pindex->nHeight;
+            if (pindex->nHeight >= nStopHeight || (pindex->nHeight <= nResumeHeight && pindex->nHeight >= nResumeStop))
+                vToCheck.push_back(pindex);
+        }
+    }
+    if (vToCheck.empty())
+    {
+        txdb.EraseVerifyProgress();
+        return true;
+    }
+
+    progress.hashTip = vToCheck.front()->GetBlockHash();
+    progress.nHeightStop = vToCheck.back()->nHeight;
+    progress.nCheckLevel = nCheckLevel;
+
+    int nThreads = max(nScriptCheckThreads, 1);
+    int nReadAhead = 4 * nThreads;
+    CBlockVerifyQueue queue(nReadAhead, nCheckLevel, mapBlockPos);
+    boost::thread_group threadGroup;
+    for (int i = 0; i < nThreads; i++)
+        threadGroup.create_thread(boost::bind(&ThreadBlockVerifyWorker, &queue));
+
+    bool fReadError = false;
+    int nLastPercent = -1;
+    try {
+        for (unsigned int i = 0; i < vToCheck.size(); i++)
+        {
+            boost::this_thread::interruption_point();
+            CBlock* pblock = new CBlock();
+            if (!pblock->ReadFromDisk(vToCheck[i]))
+            {
+                delete pblock;
+                fReadError = true;
+                error("VerifyBlocks() : block.ReadFromDisk failed at %d", vToCheck[i]->nHeight);
+                break;
+            }
+            queue.Push(vToCheck[i], pblock);
+
+            int nPercent = queue.GetChecked() * 100 / vToCheck.size();
+            if (nPercent != nLastPercent)
+            {
+                if (fBackground && nPercent % 10 == 0)
+                    LogPrintf("Verifying blocks... %d%%\n", nPercent);
+                else if (!fBackground)
+                    uiInterface.InitMessage(strprintf(_("Verifying blocks... %d%%"), nPercent));
+                nLastPercent = nPercent;
+            }
+
+            // Record how far we got in case we get interrupted
+            if (fBackground && i % 1000 == 0 && i > 0)
+            {
+                size_t nDone = queue.GetFirstUnchecked();
+                // Heights go down, so past the last block is the one below it
+                progress.nHeightNext = nDone < vToCheck.size() ? vToCheck[nDone]->nHeight : vToCheck.back()->nHeight - 1;
+                txdb.WriteVerifyProgress(progress);
+            }
+        }
+    }
+    catch (boost::thread_interrupted) {
+        queue.SetDone();
+        threadGroup.interrupt_all();
+        threadGroup.join_all();
+        size_t nDone = queue.GetFirstUnchecked();
+        if (nDone < vToCheck.size())
+        {
+            progress.nHeightNext = vToCheck[nDone]->nHeight;
+            txdb.WriteVerifyProgress(progress);
+            LogPrintf("Block verification interrupted, will resume at height %d\n", progress.nHeightNext);
+        }
+        else
+            txdb.EraseVerifyProgress();
+        throw;
+    }
+    queue.SetDone();
+    threadGroup.join_all();
+    txdb.EraseVerifyProgress();
+    if (fReadError)
+        return false;
+
+    LogPrintf("Verified %u blocks in %dms\n", vToCheck.size(), GetTimeMillis() - nStart);
+
+    const CBlockIndex* pindexBad = queue.GetBad();
+    if (pindexBad)
+    {
+        LOCK(cs_main);
+        // In the background the best chain may have moved on in the meantime
+        if (!pindexBad->IsInMainChain())
+            return true;
+        CBlockIndex* pindexFork = pindexBad->pprev;
         // Reorg back to the fork
-        LogPrintf("LoadBlockIndex() : *** moving best chain pointer back to block %d\n", pindexFork->nHeight);
+        LogPrintf("VerifyBlocks() : *** moving best chain pointer back to block %d\n", pindexFork->nHeight);
         CBlock block;
         if (!block.ReadFromDisk(pindexFork))
-            return error("LoadBlockIndex() : block.ReadFromDisk failed");
-        CTxDB txdb;
+            return error("VerifyBlocks() : block.ReadFromDisk failed");
         block.SetBestChain(txdb, pindexFork);
     }
 
     return true;
 }
+
+void ThreadVerifyBlocks(int nCheckLevel, int nCheckDepth)
+{
+    RenameThread("sling-checkblocks");
+    if (!VerifyBlocks(nCheckLevel, nCheckDepth, true))
+        LogPrintf("ThreadVerifyBlocks() : block verification stopped on a read error\n");
+}
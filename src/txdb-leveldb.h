@@ -6,6 +6,7 @@
 #ifndef BITCOIN_LEVELDB_H
 #define BITCOIN_LEVELDB_H
 
+#include "leveldbbatch.h"
 #include "main.h"
 
 #include <map>
@@ -15,6 +16,75 @@
 #include <leveldb/db.h>
 #include <leveldb/write_batch.h>
 
+/** Key of one address index entry. Each transaction touching an address gets
+ *  its own ("adx", key) record, so indexing a transaction is a single put and
+ *  reading an address' history is a range scan over the addrHash prefix.
+ *  Height and position are stored big-endian so the scan returns transactions
+ *  in chain order.
+ */
+class CAddrIndexKey
+{
+public:
+    uint160 addrHash;
+    int nHeight;
+    unsigned int nTxIndex;
+    uint256 txHash;
+
+    CAddrIndexKey()
+    {
+        addrHash = 0;
+        nHeight = 0;
+        nTxIndex = 0;
+        txHash = 0;
+    }
+
+    CAddrIndexKey(uint160 addrHashIn, int nHeightIn, unsigned int nTxIndexIn, uint256 txHashIn) :
+        addrHash(addrHashIn), nHeight(nHeightIn), nTxIndex(nTxIndexIn), txHash(txHashIn) { }
+
+    IMPLEMENT_SERIALIZE
+    (
+        uint32_t nHeightBE = ByteReverse((uint32_t)nHeight);
+        uint32_t nTxIndexBE = ByteReverse(nTxIndex);
+        READWRITE(addrHash);
+        READWRITE(nHeightBE);
+        READWRITE(nTxIndexBE);
+        READWRITE(txHash);
+        if (fRead)
+        {
+            const_cast<CAddrIndexKey*>(this)->nHeight = (int)ByteReverse(nHeightBE);
+            const_cast<CAddrIndexKey*>(this)->nTxIndex = ByteReverse(nTxIndexBE);
+        }
+    )
+};
+
+/** How far an interrupted -checkblocks run got, so the next startup can
+ *  finish it. Heights count down from nHeightNext to nHeightStop on the chain
+ *  that had hashTip as its best block. */
+class CVerifyProgress
+{
+public:
+    uint256 hashTip;
+    int nHeightNext;
+    int nHeightStop;
+    int nCheckLevel;
+
+    CVerifyProgress()
+    {
+        hashTip = 0;
+        nHeightNext = 0;
+        nHeightStop = 0;
+        nCheckLevel = 0;
+    }
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(hashTip);
+        READWRITE(nHeightNext);
+        READWRITE(nHeightStop);
+        READWRITE(nCheckLevel);
+    )
+};
+
 // Class that provides access to a LevelDB. Note that this class is frequently
 // instantiated on the stack and then destroyed again, so instantiation has to
 // be very cheap. Unfortunately that means, a CTxDB instance is actually just a
@@ -44,16 +114,17 @@ private:
     leveldb::DB *pdb;  // Points to the global instance.
 
     // A batch stores up writes and deletes for atomic application. When this
-    // field is non-NULL, writes/deletes go there instead of directly to disk.
-    leveldb::WriteBatch *activeBatch;
+    // field is non-NULL, writes/deletes go there instead of directly to disk,
+    // and reads check it first.
+    CLevelDBBatch *activeBatch;
     leveldb::Options options;
     bool fReadOnly;
     int nVersion;
 
 protected:
-    // Returns true and sets (value,false) if activeBatch contains the given key
-    // or leaves value alone and sets deleted = true if activeBatch contains a
-    // delete for it.
+    // Returns true and sets (value,false) if activeBatch or the deferred block
+    // commits contain the given key, or leaves value alone and sets
+    // deleted = true if they contain a delete for it.
     bool ScanBatch(const CDataStream &key, std::string *value, bool *deleted) const;
 
     template<typename K, typename T>
@@ -64,15 +135,12 @@ protected:
         ssKey << key;
         std::string strValue;
 
-        bool readFromDb = true;
-        if (activeBatch) {
-            // First we must search for it in the currently pending set of
-            // changes to the db. If not found in the batch, go on to read disk.
-            bool deleted = false;
-            readFromDb = ScanBatch(ssKey, &strValue, &deleted) == false;
-            if (deleted) {
-                return false;
-            }
+        // First we must search for it in the currently pending set of
+        // changes to the db. If not found in the batch, go on to read disk.
+        bool deleted = false;
+        bool readFromDb = ScanBatch(ssKey, &strValue, &deleted) == false;
+        if (deleted) {
+            return false;
         }
         if (readFromDb) {
             leveldb::Status status = pdb->Get(leveldb::ReadOptions(),
@@ -114,6 +182,8 @@ protected:
             activeBatch->Put(ssKey.str(), ssValue.str());
             return true;
         }
+        if (!Flush())
+            return false;
         leveldb::Status status = pdb->Put(leveldb::WriteOptions(), ssKey.str(), ssValue.str());
         if (!status.ok()) {
             LogPrintf("LevelDB write failure: %s\n", status.ToString());
@@ -137,6 +207,8 @@ protected:
             activeBatch->Delete(ssKey.str());
             return true;
         }
+        if (!Flush())
+            return false;
         leveldb::Status status = pdb->Delete(leveldb::WriteOptions(), ssKey.str());
         return (status.ok() || status.IsNotFound());
     }
@@ -149,11 +221,9 @@ protected:
         ssKey << key;
         std::string unused;
 
-        if (activeBatch) {
-            bool deleted;
-            if (ScanBatch(ssKey, &unused, &deleted) && !deleted) {
-                return true;
-            }
+        bool deleted;
+        if (ScanBatch(ssKey, &unused, &deleted)) {
+            return !deleted;
         }
 
 
@@ -164,7 +234,11 @@ protected:
 
 public:
     bool TxnBegin();
+    // During initial block download commits are held back and written to
+    // LevelDB together, up to -dbcoalesce commits or -dbwritebuffer bytes.
     bool TxnCommit();
+    // Write out held back commits
+    bool Flush();
     bool TxnAbort()
     {
         delete activeBatch;
@@ -183,8 +257,8 @@ public:
         return Write(std::string("version"), nVersion);
     }
 
-    bool ReadAddrIndex(uint160 addrHash, std::vector<uint256>& txHashes);
-    bool WriteAddrIndex(uint160 addrHash, uint256 txHash);
+    bool ReadAddrIndex(uint160 addrHash, std::vector<uint256>& txHashes, int nSkip = 0, int nCount = -1);
+    bool WriteAddrIndex(uint160 addrHash, int nHeight, unsigned int nTxIndex, uint256 txHash);
     bool ReadTxIndex(uint256 hash, CTxIndex& txindex);
     bool UpdateTxIndex(uint256 hash, const CTxIndex& txindex);
     bool AddTxIndex(const CTransaction& tx, const CDiskTxPos& pos, int nHeight);
@@ -203,10 +277,33 @@ public:
     bool WriteSyncCheckpoint(uint256 hashCheckpoint);
     bool ReadCheckpointPubKey(std::string& strPubKey);
     bool WriteCheckpointPubKey(const std::string& strPubKey);
+    bool ReadVerifyProgress(CVerifyProgress& progress);
+    bool WriteVerifyProgress(const CVerifyProgress& progress);
+    bool EraseVerifyProgress();
+    // Set when the address index has to be rebuilt from the blocks
+    bool ReadAddrIndexRebuild();
+    bool WriteAddrIndexRebuild();
+    bool EraseAddrIndexRebuild();
     bool LoadBlockIndex();
+
+    bool GetProperty(const std::string& strName, std::string& strValue);
+    uint64_t GetApproximateSize(const std::string& strType);
+    void GetDeferredStats(unsigned int& nCommits, size_t& nBytes);
 private:
     bool LoadBlockIndexGuts();
+    bool MigrateAddrIndex();
 };
 
 
+/** Write mapBlockIndex to a flat file that the next LoadBlockIndex can map
+ *  instead of scanning LevelDB. Call at clean shutdown. */
+bool WriteBlockIndexSnapshot();
+
+/** Check the last nCheckDepth blocks of the best chain at the given
+ *  -checklevel using a pool of threads, and roll the best chain back to before
+ *  the lowest bad block found. Returns false if a block could not be read. */
+bool VerifyBlocks(int nCheckLevel, int nCheckDepth, bool fBackground = false);
+/** Run VerifyBlocks after startup */
+void ThreadVerifyBlocks(int nCheckLevel, int nCheckDepth);
+
 #endif // BITCOIN_DB_H
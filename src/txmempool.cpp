@@ -9,7 +9,19 @@
 
 using namespace std;
 
-CTxMemPool::CTxMemPool()
+CTxMemPoolEntry::CTxMemPoolEntry() : ptx(NULL), nFee(0), nTxSize(0), nSigOps(0), dPriority(0), nValueInChain(0), nHeight(0),
+    nAncestorFee(0), nAncestorSize(0), nAncestors(0), dPriorityKey(0)
+{
+}
+
+CTxMemPoolEntry::CTxMemPoolEntry(int64_t nFeeIn, unsigned int nTxSizeIn, unsigned int nSigOpsIn,
+                                 double dPriorityIn, int64_t nValueInChainIn, int nHeightIn) :
+    ptx(NULL), nFee(nFeeIn), nTxSize(nTxSizeIn), nSigOps(nSigOpsIn), dPriority(dPriorityIn), nValueInChain(nValueInChainIn), nHeight(nHeightIn),
+    nAncestorFee(0), nAncestorSize(0), nAncestors(0), dPriorityKey(0)
+{
+}
+
+CTxMemPool::CTxMemPool() : nPriorityHeight(0)
 {
 }
 
@@ -25,7 +37,7 @@ void CTxMemPool::AddTransactionsUpdated(unsigned int n)
     nTransactionsUpdated += n;
 }
 
-bool CTxMemPool::addUnchecked(const uint256& hash, CTransaction &tx)
+bool CTxMemPool::addUnchecked(const uint256& hash, CTransaction &tx, const CTxMemPoolEntry& entryIn)
 {
     // Add to memory pool without checking anything.
     // Used by main.cpp AcceptToMemoryPool(), which DOES do
@@ -35,11 +47,125 @@ bool CTxMemPool::addUnchecked(const uint256& hash, CTransaction &tx)
         mapTx[hash] = tx;
         for (unsigned int i = 0; i < tx.vin.size(); i++)
             mapNextTx[tx.vin[i].prevout] = CInPoint(&mapTx[hash], i);
+
+        CTxMemPoolEntry& entry = mapEntry[hash];
+        entry = entryIn;
+        entry.hash = hash;
+        entry.ptx = &mapTx[hash];
+        if (entry.nTxSize == 0)
+            entry.nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+        if (entry.nSigOps == 0)
+            entry.nSigOps = GetLegacySigOpCount(tx);
+
+        BOOST_FOREACH(const CTxIn& txin, tx.vin)
+        {
+            map<uint256, CTxMemPoolEntry>::iterator mi = mapEntry.find(txin.prevout.hash);
+            if (mi != mapEntry.end())
+            {
+                entry.setParents.insert(txin.prevout.hash);
+                mi->second.setChildren.insert(hash);
+            }
+        }
+
+        // Transactions put back by a reorganization may already have
+        // children in the pool
+        for (map<COutPoint, CInPoint>::iterator it = mapNextTx.lower_bound(COutPoint(hash, 0));
+             it != mapNextTx.end() && it->first.hash == hash; ++it)
+        {
+            uint256 hashChild = it->second.ptx->GetHash();
+            map<uint256, CTxMemPoolEntry>::iterator mi = mapEntry.find(hashChild);
+            if (mi != mapEntry.end())
+            {
+                entry.setChildren.insert(hashChild);
+                mi->second.setParents.insert(hash);
+            }
+        }
+
+        UpdateAncestorState(entry);
+
+        // Everything that spends it now has one more ancestor, or more
+        set<uint256> setDescendants;
+        vector<uint256> vStack(entry.setChildren.begin(), entry.setChildren.end());
+        while (!vStack.empty())
+        {
+            uint256 hashChild = vStack.back();
+            vStack.pop_back();
+            if (!setDescendants.insert(hashChild).second)
+                continue;
+            const CTxMemPoolEntry& child = mapEntry[hashChild];
+            vStack.insert(vStack.end(), child.setChildren.begin(), child.setChildren.end());
+        }
+        BOOST_FOREACH(const uint256& hashDescendant, setDescendants)
+        {
+            CTxMemPoolEntry& descendant = mapEntry[hashDescendant];
+            setByFee.erase(&descendant);
+            UpdateAncestorState(descendant);
+            setByFee.insert(&descendant);
+        }
+
+        entry.dPriorityKey = entry.GetPriority(nPriorityHeight);
+        setByFee.insert(&entry);
+        setByPriority.insert(&entry);
+
         nTransactionsUpdated++;
     }
     return true;
 }
 
+void CTxMemPool::UpdateAncestorState(CTxMemPoolEntry& entry)
+{
+    set<uint256> setAncestors;
+    CalculateAncestors(entry, setAncestors);
+    entry.nAncestorFee = entry.nFee;
+    entry.nAncestorSize = entry.nTxSize;
+    entry.nAncestors = 1;
+    BOOST_FOREACH(const uint256& hashAncestor, setAncestors)
+    {
+        const CTxMemPoolEntry& ancestor = mapEntry[hashAncestor];
+        entry.nAncestorFee += ancestor.nFee;
+        entry.nAncestorSize += ancestor.nTxSize;
+        entry.nAncestors++;
+    }
+}
+
+void CTxMemPool::removeEntry(const uint256& hash)
+{
+    map<uint256, CTxMemPoolEntry>::iterator mi = mapEntry.find(hash);
+    if (mi == mapEntry.end())
+        return;
+    CTxMemPoolEntry& entry = mi->second;
+
+    // What is left that spent it no longer has to wait for it
+    set<uint256> setDescendants;
+    vector<uint256> vStack(entry.setChildren.begin(), entry.setChildren.end());
+    while (!vStack.empty())
+    {
+        uint256 hashChild = vStack.back();
+        vStack.pop_back();
+        if (!setDescendants.insert(hashChild).second)
+            continue;
+        const CTxMemPoolEntry& child = mapEntry[hashChild];
+        vStack.insert(vStack.end(), child.setChildren.begin(), child.setChildren.end());
+    }
+    BOOST_FOREACH(const uint256& hashDescendant, setDescendants)
+    {
+        CTxMemPoolEntry& descendant = mapEntry[hashDescendant];
+        setByFee.erase(&descendant);
+        descendant.nAncestorFee -= entry.nFee;
+        descendant.nAncestorSize -= entry.nTxSize;
+        descendant.nAncestors--;
+        descendant.setParents.erase(hash);
+        setByFee.insert(&descendant);
+    }
+
+    BOOST_FOREACH(const uint256& hashParent, entry.setParents)
+        mapEntry[hashParent].setChildren.erase(hash);
+
+    setByFee.erase(&entry);
+    setByPriority.erase(&entry);
+    mapEntry.erase(mi);
+}
+
 bool CTxMemPool::remove(const CTransaction &tx, bool fRecursive)
 {
     // Remove transaction from memory pool
@@ -57,6 +183,7 @@ bool CTxMemPool::remove(const CTransaction &tx, bool fRecursive)
             }
             BOOST_FOREACH(const CTxIn& txin, tx.vin)
                 mapNextTx.erase(txin.prevout);
+            removeEntry(hash);
             mapTx.erase(hash);
             nTransactionsUpdated++;
         }
@@ -84,6 +211,9 @@ void CTxMemPool::clear()
     LOCK(cs);
     mapTx.clear();
     mapNextTx.clear();
+    setByFee.clear();
+    setByPriority.clear();
+    mapEntry.clear();
     ++nTransactionsUpdated;
 }
 
@@ -105,3 +235,32 @@ bool CTxMemPool::lookup(uint256 hash, CTransaction& result) const
     result = i->second;
     return true;
 }
+
+void CTxMemPool::UpdatePriorities(int nBestHeight)
+{
+    LOCK(cs);
+    if (nBestHeight == nPriorityHeight)
+        return;
+    nPriorityHeight = nBestHeight;
+    setByPriority.clear();
+    for (map<uint256, CTxMemPoolEntry>::iterator mi = mapEntry.begin(); mi != mapEntry.end(); ++mi)
+    {
+        mi->second.dPriorityKey = mi->second.GetPriority(nBestHeight);
+        setByPriority.insert(&mi->second);
+    }
+}
+
+void CTxMemPool::CalculateAncestors(const CTxMemPoolEntry& entry, set<uint256>& setAncestorsRet) const
+{
+    LOCK(cs);
+    vector<uint256> vStack(entry.setParents.begin(), entry.setParents.end());
+    while (!vStack.empty())
+    {
+        uint256 hash = vStack.back();
+        vStack.pop_back();
+        if (!setAncestorsRet.insert(hash).second)
+            continue;
+        const CTxMemPoolEntry& parent = mapEntry.find(hash)->second;
+        vStack.insert(vStack.end(), parent.setParents.begin(), parent.setParents.end());
+    }
+}
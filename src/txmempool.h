@@ -7,6 +7,81 @@
 
 #include "core.h"
 
+#include <set>
+
+/*
+ * What building a block needs to know about a transaction in the memory
+ * pool, worked out once when it is accepted instead of for every block.
+ *
+ * Priority is only known from the inputs already in the chain when it was
+ * accepted, and grows with the height from there. Inputs from the pool
+ * add no priority even after they are confirmed.
+ */
+class CTxMemPoolEntry
+{
+public:
+    uint256 hash;
+    CTransaction* ptx;         // in CTxMemPool::mapTx
+    int64_t nFee;
+    unsigned int nTxSize;
+    unsigned int nSigOps;
+    double dPriority;          // at nHeight
+    int64_t nValueInChain;     // of its inputs in the chain
+    int nHeight;               // best height when accepted
+
+    // Transactions in the pool it spends, and that spend it
+    std::set<uint256> setParents;
+    std::set<uint256> setChildren;
+
+    // Totals over it and its ancestors in the pool, all of which have to
+    // go in a block before it
+    int64_t nAncestorFee;
+    unsigned int nAncestorSize;
+    unsigned int nAncestors;
+
+    // Priority at the height the pool's priority index is sorted for
+    double dPriorityKey;
+
+    CTxMemPoolEntry();
+    CTxMemPoolEntry(int64_t nFeeIn, unsigned int nTxSizeIn, unsigned int nSigOpsIn,
+                    double dPriorityIn, int64_t nValueInChainIn, int nHeightIn);
+
+    double GetPriority(int nBestHeight) const
+    {
+        return dPriority + (double)nValueInChain * (nBestHeight - nHeight) / nTxSize;
+    }
+
+    // Fee per 1000 bytes of it and its ancestors
+    double GetAncestorFeePerKb() const
+    {
+        return (double)nAncestorFee * 1000 / nAncestorSize;
+    }
+};
+
+class CompareTxMemPoolEntryByAncestorFee
+{
+public:
+    bool operator()(const CTxMemPoolEntry* a, const CTxMemPoolEntry* b) const
+    {
+        double f1 = (double)a->nAncestorFee * b->nAncestorSize;
+        double f2 = (double)b->nAncestorFee * a->nAncestorSize;
+        if (f1 != f2)
+            return f1 > f2;
+        return a->hash < b->hash;
+    }
+};
+
+class CompareTxMemPoolEntryByPriority
+{
+public:
+    bool operator()(const CTxMemPoolEntry* a, const CTxMemPoolEntry* b) const
+    {
+        if (a->dPriorityKey != b->dPriorityKey)
+            return a->dPriorityKey > b->dPriorityKey;
+        return a->hash < b->hash;
+    }
+};
+
 /*
  * CTxMemPool stores valid-according-to-the-current-best-chain
  * transactions that may be included in the next block.
@@ -21,15 +96,29 @@ class CTxMemPool
 {
 private:
     unsigned int nTransactionsUpdated;
+    int nPriorityHeight;
+
+    void removeEntry(const uint256& hash);
+    // Work out the ancestor totals of an entry not in setByFee
+    void UpdateAncestorState(CTxMemPoolEntry& entry);
 
 public:
+    typedef std::set<CTxMemPoolEntry*, CompareTxMemPoolEntryByAncestorFee> indexed_by_fee;
+    typedef std::set<CTxMemPoolEntry*, CompareTxMemPoolEntryByPriority> indexed_by_priority;
+
     mutable CCriticalSection cs;
     std::map<uint256, CTransaction> mapTx;
     std::map<COutPoint, CInPoint> mapNextTx;
 
+    // An entry for each transaction in mapTx, best first by fee rate with
+    // ancestors and by priority
+    std::map<uint256, CTxMemPoolEntry> mapEntry;
+    indexed_by_fee setByFee;
+    indexed_by_priority setByPriority;
+
     CTxMemPool();
 
-    bool addUnchecked(const uint256& hash, CTransaction &tx);
+    bool addUnchecked(const uint256& hash, CTransaction &tx, const CTxMemPoolEntry& entry = CTxMemPoolEntry());
     bool remove(const CTransaction &tx, bool fRecursive = false);
     bool removeConflicts(const CTransaction &tx);
     void clear();
@@ -50,6 +139,12 @@ public:
     }
 
     bool lookup(uint256 hash, CTransaction& result) const;
+
+    // Sort setByPriority for a block on top of nBestHeight
+    void UpdatePriorities(int nBestHeight);
+
+    // Hashes of the transactions in the pool that entry spends, directly or not
+    void CalculateAncestors(const CTxMemPoolEntry& entry, std::set<uint256>& setAncestorsRet) const;
 };
 
 #endif /* BITCOIN_TXMEMPOOL_H */
@@ -8,6 +8,7 @@
 #include "base58.h"
 #include "coincontrol.h"
 #include "kernel.h"
+#include "kernelsearch.h"
 #include "net.h"
 #include "timedata.h"
 #include "txdb.h"
@@ -543,6 +544,7 @@ void CWallet::WalletUpdateSpent(const CTransaction &tx, bool fBlock)
                     LogPrintf("WalletUpdateSpent found spent coin %s BC %s\n", FormatMoney(wtx.GetCredit()), wtx.GetHash().ToString());
                     wtx.MarkSpent(txin.prevout.n);
                     wtx.WriteToDisk();
+                    stakeCoins.Remove(txin.prevout);
                     NotifyTransactionChanged(this, txin.prevout.hash, CT_UPDATED);
                 }
             }
@@ -691,6 +693,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn)
         }
         // since AddToWallet is called directly for self-originating transactions, check for consumption of own coins
         WalletUpdateSpent(wtx, (wtxIn.hashBlock != 0));
+        UpdateStakeCoins(wtx);
 
         // Notify UI of new or updated transaction
         NotifyTransactionChanged(this, hash, fInsertedNew ? CT_NEW : CT_UPDATED);
@@ -743,6 +746,9 @@ bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pbl
 void CWallet::SyncTransaction(const CTransaction& tx, const CBlock* pblock, bool fConnect) {
     if (!fConnect)
     {
+        stakeKernelCache.Remove(tx.GetHash());
+        stakeCoins.Remove(tx.GetHash());
+
         // wallets need to refund inputs when disconnecting coinstake
         if (tx.IsCoinStake())
         {
@@ -753,6 +759,27 @@ void CWallet::SyncTransaction(const CTransaction& tx, const CBlock* pblock, bool
     }
 
     AddToWalletIfInvolvingMe(tx, pblock, true);
+
+    // Remember where our new coins are for the stake kernel search, and
+    // forget the coins spent
+    if (pblock)
+    {
+        if (!tx.IsCoinBase())
+            BOOST_FOREACH(const CTxIn& txin, tx.vin)
+                stakeKernelCache.Remove(txin.prevout);
+
+        LOCK(cs_wallet);
+        map<uint256, CWalletTx>::iterator it = mapWallet.find(tx.GetHash());
+        if (it == mapWallet.end())
+            return;
+        uint256 hashBlock = pblock->GetHash();
+        map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+        if (mi != mapBlockIndex.end())
+            UpdateStakeCoins(it->second, mi->second);
+        for (unsigned int i = 0; i < tx.vout.size(); i++)
+            if (IsMine(tx.vout[i]))
+                stakeKernelCache.Add(CStakeKernelInput(COutPoint(tx.GetHash(), i), tx.vout[i].nValue, tx.nTime, pblock->GetBlockTime(), hashBlock));
+    }
 }
 
 void CWallet::EraseFromWallet(const uint256 &hash)
@@ -763,10 +790,246 @@ void CWallet::EraseFromWallet(const uint256 &hash)
         LOCK(cs_wallet);
         if (mapWallet.erase(hash))
             CWalletDB(strWalletFile).EraseTx(hash);
+        stakeKernelCache.Remove(hash);
+        stakeCoins.Remove(hash);
     }
     return;
 }
 
+CStakeCoinSet::CStakeCoinSet() : nHeightCounted(-1), nTimeCounted(0), nMinInputCounted(0), nBalance(0), nWeight(0)
+{
+}
+
+bool CStakeCoinSet::CanStake(const CCoin& coin) const
+{
+    return coin.fHeightMature && coin.fTimeMature && coin.nValue >= nMinInputCounted;
+}
+
+void CStakeCoinSet::Count(const CCoin& coin, int nSign)
+{
+    if (coin.fHeightMature)
+        nBalance += nSign * coin.nValue;
+    if (CanStake(coin))
+        nWeight += nSign * coin.nValue;
+}
+
+void CStakeCoinSet::Queue(const COutPoint& prevout, const CCoin& coin)
+{
+    if (!coin.fHeightMature)
+        mapPendingHeight.insert(make_pair(coin.nHeightMature, prevout));
+    if (!coin.fTimeMature)
+        mapPendingTime.insert(make_pair(coin.nTimeMature, prevout));
+}
+
+void CStakeCoinSet::Add(const COutPoint& prevout, int64_t nValue, int nHeightMature, unsigned int nTimeMature)
+{
+    LOCK(cs);
+    map<COutPoint, CCoin>::iterator mi = mapCoins.find(prevout);
+    if (mi != mapCoins.end())
+    {
+        CCoin& coin = mi->second;
+        if (coin.nValue == nValue && coin.nHeightMature == nHeightMature && coin.nTimeMature == nTimeMature)
+            return;
+        Count(coin, -1);
+        mapCoins.erase(mi);
+    }
+
+    CCoin coin;
+    coin.nValue = nValue;
+    coin.nHeightMature = nHeightMature;
+    coin.nTimeMature = nTimeMature;
+    coin.fHeightMature = nHeightMature <= nHeightCounted;
+    coin.fTimeMature = nTimeMature <= nTimeCounted;
+    mapCoins.insert(make_pair(prevout, coin));
+    Count(coin, 1);
+    Queue(prevout, coin);
+}
+
+void CStakeCoinSet::Remove(const COutPoint& prevout)
+{
+    LOCK(cs);
+    map<COutPoint, CCoin>::iterator mi = mapCoins.find(prevout);
+    if (mi == mapCoins.end())
+        return;
+    Count(mi->second, -1);
+    mapCoins.erase(mi);
+}
+
+void CStakeCoinSet::Remove(const uint256& hashTx)
+{
+    LOCK(cs);
+    map<COutPoint, CCoin>::iterator mi = mapCoins.lower_bound(COutPoint(hashTx, 0));
+    while (mi != mapCoins.end() && mi->first.hash == hashTx)
+    {
+        Count(mi->second, -1);
+        mapCoins.erase(mi++);
+    }
+}
+
+void CStakeCoinSet::Clear()
+{
+    LOCK(cs);
+    mapCoins.clear();
+    mapPendingHeight.clear();
+    mapPendingTime.clear();
+    nBalance = 0;
+    nWeight = 0;
+}
+
+size_t CStakeCoinSet::size() const
+{
+    LOCK(cs);
+    return mapCoins.size();
+}
+
+// Count everything again, when the chain or the clock went back
+void CStakeCoinSet::Recount(int nHeight, unsigned int nTime)
+{
+    int64_t nStart = GetTimeMicros();
+    nHeightCounted = nHeight;
+    nTimeCounted = nTime;
+    nMinInputCounted = nMinimumInputValue;
+    nBalance = 0;
+    nWeight = 0;
+    mapPendingHeight.clear();
+    mapPendingTime.clear();
+    for (map<COutPoint, CCoin>::iterator mi = mapCoins.begin(); mi != mapCoins.end(); ++mi)
+    {
+        CCoin& coin = mi->second;
+        coin.fHeightMature = coin.nHeightMature <= nHeight;
+        coin.fTimeMature = coin.nTimeMature <= nTime;
+        Count(coin, 1);
+        Queue(mi->first, coin);
+    }
+    LogPrint("bench", "CStakeCoinSet::Recount() : %u coins in %.2fms\n", mapCoins.size(), 0.001 * (GetTimeMicros() - nStart));
+}
+
+// Bring in the coins that matured since the totals were counted
+void CStakeCoinSet::Advance(int nHeight, unsigned int nTime)
+{
+    if (nHeight < nHeightCounted || nTime < nTimeCounted || nMinimumInputValue != nMinInputCounted)
+    {
+        Recount(nHeight, nTime);
+        return;
+    }
+
+    while (!mapPendingHeight.empty() && mapPendingHeight.begin()->first <= nHeight)
+    {
+        map<COutPoint, CCoin>::iterator mi = mapCoins.find(mapPendingHeight.begin()->second);
+        if (mi != mapCoins.end() && !mi->second.fHeightMature && mi->second.nHeightMature <= nHeight)
+        {
+            Count(mi->second, -1);
+            mi->second.fHeightMature = true;
+            Count(mi->second, 1);
+        }
+        mapPendingHeight.erase(mapPendingHeight.begin());
+    }
+    while (!mapPendingTime.empty() && mapPendingTime.begin()->first <= nTime)
+    {
+        map<COutPoint, CCoin>::iterator mi = mapCoins.find(mapPendingTime.begin()->second);
+        if (mi != mapCoins.end() && !mi->second.fTimeMature && mi->second.nTimeMature <= nTime)
+        {
+            Count(mi->second, -1);
+            mi->second.fTimeMature = true;
+            Count(mi->second, 1);
+        }
+        mapPendingTime.erase(mapPendingTime.begin());
+    }
+    nHeightCounted = nHeight;
+    nTimeCounted = nTime;
+}
+
+int64_t CStakeCoinSet::GetWeight(int nHeight, unsigned int nTime, int64_t nReserve)
+{
+    LOCK(cs);
+    Advance(nHeight, nTime);
+
+    if (nBalance <= nReserve)
+        return 0;
+    int64_t nTarget = nBalance - nReserve;
+    if (nWeight <= nTarget)
+        return nWeight;
+
+    // Only part of it may stake: the coins SelectCoinsForStaking() would
+    // choose, in wallet order until the target is reached
+    int64_t nTotal = 0;
+    for (map<COutPoint, CCoin>::const_iterator mi = mapCoins.begin(); mi != mapCoins.end() && nTotal < nTarget; ++mi)
+        if (CanStake(mi->second))
+            nTotal += mi->second.nValue;
+    return nTotal;
+}
+
+// Whether pindex is in the main chain, also once Reorganize() has taken the
+// old tip out of it but not yet moved pindexBest
+static bool IsInBestChain(const CBlockIndex* pindex)
+{
+    if (pindex->pnext)
+        return true;
+    return pindex == pindexBest && (!pindex->pprev || pindex->pprev->pnext == pindex);
+}
+
+// Put the outputs of wtx in the set of coins that may stake, or take them
+// out, as they are now. pindexBlock is the block wtx is being connected in,
+// which is not yet in the main chain.
+void CWallet::UpdateStakeCoins(const CWalletTx& wtx, CBlockIndex* pindexBlock)
+{
+    AssertLockHeld(cs_wallet);
+    uint256 hash = wtx.GetHash();
+    if (!pindexBlock && wtx.hashBlock != 0)
+    {
+        map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(wtx.hashBlock);
+        if (mi != mapBlockIndex.end() && IsInBestChain(mi->second))
+            pindexBlock = mi->second;
+    }
+    if (!pindexBlock)
+    {
+        stakeCoins.Remove(hash);
+        return;
+    }
+
+    int nHeightMature = pindexBlock->nHeight + ((wtx.IsCoinBase() || wtx.IsCoinStake()) ? nCoinbaseMaturity : 0);
+    // GetStakeWeight() used to count coins strictly older than the min age
+    unsigned int nTimeMature = wtx.nTime + nStakeMinAge + 1;
+    for (unsigned int i = 0; i < wtx.vout.size(); i++)
+    {
+        if (!wtx.IsSpent(i) && IsMine(wtx.vout[i]))
+            stakeCoins.Add(COutPoint(hash, i), wtx.vout[i].nValue, nHeightMature, nTimeMature);
+        else
+            stakeCoins.Remove(COutPoint(hash, i));
+    }
+}
+
+void CWallet::RebuildStakeCoins()
+{
+    LOCK2(cs_main, cs_wallet);
+    stakeCoins.Clear();
+    for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        UpdateStakeCoins(it->second);
+    // Kernel inputs are read again as they are asked for
+    stakeKernelCache.Clear();
+}
+
+// Kernel input of one of our coins, read from disk only the first time it
+// is asked for after the coin was loaded or its block connected
+bool CWallet::GetStakeKernelInput(const COutPoint& prevout, CStakeKernelInput& inputRet) const
+{
+    if (stakeKernelCache.Get(prevout, inputRet))
+    {
+        LOCK(cs_main);
+        map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(inputRet.hashBlockFrom);
+        if (mi != mapBlockIndex.end() && mi->second->IsInMainChain())
+            return true;
+
+        // Left behind by a reorganization
+        stakeKernelCache.Remove(prevout.hash);
+    }
+
+    if (!ReadKernelInput(prevout, inputRet))
+        return false;
+    stakeKernelCache.Add(inputRet);
+    return true;
+}
+
 
 bool CWallet::IsMine(const CTxIn &txin) const
 {
@@ -1113,6 +1376,7 @@ void CWallet::ReacceptWalletTransactions()
                     if (!txindex.vSpent[i].IsNull() && IsMine(wtx.vout[i]))
                     {
                         wtx.MarkSpent(i);
+                        stakeCoins.Remove(COutPoint(wtx.GetHash(), i));
                         fUpdated = true;
                         vMissingTx.push_back(txindex.vSpent[i]);
                     }
@@ -2398,6 +2662,7 @@ bool CWallet::CreateCollateralTransaction(CTransaction& txCollateral, std::strin
 
     txCollateral.vin.clear();
     txCollateral.vout.clear();
+    txCollateral.InvalidateHash();
 
     CReserveKey reservekey(this);
     int64_t nValueIn2 = 0;
@@ -2482,6 +2747,7 @@ bool CWallet::CreateTransaction(const vector<pair<CScript, int64_t> >& vecSend,
             {
                 wtxNew.vin.clear();
                 wtxNew.vout.clear();
+                wtxNew.InvalidateHash();
                 wtxNew.fFromMe = true;
 
                 int64_t nTotalValue = nValue + nFeeRet;
@@ -2581,8 +2847,9 @@ bool CWallet::CreateTransaction(const vector<pair<CScript, int64_t> >& vecSend,
 
                 // Sign
                 int nIn = 0;
+                CSignatureHashCache sighashes(wtxNew);
                 BOOST_FOREACH(const PAIRTYPE(const CWalletTx*,unsigned int)& coin, setCoins)
-                    if (!SignSignature(*this, *coin.first, wtxNew, nIn++))
+                    if (!SignSignature(*this, *coin.first, wtxNew, nIn++, SIGHASH_ALL, &sighashes))
                         return false;
 
                 // Limit size
@@ -3356,42 +3623,12 @@ bool CWallet::FindStealthTransactions(const CTransaction& tx, mapValue_t& mapNar
 
 
 
-uint64_t CWallet::GetStakeWeight() const
+// Weight at nHeight of the coins that may stake, as kept up to date by
+// stakeCoins. The RPC and the GUI ask for it often, so it does not take
+// cs_wallet; callers read the height under cs_main.
+uint64_t CWallet::GetStakeWeight(int nHeight) const
 {
-    // Choose coins to use
-    int64_t nBalance = GetBalance();
-
-    if (nBalance <= nReserveBalance)
-        return 0;
-
-    vector<const CWalletTx*> vwtxPrev;
-
-    set<pair<const CWalletTx*,unsigned int> > setCoins;
-    int64_t nValueIn = 0;
-
-    if (!SelectCoinsForStaking(nBalance - nReserveBalance, GetTime(), setCoins, nValueIn))
-        return 0;
-
-    if (setCoins.empty())
-        return 0;
-
-    uint64_t nWeight = 0;
-
-    int64_t nCurrentTime = GetTime();
-    CTxDB txdb("r");
-
-    LOCK2(cs_main, cs_wallet);
-    BOOST_FOREACH(PAIRTYPE(const CWalletTx*, unsigned int) pcoin, setCoins)
-    {
-        CTxIndex txindex;
-        if (!txdb.ReadTxIndex(pcoin.first->GetHash(), txindex))
-            continue;
-
-        if (nCurrentTime - pcoin.first->nTime > nStakeMinAge)
-            nWeight += pcoin.first->vout[pcoin.second].nValue;
-    }
-
-    return nWeight;
+    return stakeCoins.GetWeight(nHeight, GetTime(), nReserveBalance);
 }
 
 bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int64_t nSearchInterval, int64_t nFees, CTransaction& txNew, CKey& key)
@@ -3402,6 +3639,7 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
 
     txNew.vin.clear();
     txNew.vout.clear();
+    txNew.InvalidateHash();
 
     // Mark coin stake transaction
     CScript scriptEmpty;
@@ -3429,80 +3667,88 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
     int64_t nCredit = 0;
     CScript scriptPubKeyKernel;
     CTxDB txdb("r");
+
+    // Lay the coins out for the kernel search
+    static int nMaxStakeSearchInterval = 60;
+    CStakeKernelSearch kernelSearch(pindexPrev, nBits);
+    vector<pair<const CWalletTx*,unsigned int> > vSearchCoins;
+    vector<CStakeKernelInput> vKernelInputs;
+    int64_t nTimeLayout = GetTimeMicros();
     BOOST_FOREACH(PAIRTYPE(const CWalletTx*, unsigned int) pcoin, setCoins)
     {
-        static int nMaxStakeSearchInterval = 60;
-        bool fKernelFound = false;
-        for (unsigned int n=0; n<min(nSearchInterval,(int64_t)nMaxStakeSearchInterval) && !fKernelFound && pindexPrev == pindexBest; n++)
+        CStakeKernelInput kernelInput;
+        if (!GetStakeKernelInput(COutPoint(pcoin.first->GetHash(), pcoin.second), kernelInput))
+            continue;
+        kernelSearch.Add(kernelInput);
+        vSearchCoins.push_back(pcoin);
+        vKernelInputs.push_back(kernelInput);
+    }
+    LogPrint("bench", "CreateCoinStake() : %u kernel inputs laid out in %.2fms\n", vKernelInputs.size(), 0.001 * (GetTimeMicros() - nTimeLayout));
+
+    // Search backward in time from the given txNew timestamp
+    // Search nSearchInterval seconds back up to nMaxStakeSearchInterval
+    unsigned int nSearchWindow = max((int64_t)0, min(nSearchInterval, (int64_t)nMaxStakeSearchInterval));
+    unsigned int nTimeKernel;
+    for (size_t nCoin = 0; pindexPrev == pindexBest && kernelSearch.Find(nCoin, txNew.nTime, nSearchWindow, nCoin, nTimeKernel); nCoin++)
+    {
+        boost::this_thread::interruption_point();
+        PAIRTYPE(const CWalletTx*, unsigned int) pcoin = vSearchCoins[nCoin];
+
+        // Found a kernel
+        LogPrint("coinstake", "CreateCoinStake : kernel found\n");
+        vector<valtype> vSolutions;
+        txnouttype whichType;
+        CScript scriptPubKeyOut;
+        scriptPubKeyKernel = pcoin.first->vout[pcoin.second].scriptPubKey;
+        if (!Solver(scriptPubKeyKernel, whichType, vSolutions))
+        {
+            LogPrint("coinstake", "CreateCoinStake : failed to parse kernel\n");
+            continue;
+        }
+        LogPrint("coinstake", "CreateCoinStake : parsed kernel type=%d\n", whichType);
+        if (whichType != TX_PUBKEY && whichType != TX_PUBKEYHASH)
+        {
+            LogPrint("coinstake", "CreateCoinStake : no support for kernel type=%d\n", whichType);
+            continue;  // only support pay to public key and pay to address
+        }
+        if (whichType == TX_PUBKEYHASH) // pay to address type
         {
-            boost::this_thread::interruption_point();
-            // Search backward in time from the given txNew timestamp 
-            // Search nSearchInterval seconds back up to nMaxStakeSearchInterval
-            COutPoint prevoutStake = COutPoint(pcoin.first->GetHash(), pcoin.second);
-            int64_t nBlockTime;
-            if (CheckKernel(pindexPrev, nBits, txNew.nTime - n, prevoutStake, &nBlockTime))
+            // convert to pay to public key type
+            if (!keystore.GetKey(uint160(vSolutions[0]), key))
             {
-                // Found a kernel
-                LogPrint("coinstake", "CreateCoinStake : kernel found\n");
-                vector<valtype> vSolutions;
-                txnouttype whichType;
-                CScript scriptPubKeyOut;
-                scriptPubKeyKernel = pcoin.first->vout[pcoin.second].scriptPubKey;
-                if (!Solver(scriptPubKeyKernel, whichType, vSolutions))
-                {
-                    LogPrint("coinstake", "CreateCoinStake : failed to parse kernel\n");
-                    break;
-                }
-                LogPrint("coinstake", "CreateCoinStake : parsed kernel type=%d\n", whichType);
-                if (whichType != TX_PUBKEY && whichType != TX_PUBKEYHASH)
-                {
-                    LogPrint("coinstake", "CreateCoinStake : no support for kernel type=%d\n", whichType);
-                    break;  // only support pay to public key and pay to address
-                }
-                if (whichType == TX_PUBKEYHASH) // pay to address type
-                {
-                    // convert to pay to public key type
-                    if (!keystore.GetKey(uint160(vSolutions[0]), key))
-                    {
-                        LogPrint("coinstake", "CreateCoinStake : failed to get key for kernel type=%d\n", whichType);
-                        break;  // unable to find corresponding public key
-                    }
-                    scriptPubKeyOut << key.GetPubKey() << OP_CHECKSIG;
-                }
-                if (whichType == TX_PUBKEY)
-                {
-                    valtype& vchPubKey = vSolutions[0];
-                    if (!keystore.GetKey(Hash160(vchPubKey), key))
-                    {
-                        LogPrint("coinstake", "CreateCoinStake : failed to get key for kernel type=%d\n", whichType);
-                        break;  // unable to find corresponding public key
-                    }
-
-                    if (key.GetPubKey() != vchPubKey)
-                    {
-                        LogPrint("coinstake", "CreateCoinStake : invalid key for kernel type=%d\n", whichType);
-                        break; // keys mismatch
-                    }
-
-                    scriptPubKeyOut = scriptPubKeyKernel;
-                }
-
-                txNew.nTime -= n;
-                txNew.vin.push_back(CTxIn(pcoin.first->GetHash(), pcoin.second));
-                nCredit += pcoin.first->vout[pcoin.second].nValue;
-                vwtxPrev.push_back(pcoin.first);
-                txNew.vout.push_back(CTxOut(0, scriptPubKeyOut));
+                LogPrint("coinstake", "CreateCoinStake : failed to get key for kernel type=%d\n", whichType);
+                continue;  // unable to find corresponding public key
+            }
+            scriptPubKeyOut << key.GetPubKey() << OP_CHECKSIG;
+        }
+        if (whichType == TX_PUBKEY)
+        {
+            valtype& vchPubKey = vSolutions[0];
+            if (!keystore.GetKey(Hash160(vchPubKey), key))
+            {
+                LogPrint("coinstake", "CreateCoinStake : failed to get key for kernel type=%d\n", whichType);
+                continue;  // unable to find corresponding public key
+            }
 
-                if (GetWeight(nBlockTime, (int64_t)txNew.nTime) < GetStakeSplitAge())
-                    txNew.vout.push_back(CTxOut(0, scriptPubKeyOut)); //split stake
-                LogPrint("coinstake", "CreateCoinStake : added kernel type=%d\n", whichType);
-                fKernelFound = true;
-                break;
+            if (key.GetPubKey() != vchPubKey)
+            {
+                LogPrint("coinstake", "CreateCoinStake : invalid key for kernel type=%d\n", whichType);
+                continue; // keys mismatch
             }
+
+            scriptPubKeyOut = scriptPubKeyKernel;
         }
 
-        if (fKernelFound)
-            break; // if kernel is found stop searching
+        txNew.nTime = nTimeKernel;
+        txNew.vin.push_back(CTxIn(pcoin.first->GetHash(), pcoin.second));
+        nCredit += pcoin.first->vout[pcoin.second].nValue;
+        vwtxPrev.push_back(pcoin.first);
+        txNew.vout.push_back(CTxOut(0, scriptPubKeyOut));
+
+        if (GetWeight(vKernelInputs[nCoin].nTimeBlockFrom, (int64_t)txNew.nTime) < GetStakeSplitAge())
+            txNew.vout.push_back(CTxOut(0, scriptPubKeyOut)); //split stake
+        LogPrint("coinstake", "CreateCoinStake : added kernel type=%d\n", whichType);
+        break; // if kernel is found stop searching
     }
 
     if (nCredit == 0 || nCredit > nBalance - nReserveBalance)
@@ -3627,9 +3873,10 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
 
     // Sign
     int nIn = 0;
+    CSignatureHashCache sighashes(txNew);
     BOOST_FOREACH(const CWalletTx* pcoin, vwtxPrev)
     {
-        if (!SignSignature(*this, *pcoin, txNew, nIn++))
+        if (!SignSignature(*this, *pcoin, txNew, nIn++, SIGHASH_ALL, &sighashes))
             return error("CreateCoinStake : failed to sign coinstake");
     }
 
@@ -3679,6 +3926,7 @@ bool CWallet::CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey)
                 coin.BindWallet(this);
                 coin.MarkSpent(txin.prevout.n);
                 coin.WriteToDisk();
+                stakeCoins.Remove(txin.prevout);
                 NotifyTransactionChanged(this, coin.GetHash(), CT_UPDATED);
             }
 
@@ -4276,7 +4524,7 @@ void CWallet::FixSpentCoins(int& nMismatchFound, int64_t& nBalanceInQuestion, bo
     nMismatchFound = 0;
     nBalanceInQuestion = 0;
 
-    LOCK(cs_wallet);
+    LOCK2(cs_main, cs_wallet);
     vector<CWalletTx*> vCoins;
     vCoins.reserve(mapWallet.size());
     for (map<uint256, CWalletTx>::iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
@@ -4316,6 +4564,8 @@ void CWallet::FixSpentCoins(int& nMismatchFound, int64_t& nBalanceInQuestion, bo
                 }
             }
         }
+        if (!fCheckOnly)
+            UpdateStakeCoins(*pcoin);
     }
 }
 
@@ -4336,6 +4586,7 @@ void CWallet::DisableTransaction(const CTransaction &tx)
             {
                 prev.MarkUnspent(txin.prevout.n);
                 prev.WriteToDisk();
+                UpdateStakeCoins(prev);
             }
         }
     }
@@ -20,6 +20,7 @@
 #include "ui_interface.h"
 #include "util.h"
 #include "stealth.h"
+#include "kernel.h"
 
 // Settings
 extern int64_t nTransactionFee;
@@ -94,6 +95,60 @@ public:
     )
 };
 
+/** Our confirmed unspent coins, with the balance and the stake weight they
+ * add up to. Coins are added and removed as the wallet sees transactions
+ * confirmed, spent and disconnected, and move into the totals as the best
+ * height and the time pass their maturity, so the stake weight is known
+ * without going through the whole wallet or the chain.
+ */
+class CStakeCoinSet
+{
+private:
+    struct CCoin
+    {
+        int64_t nValue;
+        int nHeightMature;         // best height from which it may stake
+        unsigned int nTimeMature;  // time from which it may stake
+        bool fHeightMature;
+        bool fTimeMature;
+    };
+
+    mutable CCriticalSection cs;
+    std::map<COutPoint, CCoin> mapCoins;
+    // Coins waiting to mature, by when they will. Entries for coins removed
+    // or already matured are skipped when their turn comes.
+    std::multimap<int, COutPoint> mapPendingHeight;
+    std::multimap<unsigned int, COutPoint> mapPendingTime;
+
+    // The totals are counted at this height and time, with this -mininput
+    int nHeightCounted;
+    unsigned int nTimeCounted;
+    int64_t nMinInputCounted;
+    int64_t nBalance;  // coins past their maturity height
+    int64_t nWeight;   // and their min age, at least -mininput
+
+    void Count(const CCoin& coin, int nSign);
+    void Queue(const COutPoint& prevout, const CCoin& coin);
+    void Recount(int nHeight, unsigned int nTime);
+    void Advance(int nHeight, unsigned int nTime);
+    bool CanStake(const CCoin& coin) const;
+
+public:
+    CStakeCoinSet();
+
+    // Add or replace a coin
+    void Add(const COutPoint& prevout, int64_t nValue, int nHeightMature, unsigned int nTimeMature);
+    void Remove(const COutPoint& prevout);
+    // Drop every output of a transaction
+    void Remove(const uint256& hashTx);
+    void Clear();
+
+    // Weight of the coins CreateCoinStake would try at best height nHeight
+    // and time nTime, keeping nReserve back
+    int64_t GetWeight(int nHeight, unsigned int nTime, int64_t nReserve);
+    size_t size() const;
+};
+
 /** A CWallet is an extension of a keystore, which also maintains a set of transactions and balances,
  * and provides the ability to create new transactions.
  */
@@ -188,6 +243,11 @@ public:
 
     std::set<COutPoint> setLockedCoins;
 
+    // Kernel inputs of our confirmed coins, so staking need not read them from disk
+    mutable CStakeKernelCache stakeKernelCache;
+    // Our coins that may stake, so the stake weight need not be counted
+    mutable CStakeCoinSet stakeCoins;
+
     int64_t nTimeFirstKey;
 
     // check whether we are allowed to upgrade (or already support) to the named feature
@@ -254,7 +314,10 @@ public:
     void SyncTransaction(const CTransaction& tx, const CBlock* pblock, bool fConnect = true);
     bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate);
     void EraseFromWallet(const uint256 &hash);
+    bool GetStakeKernelInput(const COutPoint& prevout, CStakeKernelInput& inputRet) const;
     void WalletUpdateSpent(const CTransaction& prevout, bool fBlock = false);
+    void UpdateStakeCoins(const CWalletTx& wtx, CBlockIndex* pindexBlock = NULL);
+    void RebuildStakeCoins();
     int ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false);
     void ReacceptWalletTransactions();
     void ResendWalletTransactions(bool fForce = false);
@@ -274,7 +337,7 @@ public:
     bool CreateTransaction(CScript scriptPubKey, int64_t nValue, std::string& sNarr, CWalletTx& wtxNew, CReserveKey& reservekey, int64_t& nFeeRet, const CCoinControl *coinControl=NULL);
     bool CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey);
 
-    uint64_t GetStakeWeight() const;
+    uint64_t GetStakeWeight(int nHeight) const;
     bool CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int64_t nSearchInterval, int64_t nFees, CTransaction& txNew, CKey& key);
 
     std::string SendMoney(CScript scriptPubKey, int64_t nValue, std::string& sNarr, CWalletTx& wtxNew, bool fAskFee=false);